@@ -0,0 +1,1259 @@
+// Runs the event logging and publishing core against the in-memory SD card,
+// virtual clock and a counting publisher, and reports what it costs.
+//
+//   backlog   N days of outages written through the day file writers, then
+//             drained with publishUnpublishedEvents(): wall time, events/s,
+//             heap allocations, heap high-water and SD traffic per published
+//             event
+//   listdir   listDirSorted() on a directory of N day files, against building
+//             and searching the day file index
+//   idle      publishUnpublishedEvents() with nothing pending
+//   history   the HTTP API's event streams over the published backlog: a
+//             week's range, the last 100 events and everything, in TCP
+//             sized chunks, against the events that were written
+//   recovery  day files torn and lost after the journal commit, rebuilt by
+//             EventJournal::recover() on the next boot
+//   archive   a year of published day files packed into monthly archives
+//             one step at a time: files and bytes before and after, time
+//             per step, the history streams unchanged, the archive index
+//             rebuilt at boot, and recovery leaving archived days alone
+//   correction  events logged on a wrong RTC time before NTP syncs, once
+//             close to the right time and twice days off: publishing
+//             held back, then each event corrected in place or moved to the
+//             day file of its date, ahead of a later event already there,
+//             bytes rewritten and the time it took
+//   sdio      a burst of events written with each going straight to the
+//             card and through the buffered day file writer: writes,
+//             sectors, flushes and directory updates per event, the SPI
+//             clock probe against slower cards, and runSdBenchmark()
+//   outbox    events logged through a WiFi outage and a backend outage:
+//             publish attempts made against one a second before the outbox,
+//             the queue depth, and every event delivered once, in order,
+//             when both are back
+//   quality   a restart and a brownout logged as the detector reports it: both
+//             in the published batch and its summary
+//   logging   a LOG_INFO() call into the ring drained to Serial, and one
+//             filtered out by the runtime level
+//   trace     a synthetic A0 trace replayed through mainsSampler and the
+//             loop() sequence, outages in versus events logged out
+//   waveform  A0 captured in 2 kHz bursts from loop(): a rectified
+//             50.2 Hz ripple with a 40 ms dip and an outage, the frequency
+//             and ripple estimated per window against the truth, the dip
+//             and the outage saved as raw windows, the same events logged
+//             as with the block sampler, and the kernel's time per window
+//   live      the same trace pushed to live event subscribers: p50/p99
+//             latency from the A0 edge to a client, and a stalled client
+//             being dropped
+//
+//   pio run -e native && .pio/build/native/program [outages per day]
+
+// pio test -e native builds the sources of this environment around its own test runners
+#ifndef PIO_UNIT_TESTING
+
+#include "archiveCompactor.h"
+#include "clockService.h"
+#include "dayFileIndex.h"
+#include "eventHistory.h"
+#include "eventJournal.h"
+#include "eventLog.h"
+#include "eventPublishing.h"
+#include "liveEvents.h"
+#include "logger.h"
+#include "mainsDetector.h"
+#include "mainsSampler.h"
+#include "outbox.h"
+#include "powerState.h"
+#include "powerStats.h"
+#include "sdStorage.h"
+#include "timeCorrection.h"
+#include "waveformCapture.h"
+
+#include <ESP8266WiFi.h>
+#include <hostAlloc.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <vector>
+
+#define BENCH_START_EPOCH 1656633600 // 2022-07-01 00:00:00
+
+class CountingPublisher : public EventPublisher
+{
+public:
+  const char *name() const override { return "bench"; }
+  bool publish(const EventBatch &batch) override
+  {
+    attempts++;
+    if (failing)
+    {
+      return false;
+    }
+    batches++;
+    events += batch.size();
+    brownouts += batch.brownouts();
+    batch.formatSummary(lastSummary, sizeof(lastSummary));
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+      inOrder = inOrder && batch.at(i).epoch >= lastEpoch;
+      lastEpoch = batch.at(i).epoch;
+    }
+    return true;
+  }
+  bool publishReport(PowerStatsPeriod, const PowerStatsBucket &) override
+  {
+    attempts++;
+    if (failing)
+    {
+      return false;
+    }
+    reports++;
+    return true;
+  }
+
+  size_t batches = 0;
+  size_t reports = 0;
+  size_t events = 0;
+  size_t brownouts = 0;
+  size_t attempts = 0;
+  bool failing = false;
+  bool inOrder = true;
+  uint32_t lastEpoch = 0;
+  char lastSummary[160] = "";
+};
+
+struct Snapshot
+{
+  std::chrono::steady_clock::time_point wall;
+  unsigned long allocations;
+  unsigned long long allocatedBytes;
+  HostFsStats fs;
+
+  static Snapshot take()
+  {
+    return Snapshot{std::chrono::steady_clock::now(), hostAllocStats.allocations.load(), hostAllocStats.bytes.load(),
+                    hostFsStats};
+  }
+  double secondsSince(const Snapshot &start) const
+  {
+    return std::chrono::duration<double>(wall - start.wall).count();
+  }
+};
+
+static TwitterClient *ntpSource;
+static RTC_DS1307 rtc;
+static CountingPublisher publisher;
+static size_t mismatches = 0;
+
+// Every check that fails goes through here, main() exits non-zero on any
+static void mismatch(const char *format, ...)
+{
+  mismatches++;
+  printf("  MISMATCH        ");
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+}
+
+// Fresh card, fresh publish and day file state, NTP synced at the virtual clock's now
+static void resetCore()
+{
+  endStorage();
+  SDFS.hostFormat();
+  beginStorage();
+  dayFileIndex.build(dataRoot);
+  publishedDayFileIndex.build(SD.open("/qop-published"));
+  archiveCompactor.begin();
+  powerStats.begin();
+
+  currentDateString = "";
+  mainsDetector.begin();
+  unpublishedEventsPending = true;
+  publishCursorFile = "";
+  publishCursorOffset = 0;
+  publishCursorLoaded = false;
+  publishCursorDirty = false;
+  outgoingBatch.clear();
+  heldBatchDeadline = 0;
+  publisher.batches = 0;
+  publisher.events = 0;
+  publisher.brownouts = 0;
+  publisher.lastSummary[0] = '\0';
+  publisher.attempts = 0;
+  publisher.inOrder = true;
+  publisher.lastEpoch = 0;
+
+  ntpSource->hostNtpEpoch = BENCH_START_EPOCH - millis() / 1000;
+  clockService.begin(*ntpSource, rtc);
+  getTimeFromMultipleSources();
+}
+
+static time_t backlogPowerOff(size_t day, size_t outage, size_t outagesPerDay)
+{
+  return BENCH_START_EPOCH + day * 86400 + (outage * 86400) / outagesPerDay + (day * 131 + outage * 17) % 600;
+}
+
+// late outages run past midnight, their PRES stays in the day file of the POFF
+static time_t backlogPowerOn(size_t day, size_t outage, size_t outagesPerDay)
+{
+  return backlogPowerOff(day, outage, outagesPerDay) + 30 + (day * 7 + outage * 53) % 3600;
+}
+
+// One day file per day, each outage a POFF/PRES pair spread over the day
+static size_t writeBacklog(size_t days, size_t outagesPerDay)
+{
+  size_t written = 0;
+  for (size_t day = 0; day < days; day++)
+  {
+    time_t dayStart = BENCH_START_EPOCH + day * 86400;
+    File dayFile = getLatestFileByDate(dataRoot, getFilenameFromEpoch(dayStart), dayStart);
+    for (size_t outage = 0; outage < outagesPerDay; outage++)
+    {
+      time_t off = backlogPowerOff(day, outage, outagesPerDay);
+      time_t on = backlogPowerOn(day, outage, outagesPerDay);
+      writePowerOffEventToFile(dayFile, getTimeOfEventFromEpoch(off), off, true);
+      writePowerResumeEventToFile(dayFile, getTimeOfEventFromEpoch(on), on, true);
+      written += 2;
+    }
+    dayFileWriter.close();
+    dayFile.close();
+  }
+  return written;
+}
+
+static void benchListDir()
+{
+  const int calls = 20;
+  Snapshot start = Snapshot::take();
+  size_t files = 0;
+  for (int i = 0; i < calls; i++)
+  {
+    files = listDirSorted(dataRoot).size();
+  }
+  Snapshot end = Snapshot::take();
+  printf("  listDirSorted   %zu files: %.1f us/call, %lu allocations/call, %lu dir entries/call\n", files,
+         end.secondsSince(start) * 1e6 / calls, (end.allocations - start.allocations) / calls,
+         (end.fs.dirEntriesVisited - start.fs.dirEntriesVisited) / calls);
+
+  start = Snapshot::take();
+  dayFileIndex.build(dataRoot);
+  end = Snapshot::take();
+  printf("  index build     %zu files: %.1f us at boot, %zu bytes of keys\n", dayFileIndex.size(),
+         end.secondsSince(start) * 1e6, dayFileIndex.size() * sizeof(uint32_t));
+
+  const int lookups = 100000;
+  size_t found = 0;
+  start = Snapshot::take();
+  for (int i = 0; i < lookups; i++)
+  {
+    found += dayFileIndex.lowerBound(dayFileIndex.key(i % dayFileIndex.size())) == i % dayFileIndex.size();
+  }
+  end = Snapshot::take();
+  printf("  index lookup    %.1f ns/lookup, %lu allocations\n", end.secondsSince(start) * 1e9 / lookups,
+         end.allocations - start.allocations);
+  if (found != lookups || dayFileIndex.size() != files)
+  {
+    mismatch("index holds %zu files, %zu in the directory\n", dayFileIndex.size(), files);
+  }
+}
+
+// Reports come straight out of the summary file, whatever the size of the backlog
+static void benchStats(size_t days, size_t outagesPerDay)
+{
+  const int calls = 1000;
+  uint32_t lastDay = BENCH_START_EPOCH + (days - 1) * 86400;
+  // the summary file keeps POWER_STATS_DAY_SLOTS days
+  size_t reportDays = days < POWER_STATS_DAY_SLOTS ? days : POWER_STATS_DAY_SLOTS;
+  PowerStatsBucket bucket;
+  char report[200];
+  size_t outages = 0;
+  Snapshot start = Snapshot::take();
+  for (int i = 0; i < calls; i++)
+  {
+    powerStats.read(POWER_STATS_DAY, lastDay - (i % reportDays) * 86400, bucket);
+    outages += bucket.outages;
+    formatPowerReport(bucket, POWER_STATS_DAY, report, sizeof(report));
+  }
+  Snapshot end = Snapshot::take();
+  printf("  daily report    %.2f us/report, %lu allocations\n", end.secondsSince(start) * 1e6 / calls,
+         end.allocations - start.allocations);
+  if (outages != calls * outagesPerDay)
+  {
+    mismatch("%zu outages in daily buckets, %zu expected\n", outages, calls * outagesPerDay);
+  }
+  powerStats.read(POWER_STATS_MONTH, lastDay, bucket);
+  formatPowerReport(bucket, POWER_STATS_MONTH, report, sizeof(report));
+  printf("  %s\n", report);
+}
+
+// Streams like an /api/events response: 1460 byte chunks until fill() reports the array complete
+static void streamHistory(const char *label, EventHistoryStream &stream, size_t expected, size_t written)
+{
+  uint8_t chunk[1460];
+  size_t chunks = 0;
+  size_t bytes = 0;
+  size_t objects = 0;
+  bool wellFormed = true;
+  hostAllocResetPeak();
+  long long liveBefore = hostAllocStats.live.load();
+  Snapshot start = Snapshot::take();
+  while (size_t length = stream.fill(chunk, sizeof(chunk)))
+  {
+    wellFormed = wellFormed && (bytes > 0 || chunk[0] == '[');
+    for (size_t i = 0; i < length; i++)
+    {
+      objects += chunk[i] == '{';
+    }
+    bytes += length;
+    chunks++;
+    wellFormed = wellFormed && (length == sizeof(chunk) || chunk[length - 1] == ']');
+  }
+  Snapshot end = Snapshot::take();
+  printf("  %-15s %zu events in %zu chunks: %.1f us, %.1f KB read of %.1f KB logged, %lu SD opens, %lu allocations, "
+         "%lld bytes heap peak\n",
+         label, stream.events(), chunks, end.secondsSince(start) * 1e6, (end.fs.bytesRead - start.fs.bytesRead) / 1024.0,
+         written / 1024.0, end.fs.opens - start.fs.opens, end.allocations - start.allocations,
+         hostAllocStats.peakLive.load() - liveBefore);
+  if (objects != expected || stream.events() != expected || !wellFormed)
+  {
+    mismatch("%zu events streamed, %zu expected%s\n", objects, expected,
+             wellFormed ? "" : ", malformed array");
+  }
+}
+
+static void benchHistory(size_t days, size_t outagesPerDay, size_t written)
+{
+  // one more publish pass moves the published day files, the streams then read /qop-published and /qop
+  unpublishedEventsPending = true;
+  publishUnpublishedEvents(dataRoot);
+  size_t loggedBytes = 0;
+  for (uint32_t key = nextDayFileKey(0); key != 0; key = nextDayFileKey(key))
+  {
+    loggedBytes += openDayFileByKey(key).size();
+  }
+
+  // a week from the middle of the backlog
+  uint32_t from = BENCH_START_EPOCH + (days / 2) * 86400;
+  uint32_t to = from + 7 * 86400 - 1;
+  size_t expected = 0;
+  for (size_t day = 0; day < days; day++)
+  {
+    for (size_t outage = 0; outage < outagesPerDay; outage++)
+    {
+      time_t off = backlogPowerOff(day, outage, outagesPerDay);
+      time_t on = backlogPowerOn(day, outage, outagesPerDay);
+      expected += (off >= from && off <= to) + (on >= from && on <= to);
+    }
+  }
+  EventHistoryStream stream;
+  stream.beginRange(from, to);
+  streamHistory("history week", stream, expected, loggedBytes);
+  stream.beginLast(100);
+  streamHistory("history last", stream, written < 100 ? written : 100, loggedBytes);
+  stream.beginRange(0, UINT32_MAX);
+  streamHistory("history all", stream, written, loggedBytes);
+}
+
+static void benchBacklog(size_t days, size_t outagesPerDay)
+{
+  resetCore();
+  Snapshot writeStart = Snapshot::take();
+  size_t written = writeBacklog(days, outagesPerDay);
+  Snapshot writeEnd = Snapshot::take();
+  printf("backlog %zu days, %zu events\n", days, written);
+  printf("  write           %.1f us/event, %.1f SD opens/event (day files and summary file), %.1f flushes/event\n",
+         writeEnd.secondsSince(writeStart) * 1e6 / written, (double)(writeEnd.fs.opens - writeStart.fs.opens) / written,
+         (double)(writeEnd.fs.flushes - writeStart.fs.flushes) / written);
+  benchStats(days, outagesPerDay);
+  benchListDir();
+
+  hostAllocResetPeak();
+  long long liveBefore = hostAllocStats.live.load();
+  Snapshot start = Snapshot::take();
+  size_t calls = 0;
+  // a pass per virtual second like loop(), until the held partial batch went out as well
+  while (unpublishedEventsPending || heldBatchDeadline != 0 || outbox.depth() > 0)
+  {
+    publishUnpublishedEvents(dataRoot);
+    publishOutbox();
+    calls++;
+    hostAdvanceMillis(1000);
+  }
+  Snapshot end = Snapshot::take();
+  double seconds = end.secondsSince(start);
+  size_t events = publisher.events ? publisher.events : 1;
+  printf("  publish         %zu events in %zu batches over %zu passes: %.1f ms, %.0f events/s\n", publisher.events,
+         publisher.batches, calls, seconds * 1e3, publisher.events / seconds);
+  printf("  per event       %.1f allocations, %.0f bytes allocated, %.1f bytes read, %.1f SD opens\n",
+         (double)(end.allocations - start.allocations) / events,
+         (double)(end.allocatedBytes - start.allocatedBytes) / events,
+         (double)(end.fs.bytesRead - start.fs.bytesRead) / events, (double)(end.fs.opens - start.fs.opens) / events);
+  printf("  heap            %lld bytes above the starting heap at peak, %lld still held after the drain\n",
+         hostAllocStats.peakLive.load() - liveBefore, hostAllocStats.live.load() - liveBefore);
+  printf("  SD              %lu bytes written, %lu flushes, %lu seeks, %lu renames, %lu removes\n",
+         end.fs.bytesWritten - start.fs.bytesWritten, end.fs.flushes - start.fs.flushes,
+         end.fs.seeks - start.fs.seeks, end.fs.renames - start.fs.renames, end.fs.removes - start.fs.removes);
+  if (publisher.events != written)
+  {
+    mismatch("%zu events written, %zu published\n", written, publisher.events);
+  }
+
+  const int idleCalls = 100000;
+  start = Snapshot::take();
+  for (int i = 0; i < idleCalls; i++)
+  {
+    publishUnpublishedEvents(dataRoot);
+  }
+  end = Snapshot::take();
+  printf("  idle pass       %.1f ns/call, %lu allocations, %lu SD opens\n", end.secondsSince(start) * 1e9 / idleCalls,
+         end.allocations - start.allocations, end.fs.opens - start.fs.opens);
+  benchHistory(days, outagesPerDay, written);
+}
+
+// A crash right after the journal commits: the last day file loses its tail mid-event and the day before
+// is gone entirely. The next boot must rebuild both byte for byte.
+static void benchRecovery()
+{
+  const size_t outagesPerDay = 3;
+  resetCore();
+  writeBacklog(2, outagesPerDay);
+  std::vector<std::string> files = listDirSorted(dataRoot);
+  std::map<std::string, std::vector<uint8_t>> intact;
+  for (const std::string &file : files)
+  {
+    intact[file] = SDFS.nodes[hostFsNormalize(file.c_str())]->data;
+  }
+  std::vector<uint8_t> &lastFile = SDFS.nodes[hostFsNormalize(files.back().c_str())]->data;
+  lastFile.resize(lastFile.size() - 5);
+  SDFS.remove(files.front().c_str());
+  size_t lostEvents = 1 + outagesPerDay * 2;
+
+  Snapshot start = Snapshot::take();
+  eventJournal.begin();
+  size_t recovered = eventJournal.recover();
+  Snapshot end = Snapshot::take();
+  size_t rebuilt = 0;
+  for (const std::string &file : files)
+  {
+    std::string path = hostFsNormalize(file.c_str());
+    rebuilt += SDFS.nodes.count(path) && SDFS.nodes[path]->data == intact[file];
+  }
+  printf("recovery %zu events lost after their journal commit\n", lostEvents);
+  printf("  recover         %zu events rewritten, %.1f us, %lu bytes read, %lu bytes written\n", recovered,
+         end.secondsSince(start) * 1e6, end.fs.bytesRead - start.fs.bytesRead,
+         end.fs.bytesWritten - start.fs.bytesWritten);
+  if (recovered != lostEvents || rebuilt != files.size())
+  {
+    mismatch("%zu of %zu day files rebuilt\n", rebuilt, files.size());
+  }
+}
+
+static std::string streamToString(EventHistoryStream &stream)
+{
+  std::string json;
+  uint8_t chunk[1460];
+  while (size_t length = stream.fill(chunk, sizeof(chunk)))
+  {
+    json.append((const char *)chunk, length);
+  }
+  return json;
+}
+
+// The history API's answers for a week, the last 100 events and everything
+static std::vector<std::string> historyAnswers(size_t days)
+{
+  uint32_t from = BENCH_START_EPOCH + (days / 2) * 86400;
+  EventHistoryStream stream;
+  std::vector<std::string> answers;
+  stream.beginRange(from, from + 7 * 86400 - 1);
+  answers.push_back(streamToString(stream));
+  stream.beginLast(100);
+  answers.push_back(streamToString(stream));
+  stream.beginRange(0, UINT32_MAX);
+  answers.push_back(streamToString(stream));
+  return answers;
+}
+
+static size_t publishedBytes()
+{
+  size_t bytes = 0;
+  for (size_t i = 0; i < publishedDayFileIndex.size(); i++)
+  {
+    char path[32];
+    publishedDayFileIndex.path(publishedDayFileIndex.key(i), path, sizeof(path));
+    bytes += SD.open(path).size();
+  }
+  return bytes;
+}
+
+static void benchArchive(size_t days, size_t outagesPerDay)
+{
+  resetCore();
+  size_t written = writeBacklog(days, outagesPerDay);
+  while (unpublishedEventsPending || heldBatchDeadline != 0 || outbox.depth() > 0)
+  {
+    publishUnpublishedEvents(dataRoot);
+    publishOutbox();
+    hostAdvanceMillis(1000);
+  }
+  // one more pass moves the last published day file
+  unpublishedEventsPending = true;
+  publishUnpublishedEvents(dataRoot);
+  std::vector<std::string> before = historyAnswers(days);
+  size_t filesBefore = publishedDayFileIndex.size();
+  size_t bytesBefore = publishedBytes();
+
+  // a month after the last day every month of the backlog is over
+  time_t now = BENCH_START_EPOCH + (days + 31) * 86400;
+  size_t steps = 0;
+  double maxStepUs = 0;
+  Snapshot start = Snapshot::take();
+  while (true)
+  {
+    Snapshot stepStart = Snapshot::take();
+    if (!archiveCompactor.step(now))
+    {
+      break;
+    }
+    double stepUs = Snapshot::take().secondsSince(stepStart) * 1e6;
+    maxStepUs = stepUs > maxStepUs ? stepUs : maxStepUs;
+    steps++;
+  }
+  Snapshot end = Snapshot::take();
+  size_t archives = 0;
+  size_t bytesAfter = 0;
+  File root = SD.open(ARCHIVE_ROOT);
+  while (File archive = root.openNextFile())
+  {
+    archives++;
+    bytesAfter += archive.size();
+  }
+  printf("archive %zu days, %zu events\n", days, written);
+  printf("  pack            %zu steps: %.1f us/step, %.1f us max, %lu bytes written, %lu removes\n", steps,
+         end.secondsSince(start) * 1e6 / (steps ? steps : 1), maxStepUs, end.fs.bytesWritten - start.fs.bytesWritten,
+         end.fs.removes - start.fs.removes);
+  printf("  files           %zu published day files, %.1f KB -> %zu archives, %.1f KB (%.1f bytes/event)\n",
+         filesBefore, bytesBefore / 1024.0, archives, bytesAfter / 1024.0, (double)bytesAfter / written);
+
+  std::vector<std::string> after = historyAnswers(days);
+  start = Snapshot::take();
+  archiveCompactor.begin();
+  end = Snapshot::take();
+  printf("  index build     %zu days: %.1f us at boot, %lu SD opens\n", archivedDayIndex.size(),
+         end.secondsSince(start) * 1e6, end.fs.opens - start.fs.opens);
+  std::vector<std::string> rebooted = historyAnswers(days);
+
+  eventJournal.begin();
+  size_t recovered = eventJournal.recover();
+  if (publishedDayFileIndex.size() != 0 || archivedDayIndex.size() != filesBefore)
+  {
+    mismatch("%zu day files left, %zu of %zu days archived\n", publishedDayFileIndex.size(),
+             archivedDayIndex.size(), filesBefore);
+  }
+  if (after != before || rebooted != before)
+  {
+    mismatch("history answers differ after packing\n");
+  }
+  if (recovered != 0)
+  {
+    mismatch("recovery rewrote %zu events of archived days\n", recovered);
+  }
+}
+
+// A reboot with NTP out of reach and the RTC rtcBehindS behind, outages logged, then NTP back
+static void correctionRun(const char *label, time_t truth, long rtcBehindS, size_t outages)
+{
+  dayFileWriter.close();
+  currentDayFile.close();
+  currentDayFile = File();
+  currentDateString = "";
+  ntpSource->hostNtpEpoch = 0;
+  rtc.adjust(DateTime((uint32_t)(truth - rtcBehindS)));
+  uint32_t ntpBase = truth - millis() / 1000;
+  clockService.begin(*ntpSource, rtc);
+  size_t eventsBefore = publisher.events;
+
+  // uptime of each event logged, with the time it really happened
+  std::multimap<uint32_t, uint32_t> truthByUptime;
+  for (size_t i = 0; i < outages; i++)
+  {
+    for (MainsLevel level : {MAINS_LEVEL_OFF, MAINS_LEVEL_NORMAL})
+    {
+      hostAdvanceMillis(level == MAINS_LEVEL_OFF ? 90000 : 20000);
+      uint32_t changedAt = millis() - 250;
+      // the first event after the reboot comes with the resume that brought the device up
+      size_t logged = currentDayFile ? 1 : 2;
+      logMainsLevelChange(level == MAINS_LEVEL_OFF ? MAINS_LEVEL_NORMAL : MAINS_LEVEL_OFF, level, changedAt);
+      for (size_t event = 0; event < logged; event++)
+      {
+        truthByUptime.insert({millis(), ntpBase + changedAt / 1000});
+      }
+      publishUnpublishedEvents(dataRoot);
+    }
+  }
+  size_t held = timeCorrection.pending();
+  size_t publishedWhileHeld = publisher.events - eventsBefore;
+
+  ntpSource->hostNtpEpoch = ntpBase;
+  hostAdvanceMillis(CLOCK_MIN_RESYNC_INTERVAL_MS);
+  uint32_t moved = timeCorrection.moved();
+  Snapshot start = Snapshot::take();
+  getTimeFromMultipleSources();
+  Snapshot end = Snapshot::take();
+  moved = timeCorrection.moved() - moved;
+  dayFileWriter.flush();
+
+  // every logged event once, NTP time within a second of the truth, in the day file of its date
+  size_t found = 0;
+  size_t wrong = 0;
+  for (size_t i = 0; i < dayFileIndex.size(); i++)
+  {
+    char path[32];
+    dayFileIndex.path(dayFileIndex.key(i), path, sizeof(path));
+    File dayFile = SD.open(path, FILE_READ);
+    boolean binaryFile = readEventFileHeader(dayFile);
+    EventRecord event;
+    while (readNextEvent(dayFile, binaryFile, event))
+    {
+      // CSV lines do not carry the uptime, match the corrected ones by their epoch
+      auto it = truthByUptime.end();
+      for (auto candidate = truthByUptime.begin(); candidate != truthByUptime.end(); ++candidate)
+      {
+        if (binaryFile ? candidate->first == event.uptimeMs
+                       : (event.flags & EVENT_FLAG_CORRECTED) && labs((long)event.epoch - (long)candidate->second) <= 1)
+        {
+          it = candidate;
+          break;
+        }
+      }
+      if (it == truthByUptime.end())
+      {
+        continue;
+      }
+      found++;
+      wrong += labs((long)event.epoch - (long)it->second) > 1 || !(event.flags & EVENT_FLAG_CORRECTED) ||
+               dayFileKeyForEpoch(event.epoch) != dayFileIndex.key(i);
+      truthByUptime.erase(it);
+    }
+    dayFile.close();
+  }
+  while (unpublishedEventsPending || heldBatchDeadline != 0 || outbox.depth() > 0)
+  {
+    publishUnpublishedEvents(dataRoot);
+    publishOutbox();
+    hostAdvanceMillis(1000);
+  }
+  printf("  %-15s %zu events held, RTC %ld s behind: %.1f us, %lu bytes read, %lu bytes written, %u moved\n", label,
+         held, rtcBehindS, end.secondsSince(start) * 1e6, end.fs.bytesRead - start.fs.bytesRead,
+         end.fs.bytesWritten - start.fs.bytesWritten, (unsigned)moved);
+  if (held != outages * 2 + 1 || publishedWhileHeld != 0 || found != held || wrong != 0 || !publisher.inOrder ||
+      timeCorrection.holding())
+  {
+    mismatch("%zu held, %zu published early, %zu of them found, %zu wrong\n", held,
+             publishedWhileHeld, found, wrong);
+  }
+}
+
+static void benchCorrection()
+{
+  resetCore();
+  writeBacklog(2, 4);
+  printf("correction of events logged before NTP synced\n");
+  // the newest day file is the right one, after its last event: each event is rewritten where it is
+  correctionRun("in place", BENCH_START_EPOCH + 86400 + 79200, 300, 4);
+  // days later, the events go to a day file of their own
+  correctionRun("moved", BENCH_START_EPOCH + 5 * 86400 + 3600, 3 * 86400 + 1234, 4);
+  // into a day file holding a later event, as a boot whose RTC ran ahead leaves: the moved events go in
+  // before it, and they are logged to a newer day file until NTP is back
+  for (time_t later : {BENCH_START_EPOCH + 5 * 86400 + 82800, BENCH_START_EPOCH + 6 * 86400 + 1800})
+  {
+    File dayFile = getLatestFileByDate(dataRoot, getFilenameFromEpoch(later), later);
+    writePowerResumeEventToFile(dayFile, getTimeOfEventFromEpoch(later), later, true);
+    dayFileWriter.close();
+    dayFile.close();
+  }
+  correctionRun("moved in", BENCH_START_EPOCH + 5 * 86400 + 21600, 4 * 86400, 4);
+
+  // a reboot right after: the journal's rewrites leave the corrected day files as they are
+  dayFileWriter.close();
+  std::map<std::string, std::vector<uint8_t>> corrected;
+  for (const std::string &file : listDirSorted(dataRoot))
+  {
+    corrected[file] = SDFS.nodes[hostFsNormalize(file.c_str())]->data;
+  }
+  eventJournal.begin();
+  size_t replayed = eventJournal.recover();
+  size_t changed = 0;
+  for (const auto &entry : corrected)
+  {
+    changed += SDFS.nodes[hostFsNormalize(entry.first.c_str())]->data != entry.second;
+  }
+  printf("  recover         %zu journalled writes replayed, %zu day files changed\n", replayed, changed);
+  if (changed != 0)
+  {
+    mismatch("recovery undid corrections\n");
+  }
+}
+
+static void benchLogging()
+{
+  const int calls = 100000;
+  uint8_t level = logger.level();
+  logger.setLevel(LOG_LEVEL_INFO);
+  // the other scenarios log without draining, start from an empty ring
+  logger.flush();
+  unsigned long serialBefore = Serial.bytesWritten;
+  uint32_t droppedBefore = logger.dropped();
+  Snapshot start = Snapshot::take();
+  for (int i = 0; i < calls; i++)
+  {
+    LOG_INFO("published batch of events successfully: %u", (unsigned)(i & 15));
+    logger.drain();
+  }
+  Snapshot end = Snapshot::take();
+  printf("logging\n");
+  printf("  enabled         %.1f ns/line, %lu allocations, %lu bytes to Serial, %lu lines dropped\n",
+         end.secondsSince(start) * 1e9 / calls, end.allocations - start.allocations,
+         Serial.bytesWritten - serialBefore, (unsigned long)(logger.dropped() - droppedBefore));
+
+  logger.setLevel(LOG_LEVEL_WARN);
+  start = Snapshot::take();
+  for (int i = 0; i < calls; i++)
+  {
+    LOG_INFO("published batch of events successfully: %u", (unsigned)(i & 15));
+  }
+  end = Snapshot::take();
+  printf("  filtered        %.1f ns/line\n", end.secondsSince(start) * 1e9 / calls);
+  logger.setLevel(level);
+}
+
+// Mains on reads ~900 on A0, off reads ~12. Every outage in the trace is
+// 2..21 s long: the shortest end in holdup, the rest in light sleep.
+static unsigned long long traceStartMicros;
+static unsigned long long traceOutagePeriodMicros;
+
+// Fixture of the scenarios driven by an A0 waveform: a fresh core, the waveform's clock started now and the
+// sampler reading it
+static void beginAdcScenario(HostAdcSource source)
+{
+  resetCore();
+  traceStartMicros = micros();
+  hostSetAdcSource(source);
+  mainsSampler.begin(MAINS_ANALOG_SENSE_PIN);
+}
+
+static void endAdcScenario()
+{
+  mainsSampler.end();
+  hostSetAdcSource(nullptr);
+}
+static int traceAdc(unsigned long nowMicros)
+{
+  unsigned long long elapsed = nowMicros - traceStartMicros;
+  unsigned long long cycle = elapsed / traceOutagePeriodMicros;
+  unsigned long long inCycle = elapsed % traceOutagePeriodMicros;
+  // outages start anywhere within a sampler block
+  unsigned long long outageStart = traceOutagePeriodMicros / 2 + cycle * 37 % 100 * 1000ULL;
+  unsigned long long outageLength = (2 + cycle * 7 % 20) * 1000000ULL;
+  bool off = cycle > 0 && inCycle >= outageStart && inCycle < outageStart + outageLength;
+  return (off ? 12 : 900) + (int)(nowMicros / 1000 % 7);
+}
+
+// loop() of the firmware without WiFi and the web server
+static void loopPass(unsigned long &nextTick)
+{
+  powerState.loop();
+  updatePowerStatusIfChanged();
+  if (powerState.running() && millis() >= nextTick)
+  {
+    nextTick += 1000;
+    openDayFileFor(getTimeFromMultipleSources());
+    publishUnpublishedEvents(dataRoot);
+  }
+  if (powerState.running() && outbox.depth() > 0)
+  {
+    publishOutbox();
+  }
+  loopStorage();
+}
+
+// Mains flapping: an event every 2 s, with the firmware's loop() passes in between
+static void benchSdioWrites(uint32_t window, size_t events)
+{
+  resetCore();
+  dayFileWriter.setWindow(window);
+  unsigned long nextTick = millis();
+  openDayFileFor(getTimeFromMultipleSources());
+  Snapshot start = Snapshot::take();
+  for (size_t i = 0; i < events; i++)
+  {
+    time_t now = getTimeFromMultipleSources();
+    if (i % 2 == 0)
+    {
+      writePowerOffEventToFile(currentDayFile, getTimeOfEventFromEpoch(now), now, true);
+    }
+    else
+    {
+      writePowerResumeEventToFile(currentDayFile, getTimeOfEventFromEpoch(now), now, true);
+    }
+    for (int pass = 0; pass < 200; pass++)
+    {
+      loopPass(nextTick);
+      delay(10);
+    }
+  }
+  // past the window and the batch latency, the last events are written out and published
+  unsigned long drainEnd = millis() + window + publishMaxBatchLatency * 1000 + 2000;
+  while (millis() < drainEnd)
+  {
+    loopPass(nextTick);
+    delay(10);
+  }
+  Snapshot end = Snapshot::take();
+  size_t logged = events + 1;
+  printf("  window %5lu ms  %.2f writes, %.2f sectors, %.2f flushes, %.2f dir updates per event\n",
+         (unsigned long)window, (double)(end.fs.writes - start.fs.writes) / logged,
+         (double)(end.fs.sectorWrites - start.fs.sectorWrites) / logged,
+         (double)(end.fs.flushes - start.fs.flushes) / logged,
+         (double)(end.fs.dirUpdates - start.fs.dirUpdates) / logged);
+  if (publisher.events != logged || dayFileWriter.pending() != 0)
+  {
+    mismatch("%zu of %zu events published\n", publisher.events, logged);
+  }
+}
+
+static uint8_t sdClockFor(uint32_t cardMaxMhz)
+{
+  SD.hostMaxClock = SD_SCK_MHZ(cardMaxMhz);
+  sdResetClock();
+  endStorage();
+  beginStorage();
+  return sdClockMhz();
+}
+
+static void benchSdio(size_t events)
+{
+  printf("sdio %zu events, one every 2 s\n", events);
+  benchSdioWrites(0, events);
+  benchSdioWrites(DAY_FILE_WRITER_DEFAULT_WINDOW_MS, events);
+
+  uint8_t fastCard = sdClockFor(25);
+  uint8_t slowCard = sdClockFor(18);
+  sdStepDownClock();
+  endStorage();
+  beginStorage();
+  uint8_t steppedDown = sdClockMhz();
+  printf("  clock probe     %u MHz on a 25 MHz card, %u MHz on an 18 MHz one, %u MHz after a write error\n",
+         (unsigned)fastCard, (unsigned)slowCard, (unsigned)steppedDown);
+  if (fastCard != 25 || slowCard != 16 || steppedDown != 10)
+  {
+    mismatch("clock probe\n");
+  }
+  sdClockFor(25);
+
+  SdBenchmark result;
+  Snapshot start = Snapshot::take();
+  bool ok = runSdBenchmark(result);
+  Snapshot end = Snapshot::take();
+  printf("  benchmark       %lu kB written and read back, %lu flushes, %lu sectors written\n",
+         (unsigned long)(result.bytes / 1024), (unsigned long)result.flushes,
+         end.fs.sectorWrites - start.fs.sectorWrites);
+  if (!ok || SD.exists(SD_BENCHMARK_PATH) || SD.exists(SD_PROBE_PATH))
+  {
+    mismatch("benchmark\n");
+  }
+}
+
+// A pass a second for the given minutes with an outage logged every two of them; returns the events logged
+static size_t runOutboxMinutes(unsigned long minutes, unsigned long &nextTick, size_t &maxDepth)
+{
+  size_t logged = 0;
+  for (unsigned long second = 0; second < minutes * 60; second++)
+  {
+    if (second % 60 == 0)
+    {
+      time_t now = getTimeFromMultipleSources();
+      if (second % 120 == 0)
+      {
+        writePowerOffEventToFile(currentDayFile, getTimeOfEventFromEpoch(now), now, true);
+      }
+      else
+      {
+        writePowerResumeEventToFile(currentDayFile, getTimeOfEventFromEpoch(now), now, true);
+      }
+      logged++;
+    }
+    loopPass(nextTick);
+    maxDepth = std::max(maxDepth, outbox.depth());
+    delay(1000);
+  }
+  return logged;
+}
+
+static void benchOutbox(unsigned long minutes)
+{
+  resetCore();
+  unsigned long nextTick = millis();
+  openDayFileFor(getTimeFromMultipleSources());
+  size_t logged = 1;
+  size_t maxDepth = 0;
+  printf("outbox %lu min without WiFi, %lu min with the backend down, an event every minute\n", minutes, minutes);
+
+  WiFi.hostStatus = WL_DISCONNECTED;
+  logged += runOutboxMinutes(minutes, nextTick, maxDepth);
+  size_t offlineAttempts = publisher.attempts;
+  printf("  no WiFi         %zu publish attempts, %zu items / %zu events queued, breaker %s\n", offlineAttempts,
+         outbox.depth(), outbox.queuedEvents(), outboxBreakerName(outbox.breaker()));
+
+  // still queued after an unmount, as after a power loss
+  size_t queued = outbox.depth();
+  endStorage();
+  beginStorage();
+  WiFi.hostStatus = WL_CONNECTED;
+  publisher.failing = true;
+  logged += runOutboxMinutes(minutes, nextTick, maxDepth);
+  size_t failingAttempts = publisher.attempts - offlineAttempts;
+  printf("  backend down    %zu publish attempts against %lu at one a tick, %zu items queued at most, breaker %s\n",
+         failingAttempts, minutes * 60, maxDepth, outboxBreakerName(outbox.breaker()));
+
+  publisher.failing = false;
+  unsigned long recoveredAt = millis();
+  while (millis() - recoveredAt < (OUTBOX_BREAKER_OPEN_MS + 120000) && (publisher.events < logged || outbox.depth()))
+  {
+    loopPass(nextTick);
+    delay(1000);
+  }
+  printf("  recovered       %zu of %zu events delivered %lu s after the backend came back, %zu items left\n",
+         publisher.events, logged, (millis() - recoveredAt) / 1000, outbox.depth());
+  if (offlineAttempts != 0 || queued == 0 || publisher.events != logged || !publisher.inOrder || outbox.depth() != 0)
+  {
+    mismatch("%zu events delivered%s\n", publisher.events, publisher.inOrder ? "" : " out of order");
+  }
+}
+
+// A brownout and its NORM logged as the detector reports them after a restart, then published in one batch
+static void benchPowerQuality()
+{
+  resetCore();
+  unsigned long nextTick = millis();
+  // the boot's PRES, without a POFF before it the batch counts it as a restart
+  openDayFileFor(getTimeFromMultipleSources());
+  printf("quality a restart and a 20 s brownout\n");
+
+  logMainsLevelChange(MAINS_LEVEL_NORMAL, MAINS_LEVEL_BROWNOUT, millis());
+  delay(20000);
+  logMainsLevelChange(MAINS_LEVEL_BROWNOUT, MAINS_LEVEL_NORMAL, millis());
+  unsigned long loggedAt = millis();
+  while (millis() - loggedAt < (PUBLISH_MAX_BATCH_LATENCY_S + 10) * 1000UL && publisher.batches == 0)
+  {
+    loopPass(nextTick);
+    delay(1000);
+  }
+  printf("  published       %zu batches, %zu events, %zu brownouts: %s\n", publisher.batches, publisher.events,
+         publisher.brownouts, publisher.lastSummary);
+  size_t summaryLength = strlen(publisher.lastSummary);
+  if (publisher.batches != 1 || publisher.brownouts != 1 ||
+      strncmp(publisher.lastSummary, "[power-quality] 1 brownout, 0 surges", 36) != 0 || summaryLength < 11 ||
+      strcmp(publisher.lastSummary + summaryLength - 11, ", 1 restart") != 0)
+  {
+    mismatch("brownout or restart missing from the published batch\n");
+  }
+}
+
+static void benchTrace(unsigned long hours, unsigned long outagesPerHour)
+{
+  traceOutagePeriodMicros = 3600000000ULL / outagesPerHour;
+  beginAdcScenario(traceAdc);
+  unsigned long traceEnd = millis() + hours * 3600000UL;
+
+  Snapshot start = Snapshot::take();
+  unsigned long nextTick = millis();
+  unsigned long passes = 0;
+  uint32_t resumesBefore = powerState.resumes();
+  while (millis() < traceEnd)
+  {
+    loopPass(nextTick);
+    passes++;
+    delay(10);
+  }
+  endAdcScenario();
+  Snapshot end = Snapshot::take();
+  unsigned long expectedOutages = hours * outagesPerHour - 1;
+  printf("trace %lu h, %lu outages, %lu events expected\n", hours, expectedOutages, 2 * expectedOutages + 1);
+  printf("  replay          %.2f s for %lu loop passes, %.0fx real time\n", end.secondsSince(start), passes,
+         hours * 3600.0 / end.secondsSince(start));
+  printf("  detected        %zu events published, %lu samples dropped\n", publisher.events,
+         (unsigned long)mainsSampler.droppedSamples());
+  printf("  power           %lu resumes, mains detected back to PRES logged in at most %lu ms, card %s, radio %s\n",
+         (unsigned long)(powerState.resumes() - resumesBefore), (unsigned long)powerState.maxResumeMs(),
+         storageReady ? "mounted" : "unmounted", WiFi.hostRadioOn ? "on" : "off");
+  if (publisher.events != 2 * expectedOutages + 1 || powerState.resumes() - resumesBefore != expectedOutages ||
+      powerState.maxResumeMs() > POWER_RESUME_BUDGET_MS)
+  {
+    mismatch("%zu events published, resumes over budget or missed\n", publisher.events);
+  }
+}
+
+#define BENCH_WAVE_HZ 50.2
+// inside the burst of the third second, a dip between bursts goes unseen
+#define BENCH_WAVE_DIP_S 2.05
+#define BENCH_WAVE_OUTAGE_S 14.0
+#define BENCH_WAVE_RESUME_S 26.0
+
+// Full-wave rectified ripple of 24 counts on 880, a 40 ms dip and an outage
+static int waveAdc(unsigned long nowMicros)
+{
+  double t = (nowMicros - traceStartMicros) / 1e6;
+  if ((t >= BENCH_WAVE_DIP_S && t < BENCH_WAVE_DIP_S + 0.04) || (t >= BENCH_WAVE_OUTAGE_S && t < BENCH_WAVE_RESUME_S))
+  {
+    return 15;
+  }
+  return 880 + (int)(24 * fabs(sin(2 * M_PI * BENCH_WAVE_HZ * t)) + 0.5);
+}
+
+static void benchWaveform(unsigned long seconds)
+{
+  waveformCapture.setSaveRaw(true);
+  mainsSampler.setCapture(true);
+  beginAdcScenario(waveAdc);
+  uint32_t windowsBefore = waveformCapture.windows();
+  uint32_t dropoutsBefore = waveformCapture.dropouts();
+  uint32_t savedBefore = waveformCapture.savedFiles();
+
+  unsigned long traceEnd = millis() + seconds * 1000;
+  unsigned long nextTick = millis();
+  uint32_t seen = waveformCapture.windows();
+  size_t steady = 0;
+  double maxHzError = 0;
+  double sumRipple = 0;
+  bool dipFound = false;
+  while (millis() < traceEnd)
+  {
+    loopPass(nextTick);
+    delay(10);
+    if (waveformCapture.windows() == seen)
+    {
+      continue;
+    }
+    seen = waveformCapture.windows();
+    const WaveformMetrics &last = waveformCapture.last();
+    double at = (last.takenAt - traceStartMicros / 1000) / 1000.0;
+    double end = at + WAVEFORM_WINDOW_SAMPLES / (double)WAVEFORM_SAMPLE_RATE_HZ;
+    dipFound = dipFound || ((last.flags & WAVEFORM_FLAG_DROPOUT) && at <= BENCH_WAVE_DIP_S && end > BENCH_WAVE_DIP_S);
+    bool edge = end > BENCH_WAVE_DIP_S && at < BENCH_WAVE_DIP_S + 0.04;
+    if (last.mean > 850 && !edge && at > 0)
+    {
+      steady++;
+      double error = fabs(last.frequencyCentiHz / 100.0 - BENCH_WAVE_HZ);
+      maxHzError = error > maxHzError ? error : maxHzError;
+      sumRipple += last.ripple / 100.0;
+    }
+  }
+  // mains stays on while the events of the outage go out, the capture runs on unseen
+  unsigned long drainEnd = millis() + 60000;
+  while ((unpublishedEventsPending || heldBatchDeadline != 0 || outbox.depth() > 0) && millis() < drainEnd)
+  {
+    loopPass(nextTick);
+    delay(10);
+  }
+  endAdcScenario();
+  mainsSampler.setCapture(false);
+  waveformCapture.setSaveRaw(false);
+
+  // the kernel alone, over a window of the ripple
+  uint16_t window[WAVEFORM_WINDOW_SAMPLES];
+  for (size_t i = 0; i < WAVEFORM_WINDOW_SAMPLES; i++)
+  {
+    window[i] = 880 + (int)(24 * fabs(sin(2 * M_PI * BENCH_WAVE_HZ * i / WAVEFORM_SAMPLE_RATE_HZ)) + 0.5);
+  }
+  const int calls = 20000;
+  WaveformMetrics metrics;
+  uint32_t checksum = 0;
+  auto kernelStart = std::chrono::steady_clock::now();
+  for (int i = 0; i < calls; i++)
+  {
+    window[i % WAVEFORM_WINDOW_SAMPLES] ^= 1;
+    computeWaveformMetrics(window, WAVEFORM_WINDOW_SAMPLES, WAVEFORM_SAMPLE_RATE_HZ, MAINS_OFF_BELOW, metrics);
+    checksum += metrics.frequencyCentiHz;
+  }
+  double kernelUs =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - kernelStart).count() * 1e6 / calls;
+
+  // the raw capture of the dip reads back as it was written
+  size_t validFiles = 0;
+  File root = SD.open(WAVEFORM_ROOT);
+  while (File capture = root.openNextFile())
+  {
+    std::vector<uint8_t> &data = SDFS.nodes[hostFsNormalize(capture.fullName())]->data;
+    const WaveformFileHeader *header = (const WaveformFileHeader *)data.data();
+    validFiles += data.size() >= sizeof(*header) &&
+                  isWaveformFileValid(*header, (const uint16_t *)(data.data() + sizeof(*header)),
+                                      (data.size() - sizeof(*header)) / sizeof(uint16_t));
+  }
+
+  // the ideal ripple of |sin| with a 24 count peak: 24 * sqrt(1/2 - 4/pi^2)
+  double trueRipple = 24 * sqrt(0.5 - 4 / (M_PI * M_PI));
+  uint32_t windows = waveformCapture.windows() - windowsBefore;
+  printf("waveform %lu s at %u Hz, %u reads a window (checksum %lu)\n", seconds, (unsigned)WAVEFORM_SAMPLE_RATE_HZ,
+         (unsigned)WAVEFORM_WINDOW_SAMPLES, (unsigned long)(checksum % 10));
+  printf("  windows         %lu reduced, %lu dropped, %zu steady: frequency within %.3f Hz of %.1f, ripple %.2f "
+         "counts (%.2f true)\n",
+         (unsigned long)windows, (unsigned long)waveformCapture.droppedWindows(), steady, maxHzError, BENCH_WAVE_HZ,
+         steady ? sumRipple / steady : 0, trueRipple);
+  printf("  transitions     %lu dropout windows, %lu captures saved (%zu valid), %zu events published\n",
+         (unsigned long)(waveformCapture.dropouts() - dropoutsBefore),
+         (unsigned long)(waveformCapture.savedFiles() - savedBefore), validFiles, publisher.events);
+  printf("  kernel          %.2f us a window on the host, %.1f ns a read\n", kernelUs,
+         kernelUs * 1000 / WAVEFORM_WINDOW_SAMPLES);
+  // the dip is too short for the detector, the outage is a POFF and a PRES after the boot's PRES
+  if (!dipFound || maxHzError > 0.1 || waveformCapture.savedFiles() - savedBefore != 2 || validFiles != 2 ||
+      waveformCapture.droppedWindows() != 0 || publisher.events != 3)
+  {
+    mismatch("dip %s, %lu captures, %zu events\n", dipFound ? "found" : "missed",
+             (unsigned long)(waveformCapture.savedFiles() - savedBefore), publisher.events);
+  }
+}
+
+// Subscribers 0 and 1 take every message at once, 2 one message a second, 3 never: its connection is stalled
+class BenchSink : public LiveEventSink
+{
+public:
+  bool canSend(uint32_t subscriber) override
+  {
+    if (subscriber == 2)
+    {
+      return millis() - lastSent[2] >= 1000;
+    }
+    return subscriber != 3;
+  }
+  void send(uint32_t subscriber, const char *, size_t) override
+  {
+    lastSent[subscriber] = millis();
+    received[subscriber].push_back(micros());
+  }
+  void drop(uint32_t subscriber) override { droppedAt[subscriber] = received[0].size(); }
+
+  unsigned long lastSent[4] = {};
+  std::vector<unsigned long long> received[4];
+  size_t droppedAt[4] = {};
+};
+
+static double percentileOf(std::vector<double> values, double p)
+{
+  if (values.empty())
+  {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  size_t at = (size_t)(p * values.size());
+  return values[at < values.size() ? at : values.size() - 1];
+}
+
+static void benchLive(unsigned long hours, unsigned long outagesPerHour)
+{
+  traceOutagePeriodMicros = 3600000000ULL / outagesPerHour;
+  beginAdcScenario(traceAdc);
+  BenchSink sink;
+  liveEvents.setSink(&sink);
+  uint32_t publishedBefore = liveEvents.published();
+  for (uint32_t subscriber = 0; subscriber < 4; subscriber++)
+  {
+    liveEvents.subscribe(subscriber);
+  }
+  unsigned long traceEnd = millis() + hours * 3600000UL;
+  unsigned long nextTick = millis();
+  while (millis() < traceEnd)
+  {
+    loopPass(nextTick);
+    liveEvents.pump();
+    delay(10);
+  }
+  endAdcScenario();
+
+  // A0 edges of the trace, in the order their POFF and PRES events are logged after the boot PRES
+  std::vector<unsigned long long> edges;
+  for (unsigned long long cycle = 1; cycle < hours * outagesPerHour; cycle++)
+  {
+    unsigned long long off =
+        traceStartMicros + cycle * traceOutagePeriodMicros + traceOutagePeriodMicros / 2 + cycle * 37 % 100 * 1000ULL;
+    edges.push_back(off);
+    edges.push_back(off + (2 + cycle * 7 % 20) * 1000000ULL);
+  }
+  std::vector<double> latencies;
+  for (size_t i = 0; i < edges.size() && i + 1 < sink.received[0].size(); i++)
+  {
+    latencies.push_back((sink.received[0][i + 1] - edges[i]) / 1000.0);
+  }
+  size_t published = liveEvents.published() - publishedBefore;
+  printf("live %zu events to %d subscribers\n", published, 4);
+  printf("  edge to client  p50 %.0f ms, p99 %.0f ms, max %.0f ms over %zu transitions\n",
+         percentileOf(latencies, 0.5), percentileOf(latencies, 0.99), percentileOf(latencies, 1.0), latencies.size());
+  printf("  subscribers     %zu and %zu events to the fast ones, %zu to the one a second, stalled one dropped at "
+         "event %zu\n",
+         sink.received[0].size(), sink.received[1].size(), sink.received[2].size(), sink.droppedAt[3]);
+  if (sink.received[0].size() != published || sink.received[2].size() != published ||
+      latencies.size() != edges.size() || sink.droppedAt[3] != LIVE_EVENT_QUEUE_SIZE + 1)
+  {
+    mismatch("%zu events, %zu received, %zu edges\n", published, sink.received[0].size(),
+             edges.size());
+  }
+
+  const int calls = 100000;
+  sink.received[0].reserve(sink.received[0].size() + calls);
+  sink.received[1].reserve(sink.received[1].size() + calls);
+  EventRecord event = {};
+  event.type = EVENT_TYPE_POFF;
+  sealEventRecord(event);
+  Snapshot start = Snapshot::take();
+  for (int i = 0; i < calls; i++)
+  {
+    liveEvents.publish(event);
+  }
+  Snapshot end = Snapshot::take();
+  printf("  publish         %.1f ns/event to %zu subscribers, %lu allocations\n",
+         end.secondsSince(start) * 1e9 / calls, liveEvents.subscribers(), end.allocations - start.allocations);
+  for (uint32_t subscriber = 0; subscriber < 4; subscriber++)
+  {
+    liveEvents.unsubscribe(subscriber);
+  }
+  liveEvents.pump();
+  liveEvents.setSink(nullptr);
+}
+
+int main(int argc, char **argv)
+{
+  size_t outagesPerDay = argc > 1 ? strtoul(argv[1], nullptr, 10) : 8;
+  // day file names and summaries are formatted in local time, keep them stable
+  setenv("TZ", "UTC", 1);
+  tzset();
+
+  static WiFiUDP ntpUdp;
+  NTPClient ntpClient(ntpUdp, "bench");
+  ntpSource = new TwitterClient(ntpClient, "", "", "", "");
+  eventPublisher = &publisher;
+
+  const size_t backlogDays[] = {1, 30, 365, 1095};
+  for (size_t days : backlogDays)
+  {
+    benchBacklog(days, outagesPerDay);
+  }
+  benchRecovery();
+  benchArchive(365, outagesPerDay);
+  benchCorrection();
+  benchSdio(40);
+  benchOutbox(30);
+  benchPowerQuality();
+  benchLogging();
+  benchTrace(6, 4);
+  benchWaveform(30);
+  benchLive(6, 4);
+  return mismatches ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,110 @@
+// Replays A0 waveforms through MainsDetector, block by block like mainsSampler
+// feeds it, and prints every reported level change.
+//
+//   detector-replay                     built-in waveforms (mainsWaveforms.h) with the levels they produce, then
+//                                       again scaled to a unit reading 60 % of the stock divider, with the band
+//                                       edges mainsCalibration learns from three hours of that unit
+//   detector-replay <capture>...        recorded captures, one raw A0 read per line at MAINS_SAMPLE_INTERVAL_MS
+//   detector-replay --dump <name>       writes a built-in waveform in the capture format
+//
+// The built-in waveforms are checked against their expected levels by pio test -e native.
+//
+// Build with: pio run -e detector-replay
+
+#include "mainsCalibration.h"
+#include "mainsDetector.h"
+#include "mainsSampler.h"
+
+#include <mainsWaveforms.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+static const uint32_t readsPerSecond = 1000 / MAINS_SAMPLE_INTERVAL_MS;
+
+static bool readCapture(const char *path, std::vector<uint16_t> &reads)
+{
+  FILE *file = fopen(path, "r");
+  if (!file)
+  {
+    fprintf(stderr, "cannot read %s\n", path);
+    return false;
+  }
+  char line[32];
+  while (fgets(line, sizeof(line), file))
+  {
+    char *end;
+    unsigned long value = strtoul(line, &end, 10);
+    if (end != line)
+    {
+      reads.push_back((uint16_t)value);
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  std::vector<MainsWaveform> waveforms = builtinMainsWaveforms();
+  if (argc == 3 && strcmp(argv[1], "--dump") == 0)
+  {
+    for (const MainsWaveform &waveform : waveforms)
+    {
+      if (strcmp(waveform.name, argv[2]) == 0)
+      {
+        for (uint16_t read : waveform.reads)
+        {
+          printf("%u\n", read);
+        }
+        return 0;
+      }
+    }
+    fprintf(stderr, "no built-in waveform %s\n", argv[2]);
+    return 2;
+  }
+
+  if (argc > 1)
+  {
+    for (int i = 1; i < argc; i++)
+    {
+      std::vector<uint16_t> reads;
+      if (!readCapture(argv[i], reads))
+      {
+        return 1;
+      }
+      printf("%s: %zu reads, %.1f s\n", argv[i], reads.size(), reads.size() / (double)readsPerSecond);
+      replayMainsWaveform(reads, true);
+    }
+    return 0;
+  }
+
+  for (const MainsWaveform &waveform : waveforms)
+  {
+    printf("%-12s %s  (expected %s)\n", waveform.name, mainsLevelList(replayMainsWaveform(waveform.reads)).c_str(),
+           mainsLevelList(waveform.expected).c_str());
+  }
+
+  const int percent = 60;
+  MainsCalibrationResult learned;
+  if (!learnMainsThresholds(percent, learned))
+  {
+    printf("calibration  no thresholds learned at %d %%\n", percent);
+    return 1;
+  }
+  const MainsThresholds &thresholds = learned.thresholds;
+  printf("calibration  at %d %%: reads %u (%u..%u), off up to %u: off below %u, brownout below %u, surge above %u, "
+         "hysteresis %u, debounce %u\n",
+         percent, learned.nominal, learned.low, learned.high, learned.offHigh, thresholds.offBelow,
+         thresholds.brownoutBelow, thresholds.surgeAbove, thresholds.hysteresis, thresholds.offDebounce);
+  for (const MainsWaveform &waveform : waveforms)
+  {
+    std::vector<uint16_t> reads = scaledMainsWaveform(waveform.reads, percent);
+    printf("%-12s %s  (stock edges: %s)\n", waveform.name,
+           mainsLevelList(replayMainsWaveform(reads, false, thresholds)).c_str(),
+           mainsLevelList(replayMainsWaveform(reads)).c_str());
+  }
+  return 0;
+}
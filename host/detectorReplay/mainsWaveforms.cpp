@@ -0,0 +1,164 @@
+#include <mainsWaveforms.h>
+
+#include "mainsSampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+static const uint32_t readsPerSecond = 1000 / MAINS_SAMPLE_INTERVAL_MS;
+
+static uint32_t noiseState = 1;
+static int noise(int amplitude)
+{
+  noiseState = noiseState * 1103515245 + 12345;
+  return amplitude ? (int)((noiseState >> 16) % (2 * amplitude + 1)) - amplitude : 0;
+}
+
+static void hold(std::vector<uint16_t> &reads, double seconds, int level, int noiseAmplitude = 4)
+{
+  for (uint32_t i = 0; i < seconds * readsPerSecond; i++)
+  {
+    reads.push_back((uint16_t)std::max(0, std::min(1023, level + noise(noiseAmplitude))));
+  }
+}
+
+static void ramp(std::vector<uint16_t> &reads, double seconds, int from, int to)
+{
+  uint32_t count = seconds * readsPerSecond;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    reads.push_back((uint16_t)(from + (to - from) * (int)i / (int)count + noise(4)));
+  }
+}
+
+std::vector<MainsWaveform> builtinMainsWaveforms()
+{
+  std::vector<MainsWaveform> waveforms;
+  const MainsLevel N = MAINS_LEVEL_NORMAL, O = MAINS_LEVEL_OFF, B = MAINS_LEVEL_BROWNOUT, S = MAINS_LEVEL_SURGE;
+
+  MainsWaveform outage{"outage", {N, O, N}, {}};
+  hold(outage.reads, 5, 900);
+  hold(outage.reads, 5, 12);
+  hold(outage.reads, 5, 900);
+  waveforms.push_back(outage);
+
+  // a cut through a relay that chatters for 400 ms must still be one outage
+  MainsWaveform bounce{"bounce", {N, O, N}, {}};
+  hold(bounce.reads, 5, 900);
+  for (int i = 0; i < 10; i++)
+  {
+    hold(bounce.reads, 0.04, i % 2 ? 900 : 12);
+  }
+  hold(bounce.reads, 3, 12);
+  hold(bounce.reads, 5, 900);
+  waveforms.push_back(bounce);
+
+  // sitting right on the brownout edge with heavy noise must not toggle
+  MainsWaveform edgeNoise{"edge-noise", {N}, {}};
+  hold(edgeNoise.reads, 5, 900);
+  hold(edgeNoise.reads, 60, MAINS_BROWNOUT_BELOW + 2, 60);
+  waveforms.push_back(edgeNoise);
+
+  // slow sag the single read diff never saw
+  MainsWaveform sag{"slow-sag", {N, B, N}, {}};
+  hold(sag.reads, 5, 900);
+  ramp(sag.reads, 20, 900, 650);
+  hold(sag.reads, 20, 650);
+  ramp(sag.reads, 20, 650, 900);
+  hold(sag.reads, 5, 900);
+  waveforms.push_back(sag);
+
+  // a dip shorter than the level debounce is not a brownout
+  MainsWaveform dip{"short-dip", {N}, {}};
+  hold(dip.reads, 5, 900);
+  hold(dip.reads, 0.3, 600);
+  hold(dip.reads, 5, 900);
+  waveforms.push_back(dip);
+
+  MainsWaveform surge{"surge", {N, S, N}, {}};
+  hold(surge.reads, 5, 900);
+  hold(surge.reads, 3, 1015);
+  hold(surge.reads, 5, 900);
+  waveforms.push_back(surge);
+
+  // unsmoothed rectifier output, 50 Hz ripple aliased by the 200 Hz reads
+  MainsWaveform ripple{"ripple", {N}, {}};
+  for (uint32_t i = 0; i < 30 * readsPerSecond; i++)
+  {
+    double t = i * MAINS_SAMPLE_INTERVAL_MS / 1000.0 + 0.0013 * (i % 7);
+    ripple.reads.push_back((uint16_t)(820 + 140 * std::fabs(std::sin(2 * M_PI * 50 * t))));
+  }
+  waveforms.push_back(ripple);
+
+  // power comes back into a brownout: off, then brownout, then normal
+  MainsWaveform weakReturn{"weak-return", {N, O, B, N}, {}};
+  hold(weakReturn.reads, 5, 900);
+  hold(weakReturn.reads, 4, 12);
+  hold(weakReturn.reads, 10, 700);
+  hold(weakReturn.reads, 5, 900);
+  waveforms.push_back(weakReturn);
+
+  return waveforms;
+}
+
+std::vector<MainsLevel> replayMainsWaveform(const std::vector<uint16_t> &reads, bool print,
+                                            const MainsThresholds &thresholds)
+{
+  std::vector<MainsLevel> levels;
+  MainsDetector detector;
+  detector.begin(thresholds);
+  for (size_t start = 0; start + MAINS_BLOCK_SAMPLES <= reads.size(); start += MAINS_BLOCK_SAMPLES)
+  {
+    uint32_t sum = 0;
+    for (size_t i = start; i < start + MAINS_BLOCK_SAMPLES; i++)
+    {
+      sum += reads[i];
+    }
+    uint32_t takenAt = start * MAINS_SAMPLE_INTERVAL_MS;
+    if (detector.update(takenAt, (sum + MAINS_BLOCK_SAMPLES / 2) / MAINS_BLOCK_SAMPLES))
+    {
+      levels.push_back(detector.level());
+      if (print)
+      {
+        printf("  %8.2f s  %-8s -> %-8s filtered %u\n", detector.changedAt() / 1000.0,
+               mainsLevelName(detector.previousLevel()), mainsLevelName(detector.level()), detector.filtered());
+      }
+    }
+  }
+  return levels;
+}
+
+std::vector<uint16_t> scaledMainsWaveform(const std::vector<uint16_t> &reads, int percent)
+{
+  std::vector<uint16_t> out;
+  for (uint16_t read : reads)
+  {
+    out.push_back((uint16_t)(read * percent / 100));
+  }
+  return out;
+}
+
+bool learnMainsThresholds(int percent, MainsCalibrationResult &result)
+{
+  static MainsCalibration calibration;
+  calibration.begin();
+  int nominal = MAINS_NOMINAL_READING * percent / 100;
+  for (uint32_t block = 0; !calibration.complete(); block++)
+  {
+    bool outage = block >= 36000 && block < 36600;
+    calibration.add((uint16_t)std::max(0, (outage ? 8 : nominal) + noise(3)));
+  }
+  return calibration.derive(result);
+}
+
+std::string mainsLevelList(const std::vector<MainsLevel> &levels)
+{
+  std::string text;
+  for (MainsLevel level : levels)
+  {
+    text += text.empty() ? "" : " ";
+    text += mainsLevelName(level);
+  }
+  return text;
+}
@@ -0,0 +1,193 @@
+// Host-side stand-in for the Arduino core, only as much of it as the
+// quality-of-power-supply-reporter core uses. Time is virtual: millis() only
+// moves when hostAdvanceMillis() or delay() is called, so traces replay
+// faster than real time and deterministically.
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <algorithm>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define IRAM_ATTR
+#define ICACHE_RAM_ATTR
+#define PROGMEM
+#define F(s) (s)
+
+#define DEC 10
+#define HEX 16
+
+#define A0 17
+#define D8 15
+
+class String
+{
+public:
+  String() {}
+  String(const char *s) : buf(s ? s : "") {}
+  String(const std::string &s) : buf(s) {}
+  String(int v) : buf(std::to_string(v)) {}
+  String(unsigned int v) : buf(std::to_string(v)) {}
+  String(long v) : buf(std::to_string(v)) {}
+  String(unsigned long v) : buf(std::to_string(v)) {}
+
+  const char *c_str() const { return buf.c_str(); }
+  unsigned int length() const { return buf.length(); }
+  bool isEmpty() const { return buf.empty(); }
+  long toInt() const { return std::strtol(buf.c_str(), nullptr, 10); }
+  bool operator==(const String &o) const { return buf == o.buf; }
+  bool operator==(const char *o) const { return buf == o; }
+  bool operator!=(const char *o) const { return buf != o; }
+  String &operator+=(const String &o)
+  {
+    buf += o.buf;
+    return *this;
+  }
+  String &operator+=(const char *o)
+  {
+    buf += o;
+    return *this;
+  }
+  String &operator+=(char c)
+  {
+    buf += c;
+    return *this;
+  }
+  friend String operator+(const String &a, const String &b) { return String(a.buf + b.buf); }
+  friend String operator+(const String &a, const char *b) { return String(a.buf + b); }
+
+private:
+  std::string buf;
+};
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size)
+  {
+    size_t n = 0;
+    while (size--)
+      n += write(*buffer++);
+    return n;
+  }
+  size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+
+  size_t print(const char *s) { return write(s); }
+  size_t print(const String &s) { return write(s.c_str()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int v, int base = DEC) { return printNumber((long)v, base); }
+  size_t print(unsigned int v, int base = DEC) { return printNumber((unsigned long)v, base); }
+  size_t print(long v, int base = DEC) { return printNumber(v, base); }
+  size_t print(unsigned long v, int base = DEC) { return printNumber(v, base); }
+  size_t print(long long v, int base = DEC) { return printNumber((long)v, base); }
+  size_t print(unsigned long long v, int base = DEC) { return printNumber((unsigned long)v, base); }
+  size_t print(double v, int digits = 2)
+  {
+    char b[32];
+    snprintf(b, sizeof(b), "%.*f", digits, v);
+    return write(b);
+  }
+  size_t println() { return write("\r\n"); }
+  template <typename T>
+  size_t println(T v)
+  {
+    size_t n = print(v);
+    return n + println();
+  }
+  template <typename T>
+  size_t println(T v, int base)
+  {
+    size_t n = print(v, base);
+    return n + println();
+  }
+  size_t printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+private:
+  size_t printNumber(long v, int base)
+  {
+    char b[24];
+    snprintf(b, sizeof(b), base == HEX ? "%lx" : "%ld", v);
+    return write(b);
+  }
+  size_t printNumber(unsigned long v, int base)
+  {
+    char b[24];
+    snprintf(b, sizeof(b), base == HEX ? "%lx" : "%lu", v);
+    return write(b);
+  }
+};
+
+class Stream : public Print
+{
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  String readStringUntil(char terminator)
+  {
+    std::string s;
+    int c;
+    while ((c = read()) >= 0 && c != terminator)
+      s += (char)c;
+    return String(s);
+  }
+};
+
+// Serial output is counted and discarded unless QOP_HOST_SERIAL is set in the
+// environment, so logging cost does not swamp benchmark numbers.
+class HardwareSerial : public Stream
+{
+public:
+  void begin(unsigned long) {}
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t *buffer, size_t size) override;
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  int availableForWrite() { return 128; }
+
+  unsigned long bytesWritten = 0;
+};
+extern HardwareSerial Serial;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+int analogRead(uint8_t pin);
+// Deterministic on the host, runs repeat exactly
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+// Host control of virtual time and the simulated ADC
+void hostAdvanceMillis(unsigned long ms);
+void hostAdvanceMicros(unsigned long us);
+typedef int (*HostAdcSource)(unsigned long nowMicros);
+void hostSetAdcSource(HostAdcSource source);
+
+class EspClass
+{
+public:
+  uint32_t getFreeHeap();
+  uint8_t getHeapFragmentation();
+  uint32_t getMaxFreeBlockSize();
+  uint32_t getCycleCount();
+  uint32_t getCpuFreqMHz() { return 80; }
+  void restart() {}
+};
+extern EspClass ESP;
+
+#if !defined(__GLIBC__) || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38)
+size_t strlcpy(char *dst, const char *src, size_t size);
+#endif
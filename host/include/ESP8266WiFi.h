@@ -0,0 +1,80 @@
+// Host-side stand-in for ESP8266WiFi: WiFiClient is a real TCP socket, so
+// the network sinks can be driven against localhost stand-in servers.
+#pragma once
+
+#include <Arduino.h>
+#include <Client.h>
+
+typedef enum
+{
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_CONNECTED = 3,
+  WL_CONNECTION_LOST = 5,
+  WL_DISCONNECTED = 6
+} wl_status_t;
+
+typedef enum
+{
+  WIFI_OFF = 0,
+  WIFI_STA = 1,
+  WIFI_AP = 2,
+  WIFI_AP_STA = 3
+} WiFiMode_t;
+
+// The radio calls only record what was asked for, hostRadioOn tells whether the device would be transmitting
+class ESP8266WiFiClass
+{
+public:
+  wl_status_t status() { return hostStatus; }
+  bool mode(WiFiMode_t mode)
+  {
+    hostMode = mode;
+    return true;
+  }
+  bool forceSleepBegin()
+  {
+    hostRadioOn = false;
+    return true;
+  }
+  bool forceSleepWake()
+  {
+    hostRadioOn = true;
+    return true;
+  }
+  wl_status_t begin() { return hostStatus; }
+
+  wl_status_t hostStatus = WL_CONNECTED;
+  WiFiMode_t hostMode = WIFI_STA;
+  bool hostRadioOn = true;
+};
+extern ESP8266WiFiClass WiFi;
+
+class WiFiClient : public Client
+{
+public:
+  WiFiClient() {}
+  ~WiFiClient();
+  WiFiClient(const WiFiClient &) = delete;
+  WiFiClient &operator=(const WiFiClient &) = delete;
+
+  int connect(const char *host, uint16_t port) override;
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t *buf, size_t size) override;
+  int available() override;
+  int read() override;
+  int read(uint8_t *buf, size_t size) override;
+  int peek() override;
+  void flush() override {}
+  void stop() override;
+  uint8_t connected() override;
+  operator bool() override { return fd >= 0; }
+  void setNoDelay(bool noDelay);
+
+private:
+  int fd = -1;
+  bool peerClosed = false;
+  uint8_t buffer[1024];
+  size_t bufferStart = 0;
+  size_t bufferEnd = 0;
+};
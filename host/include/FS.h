@@ -0,0 +1,112 @@
+// Host-side in-memory filesystem with the subset of the ESP8266 fs::File/fs::FS
+// API the logger uses. Every operation is counted in hostFsStats so benchmarks
+// can report SD traffic without a card.
+#pragma once
+
+#include <Arduino.h>
+#include <map>
+#include <memory>
+#include <vector>
+
+enum SeekMode
+{
+  SeekSet = 0,
+  SeekCur = 1,
+  SeekEnd = 2
+};
+
+struct HostFsStats
+{
+  unsigned long opens = 0;
+  unsigned long bytesRead = 0;
+  unsigned long bytesWritten = 0;
+  unsigned long writes = 0;
+  // 512 byte sectors each write touched, what a card programs for it
+  unsigned long sectorWrites = 0;
+  unsigned long flushes = 0;
+  // flushes of a file whose size changed, which rewrite its directory entry and FAT
+  unsigned long dirUpdates = 0;
+  unsigned long seeks = 0;
+  unsigned long dirEntriesVisited = 0;
+  unsigned long renames = 0;
+  unsigned long removes = 0;
+};
+extern HostFsStats hostFsStats;
+
+struct HostFsNode
+{
+  bool isDir = false;
+  std::vector<uint8_t> data;
+  size_t syncedSize = 0; // size in the directory entry as of the last flush
+};
+
+namespace fs
+{
+  class File : public Stream
+  {
+  public:
+    File() {}
+    File(std::shared_ptr<HostFsNode> node, const std::string &path, bool canRead, bool canWrite, bool append)
+        : node(node), path(path), canRead(canRead), canWrite(canWrite), append(append)
+    {
+    }
+
+    operator bool() const { return node != nullptr; }
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size) override;
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t read(uint8_t *buffer, size_t size);
+    bool seek(uint32_t pos, SeekMode mode);
+    bool seek(uint32_t pos) { return seek(pos, SeekSet); }
+    size_t position() const { return pos; }
+    size_t size() const { return node ? node->data.size() : 0; }
+    bool truncate(uint32_t size);
+    void flush();
+    void close();
+
+    const char *name() const;
+    const char *fullName() const { return path.c_str(); }
+    bool isFile() const { return node && !node->isDir; }
+    bool isDirectory() const { return node && node->isDir; }
+    File openNextFile();
+    void rewindDirectory() { dirCursor.clear(); }
+
+  private:
+    std::shared_ptr<HostFsNode> node;
+    std::string path;
+    bool canRead = false;
+    bool canWrite = false;
+    bool append = false;
+    size_t pos = 0;
+    std::string dirCursor; // last child openNextFile() returned
+  };
+}
+using fs::File;
+
+namespace fs
+{
+  class FS
+  {
+  public:
+    // mode is one of the stdio strings "r", "r+", "w", "w+", "a", "a+"
+    File open(const char *path, const char *mode);
+    File open(const std::string &path, const char *mode) { return open(path.c_str(), mode); }
+    bool exists(const char *path);
+    bool remove(const char *path);
+    bool rename(const char *from, const char *to);
+    bool mkdir(const char *path);
+    bool rmdir(const char *path);
+
+    // Drops every file, used between benchmark runs
+    void hostFormat();
+    std::map<std::string, std::shared_ptr<HostFsNode>> nodes;
+  };
+}
+using fs::FS;
+
+extern FS SDFS;
+
+std::string hostFsNormalize(const char *path);
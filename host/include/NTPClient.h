@@ -0,0 +1,12 @@
+// Host-side stand-in, the fake TwitterClient keeps its own virtual NTP epoch.
+#pragma once
+
+#include <WiFiUdp.h>
+
+class NTPClient
+{
+public:
+  NTPClient(WiFiUDP &, const char *, long = 0, unsigned long = 60000) {}
+  void begin() {}
+  bool update() { return true; }
+};
@@ -0,0 +1,44 @@
+// Host-side stand-in for RTClib: a DS1307 that free-runs off the virtual
+// millis() clock, with a configurable drift so resync logic can be exercised.
+#pragma once
+
+#include <Arduino.h>
+#include <ctime>
+
+class DateTime
+{
+public:
+  DateTime(uint32_t t = 0) : t(t) {}
+  DateTime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour = 0, uint8_t min = 0, uint8_t sec = 0);
+
+  uint16_t year() const { return fields().tm_year + 1900; }
+  uint8_t month() const { return fields().tm_mon + 1; }
+  uint8_t day() const { return fields().tm_mday; }
+  uint8_t hour() const { return fields().tm_hour; }
+  uint8_t minute() const { return fields().tm_min; }
+  uint8_t second() const { return fields().tm_sec; }
+  uint32_t unixtime() const { return t; }
+  String timestamp() const;
+
+private:
+  std::tm fields() const;
+  uint32_t t;
+};
+
+class RTC_DS1307
+{
+public:
+  boolean begin() { return true; }
+  uint8_t isrunning() { return 1; }
+  DateTime now();
+  void adjust(const DateTime &dt);
+
+  // Simulated drift in parts per million, positive runs fast
+  long hostDriftPpm = 0;
+  unsigned long hostReads = 0;
+  unsigned long hostAdjusts = 0;
+
+private:
+  uint32_t base = 0;
+  unsigned long baseMillis = 0;
+};
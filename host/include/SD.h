@@ -0,0 +1,34 @@
+// Host-side stand-in for the ESP8266 SD wrapper, backed by the in-memory SDFS.
+#pragma once
+
+#include <FS.h>
+#include <SdFat.h>
+
+#define FILE_READ 0x01
+#define FILE_WRITE 0x47
+
+class SDClass
+{
+public:
+  boolean begin(uint8_t csPin, uint32_t cfg = SD_SCK_MHZ(4));
+  void end() { started = false; }
+  File open(const char *filename, uint8_t mode = FILE_READ);
+  File open(const String &filename, uint8_t mode = FILE_READ) { return open(filename.c_str(), mode); }
+  boolean exists(const char *filepath) { return SDFS.exists(filepath); }
+  boolean mkdir(const char *filepath) { return SDFS.mkdir(filepath); }
+  boolean remove(const char *filepath) { return SDFS.remove(filepath); }
+  boolean rename(const char *filepathfrom, const char *filepathto) { return SDFS.rename(filepathfrom, filepathto); }
+  boolean rmdir(const char *filepath) { return SDFS.rmdir(filepath); }
+  uint8_t type() { return 3; }
+  uint8_t fatType() { return 32; }
+  size_t size() { return 8UL * 1024 * 1024 * 1024; }
+
+  // The SPI clock the last begin() asked for, and the highest clock the
+  // simulated card accepts; begin() above it fails like a card returning CRC errors.
+  uint32_t hostRequestedClock = 0;
+  uint32_t hostMaxClock = SD_SCK_MHZ(25);
+
+private:
+  bool started = false;
+};
+extern SDClass SD;
@@ -0,0 +1,2 @@
+// Host-side stand-in, SPI is never touched off device.
+#pragma once
@@ -0,0 +1,5 @@
+// Host-side stand-in for the SdFat SPI clock helpers.
+#pragma once
+
+#define SD_SCK_HZ(maxSpeed) (maxSpeed)
+#define SD_SCK_MHZ(maxMhz) (1000000UL * (maxMhz))
@@ -0,0 +1,38 @@
+// Host-side stand-in for the ESP8266 Ticker. Callbacks run off the virtual
+// clock: whenever delay() or hostAdvance*() moves time forward, every ticker
+// due on the way fires at its own due time, like os_timer callbacks running
+// while the sketch yields.
+#pragma once
+
+#include <Arduino.h>
+#include <functional>
+
+class Ticker
+{
+public:
+  Ticker() {}
+  ~Ticker() { detach(); }
+  Ticker(const Ticker &) = delete;
+  Ticker &operator=(const Ticker &) = delete;
+
+  template <typename TArg>
+  void attach_ms(uint32_t milliseconds, void (*callback)(TArg), TArg arg)
+  {
+    arm((unsigned long long)milliseconds * 1000, [callback, arg]() { callback(arg); });
+  }
+  void attach_ms(uint32_t milliseconds, void (*callback)()) { arm((unsigned long long)milliseconds * 1000, callback); }
+  void detach();
+  bool active() const { return intervalMicros != 0; }
+
+  unsigned long long hostDueMicros = 0;
+  void hostFire();
+
+private:
+  void arm(unsigned long long interval, std::function<void()> callback);
+
+  unsigned long long intervalMicros = 0;
+  std::function<void()> callback;
+};
+
+// The attached ticker due first at or before untilMicros, null when none is
+Ticker *hostNextDueTicker(unsigned long long untilMicros);
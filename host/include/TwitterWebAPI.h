@@ -0,0 +1,26 @@
+// Host-side stand-in for the esp8266-twitter client. getEpoch() follows the
+// virtual clock once hostNtpEpoch is set, tweet() outcomes are scripted.
+#pragma once
+
+#include <Arduino.h>
+#include <NTPClient.h>
+#include <string>
+
+class TwitterClient
+{
+public:
+  TwitterClient(NTPClient &, std::string, std::string, std::string, std::string) {}
+  void startNTP() {}
+  unsigned long getEpoch();
+  bool tweet(std::string message);
+
+  // Epoch at millis() == 0 once NTP is "reachable", 0 while it is not
+  unsigned long hostNtpEpoch = 0;
+  // Returning false makes the tweet fail; null means every tweet succeeds
+  bool (*hostTweetOutcome)(const std::string &message) = nullptr;
+  // Virtual milliseconds each tweet blocks for, like the TLS round trip on device
+  unsigned long hostTweetLatencyMs = 0;
+  unsigned long hostTweets = 0;
+  unsigned long hostFailedTweets = 0;
+  std::string hostLastTweet;
+};
@@ -0,0 +1,6 @@
+// Host-side stand-in, only needed to construct NTPClient.
+#pragma once
+
+class WiFiUDP
+{
+};
@@ -0,0 +1,2 @@
+// Host-side stand-in, the fake RTC does not go through I2C.
+#pragma once
@@ -0,0 +1,19 @@
+// Heap allocation counters for host benchmarks. hostAlloc.cpp replaces the
+// global operator new/delete, so every C++ allocation made by the firmware
+// code (std::string, std::vector, String) is counted.
+#pragma once
+
+#include <atomic>
+
+struct HostAllocStats
+{
+  std::atomic<unsigned long> allocations{0};
+  std::atomic<unsigned long> frees{0};
+  std::atomic<unsigned long long> bytes{0};
+  // bytes currently allocated and the most allocated at once since the last hostAllocResetPeak()
+  std::atomic<long long> live{0};
+  std::atomic<long long> peakLive{0};
+};
+extern HostAllocStats hostAllocStats;
+
+void hostAllocResetPeak();
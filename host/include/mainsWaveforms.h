@@ -0,0 +1,39 @@
+// Synthetic A0 waveforms for the mains level detector, shared by the
+// detector-replay tool and the test_mainsDetector unit tests. Reads are raw
+// A0 values at MAINS_SAMPLE_INTERVAL_MS, each waveform carries the levels it
+// must produce; the noise is deterministic so runs are comparable.
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "mainsCalibration.h"
+#include "mainsDetector.h"
+
+struct MainsWaveform
+{
+  const char *name;
+  // expected reported levels, in order, starting with the level the line settles at
+  std::vector<MainsLevel> expected;
+  std::vector<uint16_t> reads;
+};
+
+// Outage, relay bounce, noise on the brownout edge, slow sag, short dip, surge, 50 Hz ripple and power
+// returning into a brownout
+std::vector<MainsWaveform> builtinMainsWaveforms();
+
+// Feeds reads to a fresh MainsDetector in blocks, as mainsSampler does, and returns the reported levels;
+// print lists every change as it is reported
+std::vector<MainsLevel> replayMainsWaveform(const std::vector<uint16_t> &reads, bool print = false,
+                                            const MainsThresholds &thresholds = MainsThresholds());
+
+// The reads of a unit whose divider reads percent of the stock one
+std::vector<uint16_t> scaledMainsWaveform(const std::vector<uint16_t> &reads, int percent);
+
+// Three hours of block means from such a unit, with a minute long outage, through MainsCalibration
+bool learnMainsThresholds(int percent, MainsCalibrationResult &result);
+
+// "normal off normal"
+std::string mainsLevelList(const std::vector<MainsLevel> &levels);
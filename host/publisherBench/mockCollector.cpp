@@ -0,0 +1,206 @@
+#include "mockCollector.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static bool recvExact(int fd, uint8_t *buf, size_t length)
+{
+  size_t received = 0;
+  while (received < length)
+  {
+    ssize_t n = recv(fd, buf + received, length - received, 0);
+    if (n <= 0)
+    {
+      return false;
+    }
+    received += n;
+  }
+  return true;
+}
+
+bool MockCollector::start(Protocol protocol)
+{
+  this->protocol = protocol;
+  listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  int reuse = 1;
+  setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t addressLength = sizeof(address);
+  if (bind(listenFd, (sockaddr *)&address, sizeof(address)) != 0 || listen(listenFd, 4) != 0 ||
+      getsockname(listenFd, (sockaddr *)&address, &addressLength) != 0)
+  {
+    close(listenFd);
+    return false;
+  }
+  listenPort = ntohs(address.sin_port);
+  running = true;
+  std::thread(&MockCollector::acceptLoop, this).detach();
+  return true;
+}
+
+void MockCollector::stop()
+{
+  running = false;
+  shutdown(listenFd, SHUT_RDWR);
+  close(listenFd);
+}
+
+std::vector<Timestamp> MockCollector::arrivals()
+{
+  std::lock_guard<std::mutex> guard(arrivalsLock);
+  return arrivalTimes;
+}
+
+void MockCollector::acceptLoop()
+{
+  while (running)
+  {
+    pollfd p = {listenFd, POLLIN, 0};
+    if (poll(&p, 1, 100) <= 0)
+    {
+      continue;
+    }
+    int fd = accept(listenFd, nullptr, nullptr);
+    if (fd < 0)
+    {
+      continue;
+    }
+    connectionCount++;
+    std::thread([this, fd]() {
+      if (protocol == MQTT)
+      {
+        serveMqtt(fd);
+      }
+      else
+      {
+        serveHttp(fd);
+      }
+      close(fd);
+    }).detach();
+  }
+}
+
+void MockCollector::recordArrival(const char *payload, size_t length)
+{
+  Timestamp now = std::chrono::steady_clock::now();
+  size_t events = 0;
+  std::string body(payload, length);
+  for (size_t at = body.find("\"type\""); at != std::string::npos; at = body.find("\"type\"", at + 1))
+  {
+    events++;
+  }
+  eventCount += events;
+  std::lock_guard<std::mutex> guard(arrivalsLock);
+  arrivalTimes.push_back(now);
+}
+
+void MockCollector::serveHttp(int fd)
+{
+  std::string pending;
+  char chunk[4096];
+  while (running)
+  {
+    size_t headerEnd = pending.find("\r\n\r\n");
+    if (headerEnd != std::string::npos)
+    {
+      size_t contentLength = 0;
+      size_t at = pending.find("Content-Length:");
+      if (at != std::string::npos && at < headerEnd)
+      {
+        contentLength = strtoul(pending.c_str() + at + 15, nullptr, 10);
+      }
+      if (pending.size() >= headerEnd + 4 + contentLength)
+      {
+        recordArrival(pending.data() + headerEnd + 4, contentLength);
+        pending.erase(0, headerEnd + 4 + contentLength);
+        static const char reply[] = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\nConnection: keep-alive\r\n\r\nOK";
+        static const char chunkedReply[] = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\nConnection: keep-alive\r\n\r\n"
+                                           "2\r\nOK\r\n11\r\n{\"accepted\":true}\r\n0\r\n\r\n";
+        if (protocol == HTTP_CHUNKED)
+        {
+          send(fd, chunkedReply, sizeof(chunkedReply) - 1, MSG_NOSIGNAL);
+        }
+        else
+        {
+          send(fd, reply, sizeof(reply) - 1, MSG_NOSIGNAL);
+        }
+        continue;
+      }
+    }
+    ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+    if (n <= 0)
+    {
+      return;
+    }
+    pending.append(chunk, n);
+  }
+}
+
+void MockCollector::serveMqtt(int fd)
+{
+  std::vector<uint8_t> body;
+  while (running)
+  {
+    uint8_t type;
+    if (!recvExact(fd, &type, 1))
+    {
+      return;
+    }
+    size_t remaining = 0;
+    uint8_t digit;
+    int shift = 0;
+    do
+    {
+      if (!recvExact(fd, &digit, 1))
+      {
+        return;
+      }
+      remaining |= (size_t)(digit & 0x7F) << shift;
+      shift += 7;
+    } while (digit & 0x80);
+    body.resize(remaining);
+    if (remaining && !recvExact(fd, body.data(), remaining))
+    {
+      return;
+    }
+
+    switch (type & 0xF0)
+    {
+    case 0x10: // CONNECT
+    {
+      static const uint8_t connack[] = {0x20, 0x02, 0x00, 0x00};
+      send(fd, connack, sizeof(connack), MSG_NOSIGNAL);
+      break;
+    }
+    case 0x30: // PUBLISH
+    {
+      size_t topicLength = (body[0] << 8) | body[1];
+      size_t payloadStart = 2 + topicLength + ((type & 0x06) ? 2 : 0);
+      recordArrival((const char *)body.data() + payloadStart, remaining - payloadStart);
+      if (type & 0x06)
+      {
+        uint8_t puback[] = {0x40, 0x02, body[2 + topicLength], body[3 + topicLength]};
+        send(fd, puback, sizeof(puback), MSG_NOSIGNAL);
+      }
+      break;
+    }
+    case 0xC0: // PINGREQ
+    {
+      static const uint8_t pingresp[] = {0xD0, 0x00};
+      send(fd, pingresp, sizeof(pingresp), MSG_NOSIGNAL);
+      break;
+    }
+    case 0xE0: // DISCONNECT
+      return;
+    }
+  }
+}
@@ -0,0 +1,51 @@
+// Localhost stand-ins for the HTTP collector and the MQTT broker.
+//
+// Each runs on its own thread, acknowledges everything it receives the way
+// the real service would, and records when each batch fully arrived so the
+// bench can measure end-to-end latency.
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+typedef std::chrono::steady_clock::time_point Timestamp;
+
+class MockCollector
+{
+public:
+  enum Protocol
+  {
+    HTTP,
+    // HTTP answered with a chunked body, as servers streaming their replies do
+    HTTP_CHUNKED,
+    MQTT
+  };
+
+  // Listens on an ephemeral localhost port
+  bool start(Protocol protocol);
+  void stop();
+  uint16_t port() const { return listenPort; }
+
+  // Arrival time of every batch and the events it carried, in arrival order
+  std::vector<Timestamp> arrivals();
+  size_t events() const { return eventCount; }
+  size_t connections() const { return connectionCount; }
+
+private:
+  void acceptLoop();
+  void serveHttp(int fd);
+  void serveMqtt(int fd);
+  void recordArrival(const char *payload, size_t length);
+
+  Protocol protocol = HTTP;
+  int listenFd = -1;
+  uint16_t listenPort = 0;
+  std::atomic<bool> running{false};
+  std::atomic<size_t> eventCount{0};
+  std::atomic<size_t> connectionCount{0};
+  std::mutex arrivalsLock;
+  std::vector<Timestamp> arrivalTimes;
+};
@@ -0,0 +1,114 @@
+// Drives the HTTP and MQTT publishers against localhost stand-in servers and
+// reports events/sec and end-to-end latency (publish() call to the server
+// holding the complete batch).
+//
+//   pio run -e publisher-bench && .pio/build/publisher-bench/program [batches] [events per batch]
+
+#include "httpPublisher.h"
+#include "mockCollector.h"
+#include "mqttPublisher.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+static void fillBatch(EventBatch &batch, size_t events, uint32_t &epoch)
+{
+  batch.clear();
+  EventRecord event = {};
+  event.flags = EVENT_FLAG_NTP_SYNCED;
+  for (size_t i = 0; i < events; i++)
+  {
+    event.type = i % 2 ? EVENT_TYPE_PRES : EVENT_TYPE_POFF;
+    event.epoch = epoch;
+    event.adcSample = i % 2 ? 900 : 12;
+    epoch += 60 + (i * 37) % 600;
+    sealEventRecord(event);
+    batch.add(event);
+  }
+}
+
+static double percentile(std::vector<double> values, double p)
+{
+  if (values.empty())
+  {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  return values[std::min(values.size() - 1, (size_t)(p * values.size()))];
+}
+
+static void run(const char *label, EventPublisher &publisher, MockCollector &collector, size_t batches,
+                size_t eventsPerBatch)
+{
+  EventBatch batch;
+  uint32_t epoch = 1656151200;
+  std::vector<Timestamp> started;
+  std::vector<double> acknowledged;
+  size_t failures = 0;
+
+  auto begin = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < batches; i++)
+  {
+    fillBatch(batch, eventsPerBatch, epoch);
+    Timestamp t0 = std::chrono::steady_clock::now();
+    started.push_back(t0);
+    if (!publisher.publish(batch))
+    {
+      failures++;
+    }
+    acknowledged.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count());
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  publisher.stop();
+
+  std::vector<Timestamp> arrivals = collector.arrivals();
+  std::vector<double> endToEnd;
+  for (size_t i = 0; i < std::min(arrivals.size(), started.size()); i++)
+  {
+    endToEnd.push_back(std::chrono::duration<double, std::micro>(arrivals[i] - started[i]).count());
+  }
+
+  printf("%-5s batches=%zu events=%zu failed=%zu connections=%zu\n", label, batches, collector.events(), failures,
+         collector.connections());
+  printf("      throughput  %.0f events/s, %.0f batches/s\n", collector.events() / seconds, batches / seconds);
+  printf("      end-to-end  p50 %.1f us  p99 %.1f us\n", percentile(endToEnd, 0.50), percentile(endToEnd, 0.99));
+  printf("      acked       p50 %.1f us  p99 %.1f us\n", percentile(acknowledged, 0.50),
+         percentile(acknowledged, 0.99));
+}
+
+int main(int argc, char **argv)
+{
+  size_t batches = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000;
+  size_t eventsPerBatch = argc > 2 ? std::min(strtoul(argv[2], nullptr, 10), (unsigned long)EVENT_BATCH_CAPACITY)
+                                   : PUBLISH_MAX_BATCH_SIZE;
+
+  MockCollector httpCollector;
+  MockCollector chunkedCollector;
+  MockCollector mqttBroker;
+  if (!httpCollector.start(MockCollector::HTTP) || !chunkedCollector.start(MockCollector::HTTP_CHUNKED) ||
+      !mqttBroker.start(MockCollector::MQTT))
+  {
+    fprintf(stderr, "cannot listen on localhost\n");
+    return 1;
+  }
+
+  HttpPublisher http;
+  http.configure("127.0.0.1", httpCollector.port(), "/events", "bench");
+  run("http", http, httpCollector, batches, eventsPerBatch);
+
+  // chunked replies have to be read to their end for the connection to be kept
+  HttpPublisher chunkedHttp;
+  chunkedHttp.configure("127.0.0.1", chunkedCollector.port(), "/events", "bench");
+  run("http chunked", chunkedHttp, chunkedCollector, batches, eventsPerBatch);
+
+  MqttPublisher mqtt;
+  mqtt.configure("127.0.0.1", mqttBroker.port(), "qop/events", "bench");
+  run("mqtt", mqtt, mqttBroker, batches, eventsPerBatch);
+
+  httpCollector.stop();
+  chunkedCollector.stop();
+  mqttBroker.stop();
+  return 0;
+}
@@ -0,0 +1,70 @@
+#include <hostAlloc.h>
+
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+
+HostAllocStats hostAllocStats;
+
+static void *countedAlloc(std::size_t size)
+{
+  hostAllocStats.allocations.fetch_add(1, std::memory_order_relaxed);
+  hostAllocStats.bytes.fetch_add(size, std::memory_order_relaxed);
+  void *block = std::malloc(size ? size : 1);
+  if (!block)
+  {
+    throw std::bad_alloc();
+  }
+  long long live = hostAllocStats.live.fetch_add(malloc_usable_size(block), std::memory_order_relaxed) +
+                   malloc_usable_size(block);
+  long long peak = hostAllocStats.peakLive.load(std::memory_order_relaxed);
+  while (live > peak && !hostAllocStats.peakLive.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+  {
+  }
+  return block;
+}
+
+static void countedFree(void *block)
+{
+  if (block)
+  {
+    hostAllocStats.frees.fetch_add(1, std::memory_order_relaxed);
+    hostAllocStats.live.fetch_sub(malloc_usable_size(block), std::memory_order_relaxed);
+    std::free(block);
+  }
+}
+
+void hostAllocResetPeak()
+{
+  hostAllocStats.peakLive.store(hostAllocStats.live.load());
+}
+
+void *operator new(std::size_t size)
+{
+  return countedAlloc(size);
+}
+
+void *operator new[](std::size_t size)
+{
+  return countedAlloc(size);
+}
+
+void operator delete(void *block) noexcept
+{
+  countedFree(block);
+}
+
+void operator delete[](void *block) noexcept
+{
+  countedFree(block);
+}
+
+void operator delete(void *block, std::size_t) noexcept
+{
+  countedFree(block);
+}
+
+void operator delete[](void *block, std::size_t) noexcept
+{
+  countedFree(block);
+}
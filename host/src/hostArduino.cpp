@@ -0,0 +1,173 @@
+#include <Arduino.h>
+#include <Ticker.h>
+#include <cstdarg>
+#include <malloc.h>
+
+HardwareSerial Serial;
+EspClass ESP;
+
+static unsigned long long virtualMicros = 0;
+static HostAdcSource adcSource = nullptr;
+static unsigned long randomState = 1;
+
+// Moves the virtual clock forward, stopping at each ticker due on the way to run it
+static void advanceVirtualMicros(unsigned long long step)
+{
+  unsigned long long target = virtualMicros + step;
+  while (Ticker *ticker = hostNextDueTicker(target))
+  {
+    if (ticker->hostDueMicros > virtualMicros)
+    {
+      virtualMicros = ticker->hostDueMicros;
+    }
+    ticker->hostFire();
+  }
+  virtualMicros = target;
+}
+
+static bool serialEchoEnabled()
+{
+  static int enabled = -1;
+  if (enabled < 0)
+  {
+    enabled = std::getenv("QOP_HOST_SERIAL") != nullptr;
+  }
+  return enabled;
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  bytesWritten++;
+  if (serialEchoEnabled())
+  {
+    fputc(c, stdout);
+  }
+  return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+  bytesWritten += size;
+  if (serialEchoEnabled())
+  {
+    fwrite(buffer, 1, size, stdout);
+  }
+  return size;
+}
+
+size_t Print::printf(const char *fmt, ...)
+{
+  char buf[256];
+  va_list args;
+  va_start(args, fmt);
+  int len = vsnprintf(buf, sizeof(buf), fmt, args);
+  va_end(args);
+  if (len < 0)
+  {
+    return 0;
+  }
+  return write((const uint8_t *)buf, std::min((size_t)len, sizeof(buf) - 1));
+}
+
+unsigned long millis()
+{
+  return (unsigned long)(virtualMicros / 1000);
+}
+
+unsigned long micros()
+{
+  return (unsigned long)virtualMicros;
+}
+
+void delay(unsigned long ms)
+{
+  advanceVirtualMicros((unsigned long long)ms * 1000);
+}
+
+// busy waits on device, timers do not get to run
+void delayMicroseconds(unsigned int us)
+{
+  virtualMicros += us;
+}
+
+void yield()
+{
+}
+
+int analogRead(uint8_t pin)
+{
+  (void)pin;
+  return adcSource ? adcSource((unsigned long)virtualMicros) : 0;
+}
+
+long random(long howbig)
+{
+  if (howbig <= 0)
+  {
+    return 0;
+  }
+  randomState = randomState * 1103515245UL + 12345UL;
+  return (long)((randomState >> 16) % (unsigned long)howbig);
+}
+
+long random(long howsmall, long howbig)
+{
+  return howsmall >= howbig ? howsmall : howsmall + random(howbig - howsmall);
+}
+
+void randomSeed(unsigned long seed)
+{
+  randomState = seed;
+}
+
+void hostAdvanceMillis(unsigned long ms)
+{
+  advanceVirtualMicros((unsigned long long)ms * 1000);
+}
+
+void hostAdvanceMicros(unsigned long us)
+{
+  advanceVirtualMicros(us);
+}
+
+void hostSetAdcSource(HostAdcSource source)
+{
+  adcSource = source;
+}
+
+uint32_t EspClass::getFreeHeap()
+{
+  struct mallinfo2 info = mallinfo2();
+  return (uint32_t)info.fordblks;
+}
+
+uint8_t EspClass::getHeapFragmentation()
+{
+  return 0;
+}
+
+uint32_t EspClass::getMaxFreeBlockSize()
+{
+  return getFreeHeap();
+}
+
+uint32_t EspClass::getCycleCount()
+{
+  // 80 MHz worth of cycles per virtual microsecond keeps cycle based
+  // instrumentation meaningful against the virtual clock
+  return (uint32_t)(virtualMicros * 80);
+}
+
+#if !defined(__GLIBC__) || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38)
+size_t strlcpy(char *dst, const char *src, size_t size)
+{
+  size_t length = strlen(src);
+  if (size)
+  {
+    size_t copied = length < size - 1 ? length : size - 1;
+    memcpy(dst, src, copied);
+    dst[copied] = '\0';
+  }
+  return length;
+}
+#endif
@@ -0,0 +1,276 @@
+#include <FS.h>
+#include <SD.h>
+
+HostFsStats hostFsStats;
+FS SDFS;
+SDClass SD;
+
+std::string hostFsNormalize(const char *path)
+{
+  std::string normalized = path[0] == '/' ? path : std::string("/") + path;
+  while (normalized.size() > 1 && normalized.back() == '/')
+  {
+    normalized.pop_back();
+  }
+  return normalized;
+}
+
+static std::string parentOf(const std::string &path)
+{
+  size_t slash = path.rfind('/');
+  return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+size_t File::write(const uint8_t *buffer, size_t size)
+{
+  if (!node || !canWrite)
+  {
+    return 0;
+  }
+  std::vector<uint8_t> &data = node->data;
+  if (append)
+  {
+    pos = data.size();
+  }
+  if (pos + size > data.size())
+  {
+    data.resize(pos + size);
+  }
+  memcpy(data.data() + pos, buffer, size);
+  if (size > 0)
+  {
+    hostFsStats.writes++;
+    hostFsStats.sectorWrites += (pos + size - 1) / 512 - pos / 512 + 1;
+  }
+  pos += size;
+  hostFsStats.bytesWritten += size;
+  return size;
+}
+
+int File::available()
+{
+  return node && canRead ? (int)(node->data.size() - std::min(pos, node->data.size())) : 0;
+}
+
+int File::read()
+{
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int File::peek()
+{
+  return available() ? node->data[pos] : -1;
+}
+
+size_t File::read(uint8_t *buffer, size_t size)
+{
+  size_t n = std::min(size, (size_t)available());
+  if (n)
+  {
+    memcpy(buffer, node->data.data() + pos, n);
+    pos += n;
+    hostFsStats.bytesRead += n;
+  }
+  return n;
+}
+
+bool File::seek(uint32_t offset, SeekMode mode)
+{
+  if (!node)
+  {
+    return false;
+  }
+  size_t base = mode == SeekSet ? 0 : mode == SeekCur ? pos : node->data.size();
+  if (base + offset > node->data.size())
+  {
+    return false;
+  }
+  pos = base + offset;
+  hostFsStats.seeks++;
+  return true;
+}
+
+bool File::truncate(uint32_t size)
+{
+  if (!node || !canWrite)
+  {
+    return false;
+  }
+  node->data.resize(size);
+  pos = std::min(pos, (size_t)size);
+  return true;
+}
+
+void File::flush()
+{
+  if (node && canWrite)
+  {
+    hostFsStats.flushes++;
+    if (node->data.size() != node->syncedSize)
+    {
+      hostFsStats.dirUpdates++;
+      node->syncedSize = node->data.size();
+    }
+  }
+}
+
+void File::close()
+{
+  flush();
+  node = nullptr;
+}
+
+const char *File::name() const
+{
+  size_t slash = path.rfind('/');
+  return path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+}
+
+File File::openNextFile()
+{
+  if (!isDirectory())
+  {
+    return File();
+  }
+  std::string prefix = path == "/" ? "/" : path + "/";
+  // std::map keeps paths ordered, so children are visited in name order;
+  // FAT gives no such guarantee, which is why callers still sort. Resuming
+  // after the last child returned keeps a full walk linear like on a card.
+  auto entry = dirCursor.empty() ? SDFS.nodes.lower_bound(prefix) : SDFS.nodes.upper_bound(dirCursor);
+  for (; entry != SDFS.nodes.end(); ++entry)
+  {
+    const std::string &childPath = entry->first;
+    if (childPath.compare(0, prefix.size(), prefix) != 0)
+    {
+      break;
+    }
+    if (childPath.size() == prefix.size() || childPath.find('/', prefix.size()) != std::string::npos)
+    {
+      continue;
+    }
+    dirCursor = childPath;
+    hostFsStats.dirEntriesVisited++;
+    hostFsStats.opens++;
+    return File(entry->second, childPath, true, false, false);
+  }
+  return File();
+}
+
+File fs::FS::open(const char *rawPath, const char *mode)
+{
+  std::string path = hostFsNormalize(rawPath);
+  bool read = mode[0] == 'r' || strchr(mode, '+');
+  bool write = mode[0] != 'r' || strchr(mode, '+');
+  bool append = mode[0] == 'a';
+  auto found = nodes.find(path);
+  if (found == nodes.end())
+  {
+    if (mode[0] == 'r' || !nodes.count(parentOf(path)) || !nodes[parentOf(path)]->isDir)
+    {
+      return File();
+    }
+    found = nodes.emplace(path, std::make_shared<HostFsNode>()).first;
+  }
+  else if (mode[0] == 'w' && !found->second->isDir)
+  {
+    found->second->data.clear();
+  }
+  hostFsStats.opens++;
+  File file(found->second, path, read, write && !found->second->isDir, append);
+  if (append)
+  {
+    file.seek(0, SeekEnd);
+  }
+  return file;
+}
+
+bool fs::FS::exists(const char *path)
+{
+  return nodes.count(hostFsNormalize(path)) != 0;
+}
+
+bool fs::FS::remove(const char *path)
+{
+  hostFsStats.removes++;
+  auto found = nodes.find(hostFsNormalize(path));
+  if (found == nodes.end() || found->second->isDir)
+  {
+    return false;
+  }
+  nodes.erase(found);
+  return true;
+}
+
+bool fs::FS::rename(const char *from, const char *to)
+{
+  hostFsStats.renames++;
+  std::string fromPath = hostFsNormalize(from);
+  std::string toPath = hostFsNormalize(to);
+  auto found = nodes.find(fromPath);
+  if (found == nodes.end() || nodes.count(toPath) || !nodes.count(parentOf(toPath)))
+  {
+    return false;
+  }
+  nodes[toPath] = found->second;
+  nodes.erase(fromPath);
+  return true;
+}
+
+bool fs::FS::mkdir(const char *path)
+{
+  std::string dirPath = hostFsNormalize(path);
+  if (nodes.count(dirPath))
+  {
+    return false;
+  }
+  auto dir = std::make_shared<HostFsNode>();
+  dir->isDir = true;
+  nodes[dirPath] = dir;
+  return true;
+}
+
+bool fs::FS::rmdir(const char *path)
+{
+  auto found = nodes.find(hostFsNormalize(path));
+  if (found == nodes.end() || !found->second->isDir)
+  {
+    return false;
+  }
+  nodes.erase(found);
+  return true;
+}
+
+void fs::FS::hostFormat()
+{
+  nodes.clear();
+  auto root = std::make_shared<HostFsNode>();
+  root->isDir = true;
+  nodes["/"] = root;
+}
+
+boolean SDClass::begin(uint8_t csPin, uint32_t cfg)
+{
+  (void)csPin;
+  hostRequestedClock = cfg;
+  if (cfg > hostMaxClock)
+  {
+    return false;
+  }
+  if (!SDFS.nodes.count("/"))
+  {
+    SDFS.hostFormat();
+  }
+  started = true;
+  return true;
+}
+
+File SDClass::open(const char *filename, uint8_t mode)
+{
+  // like the device after end(), an unmounted card opens nothing
+  if (!started)
+  {
+    return File();
+  }
+  return SDFS.open(filename, mode == FILE_READ ? "r" : "a+");
+}
@@ -0,0 +1,45 @@
+#include <RTClib.h>
+
+DateTime::DateTime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t min, uint8_t sec)
+{
+  std::tm fields = {};
+  fields.tm_year = year - 1900;
+  fields.tm_mon = month - 1;
+  fields.tm_mday = day;
+  fields.tm_hour = hour;
+  fields.tm_min = min;
+  fields.tm_sec = sec;
+  t = (uint32_t)timegm(&fields);
+}
+
+std::tm DateTime::fields() const
+{
+  time_t seconds = t;
+  std::tm fields;
+  gmtime_r(&seconds, &fields);
+  return fields;
+}
+
+String DateTime::timestamp() const
+{
+  std::tm f = fields();
+  char buf[80];
+  snprintf(buf, sizeof(buf), "%04d-%02d-%02dT%02d:%02d:%02d", f.tm_year + 1900, f.tm_mon + 1, f.tm_mday,
+           f.tm_hour, f.tm_min, f.tm_sec);
+  return String(buf);
+}
+
+DateTime RTC_DS1307::now()
+{
+  hostReads++;
+  long long elapsedMs = (long long)(millis() - baseMillis);
+  elapsedMs += elapsedMs * hostDriftPpm / 1000000;
+  return DateTime(base + (uint32_t)(elapsedMs / 1000));
+}
+
+void RTC_DS1307::adjust(const DateTime &dt)
+{
+  hostAdjusts++;
+  base = dt.unixtime();
+  baseMillis = millis();
+}
@@ -0,0 +1,45 @@
+#include <Ticker.h>
+
+#include <vector>
+
+static std::vector<Ticker *> attachedTickers;
+
+void Ticker::arm(unsigned long long interval, std::function<void()> newCallback)
+{
+  detach();
+  intervalMicros = interval ? interval : 1;
+  callback = newCallback;
+  hostDueMicros = (unsigned long long)micros() + intervalMicros;
+  attachedTickers.push_back(this);
+}
+
+void Ticker::detach()
+{
+  if (!intervalMicros)
+  {
+    return;
+  }
+  intervalMicros = 0;
+  attachedTickers.erase(std::find(attachedTickers.begin(), attachedTickers.end(), this));
+}
+
+void Ticker::hostFire()
+{
+  hostDueMicros += intervalMicros;
+  // the callback may detach or re-arm this ticker, copy it first
+  std::function<void()> fire = callback;
+  fire();
+}
+
+Ticker *hostNextDueTicker(unsigned long long untilMicros)
+{
+  Ticker *next = nullptr;
+  for (Ticker *ticker : attachedTickers)
+  {
+    if (ticker->hostDueMicros <= untilMicros && (!next || ticker->hostDueMicros < next->hostDueMicros))
+    {
+      next = ticker;
+    }
+  }
+  return next;
+}
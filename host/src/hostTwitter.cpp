@@ -0,0 +1,19 @@
+#include <TwitterWebAPI.h>
+
+unsigned long TwitterClient::getEpoch()
+{
+  return hostNtpEpoch ? hostNtpEpoch + millis() / 1000 : millis() / 1000;
+}
+
+bool TwitterClient::tweet(std::string message)
+{
+  hostAdvanceMillis(hostTweetLatencyMs);
+  hostTweets++;
+  hostLastTweet = message;
+  if (hostTweetOutcome && !hostTweetOutcome(message))
+  {
+    hostFailedTweets++;
+    return false;
+  }
+  return true;
+}
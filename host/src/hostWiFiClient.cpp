@@ -0,0 +1,127 @@
+#include <ESP8266WiFi.h>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+ESP8266WiFiClass WiFi;
+
+WiFiClient::~WiFiClient()
+{
+  stop();
+}
+
+int WiFiClient::connect(const char *host, uint16_t port)
+{
+  stop();
+  if (WiFi.status() != WL_CONNECTED)
+  {
+    return 0;
+  }
+  addrinfo hints = {};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *address;
+  char portText[8];
+  snprintf(portText, sizeof(portText), "%u", port);
+  if (getaddrinfo(host, portText, &hints, &address) != 0)
+  {
+    return 0;
+  }
+  fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+  if (fd >= 0 && ::connect(fd, address->ai_addr, address->ai_addrlen) != 0)
+  {
+    ::close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(address);
+  peerClosed = false;
+  bufferStart = bufferEnd = 0;
+  return fd >= 0;
+}
+
+size_t WiFiClient::write(const uint8_t *buf, size_t size)
+{
+  size_t sent = 0;
+  while (fd >= 0 && sent < size)
+  {
+    ssize_t n = send(fd, buf + sent, size - sent, MSG_NOSIGNAL);
+    if (n <= 0)
+    {
+      stop();
+      break;
+    }
+    sent += n;
+  }
+  return sent;
+}
+
+// Waits up to a real millisecond for data, so polling loops that delay(1)
+// between checks still see replies from the stand-in servers promptly
+int WiFiClient::available()
+{
+  if (bufferStart == bufferEnd && fd >= 0 && !peerClosed)
+  {
+    pollfd p = {fd, POLLIN, 0};
+    if (poll(&p, 1, 1) > 0)
+    {
+      ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+      if (n > 0)
+      {
+        bufferStart = 0;
+        bufferEnd = n;
+      }
+      else
+      {
+        peerClosed = true;
+      }
+    }
+  }
+  return bufferEnd - bufferStart;
+}
+
+int WiFiClient::read()
+{
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClient::read(uint8_t *buf, size_t size)
+{
+  size_t n = std::min(size, (size_t)available());
+  memcpy(buf, buffer + bufferStart, n);
+  bufferStart += n;
+  return n;
+}
+
+int WiFiClient::peek()
+{
+  return available() ? buffer[bufferStart] : -1;
+}
+
+void WiFiClient::stop()
+{
+  if (fd >= 0)
+  {
+    ::close(fd);
+    fd = -1;
+  }
+  bufferStart = bufferEnd = 0;
+}
+
+uint8_t WiFiClient::connected()
+{
+  return fd >= 0 && (!peerClosed || bufferStart != bufferEnd);
+}
+
+void WiFiClient::setNoDelay(bool noDelay)
+{
+  int flag = noDelay;
+  if (fd >= 0)
+  {
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+  }
+}
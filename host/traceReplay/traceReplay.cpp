@@ -0,0 +1,609 @@
+// Replays traces recorded by traceRecorder (traceRecorder.h) through the
+// detection, logging and publishing core, faster than real time, and
+// reports per simulated day what the firmware made of them.
+//
+//   trace-replay                 records a built-in session of a few days with the firmware's own recorder,
+//                                replays its trace on a fresh card and checks the replay logs and publishes
+//                                the same events
+//   trace-replay <trace>...      traces pulled from the card's /qop-trace, one boot each, each on a fresh card
+//
+// A0 reads return the block mean or burst the trace holds for their time,
+// each clock resync gets the NTP and RTC time the device read, WiFi follows
+// the recorded status and the publisher returns the recorded outcomes in
+// order. Per simulated day, by the replayed clock in UTC: events logged,
+// publish calls and how many failed, SD bytes written and the host CPU time
+// the day took to replay.
+//
+// Build with: pio run -e trace-replay
+
+#include "archiveCompactor.h"
+#include "clockService.h"
+#include "dayFileIndex.h"
+#include "eventLog.h"
+#include "eventPublishing.h"
+#include "liveEvents.h"
+#include "mainsDetector.h"
+#include "mainsSampler.h"
+#include "outbox.h"
+#include "powerState.h"
+#include "powerStats.h"
+#include "traceRecorder.h"
+
+#include <ESP8266WiFi.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+// Clock reads are applied this far ahead, a resync can come after a delay() within the loop() pass
+#define REPLAY_CLOCK_LOOKAHEAD_MS 200
+// A0 reads see the block that starts within this many ms, the sampler's first read lags its block start
+#define REPLAY_ADC_SLACK_MS 2
+
+#define SESSION_EPOCH 1656633600 // 2022-07-01 00:00:00
+#define SESSION_DAYS 3
+#define SESSION_RTC_BEHIND_S 40
+#define SESSION_NTP_AFTER_MS (10 * 60000UL)
+// the last trace sector goes out with the flush interval, the session idles that long past its last event
+#define SESSION_TAIL_MS (10 * 60000UL)
+
+struct Trace
+{
+  std::string name;
+  TraceFileHeader header;
+  std::vector<TraceRecord> records;
+  size_t invalid = 0;
+};
+
+struct AdcPoint
+{
+  uint32_t at;
+  uint16_t value;
+};
+
+struct DayStats
+{
+  size_t events = 0;
+  size_t publishCalls = 0;
+  size_t failedCalls = 0;
+  unsigned long sdBytes = 0;
+  double cpuSeconds = 0;
+};
+
+// Scripted backend: the recorded outcomes in order while replaying, failing while recording
+class ReplayPublisher : public EventPublisher
+{
+public:
+  const char *name() const override { return "replay"; }
+  bool publish(const EventBatch &batch) override
+  {
+    if (!outcome(false))
+    {
+      return false;
+    }
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+      events.push_back(batch.at(i));
+    }
+    return true;
+  }
+  bool publishReport(PowerStatsPeriod, const PowerStatsBucket &) override { return outcome(true); }
+
+  void reset()
+  {
+    outcomes.clear();
+    events.clear();
+    scripted = false;
+    failing = false;
+    calls = 0;
+    failures = 0;
+    unscripted = 0;
+    misplaced = 0;
+  }
+
+  std::deque<TraceRecord> outcomes;
+  std::vector<EventRecord> events;
+  bool scripted = false;
+  bool failing = false;
+  size_t calls = 0;
+  size_t failures = 0;
+  size_t unscripted = 0; // calls past the recorded outcomes, these succeed
+  size_t misplaced = 0;  // a batch where the trace had a report or the other way round
+
+private:
+  bool outcome(bool report)
+  {
+    calls++;
+    bool ok = !failing;
+    if (scripted && outcomes.empty())
+    {
+      unscripted++;
+      ok = true;
+    }
+    else if (scripted)
+    {
+      ok = outcomes.front().flags & TRACE_PUBLISH_OK;
+      misplaced += ((outcomes.front().flags & TRACE_PUBLISH_REPORT) != 0) != report;
+      outcomes.pop_front();
+    }
+    failures += !ok;
+    return ok;
+  }
+};
+
+static TwitterClient *ntpSource;
+static RTC_DS1307 rtc;
+static ReplayPublisher publisher;
+
+static std::vector<AdcPoint> adcPoints;
+static size_t adcCursor = 0;
+// host millis() less trace millis()
+static long long offsetMs = 0;
+
+static int replayAdc(unsigned long nowMicros)
+{
+  long long at = (long long)(nowMicros / 1000) - offsetMs + REPLAY_ADC_SLACK_MS;
+  while (adcCursor + 1 < adcPoints.size() && adcPoints[adcCursor + 1].at <= at)
+  {
+    adcCursor++;
+  }
+  return adcPoints.empty() || adcPoints[adcCursor].at > at ? 0 : adcPoints[adcCursor].value;
+}
+
+// Fresh card and publish state; the clock starts from whatever NTP and the RTC answer now
+static void resetDevice()
+{
+  endStorage();
+  SDFS.hostFormat();
+  beginStorage();
+  dayFileIndex.build(dataRoot);
+  publishedDayFileIndex.build(SD.open("/qop-published"));
+  archiveCompactor.begin();
+  powerStats.begin();
+
+  currentDateString = "";
+  mainsDetector.begin();
+  unpublishedEventsPending = true;
+  publishCursorFile = "";
+  publishCursorOffset = 0;
+  publishCursorLoaded = false;
+  publishCursorDirty = false;
+  outgoingBatch.clear();
+  heldBatchDeadline = 0;
+  publisher.reset();
+  // the outbox draws its backoff jitter from random(), a replay draws the same
+  randomSeed(1);
+
+  clockService.begin(*ntpSource, rtc);
+  getTimeFromMultipleSources();
+}
+
+// loop() of the firmware without the network stack and the web server
+static void loopPass(unsigned long &nextTick)
+{
+  powerState.loop();
+  if (!powerState.running())
+  {
+    updatePowerStatusIfChanged();
+    return;
+  }
+  updatePowerStatusIfChanged();
+  if (outbox.depth() > 0)
+  {
+    publishOutbox();
+  }
+  if (millis() >= nextTick)
+  {
+    nextTick += 1000;
+    openDayFileFor(getTimeFromMultipleSources());
+    publishUnpublishedEvents(dataRoot);
+    publishDueReports(getTimeFromMultipleSources());
+    if (!unpublishedEventsPending && outbox.depth() == 0)
+    {
+      archiveCompactor.step(getTimeFromMultipleSources());
+    }
+  }
+  loopStorage();
+}
+
+// Per day of the replayed clock, closed whenever the day changes
+class DayMeter
+{
+public:
+  void start() { mark(); }
+  void pass()
+  {
+    uint32_t day = clockService.epochAt(millis()) / 86400;
+    if (day != current)
+    {
+      close();
+      current = day;
+    }
+  }
+  void close()
+  {
+    DayStats &stats = days[current];
+    stats.events += liveEvents.published() - events;
+    stats.publishCalls += publisher.calls - calls;
+    stats.failedCalls += publisher.failures - failures;
+    stats.sdBytes += hostFsStats.bytesWritten - sdBytes;
+    stats.cpuSeconds += (double)(std::clock() - cpu) / CLOCKS_PER_SEC;
+    mark();
+  }
+
+  std::map<uint32_t, DayStats> days;
+
+private:
+  void mark()
+  {
+    current = clockService.epochAt(millis()) / 86400;
+    events = liveEvents.published();
+    calls = publisher.calls;
+    failures = publisher.failures;
+    sdBytes = hostFsStats.bytesWritten;
+    cpu = std::clock();
+  }
+
+  uint32_t current = 0;
+  uint32_t events = 0;
+  size_t calls = 0;
+  size_t failures = 0;
+  unsigned long sdBytes = 0;
+  std::clock_t cpu = 0;
+};
+
+static bool parseTrace(const std::string &name, const std::vector<uint8_t> &data, Trace &trace)
+{
+  trace.name = name;
+  if (data.size() < sizeof(TraceFileHeader))
+  {
+    return false;
+  }
+  memcpy(&trace.header, data.data(), sizeof(TraceFileHeader));
+  if (!isTraceFileHeaderValid(trace.header))
+  {
+    return false;
+  }
+  // a record torn by a power loss at the end is left out
+  for (size_t offset = sizeof(TraceFileHeader); offset + sizeof(TraceRecord) <= data.size();
+       offset += sizeof(TraceRecord))
+  {
+    TraceRecord record;
+    memcpy(&record, data.data() + offset, sizeof(record));
+    if (!isTraceRecordValid(record))
+    {
+      trace.invalid++;
+      continue;
+    }
+    trace.records.push_back(record);
+  }
+  return true;
+}
+
+static bool loadTrace(const char *path, Trace &trace)
+{
+  FILE *file = fopen(path, "rb");
+  if (!file)
+  {
+    return false;
+  }
+  std::vector<uint8_t> data;
+  uint8_t chunk[4096];
+  size_t length;
+  while ((length = fread(chunk, 1, sizeof(chunk), file)) > 0)
+  {
+    data.insert(data.end(), chunk, chunk + length);
+  }
+  fclose(file);
+  const char *slash = strrchr(path, '/');
+  return parseTrace(slash ? slash + 1 : path, data, trace);
+}
+
+static void applyClock(const TraceRecord &record)
+{
+  long long hostAt = record.at + offsetMs;
+  if (record.flags & TRACE_CLOCK_NTP_ASKED)
+  {
+    // getEpoch() answers data[0] at hostAt, and follows the virtual clock from there
+    ntpSource->hostNtpEpoch = record.data[0] >= NTP_VALID_EPOCH ? record.data[0] - (unsigned long)(hostAt / 1000) : 0;
+  }
+  long long ahead = hostAt - (long long)millis();
+  rtc.adjust(DateTime(record.data[1] - (uint32_t)(ahead > 0 ? ahead / 1000 : 0)));
+}
+
+static std::string dayName(uint32_t day)
+{
+  time_t epoch = (time_t)day * 86400;
+  char name[16];
+  strftime(name, sizeof(name), "%Y-%m-%d", gmtime(&epoch));
+  return name;
+}
+
+// Runs one trace through the core from a fresh card, true when every recorded outcome was used in order
+static bool replay(const Trace &trace, DayMeter &meter)
+{
+  adcPoints.clear();
+  adcCursor = 0;
+  std::vector<TraceRecord> inputs;
+  std::deque<TraceRecord> outcomes;
+  size_t counts[TRACE_KIND_LAST + 1] = {};
+  size_t blocks = 0;
+  uint32_t lost = 0;
+  uint32_t lastAt = trace.header.startedAtMs;
+  for (const TraceRecord &record : trace.records)
+  {
+    counts[record.kind]++;
+    lastAt = std::max(lastAt, record.at);
+    switch (record.kind)
+    {
+    case TRACE_SAMPLES:
+      for (uint8_t i = 0; i < record.flags; i++)
+      {
+        adcPoints.push_back({record.at + i * trace.header.blockMs, traceSampleAt(record, i)});
+      }
+      blocks += record.flags;
+      lastAt = std::max(lastAt, record.at + (record.flags - 1) * trace.header.blockMs);
+      break;
+    case TRACE_BURST:
+      adcPoints.push_back({record.at, record.value});
+      break;
+    case TRACE_CLOCK:
+    case TRACE_WIFI:
+      inputs.push_back(record);
+      break;
+    case TRACE_PUBLISH:
+      outcomes.push_back(record);
+      break;
+    case TRACE_GAP:
+      // the A0 level holds through it, the replay keeps the last point
+      lost += record.data[0];
+      break;
+    }
+  }
+  // samples records are written once full, after what was noted while they filled
+  std::stable_sort(adcPoints.begin(), adcPoints.end(),
+                   [](const AdcPoint &a, const AdcPoint &b) { return a.at < b.at; });
+  std::stable_sort(inputs.begin(), inputs.end(),
+                   [](const TraceRecord &a, const TraceRecord &b) { return a.at < b.at; });
+
+  time_t started = trace.header.epoch;
+  char startedAt[24];
+  strftime(startedAt, sizeof(startedAt), "%Y-%m-%d %H:%M:%S", gmtime(&started));
+  printf("trace %s: %.1f h from %s%s, %zu records (%zu unreadable, %lu lost)\n", trace.name.c_str(),
+         (lastAt - trace.header.startedAtMs) / 3600000.0, startedAt,
+         trace.header.flags & TRACE_HEADER_NTP_SYNCED ? " NTP" : " RTC", trace.records.size(), trace.invalid,
+         (unsigned long)lost);
+  printf("  inputs          %zu block means, %zu bursts, %zu clock reads, %zu WiFi changes, %zu publish outcomes\n",
+         blocks, counts[TRACE_BURST], counts[TRACE_CLOCK], counts[TRACE_WIFI], counts[TRACE_PUBLISH]);
+
+  // the device's clock as the trace started, NTP only once a resync reads it
+  offsetMs = (long long)millis() - trace.header.startedAtMs;
+  rtc.adjust(DateTime(trace.header.epoch));
+  ntpSource->hostNtpEpoch =
+      trace.header.flags & TRACE_HEADER_NTP_SYNCED ? trace.header.epoch - millis() / 1000 : 0;
+  WiFi.hostStatus = WL_DISCONNECTED;
+  resetDevice();
+  publisher.outcomes = outcomes;
+  publisher.scripted = true;
+  hostSetAdcSource(replayAdc);
+  mainsSampler.begin(MAINS_ANALOG_SENSE_PIN);
+
+  size_t input = 0;
+  unsigned long nextTick = millis();
+  unsigned long long end = lastAt + offsetMs + 1000;
+  std::clock_t cpuStart = std::clock();
+  meter.start();
+  while (millis() < end)
+  {
+    for (; input < inputs.size() && inputs[input].at + offsetMs <= (long long)millis() + REPLAY_CLOCK_LOOKAHEAD_MS;
+         input++)
+    {
+      const TraceRecord &record = inputs[input];
+      if (record.kind == TRACE_WIFI && record.at + offsetMs > (long long)millis())
+      {
+        break;
+      }
+      if (record.kind == TRACE_CLOCK)
+      {
+        applyClock(record);
+      }
+      else
+      {
+        WiFi.hostStatus = (wl_status_t)record.value;
+      }
+    }
+    loopPass(nextTick);
+    meter.pass();
+    delay(10);
+  }
+  meter.close();
+  double cpu = (double)(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+  mainsSampler.end();
+  hostSetAdcSource(nullptr);
+
+  printf("  %-12s %8s %14s %7s %10s %8s\n", "day", "events", "publish calls", "failed", "SD bytes", "CPU ms");
+  for (const auto &entry : meter.days)
+  {
+    const DayStats &day = entry.second;
+    printf("  %-12s %8zu %14zu %7zu %10lu %8.1f\n", dayName(entry.first).c_str(), day.events, day.publishCalls,
+           day.failedCalls, day.sdBytes, day.cpuSeconds * 1000);
+  }
+  double days = (lastAt - trace.header.startedAtMs) / 86400000.0;
+  printf("  replay          %.2f s CPU for %.2f simulated days, %.0fx real time; %zu events published, %zu "
+         "outcomes left over, %zu calls past the trace, %zu out of place\n",
+         cpu, days, cpu > 0 ? days * 86400 / cpu : 0, publisher.events.size(), publisher.outcomes.size(),
+         publisher.unscripted, publisher.misplaced);
+  return publisher.outcomes.empty() && publisher.unscripted == 0 && publisher.misplaced == 0;
+}
+
+// Outages as {second of the day, seconds off}: blips the holdup rides out, outages into light sleep, one of 25 min
+static const uint32_t sessionOutages[][2] = {{300, 20},       {3 * 3600, 4},      {6 * 3600 + 17, 45},
+                                             {9 * 3600 + 333, 600}, {13 * 3600 + 5, 2}, {17 * 3600 + 999, 1500},
+                                             {21 * 3600 + 71, 15}};
+#define SESSION_BROWNOUT_AT (11 * 3600)
+#define SESSION_BROWNOUT_S 90
+
+static unsigned long long sessionStartMicros;
+
+static int sessionAdc(unsigned long nowMicros)
+{
+  unsigned long long elapsedMs = (nowMicros - sessionStartMicros) / 1000;
+  uint32_t inDay = elapsedMs / 1000 % 86400;
+  int noise = (int)(elapsedMs % 7);
+  for (const auto &outage : sessionOutages)
+  {
+    if (inDay >= outage[0] && inDay < outage[0] + outage[1])
+    {
+      return 12 + noise;
+    }
+  }
+  if (inDay >= SESSION_BROWNOUT_AT && inDay < SESSION_BROWNOUT_AT + SESSION_BROWNOUT_S)
+  {
+    return 700 + noise;
+  }
+  return 900 + noise;
+}
+
+// A few days with the recorder on: NTP late after boot with the RTC behind, WiFi and the backend down for a while
+static bool recordSession(Trace &trace, std::vector<EventRecord> &published, size_t &logged, size_t &calls)
+{
+  rtc.adjust(DateTime(SESSION_EPOCH - SESSION_RTC_BEHIND_S));
+  ntpSource->hostNtpEpoch = 0;
+  WiFi.hostStatus = WL_CONNECTED;
+  resetDevice();
+  uint32_t loggedBefore = liveEvents.published();
+  sessionStartMicros = micros();
+  unsigned long start = millis();
+  hostSetAdcSource(sessionAdc);
+  traceRecorder.setEnabled(true);
+  mainsSampler.begin(MAINS_ANALOG_SENSE_PIN);
+
+  unsigned long nextTick = millis();
+  unsigned long end = start + SESSION_DAYS * 86400000UL + SESSION_TAIL_MS;
+  while (millis() < end)
+  {
+    unsigned long elapsed = millis() - start;
+    uint32_t day = elapsed / 86400000UL;
+    uint32_t inDay = elapsed / 1000 % 86400;
+    if (ntpSource->hostNtpEpoch == 0 && elapsed >= SESSION_NTP_AFTER_MS)
+    {
+      ntpSource->hostNtpEpoch = SESSION_EPOCH - start / 1000;
+    }
+    // each over an outage, its events wait for the network
+    WiFi.hostStatus = day == 1 && inDay >= 6 * 3600 && inDay < 6 * 3600 + 1800 ? WL_DISCONNECTED : WL_CONNECTED;
+    publisher.failing = day == 2 && inDay >= 9 * 3600 && inDay < 9 * 3600 + 2700;
+    loopPass(nextTick);
+    delay(10);
+  }
+  mainsSampler.end();
+  traceRecorder.setEnabled(false);
+  hostSetAdcSource(nullptr);
+  published = publisher.events;
+  logged = liveEvents.published() - loggedBefore;
+  calls = publisher.calls;
+
+  File root = SD.open(TRACE_ROOT);
+  File file = root.openNextFile();
+  if (!file)
+  {
+    return false;
+  }
+  std::string name = file.name();
+  return parseTrace(name, SDFS.nodes[hostFsNormalize(file.fullName())]->data, trace);
+}
+
+static bool sameEvents(const std::vector<EventRecord> &a, const std::vector<EventRecord> &b)
+{
+  if (a.size() != b.size())
+  {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); i++)
+  {
+    if (a[i].type != b[i].type || a[i].epoch != b[i].epoch || a[i].flags != b[i].flags)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  // day file names are formatted in local time, the report's days are UTC
+  setenv("TZ", "UTC", 1);
+  tzset();
+
+  static WiFiUDP ntpUdp;
+  NTPClient ntpClient(ntpUdp, "replay");
+  ntpSource = new TwitterClient(ntpClient, "", "", "", "");
+  eventPublisher = &publisher;
+
+  if (argc > 1)
+  {
+    int failed = 0;
+    for (int i = 1; i < argc; i++)
+    {
+      Trace trace;
+      if (!loadTrace(argv[i], trace))
+      {
+        fprintf(stderr, "%s: not a trace file\n", argv[i]);
+        failed++;
+        continue;
+      }
+      DayMeter meter;
+      replay(trace, meter);
+    }
+    return failed ? 1 : 0;
+  }
+
+  Trace trace;
+  std::vector<EventRecord> recorded;
+  size_t logged = 0;
+  size_t calls = 0;
+  std::clock_t cpuStart = std::clock();
+  bool traced = recordSession(trace, recorded, logged, calls);
+  double cpu = (double)(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+  printf("session %d days recorded in %.2f s CPU: %zu events logged, %zu published in %zu publish calls, trace %lu "
+         "bytes, %lu records lost\n",
+         SESSION_DAYS, cpu, logged, recorded.size(), calls, (unsigned long)traceRecorder.bytesWritten(),
+         (unsigned long)traceRecorder.lostRecords());
+  if (!traced)
+  {
+    printf("  MISMATCH        no trace written\n");
+    return 1;
+  }
+  DayMeter meter;
+  bool allUsed = replay(trace, meter);
+  size_t replayed = 0;
+  for (const auto &entry : meter.days)
+  {
+    replayed += entry.second.events;
+  }
+  // the boot's PRES, then a POFF and a PRES for every outage of the session and a BRWN for every brownout,
+  // its NORM is not published
+  size_t expected = 1;
+  for (uint32_t day = 0; day * 86400000ULL < SESSION_DAYS * 86400000ULL + SESSION_TAIL_MS; day++)
+  {
+    expected += (day * 86400ULL + SESSION_BROWNOUT_AT) * 1000 < SESSION_DAYS * 86400000ULL + SESSION_TAIL_MS;
+    for (const auto &outage : sessionOutages)
+    {
+      expected += 2 * ((day * 86400ULL + outage[0] + outage[1]) * 1000 < SESSION_DAYS * 86400000ULL + SESSION_TAIL_MS);
+    }
+  }
+  if (!allUsed || !sameEvents(recorded, publisher.events) || replayed != logged || publisher.calls != calls ||
+      recorded.size() != expected)
+  {
+    printf("  MISMATCH        replay logged %zu of %zu events, published %zu of %zu (%zu expected) in %zu of %zu "
+           "calls\n",
+           replayed, logged, publisher.events.size(), recorded.size(), expected, publisher.calls, calls);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,85 @@
+// Published day files packed into monthly archives in idle time.
+//
+// /qop-published gains a day file every day and never loses one, so over
+// the years its directory grows to thousands of entries that every walk at
+// boot and every open has to search through. Once a month is over, its
+// published day files are packed one at a time into /qop-archive/YYYYMM
+// (eventArchive.h): step() packs the oldest day file left, from loop() when
+// nothing else is pending, and only removes the day file once its block and
+// the archive's updated header are on the card. A power loss in between
+// leaves the day file in place; the next step() finds the day in the header
+// or packs it again over the block the header does not know of.
+//
+// archivedDayIndex lists the archived days next to the day file indexes,
+// and ArchiveDayReader hands out a day's events one at a time, so the
+// history API reads archived days like day files.
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+
+#include "dayFileIndex.h"
+#include "eventArchive.h"
+
+#define ARCHIVE_ROOT "/qop-archive"
+// Encoded events gathered before they are written to the archive
+#define ARCHIVE_WRITE_BUFFER 128
+// Encoded events read ahead by an ArchiveDayReader
+#define ARCHIVE_READ_BUFFER 64
+
+class ArchiveCompactor
+{
+public:
+  // Indexes the days already archived, at boot once the card is mounted
+  void begin();
+  // Packs the oldest published day file of a month before the one now falls in. False when there was
+  // nothing to pack or packing failed.
+  bool step(time_t now);
+
+  uint32_t packedDays() const { return days; }
+  // Day file bytes packed and archive bytes they took, since boot
+  uint32_t bytesIn() const { return inBytes; }
+  uint32_t bytesOut() const { return outBytes; }
+
+private:
+  bool pack(File &archive, ArchiveHeader &header, uint32_t key, const char *dayPath);
+
+  bool stalled = false; // an archive full or unreadable, nothing more is packed until the next boot
+  uint32_t days = 0;
+  uint32_t inBytes = 0;
+  uint32_t outBytes = 0;
+};
+
+class ArchiveDayReader
+{
+public:
+  ~ArchiveDayReader() { close(); }
+
+  // Positions the reader at the first event of the archived day. False when no archive holds it.
+  bool open(uint32_t key);
+  // The next event of the day, false after the last one
+  bool next(EventRecord &event);
+  void close();
+  bool isOpen() const { return (bool)file; }
+  // Events of the open day, from the archive header
+  uint16_t events() const { return dayEvents; }
+
+private:
+  File file;
+  ArchiveCodec codec;
+  uint8_t buffer[ARCHIVE_READ_BUFFER];
+  size_t used = 0;
+  size_t position = 0;
+  uint32_t remaining = 0; // encoded bytes of the day not yet read into buffer
+  uint32_t crc = 0;
+  uint16_t dayEvents = 0;
+};
+
+// Full path of the archive of month YYYYMM, "/qop-archive/202207"
+void archivePath(uint32_t month, char *buf, size_t length);
+// Whether an archive on the card holds the day; read from the archive itself, so it also works before begin()
+bool isDayArchived(uint32_t key);
+
+extern ArchiveCompactor archiveCompactor;
+// Days packed into the archives under /qop-archive
+extern DayFileIndex archivedDayIndex;
@@ -0,0 +1,50 @@
+// Boot phase timings.
+//
+// setup() only brings up what sensing needs: the clock anchored on the RTC,
+// the SD card with the journal replayed and the day file indexes, then the
+// mains detector and sampler, so transitions while power flaps at boot are
+// logged from a few hundred ms after reset. The web server, WiFi and NTP
+// follow from loop() (continueBoot() in main.cpp), the SD tree dump last.
+// The station is started with the stored credentials and static IP settings
+// and polled from loop(); only when it has not connected after
+// BOOT_WIFI_WAIT_MS is the WiFi manager started for its captive portal, so
+// no boot step waits on a connect.
+// Events logged before NTP synced carry the RTC's time and no sync flag.
+//
+// bootTimer keeps the millis() each phase completed at, for the log and
+// /api/status.
+#pragma once
+
+#include <Arduino.h>
+
+enum BootPhase : uint8_t
+{
+  BOOT_CLOCK = 0,   // clock anchored on the RTC
+  BOOT_STORAGE = 1, // card mounted, journal replayed, indexes built
+  BOOT_SENSING = 2, // detector and sampler running, events are logged
+  BOOT_NETWORK = 3, // web server, WiFi station and NTP client started
+  BOOT_WIFI = 4,    // station connected
+  BOOT_NTP = 5,     // first NTP sync
+  BOOT_PHASES = 6,
+};
+
+// Station connect time allowed before the captive portal is started
+#define BOOT_WIFI_WAIT_MS 30000UL
+
+class BootTimer
+{
+public:
+  // Records the phase as completed now; later calls for the same phase are ignored
+  void mark(BootPhase phase);
+  bool reached(BootPhase phase) const { return reachedMask & (1 << phase); }
+  // millis() the phase completed at, 0 before it did
+  uint32_t at(BootPhase phase) const { return completedAt[phase]; }
+
+private:
+  uint32_t completedAt[BOOT_PHASES] = {};
+  uint8_t reachedMask = 0;
+};
+
+const char *bootPhaseName(BootPhase phase);
+
+extern BootTimer bootTimer;
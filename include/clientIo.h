@@ -0,0 +1,11 @@
+// Blocking reads with a deadline on a network Client, shared by the HTTP and MQTT sinks
+#pragma once
+
+#include <Arduino.h>
+#include <Client.h>
+
+// Reads exactly length bytes; false on timeout or disconnect
+bool readExact(Client &client, uint8_t *buf, size_t length, uint32_t timeoutMs);
+// Reads one "\r\n" or "\n" terminated line without its terminator, truncated to length - 1.
+// Returns the line length, or -1 on timeout or disconnect.
+int readLine(Client &client, char *buf, size_t length, uint32_t timeoutMs);
@@ -0,0 +1,58 @@
+// Wall clock anchored to millis().
+//
+// now() is O(1) and touches no bus: it extrapolates from the last anchor taken
+// from NTP (or the DS1307 while NTP is unavailable). Anchors are refreshed every
+// resync interval; when a resync measures drift the interval is halved until
+// the clock holds again, and the RTC is only adjusted when it has actually
+// drifted away from NTP.
+//
+// At boot the clock starts on the RTC alone; NTP is attached once the
+// network is started. Until the first NTP sync it is resynced every
+// CLOCK_MIN_RESYNC_INTERVAL_MS, and asks NTP only while WiFi is connected:
+// an unanswered NTP request holds loop() for a second.
+#pragma once
+
+#include <Arduino.h>
+#include <TwitterWebAPI.h>
+#include "RTClib.h"
+
+#define CLOCK_RESYNC_INTERVAL_MS (15 * 60 * 1000UL)
+#define CLOCK_MIN_RESYNC_INTERVAL_MS (60 * 1000UL)
+// Drift beyond this many seconds between resyncs shortens the interval
+#define CLOCK_MAX_DRIFT_S 2
+// RTC is re-set from NTP once it is off by more than this many seconds
+#define CLOCK_RTC_MAX_DRIFT_S 2
+// Epochs before May 2022 mean the NTP client has not synced yet
+#define NTP_VALID_EPOCH 1651363200
+
+class ClockService
+{
+public:
+  void begin(TwitterClient &ntpSource, RTC_DS1307 &rtc, uint32_t resyncIntervalMs = CLOCK_RESYNC_INTERVAL_MS);
+  // RTC only, until attachNtp()
+  void begin(RTC_DS1307 &rtc, uint32_t resyncIntervalMs = CLOCK_RESYNC_INTERVAL_MS);
+  void attachNtp(TwitterClient &ntpSource);
+  time_t now();
+  // Wall clock time of an earlier (or later) millis() reading
+  time_t epochAt(uint32_t millisValue);
+  void resync();
+  bool isNtpSynced() const { return ntpSynced; }
+  int32_t lastDrift() const { return measuredDrift; }
+  uint32_t resyncs() const { return resyncCount; }
+
+private:
+  TwitterClient *ntpSource = nullptr;
+  RTC_DS1307 *rtc = nullptr;
+  uint32_t resyncIntervalMs = CLOCK_RESYNC_INTERVAL_MS;
+  uint32_t currentIntervalMs = CLOCK_RESYNC_INTERVAL_MS;
+  time_t anchorEpoch = 0;
+  uint32_t anchorMillis = 0;
+  bool anchored = false;
+  bool ntpSynced = false;
+  int32_t measuredDrift = 0;
+  uint32_t resyncCount = 0;
+};
+
+boolean requireRtcTimeAdjustment(time_t ntpEpoch, time_t rtcEpoch);
+
+extern ClockService clockService;
@@ -0,0 +1,56 @@
+// Sorted index of the day files under /qop.
+//
+// Day files are named YYYYMMDD, so the index keeps each one as that number:
+// four bytes a file instead of a path string, ordered like the names. It is
+// built with one directory walk at boot and then kept current as day files
+// are created and moved to /qop-published, so publishing never lists the
+// directory again. Lookups are binary searches. A second index covers
+// /qop-published for the history API.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <vector>
+
+#include <FS.h>
+
+#define DAY_FILE_ROOT_LENGTH 16
+
+class DayFileIndex
+{
+public:
+  explicit DayFileIndex(const char *rootPath = "/qop");
+
+  // Rebuilds the index from the day files in rootDir
+  void build(File rootDir);
+  bool built() const { return isBuilt; }
+
+  void add(uint32_t key);
+  void remove(uint32_t key);
+  bool contains(uint32_t key) const;
+  // Position of the first day file at or after key
+  size_t lowerBound(uint32_t key) const;
+
+  size_t size() const { return keys.size(); }
+  bool empty() const { return keys.empty(); }
+  uint32_t key(size_t position) const { return keys[position]; }
+  uint32_t newest() const { return keys.empty() ? 0 : keys.back(); }
+  // Full path of the day file with the given key, "/qop/20220701"
+  void path(uint32_t key, char *buf, size_t length) const;
+
+private:
+  std::vector<uint32_t> keys;
+  char root[DAY_FILE_ROOT_LENGTH];
+  bool isBuilt = false;
+};
+
+// YYYYMMDD key of a day file name or path, 0 when the name is not a day file
+uint32_t dayFileKey(const char *name);
+// Key of the day file an event at epoch is logged to, by local date like getFilenameFromEpoch()
+uint32_t dayFileKeyForEpoch(time_t epoch);
+
+// Day files under /qop, still to be published
+extern DayFileIndex dayFileIndex;
+// Day files moved to /qop-published, for the history API
+extern DayFileIndex publishedDayFileIndex;
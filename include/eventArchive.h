@@ -0,0 +1,72 @@
+// Monthly archive format for published day files, shared by the firmware and the host tools.
+//
+// An archive holds the published day files of one month, YYYYMM, in a
+// single file: one ArchiveHeader with room for ARCHIVE_MAX_DAYS ArchiveDay
+// entries, exactly one sector, then the days' event blocks in the order they
+// were packed. An entry gives its day's key, where its block starts and how
+// many events it holds, so a reader seeks straight to a day.
+//
+// A block is the day's events, each encoded against the one before it,
+// followed by the CRC-32 of the encoded bytes:
+//
+//   type | flags << 4            1 byte
+//   epoch delta, zigzag          varint
+//   uptimeMs delta, zigzag       varint
+//   adcSample                    varint
+//
+// Events of a day are seconds to hours apart, so an event takes 5 to 10
+// bytes instead of the 16 of an EventRecord or the ~30 of a CSV line. The
+// record CRC is not stored, decoding seals each record again.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "eventRecord.h"
+
+#define ARCHIVE_MAGIC 0x41504F51 // "QOPA"
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_MAX_DAYS 31
+// Longest encoding of one event: the type byte, two 5 byte varints and a 3 byte one
+#define ARCHIVE_EVENT_MAX_BYTES 14
+
+struct ArchiveDay
+{
+  uint32_t key;    // YYYYMMDD of the day file
+  uint32_t offset; // of the day's block from the start of the archive
+  uint32_t length; // encoded events, the block's CRC follows them
+  uint16_t events;
+  uint16_t reserved;
+};
+
+struct ArchiveHeader
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t dayCount;
+  uint32_t month; // YYYYMM
+  uint32_t crc;   // CRC-32 of the header before it and of all ARCHIVE_MAX_DAYS entries
+  ArchiveDay days[ARCHIVE_MAX_DAYS];
+};
+
+static_assert(sizeof(ArchiveDay) == 16, "archive day entries must stay 16 bytes");
+static_assert(sizeof(ArchiveHeader) == 512, "the archive header and its day entries fill one sector");
+
+// Previous event of a block; encoding and decoding start from a zeroed one
+struct ArchiveCodec
+{
+  uint32_t epoch = 0;
+  uint32_t uptimeMs = 0;
+};
+
+void initArchiveHeader(ArchiveHeader &header, uint32_t month);
+void sealArchiveHeader(ArchiveHeader &header);
+bool isArchiveHeaderValid(const ArchiveHeader &header);
+// Entry of the day with the given key, NULL when the archive does not hold it
+const ArchiveDay *findArchiveDay(const ArchiveHeader &header, uint32_t key);
+
+// Encodes event into out, which has room for ARCHIVE_EVENT_MAX_BYTES. Returns the bytes used.
+size_t encodeArchiveEvent(const EventRecord &event, ArchiveCodec &codec, uint8_t *out);
+// Decodes the event at the start of data into a sealed record. Returns the bytes used, 0 when data ends
+// inside the event or does not start with one.
+size_t decodeArchiveEvent(const uint8_t *data, size_t length, ArchiveCodec &codec, EventRecord &event);
@@ -0,0 +1,60 @@
+// A run of logged events published together.
+//
+// Events are collected in log order; each POFF followed by a PRES counts as an
+// outage, a PRES without one as a restart, and BRWN and SURG events count as
+// brownouts and surges. The batch keeps running totals, so publishing a
+// summary ("3 outages, total 47 min, longest 22 min") never has to walk the
+// events again.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "eventRecord.h"
+
+#define EVENT_BATCH_CAPACITY 32
+// Events per batch, a backlog is drained in posts of at most this many events
+#define PUBLISH_MAX_BATCH_SIZE 16
+// Seconds a batch waits for more events before it is published anyway
+#define PUBLISH_MAX_BATCH_LATENCY_S 60
+
+class EventBatch
+{
+public:
+  void clear();
+  // Returns false once the batch is at EVENT_BATCH_CAPACITY
+  bool add(const EventRecord &event);
+
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  const EventRecord &at(size_t index) const { return events[index]; }
+
+  uint16_t outages() const { return outageCount; }
+  uint16_t powerOns() const { return powerOnCount; }
+  uint16_t brownouts() const { return brownoutCount; }
+  uint16_t surges() const { return surgeCount; }
+  uint32_t totalDowntime() const { return downtime; }
+  uint32_t longestOutage() const { return longest; }
+  uint32_t firstEpoch() const { return count ? events[0].epoch : 0; }
+  uint32_t lastEpoch() const { return count ? events[count - 1].epoch : 0; }
+
+  // One line summary for text sinks, truncated to length. Returns the formatted length.
+  int formatSummary(char *buf, size_t length) const;
+
+private:
+  EventRecord events[EVENT_BATCH_CAPACITY];
+  size_t count = 0;
+  uint16_t outageCount = 0;
+  uint16_t powerOnCount = 0;
+  uint16_t brownoutCount = 0;
+  uint16_t surgeCount = 0;
+  uint32_t downtime = 0;
+  uint32_t longest = 0;
+  uint32_t powerOffEpoch = 0;
+  bool powerOffOpen = false;
+};
+
+// "Sat Jun 25 10:05:00 2022", asctime() without its padding and newline
+int formatEventTime(char *buf, size_t length, uint32_t epoch);
+// "47 min" or "35 s"
+int formatDuration(char *buf, size_t length, uint32_t seconds);
@@ -0,0 +1,67 @@
+// Logged events streamed back as JSON, for the HTTP API.
+//
+// An EventHistoryStream walks the day files of /qop and /qop-published and
+// the days packed into /qop-archive (archiveCompactor.h) in date order and hands out one JSON array a chunk at a time: fill() writes
+// as much as fits the buffer it is given and keeps a single file open
+// between calls, so a download of months of events needs no more RAM than
+// one chunk and one event. Only the day files of the requested range are
+// opened, found through the day file indexes, and within a day file the
+// first event of the range is found by bisection instead of a scan. It reads
+// and flushes the card, so begin*() and fill() are only called from loop().
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <FS.h>
+
+#include "archiveCompactor.h"
+#include "eventRecord.h"
+
+// Largest "last" an API client can ask for
+#define EVENT_HISTORY_MAX_LAST 1000
+// Room for one event object and its separator
+#define EVENT_HISTORY_JSON_LENGTH 80
+
+class EventHistoryStream
+{
+public:
+  ~EventHistoryStream() { end(); }
+
+  // Events with from <= epoch <= to
+  void beginRange(uint32_t from, uint32_t to);
+  // The newest count events
+  void beginLast(size_t count);
+  void end();
+
+  // Writes the next part of the JSON array to buf. Returns the bytes written, 0 once the array is complete.
+  size_t fill(uint8_t *buf, size_t length);
+  size_t events() const { return streamed; }
+
+private:
+  bool nextEvent(EventRecord &event);
+  bool openDayFile(uint32_t key);
+  size_t formatNext(char *buf, size_t length);
+
+  uint32_t from = 0;
+  uint32_t to = 0;
+  uint32_t lastKey = 0; // day files after this one hold no events of the range
+  size_t skip = 0;      // events to pass over before the first one streamed
+  uint32_t fileKey = 0; // key of the open day file, 0 before the first
+  File file;
+  bool binaryFile = false;
+  ArchiveDayReader archived; // instead of file when the day is archived
+  uint8_t state = 0;
+  size_t streamed = 0;
+  char pending[EVENT_HISTORY_JSON_LENGTH];
+  size_t pendingLength = 0;
+  size_t pendingSent = 0;
+};
+
+// Next and previous day in /qop, /qop-published and the archives together, 0 when there is none
+uint32_t nextDayFileKey(uint32_t after);
+uint32_t previousDayFileKey(uint32_t before);
+// Opens the day file with the given key from whichever directory holds it; archived days have none
+File openDayFileByKey(uint32_t key);
+// Positions a day file, just past its header, at its first event dated from or later
+void seekEventFrom(File &dayFile, bool binaryFile, uint32_t from);
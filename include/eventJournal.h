@@ -0,0 +1,104 @@
+// Write-ahead journal for events and publish cursor updates.
+//
+// qop.journal is created once at its full size and never grows, so a commit
+// never allocates clusters or touches the FAT. It is a run of 512-byte
+// sectors, each holding one checksummed record, and every commit is one
+// sector-aligned write and one flush:
+//
+//   sectors 0..1   publish cursor, written alternately so the previous cursor
+//                  survives a torn write
+//   sectors 2..    ring of logged events with the day file, offset and bytes
+//                  they were appended with, or rewritten with later
+//
+// Events are committed to the journal first and appended to their day file
+// through dayFileWriter (sdStorage.h), which buffers them for a bounded
+// window; the day file is flushed before it is read and when it is closed.
+// On boot the highest valid sequence number wins, and recover() re-appends
+// journalled events a crash kept out of their day file and rewrites a crash
+// kept from their place in it.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include <FS.h>
+
+#define EVENT_JOURNAL_PATH "/qop.journal"
+#define EVENT_JOURNAL_MAGIC 0x4A504F51 // "QOPJ"
+#define EVENT_JOURNAL_SECTOR_SIZE 512
+#define EVENT_JOURNAL_CURSOR_SECTORS 2
+#define EVENT_JOURNAL_EVENT_SECTORS 30
+#define EVENT_JOURNAL_SECTORS (EVENT_JOURNAL_CURSOR_SECTORS + EVENT_JOURNAL_EVENT_SECTORS)
+#define EVENT_JOURNAL_PATH_LENGTH 48
+#define EVENT_JOURNAL_DATA_LENGTH 444
+
+enum EventJournalKind : uint8_t
+{
+  EVENT_JOURNAL_EMPTY = 0,
+  EVENT_JOURNAL_CURSOR = 1,
+  EVENT_JOURNAL_EVENT = 2,
+  EVENT_JOURNAL_REWRITE = 3, // bytes written over an event already in the day file
+};
+
+struct EventJournalSector
+{
+  uint32_t magic;
+  uint32_t sequence; // increases with every commit, across both kinds
+  uint8_t kind;      // EventJournalKind
+  uint8_t reserved;
+  uint16_t length;                      // bytes used in data
+  uint32_t offset;                      // cursor: publish offset, event: day file offset of data
+  char path[EVENT_JOURNAL_PATH_LENGTH]; // cursor: publish cursor file, event: day file
+  uint8_t data[EVENT_JOURNAL_DATA_LENGTH];
+  uint32_t crc; // CRC-32 of all the fields above
+};
+
+static_assert(sizeof(EventJournalSector) == EVENT_JOURNAL_SECTOR_SIZE, "journal records are one sector each");
+
+class EventJournal
+{
+public:
+  // Opens the journal, creating it when it is missing or has the wrong size, and finds the newest records
+  bool begin(const char *path = EVENT_JOURNAL_PATH);
+  // Closes the journal, before SD.end(); the next commit reopens it
+  void end();
+
+  bool commitCursor(const char *file, uint32_t offset);
+  // Commits the bytes to the journal, then appends them to the day file through dayFileWriter. They are
+  // only written out and flushed here when the journal could not take the commit.
+  bool appendEvent(File &dayFile, const uint8_t *bytes, size_t length);
+  // Commits the bytes to the journal, then writes them over an event already in the day file at offset.
+  // The caller flushes the day file.
+  bool rewriteEvent(File &dayFile, uint32_t offset, const uint8_t *bytes, size_t length);
+
+  // Publish cursor of the newest valid cursor record, false when there is none
+  bool cursor(std::string &file, uint32_t &offset) const;
+  // Re-appends journalled events that are missing from or torn in their day file, and writes rewritten ones
+  // over what the day file still holds, oldest first.
+  // Returns the number of events written back.
+  size_t recover();
+
+  uint32_t sequence() const { return lastSequence; }
+
+private:
+  bool create();
+  bool open();
+  bool commit(uint32_t slot, uint8_t kind, const char *path, uint32_t offset, const uint8_t *bytes, size_t length);
+  bool readSector(uint32_t slot, EventJournalSector &sector);
+  bool recoverEvent(const EventJournalSector &sector);
+
+  char path[24] = EVENT_JOURNAL_PATH;
+  File file;
+  bool ready = false;
+  uint32_t lastSequence = 0;
+  uint32_t nextEventSlot = 0;
+  // cursor sector holding the newest cursor, -1 when neither holds one
+  int8_t cursorSlot = -1;
+  std::string cursorFile;
+  uint32_t cursorOffset = 0;
+};
+
+bool isEventJournalSectorValid(const EventJournalSector &sector);
+
+extern EventJournal eventJournal;
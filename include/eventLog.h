@@ -0,0 +1,68 @@
+// Mains level change logging and the /qop day file event log.
+//
+// Day files are named YYYYMMDD under /qop and hold one event per mains level
+// change, either as CSV lines or binary EventRecords (see eventRecord.h).
+#pragma once
+
+#include <Arduino.h>
+#include <SD.h>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "eventRecord.h"
+#include "mainsDetector.h"
+
+#define MAINS_ANALOG_SENSE_PIN A0
+#define SD_CS_PIN D8
+
+// Build with -D QOP_BINARY_EVENT_LOG=1 to create new day files as fixed size binary records
+#ifndef QOP_BINARY_EVENT_LOG
+#define QOP_BINARY_EVENT_LOG 0
+#endif
+
+// Longest CSV day file line read back, "1,POFF,23:59:59,1656633600\r\n" with room to spare
+#define EVENT_LINE_LENGTH 64
+
+// Set while the card is mounted and /qop and the event journal are open
+extern bool storageReady;
+extern File dataRoot;
+extern File currentDayFile;
+extern std::string currentDateString;
+extern time_t ntpEpoch;
+// Set whenever an event is written, cleared once publishing reaches the end of the newest day file
+extern bool unpublishedEventsPending;
+
+// Mounts the card at the probed SPI clock (sdStorage.h) and opens /qop, the event journal and the outbox,
+// creating what is missing. Does nothing while storageReady, so it also serves to remount lazily after a power loss.
+bool beginStorage();
+// Writes out buffered events, closes every open file and unmounts the card
+void endStorage();
+// From loop(): writes out buffered events whose durability window ran out, remounting one SPI clock
+// slower when the card fails the write
+void loopStorage();
+
+void openDayFileFor(time_t currentEpochTime);
+void updatePowerStatusIfChanged();
+void logMainsLevelChange(MainsLevel previous, MainsLevel level, uint32_t changedAt);
+
+time_t getTimeFromMultipleSources();
+boolean isEpochNTPSynced(time_t epoch);
+
+void writePowerResumeEventToFile(File dateFile, std::string timeOfEvent, time_t epoch, boolean ntpStatus);
+void writePowerOnEventToFile(File dateFile, std::string timeOfEvent, time_t epoch, boolean ntpStatus);
+void writePowerOffEventToFile(File dateFile, std::string timeOfEvent, time_t epoch, boolean ntpStatus);
+void writeEventToFile(File dateFile, uint8_t eventType, std::string timeOfEvent, time_t epoch, boolean ntpStatus);
+// Encodes record the way dayFile holds its events, behind the file header when dayFile is still empty. bytes has
+// room for EVENT_JOURNAL_DATA_LENGTH; eventOffset is where the event starts in it. Returns the bytes used.
+size_t encodeEventFor(File &dayFile, const EventRecord &record, const char *timeOfEvent, uint8_t *bytes,
+                      size_t &eventOffset);
+boolean isBinaryEventFile(File dateFile, time_t epoch);
+boolean readEventFileHeader(File &dayFile);
+boolean readNextEvent(File &dayFile, boolean binaryFile, EventRecord &event);
+size_t readEventLine(File &dayFile, char *line, size_t length);
+
+std::string getFilenameFromEpoch(time_t epochTime);
+std::string getTimeOfEventFromEpoch(time_t epochTime);
+File getLatestFileByDate(File rootDir, std::string date, time_t epochTime);
+std::vector<std::string> listDirSorted(File rootDir);
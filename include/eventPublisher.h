@@ -0,0 +1,43 @@
+// Backend that published event batches go to.
+//
+// publishUnpublishedEvents() only ever talks to the EventPublisher selected in
+// the configuration, so Twitter, an HTTP collector or an MQTT broker can be
+// swapped at runtime, and the network sinks can be driven from a host harness.
+#pragma once
+
+#include <stddef.h>
+
+#include "eventBatch.h"
+#include "powerStats.h"
+
+// Large enough for a full EventBatch as JSON
+#define EVENT_JSON_BUFFER_SIZE 2048
+// How long a sink waits for the backend to acknowledge a batch
+#define PUBLISH_REPLY_TIMEOUT_MS 5000
+
+class EventPublisher
+{
+public:
+  virtual ~EventPublisher() {}
+  virtual const char *name() const = 0;
+  // True once the backend accepted every event in the batch
+  virtual bool publish(const EventBatch &batch) = 0;
+  // True once the backend accepted a daily or monthly power quality report
+  virtual bool publishReport(PowerStatsPeriod period, const PowerStatsBucket &bucket) = 0;
+  // Connection upkeep between batches, called from loop()
+  virtual void loop() {}
+  virtual void stop() {}
+};
+
+// {"device":"..","outages":n,"downtime":s,"longest":s,"brownouts":n,"surges":n,"events":[{"type":"POFF","epoch":n,"ntp":true,"adc":n},..]}
+// Returns the JSON length, or 0 if it did not fit.
+size_t formatBatchJson(const EventBatch &batch, const char *device, char *buf, size_t length);
+
+// {"type":"POFF","epoch":n,"ntp":true,"adc":n}, one event as it appears in batches and the HTTP API.
+// Returns the JSON length, or 0 if it did not fit.
+size_t formatEventJson(const EventRecord &event, char *buf, size_t length);
+
+// {"device":"..","report":"daily","start":n,"outages":n,"sustainedOutages":n,"downtime":s,"sustainedDowntime":s,
+//  "longest":s,"brownouts":n,"brownoutTime":s,"surges":n,"surgeTime":s,"restarts":n,"histogram":[n,..]}
+size_t formatReportJson(PowerStatsPeriod period, const PowerStatsBucket &bucket, const char *device, char *buf,
+                        size_t length);
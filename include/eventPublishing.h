@@ -0,0 +1,50 @@
+// Publishing of the /qop event log.
+//
+// A cursor persisted in the event journal marks the first event not yet published;
+// each pass resumes there, collects events into an EventBatch and queues full
+// or overdue batches in the outbox (outbox.h), which hands them to the selected
+// EventPublisher with retries and backoff.
+#pragma once
+
+#include <Arduino.h>
+#include <SD.h>
+#include <string>
+#include <vector>
+
+#include "eventBatch.h"
+#include "eventPublisher.h"
+
+extern EventPublisher *eventPublisher;
+
+// Publish cursor: day file and byte offset of the first event not yet published,
+// persisted in the event journal. Replaces qop.cursor and the (file, line number) pair of qop.status.
+extern std::string publishCursorFile;
+extern uint32_t publishCursorOffset;
+extern bool publishCursorLoaded;
+extern bool publishCursorDirty;
+
+// Backlogged events are published in batches of at most publishMaxBatchSize events; a partial batch
+// waits up to publishMaxBatchLatency seconds for more outages before it goes out
+extern EventBatch outgoingBatch;
+extern size_t publishMaxBatchSize;
+extern uint32_t publishMaxBatchLatency;
+extern uint32_t heldBatchDeadline;
+
+void publishUnpublishedEvents(File rootDir);
+void publishDueReports(time_t now);
+// Sends what is due in the outbox; from loop() after the passes above
+void publishOutbox();
+boolean queueOutgoingBatch(std::string batchEndFile, uint32_t batchEndOffset);
+
+// Day files the publish cursor has yet to get through; bytes is set to their size past the cursor
+size_t publishBacklog(uint32_t &bytes);
+
+void advancePublishCursor(std::string file, uint32_t offset);
+void persistPublishCursor();
+void loadPublishCursor();
+uint32_t offsetAfterLines(std::string path, int lineCount);
+
+std::vector<std::string> getPublishStatusContent();
+boolean doesStatusExist(std::vector<std::string> statusVec);
+std::string getDateFromStatus(std::vector<std::string> statusVec);
+std::string getLineNumFromStatus(std::vector<std::string> statusVec);
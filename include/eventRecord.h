@@ -0,0 +1,75 @@
+// Binary event log format, shared by the firmware and the host tools.
+//
+// A binary day file is one EventFileHeader followed by fixed size EventRecords,
+// so record i lives at sizeof(EventFileHeader) + i * sizeof(EventRecord) and
+// resuming is a single seek. Fields are little endian, which is what both the
+// ESP8266 and x86/ARM hosts use, so records are written and mapped as-is.
+//
+// Day files without the header magic are the original CSV format
+// ("<sync flag>,<event>,<HH:MM:SS>,<epoch>"); readers accept both. The sync
+// flag is "1" for NTP time, "c" for a time corrected to NTP after the fact
+// and "-" for neither; a line starting with "#" was moved to another day file.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define EVENT_FILE_MAGIC 0x45504F51 // "QOPE"
+#define EVENT_FILE_VERSION 1
+
+enum EventType : uint8_t
+{
+  EVENT_TYPE_NONE = 0,
+  EVENT_TYPE_PON = 1,
+  EVENT_TYPE_PRES = 2,
+  EVENT_TYPE_POFF = 3,
+  EVENT_TYPE_BRWN = 4, // mains sagged into the brownout band
+  EVENT_TYPE_SURG = 5, // mains rose into the surge band
+  EVENT_TYPE_NORM = 6, // mains back to normal after a brownout or surge
+  EVENT_TYPE_LAST = EVENT_TYPE_NORM,
+};
+
+#define EVENT_FLAG_NTP_SYNCED 0x01
+// Logged before NTP synced, epoch corrected once it did (timeCorrection.h)
+#define EVENT_FLAG_CORRECTED 0x02
+// Superseded by its corrected copy in another day file; readers skip it
+#define EVENT_FLAG_MOVED 0x04
+
+struct EventFileHeader
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t recordSize;
+  uint32_t createdEpoch;
+  uint32_t reserved;
+};
+
+struct EventRecord
+{
+  uint32_t epoch;     // seconds, local time as handed out by the NTP client
+  uint32_t uptimeMs;  // millis() when the event was detected
+  uint16_t adcSample; // A0 reading the event was detected on
+  uint8_t type;       // EventType
+  uint8_t flags;      // EVENT_FLAG_*
+  uint32_t crc;       // CRC-32 of all the fields above
+};
+
+static_assert(sizeof(EventFileHeader) == 16, "event file header must stay 16 bytes");
+static_assert(sizeof(EventRecord) == 16, "event records must stay 16 bytes, 32 to a sector");
+
+uint32_t crc32(const uint8_t *data, size_t length, uint32_t crc = 0);
+
+void initEventFileHeader(EventFileHeader &header, uint32_t createdEpoch);
+bool isEventFileHeaderValid(const EventFileHeader &header);
+
+void sealEventRecord(EventRecord &record);
+bool isEventRecordValid(const EventRecord &record);
+
+const char *eventTypeName(uint8_t type);
+uint8_t eventTypeFromName(const char *name, size_t length);
+
+// Parses one CSV day file line into a sealed record, without allocating.
+// The line may still carry its "\r\n"; returns false for malformed and moved lines.
+bool parseCsvEventLine(const char *line, EventRecord &record);
+// Formats record as a CSV day file line with its "\r\n". Returns the length, 0 when it does not fit.
+size_t formatCsvEventLine(const EventRecord &record, const char *timeOfEvent, char *line, size_t length);
@@ -0,0 +1,33 @@
+// Heap high-water and fragmentation counters.
+//
+// The ESP8266 has about 40 KB of heap and no compaction, so a leak or a
+// slowly fragmenting heap shows up as a falling free heap or largest free
+// block long before an allocation fails. sample() keeps the lowest free heap
+// and largest free block and the highest fragmentation seen since boot, and
+// prints a line whenever one of them gets worse.
+#pragma once
+
+#include <Arduino.h>
+
+struct HeapStats
+{
+  uint32_t freeHeap;        // bytes free at the last sample
+  uint32_t minFreeHeap;     // low-water mark of the free heap, the heap high-water mark
+  uint32_t maxFreeBlock;    // largest free block at the last sample
+  uint32_t minMaxFreeBlock; // smallest largest free block seen
+  uint8_t fragmentation;    // percent, at the last sample
+  uint8_t maxFragmentation; // percent, highest seen
+  uint32_t samples;
+};
+
+class HeapMonitor
+{
+public:
+  void sample();
+  const HeapStats &stats() const { return heap; }
+
+private:
+  HeapStats heap = {0, UINT32_MAX, 0, UINT32_MAX, 0, 0, 0};
+};
+
+extern HeapMonitor heapMonitor;
@@ -0,0 +1,41 @@
+// Read-only JSON API on the web GUI's server, and metrics for Prometheus.
+//
+//   GET /api/status                    mains level, clock, day files, publish cursor, heap, outbox, boot phase times
+//   GET /api/events?from=<epoch>&to=<epoch>
+//   GET /api/events?last=<n>           logged events, oldest first
+//   GET /api/days?last=<n>             daily power quality summaries from qop.stats
+//   GET /api/backlog                   day files and bytes not yet queued as of asOf, events queued in the outbox
+//   GET /api/waveform                  metrics of the newest A0 capture window (waveformCapture.h)
+//   WS  /api/live                      every event as it is logged (liveEvents.h)
+//   GET /metrics                       Prometheus text: heap, SD and publish backlog, and with QOP_PROFILE the
+//                                      loop() section timings (profiler.h)
+//
+// Event and day lists are chunked responses filled from SD as the client
+// takes them (see eventHistory.h), so a long history neither sits in RAM
+// nor holds up loop(). The card is only read from loop(): loopHttpApi()
+// formats the next HTTP_API_RESPONSE_BUFFER bytes of a list once the
+// server's callbacks took the last ones, and refreshes the backlog figures
+// every HTTP_API_BACKLOG_REFRESH_MS. The callbacks run from the TCP stack
+// and never touch the card or the clock sources.
+#pragma once
+
+#include <ESPAsyncWebServer.h>
+
+// Events returned when neither a range nor last is given
+#define HTTP_API_DEFAULT_LAST 100
+#define HTTP_API_DEFAULT_DAYS 7
+// Event and day lists streamed at the same time, each holds a file open; more get a 503
+#define HTTP_API_MAX_STREAMS 2
+// Bytes of a list loop() formats at a time, per stream
+#define HTTP_API_RESPONSE_BUFFER 512
+// A day summary being sent: "[," then a day report with every counter at its maximum and a 31 character
+// device name of control characters, escaped to six bytes each
+#define HTTP_API_DAY_SUMMARY_BUFFER 520
+#define HTTP_API_BACKLOG_REFRESH_MS 10000
+
+void beginHttpApi(AsyncWebServer &server);
+// Event and day lists being streamed, each holding a file open
+size_t httpApiOpenStreams();
+// Hands queued live events to WebSocket clients whose connection has room again, fills the event and day
+// lists being streamed, refreshes the backlog figures
+void loopHttpApi();
@@ -0,0 +1,33 @@
+// Posts event batches and power quality reports as JSON to an HTTP collector.
+//
+// The TCP connection is kept alive between batches (HTTP/1.1 keep-alive) and
+// only re-established when the collector closed it, so a drained backlog
+// costs one connect instead of one per event.
+#pragma once
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+#include "eventPublisher.h"
+
+class HttpPublisher : public EventPublisher
+{
+public:
+  void configure(const char *host, uint16_t port, const char *path, const char *device);
+  const char *name() const override { return "http"; }
+  bool publish(const EventBatch &batch) override;
+  bool publishReport(PowerStatsPeriod period, const PowerStatsBucket &bucket) override;
+  void stop() override;
+
+private:
+  bool post(size_t payloadLength);
+  bool readResponse();
+
+  WiFiClient client;
+  char host[64] = "";
+  uint16_t port = 80;
+  char path[64] = "/";
+  char device[32] = "";
+  char header[256];
+  char payload[EVENT_JSON_BUFFER_SIZE];
+};
@@ -0,0 +1,13 @@
+// Bounded text appends for the JSON bodies the publishers send and the HTTP API serves.
+//
+// Every append writes at buf + used and moves used on; once something did not
+// fit, used sticks at length and later appends do nothing, so a caller checks
+// for overflow once at the end (used < length).
+#pragma once
+
+#include <stddef.h>
+
+// printf-style append, for numbers and text known to need no escaping
+void appendf(char *buf, size_t length, size_t &used, const char *format, ...) __attribute__((format(printf, 4, 5)));
+// Appends value as a quoted JSON string, with quotes, backslashes and control characters escaped
+void appendJsonString(char *buf, size_t length, size_t &used, const char *value);
@@ -0,0 +1,89 @@
+// Push of power events to live subscribers as they are logged.
+//
+// Every event writeEventToFile() logs is formatted once into a small ring
+// and fanned out from there: each subscriber keeps its own read position,
+// and pump() hands it the messages it has not seen for as long as its
+// connection takes them. A subscriber that falls a whole ring behind is
+// dropped instead of being waited on, so a slow or stalled client costs a
+// fixed amount of RAM and never holds up loop().
+//
+// Connects and disconnects arrive in the web server's callbacks, outside
+// loop(): subscribe() and unsubscribe() only queue the request, and pump()
+// applies it before it walks the slots, so only loop() touches them.
+//
+// Delivery goes through a LiveEventSink, a WebSocket server on the device
+// (httpApi.cpp) and a recording stand-in on the host.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "eventRecord.h"
+
+// Messages kept for subscribers that have not taken them yet, a power of two
+#define LIVE_EVENT_QUEUE_SIZE 16
+#define LIVE_EVENT_MAX_SUBSCRIBERS 4
+#define LIVE_EVENT_JSON_LENGTH 96
+// Subscribe and unsubscribe requests waiting for pump(), a power of two
+#define LIVE_EVENT_REQUEST_QUEUE_SIZE 8
+
+class LiveEventSink
+{
+public:
+  virtual ~LiveEventSink() {}
+  // True when the subscriber's connection takes another message right now
+  virtual bool canSend(uint32_t subscriber) = 0;
+  virtual void send(uint32_t subscriber, const char *message, size_t length) = 0;
+  // Disconnects a subscriber that fell too far behind
+  virtual void drop(uint32_t subscriber) = 0;
+};
+
+class LiveEventHub
+{
+public:
+  void setSink(LiveEventSink *sink) { this->sink = sink; }
+
+  // Safe outside loop(). New subscribers get the events logged once loop() took the request; one that finds every
+  // slot taken is dropped through the sink. False when the request could not be queued.
+  bool subscribe(uint32_t subscriber);
+  bool unsubscribe(uint32_t subscriber);
+
+  // Queues one logged event and sends it to every subscriber that can take it
+  void publish(const EventRecord &event);
+  // Sends queued messages to subscribers whose connection has room again; from loop()
+  void pump();
+
+  size_t subscribers() const;
+  uint32_t published() const { return head; }
+  uint32_t droppedSubscribers() const { return dropped; }
+
+private:
+  struct Request
+  {
+    uint32_t id;
+    bool subscribe;
+  };
+
+  bool queueRequest(uint32_t subscriber, bool subscribe);
+  void applyRequests();
+
+  struct Subscriber
+  {
+    uint32_t id;
+    uint32_t next; // sequence number of the next message to send
+    bool used;
+  };
+
+  LiveEventSink *sink = nullptr;
+  char messages[LIVE_EVENT_QUEUE_SIZE][LIVE_EVENT_JSON_LENGTH];
+  uint8_t lengths[LIVE_EVENT_QUEUE_SIZE];
+  uint32_t head = 0; // sequence number of the next message queued
+  Subscriber slots[LIVE_EVENT_MAX_SUBSCRIBERS] = {};
+  // written by the web server's callbacks up to requestHead, taken by pump() from requestTail
+  Request requests[LIVE_EVENT_REQUEST_QUEUE_SIZE];
+  volatile uint8_t requestHead = 0;
+  volatile uint8_t requestTail = 0;
+  uint32_t dropped = 0;
+};
+
+extern LiveEventHub liveEvents;
@@ -0,0 +1,113 @@
+// Levelled logging through a ring buffer.
+//
+// LOG_ERROR() .. LOG_TRACE() take printf style arguments, format one line into
+// a RAM ring and return; they never wait on the UART or the SD card. Call
+// sites above LOG_COMPILE_LEVEL compile to nothing, and below it the runtime
+// level (the "logLevel" setting) is checked before any argument is evaluated.
+// drain() runs from loop() and empties the ring in idle time: to Serial only
+// as far as its TX FIFO has room, and to qop.log on SD in sector sized
+// writes. Lines that do not fit the ring are dropped and counted.
+//
+// Not for interrupt or Ticker context: the ring has a single producer, loop().
+#pragma once
+
+#include <Arduino.h>
+
+#define LOG_LEVEL_OFF 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+#define LOG_LEVEL_TRACE 5
+
+// Build with -D LOG_COMPILE_LEVEL=LOG_LEVEL_WARN (or lower) to strip the chattier call sites from the firmware
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#define LOG_SINK_SERIAL 0x01
+#define LOG_SINK_SD 0x02
+
+#define LOG_RING_SIZE 2048
+#define LOG_LINE_LENGTH 128
+#define LOG_FILE_PATH "/qop.log"
+#define LOG_FILE_OLD_PATH "/qop.log.1"
+// qop.log is rotated to qop.log.1 once it grows past this
+#define LOG_FILE_MAX_SIZE (256 * 1024UL)
+// The SD sink writes once this much is pending, or once the oldest pending line is this old
+#define LOG_SD_WRITE_SIZE 512
+#define LOG_SD_WRITE_INTERVAL_MS 10000
+
+#define LOG_AT(atLevel, ...)                \
+  do                                        \
+  {                                         \
+    if ((atLevel) <= logger.level())        \
+    {                                       \
+      logger.write((atLevel), __VA_ARGS__); \
+    }                                       \
+  } while (0)
+
+#if LOG_COMPILE_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) do {} while (0)
+#endif
+#if LOG_COMPILE_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) do {} while (0)
+#endif
+#if LOG_COMPILE_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) do {} while (0)
+#endif
+#if LOG_COMPILE_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do {} while (0)
+#endif
+#if LOG_COMPILE_LEVEL >= LOG_LEVEL_TRACE
+#define LOG_TRACE(...) LOG_AT(LOG_LEVEL_TRACE, __VA_ARGS__)
+#else
+#define LOG_TRACE(...) do {} while (0)
+#endif
+
+class Logger
+{
+public:
+  uint8_t level() const { return runtimeLevel; }
+  void setLevel(uint8_t level) { runtimeLevel = level; }
+  // LOG_SINK_* flags
+  void setSinks(uint8_t sinks);
+  uint8_t sinks() const { return enabledSinks; }
+
+  void write(uint8_t level, const char *format, ...) __attribute__((format(printf, 3, 4)));
+  // Moves pending lines to the enabled sinks without blocking
+  void drain();
+  // Writes out every pending line, waiting on the UART; for setup() before loop() drains
+  void flush();
+
+  uint32_t dropped() const { return droppedLines; }
+  size_t pending() const;
+
+private:
+  size_t pendingFor(size_t tail) const;
+  size_t drainSerial(size_t room);
+  void drainSd(bool force);
+
+  char ring[LOG_RING_SIZE];
+  size_t head = 0;       // next byte written
+  size_t serialTail = 0; // next byte for Serial
+  size_t sdTail = 0;     // next byte for qop.log
+  uint32_t sdPendingSince = 0;
+  uint8_t runtimeLevel = LOG_LEVEL_INFO;
+  uint8_t enabledSinks = LOG_SINK_SERIAL;
+  uint32_t droppedLines = 0;
+};
+
+uint8_t logLevelFromName(const char *name);
+const char *logLevelName(uint8_t level);
+uint8_t logSinksFromName(const char *name);
+
+extern Logger logger;
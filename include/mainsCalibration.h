@@ -0,0 +1,68 @@
+// Learns a unit's own A0 band edges from the block means it reads.
+//
+// Dividers and transformers differ enough between installs that the stock
+// edges in mainsDetector.h miss outages on some units and see brownouts all
+// day on others. While learning, every block mean the detector gets is also
+// counted into a histogram of 4 count bins; when a bin would overflow all
+// bins are halved, so the shape is kept in 512 bytes however long it runs.
+//
+// After MAINS_CALIBRATION_BLOCKS blocks derive() takes the most common
+// reading as the mains-on level and the blocks above half of it as its
+// distribution: the median is the nominal reading the stock edges are scaled
+// to, the 2nd to 98th percentile spread is the hysteresis. Blocks below a
+// quarter of it are the mains-off distribution, when an outage happened
+// while learning the off edge stays clear of it. A spread that is small
+// against the distance down to the off edge lets the detector report a power
+// loss or return after a single block. Integer math only.
+#pragma once
+
+#include <stdint.h>
+
+#include "mainsDetector.h"
+
+// Three hours of 100 ms blocks
+#define MAINS_CALIBRATION_BLOCKS 108000UL
+#define MAINS_CALIBRATION_BIN_SHIFT 2
+#define MAINS_CALIBRATION_BINS (1024 >> MAINS_CALIBRATION_BIN_SHIFT)
+// Below this the sense input is not wired or the divider is far off, nothing to learn from
+#define MAINS_CALIBRATION_MIN_NOMINAL 256
+// 2 s of blocks make an outage worth keeping the off edge above
+#define MAINS_CALIBRATION_MIN_OFF_BLOCKS 20
+#define MAINS_CALIBRATION_MIN_HYSTERESIS 6
+#define MAINS_CALIBRATION_MAX_HYSTERESIS 48
+// Single block power loss detection when the on level's low end is this many spreads above the off edge
+#define MAINS_CALIBRATION_CONFIDENT_SPREADS 16
+
+struct MainsCalibrationResult
+{
+  uint16_t nominal; // median mains-on reading
+  uint16_t low;     // 2nd percentile of the mains-on readings
+  uint16_t high;    // 98th percentile of the mains-on readings
+  uint16_t offHigh; // 99th percentile of the mains-off readings, 0 when no outage was seen
+  MainsThresholds thresholds;
+};
+
+class MainsCalibration
+{
+public:
+  // Starts learning from scratch
+  void begin();
+  void stop() { active = false; }
+  bool learning() const { return active; }
+  // Counts one block mean while learning; true once enough blocks were counted
+  bool add(uint16_t blockMean);
+  bool complete() const { return active && blocks >= MAINS_CALIBRATION_BLOCKS; }
+  uint32_t blocksCounted() const { return blocks; }
+
+  // False when the readings show no usable mains-on level, or one too noisy to keep clear of the band edges
+  bool derive(MainsCalibrationResult &result) const;
+
+private:
+  uint16_t percentile(uint16_t fromBin, uint16_t toBin, uint32_t count, uint8_t percent) const;
+
+  bool active = false;
+  uint32_t blocks = 0;
+  uint16_t bins[MAINS_CALIBRATION_BINS];
+};
+
+extern MainsCalibration mainsCalibration;
@@ -0,0 +1,81 @@
+// Mains level detection from filtered A0 blocks.
+//
+// mainsSampler reduces a block of ADC reads to their mean; each block mean is
+// smoothed by a fixed point exponential moving average and classified into an
+// absolute level. Band edges carry hysteresis around the current level and a
+// new level has to hold for a number of blocks before it is reported, so noise
+// near a threshold never produces a pair of events. Integer math only.
+#pragma once
+
+#include <stdint.h>
+
+enum MainsLevel : uint8_t
+{
+  MAINS_LEVEL_UNKNOWN = 0,
+  MAINS_LEVEL_OFF = 1,
+  MAINS_LEVEL_BROWNOUT = 2,
+  MAINS_LEVEL_NORMAL = 3,
+  MAINS_LEVEL_SURGE = 4,
+};
+
+// A0 block means at the band edges, in ADC counts (0..1023); the stock divider reads ~900 at 230 V.
+// mainsCalibration.h scales them to what a unit reads at its own nominal level
+#define MAINS_NOMINAL_READING 900
+#define MAINS_OFF_BELOW 200
+#define MAINS_BROWNOUT_BELOW 760
+#define MAINS_SURGE_ABOVE 990
+// A level is only left once the filtered reading is this many counts past the band edge
+#define MAINS_HYSTERESIS 16
+// EMA weight of a new block is 1 / 2^MAINS_EMA_SHIFT
+#define MAINS_EMA_SHIFT 1
+// Blocks a new level has to hold before it is reported. Power loss is reported fast, brownouts and
+// surges have to be sustained so the decay through the brownout band at power off is not one
+#define MAINS_OFF_DEBOUNCE_BLOCKS 2
+#define MAINS_LEVEL_DEBOUNCE_BLOCKS 10
+
+struct MainsThresholds
+{
+  uint16_t offBelow = MAINS_OFF_BELOW;
+  uint16_t brownoutBelow = MAINS_BROWNOUT_BELOW;
+  uint16_t surgeAbove = MAINS_SURGE_ABOVE;
+  uint16_t hysteresis = MAINS_HYSTERESIS;
+  uint8_t offDebounce = MAINS_OFF_DEBOUNCE_BLOCKS;
+};
+
+// Band edges in order with their hysteresis apart and inside the ADC range, a debounce of at least a block
+bool isMainsThresholdsValid(const MainsThresholds &thresholds);
+
+class MainsDetector
+{
+public:
+  void begin(const MainsThresholds &thresholds = MainsThresholds());
+  // New band edges for the following blocks, the reported level stays
+  void setThresholds(const MainsThresholds &thresholds) { limits = thresholds; }
+  // Feeds one block mean taken at millis() takenAt. Returns true when the reported level changed.
+  bool update(uint32_t takenAt, uint16_t blockMean);
+
+  MainsLevel level() const { return current; }
+  MainsLevel previousLevel() const { return previous; }
+  // millis() of the first block at the new level, events are back-dated to it
+  uint32_t changedAt() const { return candidateSince; }
+  // Smoothed reading in ADC counts
+  uint16_t filtered() const { return (uint16_t)(ema >> 8); }
+  const MainsThresholds &thresholds() const { return limits; }
+
+private:
+  MainsLevel classify(uint16_t value) const;
+  uint16_t edge(uint16_t threshold, MainsLevel below) const;
+
+  MainsThresholds limits;
+  uint32_t ema = 0; // Q8 fixed point ADC counts
+  bool primed = false;
+  MainsLevel current = MAINS_LEVEL_UNKNOWN;
+  MainsLevel previous = MAINS_LEVEL_UNKNOWN;
+  MainsLevel candidate = MAINS_LEVEL_UNKNOWN;
+  uint8_t candidateBlocks = 0;
+  uint32_t candidateSince = 0;
+};
+
+const char *mainsLevelName(MainsLevel level);
+
+extern MainsDetector mainsDetector;
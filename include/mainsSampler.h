@@ -0,0 +1,66 @@
+// Timer driven sampling of the mains sense pin.
+//
+// A Ticker reads the ADC at a few hundred Hz and sums the reads into blocks;
+// each finished block is pushed as its mean into a lock-free ring, so sampling
+// keeps its rate while loop() is blocked in SD reads or a tweet (the network
+// stack yields while it waits, which is when Ticker callbacks run). Level
+// detection (mainsDetector.h) drains the ring from loop().
+//
+// In capture mode (waveformCapture.h) loop() also takes a burst of one
+// window of reads at WAVEFORM_SAMPLE_RATE_HZ every WAVEFORM_BURST_INTERVAL_MS,
+// paced on the cycle counter with the Ticker detached; every read that falls
+// on the Ticker's interval goes into the blocks too, so detection sees the
+// same block means. The ADC is never read from an interrupt: analogRead()
+// is in flash and not safe with the cache off, and 2 kHz reads all the time
+// starve WiFi, which only loses a short window a second this way.
+#pragma once
+
+#include <Arduino.h>
+#include <Ticker.h>
+
+#include "sampleRing.h"
+#include "waveformCapture.h"
+
+// 200 Hz, a block of 20 reads spans five 50 Hz mains cycles so ripple averages out.
+// 128 blocks of 100 ms bridge 12.8 s of loop() being busy before blocks are dropped
+#define MAINS_SAMPLE_INTERVAL_MS 5
+#define MAINS_BLOCK_SAMPLES 20
+#define MAINS_SAMPLE_RING_SIZE 128
+
+struct MainsSample
+{
+  uint32_t takenAt; // millis() of the first read in the block
+  uint16_t value;   // mean of the block's reads
+};
+
+class MainsSampler
+{
+public:
+  void begin(uint8_t pin, uint32_t intervalMs = MAINS_SAMPLE_INTERVAL_MS);
+  void end();
+  // Capture mode on or off, restarting the sampling when it runs
+  void setCapture(bool enabled);
+  bool capturing() const { return capture; }
+  // From updatePowerStatusIfChanged(): the capture burst, when one is due
+  void loop();
+  bool next(MainsSample &sample) { return ring.pop(sample); }
+  size_t backlog() const { return ring.size(); }
+  uint32_t droppedSamples() const { return ring.dropped(); }
+
+private:
+  static void takeSample(MainsSampler *sampler);
+  void add(uint16_t value);
+
+  Ticker ticker;
+  uint8_t pin;
+  uint32_t intervalMs = MAINS_SAMPLE_INTERVAL_MS;
+  bool running = false;
+  bool capture = false;
+  uint32_t blockStart = 0;
+  uint32_t blockSum = 0;
+  uint16_t blockReads = 0;
+  uint32_t burstDueAt = 0;
+  SampleRing<MainsSample, MAINS_SAMPLE_RING_SIZE> ring;
+};
+
+extern MainsSampler mainsSampler;
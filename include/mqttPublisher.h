@@ -0,0 +1,42 @@
+// Publishes event batches and power quality reports as JSON to an MQTT broker.
+//
+// A minimal MQTT 3.1.1 client: one persistent connection, QoS 1 PUBLISH per
+// batch so a batch only counts as published once the broker sent PUBACK, and
+// PINGREQ from loop() to keep the connection open between batches.
+#pragma once
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+#include "eventPublisher.h"
+
+#define MQTT_KEEP_ALIVE_S 60
+
+class MqttPublisher : public EventPublisher
+{
+public:
+  void configure(const char *host, uint16_t port, const char *topic, const char *clientId);
+  const char *name() const override { return "mqtt"; }
+  bool publish(const EventBatch &batch) override;
+  // Reports go to "<topic>/report"
+  bool publishReport(PowerStatsPeriod period, const PowerStatsBucket &bucket) override;
+  void loop() override;
+  void stop() override;
+
+private:
+  bool publishPayload(const char *topicName, size_t payloadLength);
+  bool ensureConnected();
+  bool sendPacket(uint8_t type, const uint8_t *body, size_t bodyLength, const uint8_t *payload = NULL,
+                  size_t payloadLength = 0);
+  // Reads packets until one of the given type arrives, returns its body length or -1
+  int awaitPacket(uint8_t type, uint8_t *body, size_t bodyLength);
+
+  WiFiClient client;
+  char host[64] = "";
+  uint16_t port = 1883;
+  char topic[64] = "";
+  char clientId[32] = "";
+  uint16_t packetId = 0;
+  uint32_t lastSentAt = 0;
+  char payload[EVENT_JSON_BUFFER_SIZE];
+};
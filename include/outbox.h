@@ -0,0 +1,147 @@
+// Durable queue of what waits to go out to the EventPublisher.
+//
+// publishUnpublishedEvents() turns day file events into batches and
+// publishDueReports() finished periods into reports; both are queued here,
+// and the publish cursor or report mark moves on once the item is on the
+// card. From then on delivery no longer depends on the day files, which may
+// already sit in /qop-published.
+//
+// /qop.outbox is created once at its full size, a ring of OUTBOX_SLOTS slots
+// of OUTBOX_SLOT_SIZE bytes each holding one item: a checksummed header and
+// the batch's EventRecords or the report's PowerStatsBucket, which carry
+// their own checksums. An item's delivery state, attempts and done, is
+// rewritten in place in the first bytes of its slot.
+//
+// sendDue() sends the oldest item, one per call so loop() gets to the
+// detector between publishes. After a failure the next attempt
+// waits an exponential backoff with jitter; while the circuit breaker is
+// open nothing is attempted at all. It opens while WiFi is not connected
+// (WiFiManager keeps the station connected and reports through WiFi.status()),
+// and the first item goes out as soon as it is back. It also opens for
+// OUTBOX_BREAKER_OPEN_MS after OUTBOX_BREAKER_FAILURES failures in a row,
+// then lets a single attempt through that closes it again or reopens it.
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+
+#include "eventBatch.h"
+#include "eventPublisher.h"
+#include "powerStats.h"
+
+#define OUTBOX_PATH "/qop.outbox"
+#define OUTBOX_MAGIC 0x424F5051 // "QPOB"
+#define OUTBOX_SLOTS 16
+#define OUTBOX_SLOT_SIZE 1024
+// Wait after an item's first failure, doubled with every further one up to OUTBOX_BACKOFF_MAX_MS.
+// Each wait is drawn between half of it and all of it.
+#define OUTBOX_BACKOFF_BASE_MS 2000
+#define OUTBOX_BACKOFF_MAX_MS 300000
+#define OUTBOX_BREAKER_FAILURES 5
+#define OUTBOX_BREAKER_OPEN_MS 300000
+
+enum OutboxKind : uint8_t
+{
+  OUTBOX_EMPTY = 0,
+  OUTBOX_BATCH = 1,
+  OUTBOX_REPORT = 2,
+};
+
+enum OutboxBreaker : uint8_t
+{
+  OUTBOX_BREAKER_CLOSED = 0,
+  OUTBOX_BREAKER_OPEN = 1,      // too many failures in a row, waiting out OUTBOX_BREAKER_OPEN_MS
+  OUTBOX_BREAKER_HALF_OPEN = 2, // the next attempt decides
+  OUTBOX_BREAKER_OFFLINE = 3,   // WiFi not connected
+};
+
+struct OutboxItemHeader
+{
+  // delivery state, rewritten in place and not covered by crc
+  uint8_t done;
+  uint8_t reserved[3];
+  uint32_t attempts;
+  // written once with the item
+  uint32_t magic;
+  uint32_t sequence; // increases with every item queued
+  uint8_t kind;      // OutboxKind
+  uint8_t period;    // report: PowerStatsPeriod
+  uint16_t count;    // batch: events following the header
+  uint32_t cursorKey; // batch: day file key and offset the publish cursor moved to with it
+  uint32_t cursorOffset;
+  uint32_t crc; // CRC-32 of magic through cursorOffset
+};
+
+static_assert(sizeof(OutboxItemHeader) + EVENT_BATCH_CAPACITY * sizeof(EventRecord) <= OUTBOX_SLOT_SIZE,
+              "a full batch fits a slot");
+static_assert(sizeof(OutboxItemHeader) + sizeof(PowerStatsBucket) <= OUTBOX_SLOT_SIZE, "a report fits a slot");
+
+class Outbox
+{
+public:
+  // Opens the queue, creating it when it is missing or has the wrong size, and finds the items not yet sent
+  bool begin(const char *path = OUTBOX_PATH);
+  // Closes the queue, before SD.end()
+  void end();
+
+  // False when the queue is full or the item could not be written
+  bool enqueueBatch(const EventBatch &batch, uint32_t cursorKey, uint32_t cursorOffset);
+  bool enqueueReport(PowerStatsPeriod period, const PowerStatsBucket &bucket);
+  bool hasReport(PowerStatsPeriod period, uint32_t periodStart) const;
+  // Day file key and offset queued with the newest batch, false when no batch was ever queued
+  bool newestBatchCursor(uint32_t &key, uint32_t &offset) const;
+
+  // From loop(): sends the oldest due item, passing over unreadable ones. Returns the items sent, 0 or 1.
+  size_t sendDue(EventPublisher &publisher);
+
+  size_t depth() const;
+  size_t queuedEvents() const;
+  bool full() const { return depth() >= OUTBOX_SLOTS; }
+  OutboxBreaker breaker() const { return breakerState; }
+  uint8_t failureStreak() const { return failures; }
+  // Until the oldest item is due, 0 when it is due now or nothing is queued
+  uint32_t retryInMs() const;
+  uint32_t sent() const { return sentCount; }
+  uint32_t attempts() const { return attemptCount; }
+
+private:
+  struct Slot
+  {
+    uint32_t sequence;
+    uint32_t attempts;
+    uint32_t periodStart; // report
+    uint32_t cursorKey;   // batch
+    uint32_t cursorOffset;
+    uint16_t count;
+    uint8_t kind; // OUTBOX_EMPTY once sent
+    uint8_t period;
+  };
+
+  bool create();
+  bool open();
+  bool writeItem(uint32_t slot, OutboxItemHeader &header, const uint8_t *payload, size_t length);
+  bool writeState(uint32_t slot, bool done, uint32_t attempts);
+  int oldest() const;
+  int freeSlot() const;
+  bool attempt(uint32_t slot, EventPublisher &publisher, bool &corrupt);
+  uint32_t backoff(uint32_t attempts) const;
+
+  char path[24] = OUTBOX_PATH;
+  File file;
+  bool ready = false;
+  Slot slots[OUTBOX_SLOTS] = {};
+  uint32_t lastSequence = 0;
+  int newestSlot = -1;
+  uint32_t newestCursorKey = 0;
+  uint32_t newestCursorOffset = 0;
+  OutboxBreaker breakerState = OUTBOX_BREAKER_CLOSED;
+  uint8_t failures = 0;
+  uint32_t nextAttemptAt = 0; // millis()
+  uint32_t openedAt = 0;
+  uint32_t sentCount = 0;
+  uint32_t attemptCount = 0;
+};
+
+const char *outboxBreakerName(OutboxBreaker breaker);
+
+extern Outbox outbox;
@@ -0,0 +1,75 @@
+// What the device does between losing mains and getting it back.
+//
+//   RUNNING  normal operation
+//   HOLDUP   mains just went: the POFF is logged, the card is unmounted and
+//            WiFi switched off so the hold-up capacitor lasts, sampling and
+//            detection keep going in case it was a blip
+//   SLEEP    still off after POWER_HOLDUP_MS: the sampler stops and the CPU
+//            light-sleeps in slices, each ended by a short burst of A0 reads
+//            (the ESP8266 cannot wake on an ADC threshold, the slices stand
+//            in for one)
+//   RESUME   a burst saw mains again: sampling restarts and the detector
+//            confirms it; the card is remounted by the first event logged,
+//            the PRES, and WiFi comes back
+//
+// loop() does nothing but this and the detector outside RUNNING, so nothing
+// touches the card or the network while it is unmounted, and a device that
+// keeps running without mains never logs a resume it did not see.
+#pragma once
+
+#include <Arduino.h>
+
+// Awake after a power loss before light sleep, a blip shorter than this is caught by the sampler
+#define POWER_HOLDUP_MS 2000
+// Pause per loop() pass in HOLDUP, the sampler's Ticker still runs in it
+#define POWER_HOLDUP_POLL_MS 10
+// Light sleep between A0 bursts in SLEEP, the worst case added to a resume
+#define POWER_SLEEP_SLICE_MS 100
+#define POWER_SLEEP_BURST_READS 8
+// A resume the detector has not confirmed by then was noise, back to SLEEP
+#define POWER_RESUME_TIMEOUT_MS 1000
+// Mains back to PRES logged; longer resumes are logged as warnings
+#define POWER_RESUME_BUDGET_MS 500
+
+enum PowerState : uint8_t
+{
+  POWER_RUNNING = 0,
+  POWER_HOLDUP = 1,
+  POWER_SLEEP = 2,
+  POWER_RESUME = 3,
+};
+
+class PowerStateMachine
+{
+public:
+  PowerState state() const { return current; }
+  bool running() const { return current == POWER_RUNNING; }
+
+  // The POFF is logged: RUNNING -> HOLDUP. The card is released on the next loop() pass, not from under a reader.
+  void powerLost();
+  // The PRES is logged: back to RUNNING, how long the resume took is recorded
+  void powerRestored(uint32_t changedAt);
+  // From loop(), first thing: moves HOLDUP, SLEEP and RESUME along, sleeping in SLEEP
+  void loop();
+
+  uint32_t lastResumeMs() const { return lastResume; }
+  uint32_t maxResumeMs() const { return maxResume; }
+  uint32_t resumes() const { return resumeCount; }
+
+private:
+  void radioOff();
+  void radioOn();
+  void sleepSlice();
+
+  PowerState current = POWER_RUNNING;
+  uint32_t enteredAt = 0; // millis() the current state was entered
+  uint32_t restoredAt = 0;
+  bool radioIsOff = false;
+  uint32_t lastResume = 0;
+  uint32_t maxResume = 0;
+  uint32_t resumeCount = 0;
+};
+
+const char *powerStateName(PowerState state);
+
+extern PowerStateMachine powerState;
@@ -0,0 +1,126 @@
+// Incremental power quality statistics per hour, day and month.
+//
+// Every logged event updates the buckets of the periods it falls in, so a
+// report never has to walk the day files. Buckets live in fixed slots of one
+// summary file (qop.stats): slot = period number modulo the slot count, and a
+// slot whose periodStart does not match belongs to an older period and reads
+// as empty. A week of hours, over a year of days and ten years of months fit
+// in ~40 KB, and reading or updating any bucket is one seek.
+//
+// Outage and brownout/surge time is booked to the period the outage (or sag)
+// started in. SAIFI/SAIDI style figures count sustained outages (at least
+// POWER_STATS_SUSTAINED_S), shorter ones are momentary (MAIFI).
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace fs
+{
+  class File;
+}
+
+#define POWER_STATS_PATH "/qop.stats"
+#define POWER_STATS_MAGIC 0x53504F51 // "QOPS"
+#define POWER_STATS_VERSION 1
+
+#define POWER_STATS_HOUR_SLOTS 168
+#define POWER_STATS_DAY_SLOTS 400
+#define POWER_STATS_MONTH_SLOTS 120
+
+// Outages this long or longer are sustained interruptions
+#define POWER_STATS_SUSTAINED_S 300
+// Outage duration histogram: < 1 min, < 5 min, < 15 min, < 1 h, < 2 h, < 4 h, < 8 h, longer
+#define POWER_STATS_HISTOGRAM_BINS 8
+// Events dated before 2020 come from an unset clock and are not counted
+#define POWER_STATS_MIN_EPOCH 1577836800
+
+enum PowerStatsPeriod : uint8_t
+{
+  POWER_STATS_HOUR = 0,
+  POWER_STATS_DAY = 1,
+  POWER_STATS_MONTH = 2,
+  POWER_STATS_PERIODS = 3,
+};
+
+struct PowerStatsBucket
+{
+  uint32_t periodStart;       // first second of the period, 0 for an empty bucket
+  uint16_t outages;           // outages that started in the period
+  uint16_t sustainedOutages;  // of those, sustained ones (SAIFI)
+  uint32_t downtime;          // seconds, all outages
+  uint32_t sustainedDowntime; // seconds, sustained outages only (SAIDI)
+  uint32_t longestOutage;     // seconds
+  uint16_t brownouts;
+  uint16_t surges;
+  uint32_t brownoutTime; // seconds
+  uint32_t surgeTime;    // seconds
+  uint16_t restarts;     // power resumes without a logged power off
+  uint16_t reserved;
+  uint16_t outageHistogram[POWER_STATS_HISTOGRAM_BINS];
+  uint32_t crc; // CRC-32 of all the fields above
+};
+
+struct PowerStatsHeader
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t bucketSize;
+  uint16_t slots[POWER_STATS_PERIODS];
+  uint16_t reserved;
+  // Start of the outage, brownout and surge in progress, 0 when there is none
+  uint32_t openOutageStart;
+  uint32_t openBrownoutStart;
+  uint32_t openSurgeStart;
+  // periodStart of the last published day and month report
+  uint32_t reportedDay;
+  uint32_t reportedMonth;
+  uint32_t crc;
+};
+
+static_assert(sizeof(PowerStatsBucket) == 56, "summary file layout depends on the bucket size");
+static_assert(sizeof(PowerStatsHeader) == 40, "summary file layout depends on the header size");
+
+class PowerStats
+{
+public:
+  // Loads the summary file, creating it when it is missing or from another version
+  bool begin(const char *path = POWER_STATS_PATH);
+  // Books one logged event (EventType) into its hour, day and month
+  void record(uint8_t type, uint32_t epoch);
+  // The bucket of the period containing epoch; an empty bucket when nothing was recorded
+  bool read(PowerStatsPeriod period, uint32_t epoch, PowerStatsBucket &bucket);
+
+  // Day and month reports fall due once their period has ended. Returns false when nothing is due.
+  bool nextDueReport(uint32_t now, PowerStatsPeriod &period, uint32_t &periodStart);
+  void markReported(PowerStatsPeriod period, uint32_t periodStart);
+
+  const PowerStatsHeader &state() const { return header; }
+
+private:
+  bool create();
+  bool readSlot(fs::File &file, PowerStatsPeriod period, uint32_t periodStart, PowerStatsBucket &bucket);
+  bool writeSlot(fs::File &file, PowerStatsPeriod period, PowerStatsBucket &bucket);
+  bool writeHeader(fs::File &file);
+  PowerStatsBucket &bucketFor(fs::File &file, PowerStatsPeriod period, uint32_t epoch);
+  void addOutage(fs::File &file, uint32_t start, uint32_t duration);
+  void addRestart(fs::File &file, uint32_t epoch);
+  void addSagStart(fs::File &file, uint32_t epoch, bool surge);
+  void closeSag(fs::File &file, uint32_t epoch, bool surge);
+
+  char path[24] = POWER_STATS_PATH;
+  bool loaded = false;
+  PowerStatsHeader header;
+  // Last bucket touched per period, written through on every change
+  PowerStatsBucket current[POWER_STATS_PERIODS];
+};
+
+uint32_t powerStatsPeriodStart(PowerStatsPeriod period, uint32_t epoch);
+uint32_t powerStatsSlotOffset(PowerStatsPeriod period, uint32_t periodStart);
+const char *powerStatsPeriodName(PowerStatsPeriod period);
+void sealPowerStatsBucket(PowerStatsBucket &bucket);
+bool isPowerStatsBucketValid(const PowerStatsBucket &bucket);
+// "[daily] Jun 25: 3 outages, 47 min down (2 sustained, 41 min), longest 22 min, 1 brownout 4 min, 0 surges"
+int formatPowerReport(const PowerStatsBucket &bucket, PowerStatsPeriod period, char *buf, size_t length);
+
+extern PowerStats powerStats;
@@ -0,0 +1,86 @@
+// Cycle counter profiling of the loop() sections that can hold it up.
+//
+// Build with -D QOP_PROFILE=1 to time the sections below with
+// ESP.getCycleCount(). Each keeps its run count, total and longest run and a
+// histogram of decades from 10 us to 10 s in static storage, served from
+// GET /metrics (httpApi.h) next to the heap and backlog gauges. The bucket
+// bounds are kept in cycles, so a timed run costs two cycle counter reads
+// and a few adds and compares, under a microsecond against sections that
+// take tens of microseconds at least; loop() itself is a section, so the
+// share the timing takes can be read off the totals. Without QOP_PROFILE
+// the macros leave the calls as they are.
+//
+// The cycle counter wraps after 53 s at 80 MHz, 26 s at 160 MHz; a longer
+// run is counted as what is left of it past the wrap.
+#pragma once
+
+#include <Arduino.h>
+
+#ifndef QOP_PROFILE
+#define QOP_PROFILE 0
+#endif
+
+enum ProfileSection : uint8_t
+{
+  PROFILE_LOOP = 0,
+  PROFILE_WIFI_MANAGER,
+  PROFILE_UPDATER,
+  PROFILE_LIST_DIR,
+  PROFILE_PUBLISH_READ,
+  PROFILE_TWEET,
+  PROFILE_RTC_NOW,
+  PROFILE_SECTION_COUNT,
+};
+
+// Upper bounds of the histogram buckets in microseconds, the last bucket takes the rest
+#define PROFILE_BUCKETS 8
+#define PROFILE_BUCKET_BOUNDS_US {10UL, 100UL, 1000UL, 10000UL, 100000UL, 1000000UL, 10000000UL}
+
+struct ProfileStats
+{
+  uint32_t count;
+  uint64_t totalCycles;
+  uint32_t maxCycles;
+  uint32_t buckets[PROFILE_BUCKETS];
+};
+
+#if QOP_PROFILE
+
+// Name used as the section label in /metrics
+const char *profileSectionName(uint8_t section);
+// Upper bound of a bucket in seconds as Prometheus writes it, "+Inf" for the last
+const char *profileBucketBound(uint8_t bucket);
+void profileRecord(uint8_t section, uint32_t cycles);
+const ProfileStats &profileStats(uint8_t section);
+
+class ProfileScope
+{
+public:
+  explicit ProfileScope(uint8_t section) : section(section), startedAt(ESP.getCycleCount()) {}
+  ~ProfileScope() { profileRecord(section, ESP.getCycleCount() - startedAt); }
+
+private:
+  uint8_t section;
+  uint32_t startedAt;
+};
+
+template <typename Call>
+inline auto profiled(uint8_t section, Call call) -> decltype(call())
+{
+  ProfileScope scope(section);
+  return call();
+}
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+// Times the rest of the enclosing block
+#define PROFILE_SCOPE(section) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(section)
+// Times one call and passes its result on
+#define PROFILED(section, ...) profiled(section, [&]() { return __VA_ARGS__; })
+
+#else
+
+#define PROFILE_SCOPE(section)
+#define PROFILED(section, ...) (__VA_ARGS__)
+
+#endif
@@ -0,0 +1,55 @@
+// Lock-free single producer / single consumer ring buffer.
+//
+// The producer (a timer callback) only writes head, the consumer (loop()) only
+// writes tail, so neither side ever waits on the other. When the consumer
+// falls behind by a full ring, new items are dropped and counted rather than
+// overwriting items the consumer may be reading.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+template <typename T, size_t N>
+class SampleRing
+{
+  static_assert(N && (N & (N - 1)) == 0, "ring capacity must be a power of two");
+
+public:
+  // Producer side
+  bool push(const T &item)
+  {
+    uint32_t head = this->head.load(std::memory_order_relaxed);
+    if (head - tail.load(std::memory_order_acquire) == N)
+    {
+      droppedItems.store(droppedItems.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      return false;
+    }
+    items[head & (N - 1)] = item;
+    this->head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side
+  bool pop(T &item)
+  {
+    uint32_t tail = this->tail.load(std::memory_order_relaxed);
+    if (tail == head.load(std::memory_order_acquire))
+    {
+      return false;
+    }
+    item = items[tail & (N - 1)];
+    this->tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  size_t size() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+  static constexpr size_t capacity() { return N; }
+  uint32_t dropped() const { return droppedItems.load(std::memory_order_relaxed); }
+
+private:
+  T items[N];
+  std::atomic<uint32_t> head{0};
+  std::atomic<uint32_t> tail{0};
+  std::atomic<uint32_t> droppedItems{0};
+};
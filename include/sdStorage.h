@@ -0,0 +1,99 @@
+// SD card bus clock and buffered day file appends.
+//
+// The SPI clock is probed once, at the first mount: from the fastest clock
+// in SD_SPI_CLOCKS_MHZ down, the first one the card initialises at and
+// reads a test sector back correctly at is kept for every later remount.
+// A write error at runtime steps it down one notch (sdStepDownClock()), the
+// next mount verifies the slower clock the same way.
+//
+// Day file appends go through dayFileWriter, which gathers events in a
+// sector sized buffer and writes them out in whole sectors: when the buffer
+// fills, when DAY_FILE_WRITER_MAX_EVENTS are waiting, when the oldest has
+// waited the durability window, before a reader opens the file and before it
+// is closed. Every event is committed to the event journal before it is
+// buffered, so the window bounds what recover() may have to replay after a
+// crash, not what a crash loses.
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+
+// Clocks tried at the first mount, fastest first. 25 MHz is the SD default speed limit.
+#define SD_SPI_CLOCKS_MHZ 25, 20, 16, 10, 8, 4, 1
+// Written and read back at each probed clock, then removed
+#define SD_PROBE_PATH "/qop.probe"
+
+#define DAY_FILE_WRITER_BUFFER 512
+// Buffered events are still in the journal's event ring (EVENT_JOURNAL_EVENT_SECTORS), with room to spare
+#define DAY_FILE_WRITER_MAX_EVENTS 16
+#define DAY_FILE_WRITER_DEFAULT_WINDOW_MS 10000
+#define DAY_FILE_WRITER_MAX_WINDOW_MS 300000
+
+// Build with -D QOP_SD_BENCHMARK=1 to run runSdBenchmark() at boot and log the card's throughput
+#ifndef QOP_SD_BENCHMARK
+#define QOP_SD_BENCHMARK 0
+#endif
+
+// Written to the card and read back by runSdBenchmark(), then removed
+#define SD_BENCHMARK_PATH "/qop.bench"
+#define SD_BENCHMARK_BYTES (256 * 1024UL)
+// The benchmark flushes every this many bytes, and times each flush
+#define SD_BENCHMARK_FLUSH_BYTES 4096
+
+// Mounts the card at the probed clock, probing first when no clock is known yet
+bool sdBegin(uint8_t csPin);
+// SPI clock of the last successful mount, 0 before it
+uint8_t sdClockMhz();
+// After an I/O error: the next sdBegin() uses the next slower clock. False at the slowest.
+bool sdStepDownClock();
+// Forgets the probed clock, the next sdBegin() probes again, as after a card swap
+void sdResetClock();
+
+class DayFileWriter
+{
+public:
+  // How long an event may stay buffered, 0 writes each one straight to the card
+  void setWindow(uint32_t ms);
+  uint32_t window() const { return windowMs; }
+
+  // Size of dayFile with what is buffered for it, where the next event goes
+  uint32_t size(File &dayFile);
+  // Buffers the bytes for dayFile, writing out what was buffered for another file first. False when a write
+  // to the card failed.
+  bool append(File &dayFile, const uint8_t *bytes, size_t length);
+  // Writes out everything buffered and flushes the day file, so readers see it
+  bool flush();
+  // flush(), then lets go of the day file; before the day file is closed
+  bool close();
+  // From loop(): flushes once the oldest buffered event has waited the window
+  bool loop();
+
+  // Bytes buffered and not yet written to the card
+  size_t pending() const { return used; }
+
+private:
+  bool writeOut(size_t length);
+
+  File file;
+  uint8_t buffer[DAY_FILE_WRITER_BUFFER];
+  size_t used = 0;
+  uint8_t events = 0;
+  uint32_t bufferedAt = 0; // millis() of the oldest buffered event
+  uint32_t windowMs = DAY_FILE_WRITER_DEFAULT_WINDOW_MS;
+};
+
+struct SdBenchmark
+{
+  uint8_t clockMhz;
+  uint32_t bytes;
+  uint32_t writeUs; // sector sized writes and the flushes between them
+  uint32_t readUs;
+  uint32_t flushes;
+  uint32_t maxFlushUs;
+  uint32_t totalFlushUs;
+};
+
+// Writes, flushes and reads back SD_BENCHMARK_BYTES on the mounted card, in sector sized blocks
+bool runSdBenchmark(SdBenchmark &result, uint32_t bytes = SD_BENCHMARK_BYTES);
+
+extern DayFileWriter dayFileWriter;
@@ -0,0 +1,89 @@
+// Retroactive correction of events logged before NTP synced.
+//
+// Until the first NTP sync after boot the clock runs on the RTC, which may
+// be off by minutes or, with a flat coin cell, by years, and
+// getLatestFileByDate() puts the events in the newest day file whatever
+// their date. Each such event is noted here with its millis() anchor: the
+// millis() of the instant its epoch was taken for. Publishing holds back
+// and the power statistics leave them out until the first sync, when one
+// sequential pass over the day file rewrites every noted event in place
+// with the NTP time of its anchor, flagged EVENT_FLAG_CORRECTED. An event
+// whose corrected date belongs to another day file is copied to that file
+// first, then marked EVENT_FLAG_MOVED where it was (a "#" line in a CSV
+// file); one dated to a day already published is corrected where it is. Both go
+// through the event journal like every other write.
+//
+// Day files stay in time order, which POFF/PRES pairing and the bisection in
+// seekEventFrom() rely on: the unpublished events of the target file later
+// than a copy are appended again after it, merged by time, and marked moved
+// where they were. A day file only ever grows, so a crash in between leaves
+// an event twice, never a torn one, and the publish cursor stays valid.
+//
+// Anchors do not survive a reboot, events logged before one stay as they
+// were. When no sync arrives within TIME_CORRECTION_HOLD_MS, the noted
+// events are released uncorrected and nothing more is noted until one does.
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+
+#include "eventRecord.h"
+
+#define TIME_CORRECTION_SLOTS 16
+#define TIME_CORRECTION_HOLD_MS (15 * 60 * 1000UL)
+
+class TimeCorrection
+{
+public:
+  // Notes an event written without NTP time at offset in dayFile. False when it cannot be corrected later:
+  // no slot left or the hold ran out.
+  bool note(File &dayFile, uint32_t offset, size_t length, const EventRecord &record);
+  // From getTimeFromMultipleSources(): corrects the noted events once NTP synced, releases them at the end
+  // of the hold
+  void loop();
+  // Publishing waits while events are noted
+  bool holding() const { return count > 0; }
+
+  size_t pending() const { return count; }
+  uint32_t corrected() const { return correctedCount; }
+  uint32_t moved() const { return movedCount; }
+  int32_t lastOffset() const { return offsetS; }
+
+private:
+  // An event of a target day file that has to follow the copies moved into it
+  struct LaterEvent
+  {
+    uint32_t offset;
+    uint32_t epoch;
+    uint8_t length;
+  };
+
+  struct Pending
+  {
+    uint32_t key;      // day file the event was logged to
+    uint32_t offset;   // of its record or line
+    uint32_t anchorMs; // millis() of the instant its epoch was taken for
+    uint32_t epoch;    // as logged
+    uint32_t uptimeMs; // of the record, to recognise it
+    uint16_t adcSample;
+    uint8_t type;
+    uint8_t length;
+  };
+
+  void apply();
+  size_t findLater(File &dayFile, boolean binaryFile, uint32_t key, uint32_t after, const uint8_t *outcomes,
+                   LaterEvent *later, size_t max) const;
+  void moveTo(uint32_t target, const EventRecord *moved, size_t copies, const uint8_t *outcomes);
+  void release();
+
+  Pending slots[TIME_CORRECTION_SLOTS];
+  size_t count = 0;
+  uint32_t firstNotedAt = 0;
+  bool gaveUp = false;
+  bool applying = false;
+  uint32_t correctedCount = 0;
+  uint32_t movedCount = 0;
+  int32_t offsetS = 0;
+};
+
+extern TimeCorrection timeCorrection;
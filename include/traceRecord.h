@@ -0,0 +1,92 @@
+// Trace file format of traceRecorder (traceRecorder.h), shared by the
+// firmware and the host replay (host/traceReplay).
+//
+// A trace is what the detection, logging and publishing code took in from
+// outside during one boot, enough to run the same code again on the host:
+//
+//   TRACE_SAMPLES   up to TRACE_SAMPLES_PER_RECORD block means of
+//                   mainsSampler, TRACE block milliseconds apart
+//   TRACE_BURST     the mean of a light sleep burst of A0 reads (powerState.h)
+//   TRACE_CLOCK     what a clockService resync read from NTP and the RTC
+//   TRACE_WIFI      WiFi.status() changed
+//   TRACE_PUBLISH   the outcome of a batch or report handed to the publisher
+//   TRACE_GAP       records lost while the recorder's RAM ring was full
+//
+// A trace file is one TraceFileHeader followed by fixed size TraceRecords,
+// little endian like the binary day files. Records are appended in the order
+// they were completed, not by at: a TRACE_SAMPLES record is written once it
+// is full, after the records noted while it filled.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_FILE_MAGIC 0x54504F51 // "QOPT"
+#define TRACE_FILE_VERSION 1
+#define TRACE_SAMPLES_PER_RECORD 5
+
+enum TraceKind : uint8_t
+{
+  TRACE_NONE = 0,
+  TRACE_SAMPLES = 1,
+  TRACE_BURST = 2,
+  TRACE_CLOCK = 3,
+  TRACE_WIFI = 4,
+  TRACE_PUBLISH = 5,
+  TRACE_GAP = 6,
+  TRACE_KIND_LAST = TRACE_GAP,
+};
+
+// TraceFileHeader flags: the clock ran on NTP time when the trace started
+#define TRACE_HEADER_NTP_SYNCED 0x01
+// TRACE_CLOCK flags: NTP was asked, data[0] is its answer (0 when it had none)
+#define TRACE_CLOCK_NTP_ASKED 0x01
+// TRACE_PUBLISH flags
+#define TRACE_PUBLISH_OK 0x01
+#define TRACE_PUBLISH_REPORT 0x02
+
+struct TraceFileHeader
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t recordSize;
+  uint16_t blockMs;     // mainsSampler block length
+  uint8_t flags;        // TRACE_HEADER_*
+  uint8_t reserved;
+  uint32_t startedAtMs; // millis() the trace started at
+  uint32_t epoch;       // clock time at startedAtMs
+  uint32_t crc;         // CRC-32 of the fields above
+};
+
+//   kind            flags                  value                    data[0]                  data[1]
+//   TRACE_SAMPLES   means held             first mean               means 2 and 3            means 4 and 5
+//   TRACE_BURST                            burst mean
+//   TRACE_CLOCK     TRACE_CLOCK_*                                   NTP epoch                RTC epoch
+//   TRACE_WIFI                             wl_status_t
+//   TRACE_PUBLISH   TRACE_PUBLISH_*        events, or report period first epoch, or bucket start
+//   TRACE_GAP                                                       records lost
+struct TraceRecord
+{
+  uint32_t at; // millis()
+  uint8_t kind; // TraceKind
+  uint8_t flags;
+  uint16_t value;
+  uint32_t data[2];
+};
+
+static_assert(sizeof(TraceFileHeader) == 24, "trace file header must stay 24 bytes");
+static_assert(sizeof(TraceRecord) == 16, "trace records must stay 16 bytes, 32 to a sector");
+
+void initTraceFileHeader(TraceFileHeader &header, uint16_t blockMs, uint32_t startedAtMs, uint32_t epoch,
+                         bool ntpSynced);
+bool isTraceFileHeaderValid(const TraceFileHeader &header);
+bool isTraceRecordValid(const TraceRecord &record);
+
+// Starts a TRACE_SAMPLES record with one block mean
+void initTraceSamples(TraceRecord &record, uint32_t takenAt, uint16_t mean);
+// Adds the next block mean; false when the record is full or the block does not follow its last one
+bool addTraceSample(TraceRecord &record, uint32_t takenAt, uint16_t mean, uint16_t blockMs);
+// Block mean i of a TRACE_SAMPLES record, taken at record.at + i * blockMs
+uint16_t traceSampleAt(const TraceRecord &record, uint8_t i);
+
+const char *traceKindName(uint8_t kind);
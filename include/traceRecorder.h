@@ -0,0 +1,81 @@
+// Records what the detection, logging and publishing code takes in, for
+// host/traceReplay to run the same code on it again.
+//
+// With the "traceRecord" setting on, every block mean mainsSampler hands the
+// detector, the light sleep bursts, each clock resync's NTP and RTC reads,
+// WiFi status changes and every publish outcome are noted as TraceRecords
+// (traceRecord.h) into a RAM ring. loop() appends the ring to
+// /qop-trace/<epoch the trace started at, hex> a sector at a time, or every
+// TRACE_FLUSH_INTERVAL_MS, while the card is mounted; what is noted during
+// an outage waits in the ring for the resume. Records noted while the ring
+// is full are counted and a TRACE_GAP stands in for them.
+//
+// Block means come five to a record, about 2.7 MB a day. Bursts are only
+// noted when they moved by more than TRACE_BURST_DELTA counts or crossed the
+// resume level, the replay holds the last one noted, so an hour of light
+// sleep costs a few records. A trace stops growing at TRACE_MAX_FILE_BYTES.
+#pragma once
+
+#include <Arduino.h>
+
+#include "mainsSampler.h"
+#include "traceRecord.h"
+
+#define TRACE_ROOT "/qop-trace"
+// A power of two; 128 records hold a minute of block means
+#define TRACE_RING_RECORDS 128
+#define TRACE_FLUSH_RECORDS 32
+#define TRACE_FLUSH_INTERVAL_MS 30000
+#define TRACE_BURST_DELTA 8
+#define TRACE_MAX_FILE_BYTES (32UL << 20)
+
+class TraceRecorder
+{
+public:
+  // Off drops what was not written yet; on starts a new trace file on the next loop()
+  void setEnabled(bool enabled);
+  bool enabled() const { return on; }
+
+  // From updatePowerStatusIfChanged(), with each block before the detector sees it
+  void noteSample(const MainsSample &sample);
+  // From powerState's light sleep, with each burst's mean
+  void noteBurst(uint16_t mean, bool resumeLevel);
+  // From ClockService::resync(), ntpEpoch is 0 when NTP was not asked
+  void noteClock(uint32_t at, bool ntpAsked, uint32_t ntpEpoch, uint32_t rtcEpoch);
+  // From Outbox::attempt(), after the publisher returned
+  void notePublish(bool report, uint16_t count, uint32_t first, bool ok);
+
+  // From updatePowerStatusIfChanged(): starts the trace, notes WiFi status changes, writes the ring out
+  void loop();
+
+  uint32_t records() const { return head; }
+  uint32_t lostRecords() const { return lostTotal; }
+  uint32_t bytesWritten() const { return written; }
+
+private:
+  void push(const TraceRecord &record);
+  void flush();
+
+  bool on = false;
+  bool started = false;
+  bool full = false; // the trace reached TRACE_MAX_FILE_BYTES
+  char path[32] = "";
+  TraceFileHeader header = {};
+  uint32_t lastFlush = 0;
+  uint8_t wifiStatus = 0xFF;
+  bool haveBurst = false;
+  uint16_t lastBurst = 0;
+  bool lastBurstResumes = false;
+  bool packing = false;
+  TraceRecord samples = {};
+
+  TraceRecord ring[TRACE_RING_RECORDS];
+  uint32_t head = 0; // records noted
+  uint32_t tail = 0; // records written out or dropped
+  uint32_t lost = 0; // since the last TRACE_GAP
+  uint32_t lostAt = 0;
+  uint32_t lostTotal = 0;
+  uint32_t written = 0;
+};
+
+extern TraceRecorder traceRecorder;
@@ -0,0 +1,19 @@
+// Posts a one line summary of each event batch, and each daily or monthly report, as a tweet
+#pragma once
+
+#include <Arduino.h>
+#include <TwitterWebAPI.h>
+
+#include "eventPublisher.h"
+
+class TwitterPublisher : public EventPublisher
+{
+public:
+  TwitterPublisher(TwitterClient &client) : client(client) {}
+  const char *name() const override { return "twitter"; }
+  bool publish(const EventBatch &batch) override;
+  bool publishReport(PowerStatsPeriod period, const PowerStatsBucket &bucket) override;
+
+private:
+  TwitterClient &client;
+};
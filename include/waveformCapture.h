@@ -0,0 +1,102 @@
+// High rate A0 capture mode.
+//
+// The block sampler reads A0 every 5 ms and only keeps block means, too
+// slow to see flicker, the mains frequency or a dropout of a few cycles.
+// With capture on, mainsSampler reads a window of A0 at
+// WAVEFORM_SAMPLE_RATE_HZ in a burst from loop() every
+// WAVEFORM_BURST_INTERVAL_MS and hands every read to add(). add() fills one
+// of two windows while loop() reduces the other to WaveformMetrics
+// (waveformMetrics.h); a burst only starts while canFill(), a window finished
+// with the other one still waiting is counted as dropped.
+//
+// With raw saving on, a window whose mean moves by WAVEFORM_TRANSITION_COUNTS
+// or that shows a dropout is written to /qop-wave together with the window
+// burst before it, at most once per WAVEFORM_SAVE_MIN_INTERVAL_MS, for qop-reader
+// to look at. Files are named by the epoch of their first read in hex. The
+// windows of a resume are not saved: the card is mounted again only once
+// the detector has confirmed it.
+#pragma once
+
+#include <Arduino.h>
+
+#include "waveformMetrics.h"
+
+#define WAVEFORM_ROOT "/qop-wave"
+// Change of a window's mean from the one before that saves both
+#define WAVEFORM_TRANSITION_COUNTS 48
+#define WAVEFORM_SAVE_MIN_INTERVAL_MS 10000
+
+class WaveformCapture
+{
+public:
+  // Empty windows, from MainsSampler::begin(); the counters run on since boot
+  void restart();
+  void setSaveRaw(bool enabled) { saveRaw = enabled; }
+
+  // The window a burst fills can be handed on once full
+  bool canFill() const { return !full[filling ^ 1]; }
+  // From mainsSampler's bursts
+  void add(uint16_t value)
+  {
+    if (used == 0)
+    {
+      startedAt[filling] = millis();
+    }
+    buffers[filling][used++] = value;
+    if (used < WAVEFORM_WINDOW_SAMPLES)
+    {
+      return;
+    }
+    used = 0;
+    if (full[filling ^ 1])
+    {
+      dropped++;
+      return;
+    }
+    full[filling] = true;
+    filling ^= 1;
+  }
+
+  // From loop(): reduces the window add() finished, saving it when it shows a transition. False when no
+  // window was waiting.
+  bool loop();
+
+  // Metrics of the newest window, once windows() > 0
+  const WaveformMetrics &last() const { return latest; }
+  uint32_t windows() const { return windowCount; }
+  uint32_t droppedWindows() const { return dropped; }
+  // Windows a dropout started in
+  uint32_t dropouts() const { return dropoutCount; }
+  uint32_t savedFiles() const { return savedCount; }
+  // Lowest and highest mains frequency of steady windows, 1/100 Hz, 0 before one was seen
+  uint16_t minFrequency() const { return lowestFrequency; }
+  uint16_t maxFrequency() const { return highestFrequency; }
+
+private:
+  bool isTransition(const WaveformMetrics &metrics) const;
+  void save(const uint16_t *window);
+
+  uint16_t buffers[2][WAVEFORM_WINDOW_SAMPLES];
+  uint32_t startedAt[2] = {0, 0};
+  bool full[2] = {false, false};
+  uint8_t filling = 0;
+  uint16_t used = 0;
+  uint32_t dropped = 0;
+
+  // the window before the newest, written out with it
+  uint16_t before[WAVEFORM_WINDOW_SAMPLES];
+  uint32_t beforeAt = 0;
+  bool haveBefore = false;
+  uint32_t droppedBefore = 0; // dropped when before was taken, unchanged when no burst came in between
+  bool saveRaw = false;
+  uint32_t lastSavedAt = 0;
+
+  WaveformMetrics latest = {};
+  uint32_t windowCount = 0;
+  uint32_t dropoutCount = 0;
+  uint32_t savedCount = 0;
+  uint16_t lowestFrequency = 0;
+  uint16_t highestFrequency = 0;
+};
+
+extern WaveformCapture waveformCapture;
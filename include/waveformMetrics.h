@@ -0,0 +1,82 @@
+// Window metrics of high rate A0 captures, and the raw capture file format, shared by the firmware and the host
+// tools.
+//
+// The mains sense divider follows a rectified and smoothed transformer
+// output: the mean of a window is the supply level, what rides on it the
+// ripple, twice the mains frequency with a full-wave rectifier. A window of
+// WAVEFORM_WINDOW_SAMPLES reads is reduced to
+//
+//   mean, min, max       ADC counts
+//   rms                  ADC counts, of the reads as they are
+//   ripple               hundredths of an ADC count, rms of the reads less their mean
+//   frequency            hundredths of a Hz, from the rising crossings of the mean
+//
+// Integer math only, the sums run four reads per iteration. The frequency
+// interpolates each crossing between the two reads around it, in 1/256ths of
+// a read, so a window of a few cycles still resolves a few hundredths of a Hz.
+//
+// A raw capture file is one WaveformFileHeader followed by windows times
+// windowSamples little-endian uint16 reads.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define WAVEFORM_SAMPLE_RATE_HZ 2000
+// 128 ms at 2 kHz, six and a half 50 Hz cycles
+#define WAVEFORM_WINDOW_SAMPLES 256
+// A window is read as one burst from loop() this often
+#define WAVEFORM_BURST_INTERVAL_MS 1000
+// Ripple periods per mains cycle: 2 behind a full-wave rectifier, 1 behind a half-wave one
+#define WAVEFORM_RIPPLE_PER_CYCLE 2
+// Counts below the mean a read has to go before the next rise through it counts as a crossing
+#define WAVEFORM_CROSSING_HYSTERESIS 2
+
+#define WAVEFORM_FILE_MAGIC 0x57504F51 // "QOPW"
+#define WAVEFORM_FILE_VERSION 1
+
+// A read dipped below the off threshold while the window's mean stayed above it
+#define WAVEFORM_FLAG_DROPOUT 0x01
+
+static_assert((uint64_t)WAVEFORM_WINDOW_SAMPLES * 1023 * 1023 <= UINT32_MAX, "the sum of squares must fit 32 bits");
+static_assert(WAVEFORM_WINDOW_SAMPLES % 4 == 0, "windows are summed four reads at a time");
+
+struct WaveformMetrics
+{
+  uint32_t takenAt; // millis() of the window's first read
+  uint16_t mean;
+  uint16_t min;
+  uint16_t max;
+  uint16_t rms;
+  uint16_t ripple;           // 1/100 ADC count
+  uint16_t frequencyCentiHz; // mains frequency, 0 when the ripple does not cross its mean twice
+  uint8_t crossings;         // rising crossings of the mean
+  uint8_t flags;             // WAVEFORM_FLAG_*
+};
+
+struct WaveformFileHeader
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t sampleRateHz;
+  uint16_t windowSamples;
+  uint16_t windows;
+  uint32_t epoch;     // of the first read
+  uint32_t takenAtMs; // millis() of the first read
+  uint32_t crc;       // CRC-32 of the header before it, then of the reads
+};
+
+static_assert(sizeof(WaveformFileHeader) == 24, "the capture file header must stay 24 bytes");
+
+// Reduces samples reads taken at sampleRateHz, a multiple of 4 up to WAVEFORM_WINDOW_SAMPLES; offBelow sets
+// WAVEFORM_FLAG_DROPOUT
+void computeWaveformMetrics(const uint16_t *reads, size_t samples, uint16_t sampleRateHz, uint16_t offBelow,
+                            WaveformMetrics &metrics);
+// Square root rounded down
+uint32_t isqrt32(uint32_t value);
+
+void initWaveformFileHeader(WaveformFileHeader &header, uint16_t sampleRateHz, uint16_t windowSamples,
+                            uint16_t windows, uint32_t epoch, uint32_t takenAtMs);
+// CRC-32 of the header fields before crc; header.crc continues it over the reads with crc32()
+uint32_t waveformHeaderCrc(const WaveformFileHeader &header);
+bool isWaveformFileValid(const WaveformFileHeader &header, const uint16_t *reads, size_t count);
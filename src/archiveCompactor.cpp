@@ -0,0 +1,271 @@
+#include "archiveCompactor.h"
+
+#include <SD.h>
+
+#include "eventLog.h"
+#include "logger.h"
+
+ArchiveCompactor archiveCompactor;
+DayFileIndex archivedDayIndex(ARCHIVE_ROOT);
+
+void archivePath(uint32_t month, char *buf, size_t length)
+{
+  snprintf(buf, length, "%s/%06lu", ARCHIVE_ROOT, (unsigned long)month);
+}
+
+static bool readArchiveHeader(File &archive, ArchiveHeader &header)
+{
+  return archive.seek(0) && archive.read((uint8_t *)&header, sizeof(header)) == sizeof(header) &&
+         isArchiveHeaderValid(header);
+}
+
+bool isDayArchived(uint32_t key)
+{
+  char path[32];
+  archivePath(key / 100, path, sizeof(path));
+  File archive = SDFS.open(path, "r");
+  if (!archive)
+  {
+    return false;
+  }
+  ArchiveHeader header;
+  bool archived = readArchiveHeader(archive, header) && findArchiveDay(header, key) != NULL;
+  archive.close();
+  return archived;
+}
+
+void ArchiveCompactor::begin()
+{
+  archivedDayIndex = DayFileIndex(ARCHIVE_ROOT);
+  stalled = false;
+  if (!SD.exists(ARCHIVE_ROOT))
+  {
+    SD.mkdir("qop-archive");
+  }
+  File root = SD.open(ARCHIVE_ROOT);
+  size_t archives = 0;
+  ArchiveHeader header;
+  while (root)
+  {
+    File archive = root.openNextFile();
+    if (!archive)
+    {
+      break;
+    }
+    if (!archive.isDirectory() && readArchiveHeader(archive, header))
+    {
+      archives++;
+      for (uint16_t i = 0; i < header.dayCount; i++)
+      {
+        archivedDayIndex.add(header.days[i].key);
+      }
+    }
+    archive.close();
+  }
+  root.close();
+  LOG_INFO("archive index: %u days in %u archives", (unsigned)archivedDayIndex.size(), (unsigned)archives);
+}
+
+bool ArchiveCompactor::step(time_t now)
+{
+  if (!storageReady || stalled || publishedDayFileIndex.empty())
+  {
+    return false;
+  }
+  uint32_t key = publishedDayFileIndex.key(0);
+  uint32_t month = key / 100;
+  if (month >= dayFileKeyForEpoch(now) / 100)
+  {
+    return false;
+  }
+  char dayPath[32];
+  char path[32];
+  publishedDayFileIndex.path(key, dayPath, sizeof(dayPath));
+  archivePath(month, path, sizeof(path));
+
+  ArchiveHeader header;
+  if (!SD.exists(path))
+  {
+    LOG_INFO("archive: starting %s", path);
+    initArchiveHeader(header, month);
+    File created = SDFS.open(path, "w");
+    bool ok = created && created.write((const uint8_t *)&header, sizeof(header)) == sizeof(header);
+    created.close();
+    if (!ok)
+    {
+      SD.remove(path);
+      LOG_ERROR("archive: cannot create %s", path);
+      return false;
+    }
+  }
+  File archive = SDFS.open(path, "r+");
+  if (!archive || !readArchiveHeader(archive, header))
+  {
+    // the days it holds are no day files any more, it is never written over
+    LOG_ERROR("archive: %s is unreadable, packing stops", path);
+    archive.close();
+    stalled = true;
+    return false;
+  }
+  // packed before a power loss kept the day file from being removed
+  if (findArchiveDay(header, key) == NULL)
+  {
+    if (header.dayCount >= ARCHIVE_MAX_DAYS)
+    {
+      LOG_ERROR("archive: %s is full, %lu stays a day file", path, (unsigned long)key);
+      archive.close();
+      stalled = true;
+      return false;
+    }
+    if (!pack(archive, header, key, dayPath))
+    {
+      archive.close();
+      return false;
+    }
+  }
+  archive.close();
+  SD.remove(dayPath);
+  publishedDayFileIndex.remove(key);
+  archivedDayIndex.add(key);
+  days++;
+  return true;
+}
+
+// Appends the day file's events to the archive as one block, then adds the day to the header
+bool ArchiveCompactor::pack(File &archive, ArchiveHeader &header, uint32_t key, const char *dayPath)
+{
+  File dayFile = SD.open(dayPath, FILE_READ);
+  if (!dayFile)
+  {
+    LOG_ERROR("archive: cannot open %s", dayPath);
+    return false;
+  }
+  uint32_t dayBytes = dayFile.size();
+  boolean binaryFile = readEventFileHeader(dayFile);
+  // right after the last block the header knows of, over any block a power loss kept out of it
+  uint32_t offset = sizeof(header);
+  for (uint16_t i = 0; i < header.dayCount; i++)
+  {
+    uint32_t end = header.days[i].offset + header.days[i].length + sizeof(uint32_t);
+    offset = end > offset ? end : offset;
+  }
+  bool ok = archive.seek(offset);
+
+  uint8_t chunk[ARCHIVE_WRITE_BUFFER];
+  size_t used = 0;
+  uint32_t length = 0;
+  uint32_t crc = 0;
+  uint16_t events = 0;
+  ArchiveCodec codec;
+  EventRecord event;
+  while (ok && events < UINT16_MAX && readNextEvent(dayFile, binaryFile, event))
+  {
+    used += encodeArchiveEvent(event, codec, chunk + used);
+    events++;
+    if (used > sizeof(chunk) - ARCHIVE_EVENT_MAX_BYTES)
+    {
+      ok = archive.write(chunk, used) == used;
+      crc = crc32(chunk, used, crc);
+      length += used;
+      used = 0;
+    }
+  }
+  dayFile.close();
+  if (ok && used > 0)
+  {
+    ok = archive.write(chunk, used) == used;
+    crc = crc32(chunk, used, crc);
+    length += used;
+  }
+  ok = ok && archive.write((const uint8_t *)&crc, sizeof(crc)) == sizeof(crc);
+  archive.flush();
+  if (!ok)
+  {
+    LOG_ERROR("archive: writing %lu failed", (unsigned long)key);
+    return false;
+  }
+
+  ArchiveDay &day = header.days[header.dayCount++];
+  day.key = key;
+  day.offset = offset;
+  day.length = length;
+  day.events = events;
+  day.reserved = 0;
+  sealArchiveHeader(header);
+  ok = archive.seek(0) && archive.write((const uint8_t *)&header, sizeof(header)) == sizeof(header);
+  archive.flush();
+  if (!ok)
+  {
+    LOG_ERROR("archive: header update for %lu failed", (unsigned long)key);
+    return false;
+  }
+  inBytes += dayBytes;
+  outBytes += length + sizeof(crc);
+  LOG_DEBUG("archive: packed %lu, %u events, %lu bytes into %lu", (unsigned long)key, (unsigned)events,
+            (unsigned long)dayBytes, (unsigned long)(length + sizeof(crc)));
+  return true;
+}
+
+bool ArchiveDayReader::open(uint32_t key)
+{
+  close();
+  char path[32];
+  archivePath(key / 100, path, sizeof(path));
+  file = SDFS.open(path, "r");
+  ArchiveHeader header;
+  const ArchiveDay *day = file && readArchiveHeader(file, header) ? findArchiveDay(header, key) : NULL;
+  if (day == NULL || !file.seek(day->offset))
+  {
+    close();
+    return false;
+  }
+  codec = ArchiveCodec();
+  used = 0;
+  position = 0;
+  remaining = day->length;
+  crc = 0;
+  dayEvents = day->events;
+  return true;
+}
+
+bool ArchiveDayReader::next(EventRecord &event)
+{
+  if (!file)
+  {
+    return false;
+  }
+  if (used - position < ARCHIVE_EVENT_MAX_BYTES && remaining > 0)
+  {
+    memmove(buffer, buffer + position, used - position);
+    used -= position;
+    position = 0;
+    size_t wanted = sizeof(buffer) - used < remaining ? sizeof(buffer) - used : remaining;
+    size_t got = file.read(buffer + used, wanted);
+    crc = crc32(buffer + used, got, crc);
+    used += got;
+    remaining = got == wanted ? remaining - got : 0;
+  }
+  size_t consumed = decodeArchiveEvent(buffer + position, used - position, codec, event);
+  if (consumed > 0)
+  {
+    position += consumed;
+    return true;
+  }
+  // the day is read out: check the block against its CRC, too late to hold events back but not to say so
+  uint32_t stored = 0;
+  if (position != used || file.read((uint8_t *)&stored, sizeof(stored)) != sizeof(stored) || stored != crc)
+  {
+    LOG_WARN("archive: day block fails its checksum");
+  }
+  close();
+  return false;
+}
+
+void ArchiveDayReader::close()
+{
+  if (file)
+  {
+    file.close();
+  }
+  file = File();
+}
@@ -0,0 +1,36 @@
+#include "bootTimer.h"
+#include "logger.h"
+
+BootTimer bootTimer;
+
+void BootTimer::mark(BootPhase phase)
+{
+  if (reached(phase))
+  {
+    return;
+  }
+  completedAt[phase] = millis();
+  reachedMask |= 1 << phase;
+  LOG_INFO("boot: %s at %lu ms", bootPhaseName(phase), (unsigned long)completedAt[phase]);
+}
+
+const char *bootPhaseName(BootPhase phase)
+{
+  switch (phase)
+  {
+  case BOOT_CLOCK:
+    return "clock";
+  case BOOT_STORAGE:
+    return "storage";
+  case BOOT_SENSING:
+    return "sensing";
+  case BOOT_NETWORK:
+    return "network";
+  case BOOT_WIFI:
+    return "wifi";
+  case BOOT_NTP:
+    return "ntp";
+  default:
+    return "?";
+  }
+}
@@ -0,0 +1,61 @@
+#include "clientIo.h"
+
+static bool waitForData(Client &client, uint32_t startedAt, uint32_t timeoutMs)
+{
+  while (!client.available())
+  {
+    if (!client.connected() || millis() - startedAt > timeoutMs)
+    {
+      return false;
+    }
+    delay(1);
+  }
+  return true;
+}
+
+bool readExact(Client &client, uint8_t *buf, size_t length, uint32_t timeoutMs)
+{
+  uint32_t startedAt = millis();
+  size_t received = 0;
+  while (received < length)
+  {
+    if (!waitForData(client, startedAt, timeoutMs))
+    {
+      return false;
+    }
+    int n = client.read(buf + received, length - received);
+    if (n > 0)
+    {
+      received += n;
+    }
+  }
+  return true;
+}
+
+int readLine(Client &client, char *buf, size_t length, uint32_t timeoutMs)
+{
+  uint32_t startedAt = millis();
+  size_t used = 0;
+  while (true)
+  {
+    if (!waitForData(client, startedAt, timeoutMs))
+    {
+      return -1;
+    }
+    int c = client.read();
+    if (c < 0 || c == '\r')
+    {
+      continue;
+    }
+    if (c == '\n')
+    {
+      break;
+    }
+    if (used + 1 < length)
+    {
+      buf[used++] = c;
+    }
+  }
+  buf[used] = '\0';
+  return used;
+}
@@ -0,0 +1,104 @@
+#include "clockService.h"
+#include "logger.h"
+#include "profiler.h"
+#include "traceRecorder.h"
+
+#include <ESP8266WiFi.h>
+
+ClockService clockService;
+
+void ClockService::begin(TwitterClient &ntpSource, RTC_DS1307 &rtc, uint32_t resyncIntervalMs)
+{
+  this->ntpSource = &ntpSource;
+  this->rtc = &rtc;
+  this->resyncIntervalMs = resyncIntervalMs;
+  currentIntervalMs = resyncIntervalMs;
+  resync();
+}
+
+void ClockService::begin(RTC_DS1307 &rtc, uint32_t resyncIntervalMs)
+{
+  ntpSource = nullptr;
+  this->rtc = &rtc;
+  this->resyncIntervalMs = resyncIntervalMs;
+  currentIntervalMs = resyncIntervalMs;
+  resync();
+}
+
+void ClockService::attachNtp(TwitterClient &ntpSource)
+{
+  this->ntpSource = &ntpSource;
+}
+
+time_t ClockService::now()
+{
+  uint32_t interval = ntpSynced ? currentIntervalMs : CLOCK_MIN_RESYNC_INTERVAL_MS;
+  if (!anchored || millis() - anchorMillis >= interval)
+  {
+    resync();
+  }
+  return epochAt(millis());
+}
+
+time_t ClockService::epochAt(uint32_t millisValue)
+{
+  return anchorEpoch + (int32_t)(millisValue - anchorMillis) / 1000;
+}
+
+void ClockService::resync()
+{
+  if (rtc == nullptr)
+  {
+    return;
+  }
+  resyncCount++;
+  uint32_t syncMillis = millis();
+  bool askNtp = ntpSource != nullptr && (ntpSynced || WiFi.status() == WL_CONNECTED);
+  time_t ntpEpoch = askNtp ? ntpSource->getEpoch() : 0;
+  time_t rtcEpoch = PROFILED(PROFILE_RTC_NOW, rtc->now()).unixtime();
+  traceRecorder.noteClock(syncMillis, askNtp, ntpEpoch, rtcEpoch);
+  time_t epoch;
+  ntpSynced = ntpEpoch >= NTP_VALID_EPOCH;
+  if (ntpSynced)
+  {
+    epoch = ntpEpoch;
+    if (requireRtcTimeAdjustment(ntpEpoch, rtcEpoch))
+    {
+      LOG_INFO("adjusting RTC clock, drift: %ld", (long)(rtcEpoch - ntpEpoch));
+      rtc->adjust(DateTime((uint32_t)ntpEpoch));
+    }
+  }
+  else
+  {
+    epoch = rtcEpoch;
+  }
+
+  if (anchored)
+  {
+    measuredDrift = epoch - epochAt(syncMillis);
+    if (abs(measuredDrift) > CLOCK_MAX_DRIFT_S)
+    {
+      currentIntervalMs /= 2;
+      if (currentIntervalMs < CLOCK_MIN_RESYNC_INTERVAL_MS)
+      {
+        currentIntervalMs = CLOCK_MIN_RESYNC_INTERVAL_MS;
+      }
+    }
+    else if (currentIntervalMs < resyncIntervalMs)
+    {
+      currentIntervalMs = currentIntervalMs * 2 < resyncIntervalMs ? currentIntervalMs * 2 : resyncIntervalMs;
+    }
+  }
+  anchorEpoch = epoch;
+  anchorMillis = syncMillis;
+  anchored = true;
+
+  LOG_DEBUG("clock resynced from %s, epoch: %ld, drift: %ld", ntpSynced ? "NTP" : "RTC", (long)epoch,
+            (long)measuredDrift);
+}
+
+// Compares whole epochs, so an RTC running ahead or behind, across any unit boundary, is caught
+boolean requireRtcTimeAdjustment(time_t ntpEpoch, time_t rtcEpoch)
+{
+  return abs((long)(ntpEpoch - rtcEpoch)) > CLOCK_RTC_MAX_DRIFT_S;
+}
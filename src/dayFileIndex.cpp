@@ -0,0 +1,108 @@
+#include "dayFileIndex.h"
+#include "logger.h"
+
+#include <Arduino.h>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+DayFileIndex dayFileIndex;
+DayFileIndex publishedDayFileIndex("/qop-published");
+
+DayFileIndex::DayFileIndex(const char *rootPath)
+{
+  strlcpy(root, rootPath, sizeof(root));
+}
+
+void DayFileIndex::build(File rootDir)
+{
+  keys.clear();
+  strlcpy(root, rootDir.fullName(), sizeof(root));
+  // dataRoot is reused across calls, start the directory walk over every time
+  rootDir.rewindDirectory();
+  while (true)
+  {
+    File pickedFile = rootDir.openNextFile();
+    if (!pickedFile)
+    {
+      break;
+    }
+    uint32_t key = dayFileKey(pickedFile.name());
+    pickedFile.close();
+    if (key != 0)
+    {
+      keys.push_back(key);
+    }
+  }
+  std::sort(keys.begin(), keys.end());
+  isBuilt = true;
+  LOG_INFO("day file index: %u files", (unsigned)keys.size());
+}
+
+void DayFileIndex::add(uint32_t key)
+{
+  if (key == 0)
+  {
+    return;
+  }
+  // new day files are nearly always the newest
+  if (keys.empty() || key > keys.back())
+  {
+    keys.push_back(key);
+    return;
+  }
+  std::vector<uint32_t>::iterator at = std::lower_bound(keys.begin(), keys.end(), key);
+  if (*at != key)
+  {
+    keys.insert(at, key);
+  }
+}
+
+void DayFileIndex::remove(uint32_t key)
+{
+  std::vector<uint32_t>::iterator at = std::lower_bound(keys.begin(), keys.end(), key);
+  if (at != keys.end() && *at == key)
+  {
+    keys.erase(at);
+  }
+}
+
+bool DayFileIndex::contains(uint32_t key) const
+{
+  return std::binary_search(keys.begin(), keys.end(), key);
+}
+
+size_t DayFileIndex::lowerBound(uint32_t key) const
+{
+  return std::lower_bound(keys.begin(), keys.end(), key) - keys.begin();
+}
+
+void DayFileIndex::path(uint32_t key, char *buf, size_t length) const
+{
+  snprintf(buf, length, "%s/%08lu", root, (unsigned long)key);
+}
+
+uint32_t dayFileKey(const char *name)
+{
+  const char *slash = strrchr(name, '/');
+  if (slash != NULL)
+  {
+    name = slash + 1;
+  }
+  uint32_t key = 0;
+  for (int i = 0; i < 8; i++)
+  {
+    if (name[i] < '0' || name[i] > '9')
+    {
+      return 0;
+    }
+    key = key * 10 + (name[i] - '0');
+  }
+  return name[8] == '\0' ? key : 0;
+}
+
+uint32_t dayFileKeyForEpoch(time_t epoch)
+{
+  tm *localTime = localtime(&epoch);
+  return (1900 + localTime->tm_year) * 10000UL + (localTime->tm_mon + 1) * 100UL + localTime->tm_mday;
+}
@@ -0,0 +1,125 @@
+#include "eventArchive.h"
+
+#include <string.h>
+
+void initArchiveHeader(ArchiveHeader &header, uint32_t month)
+{
+  memset(&header, 0, sizeof(header));
+  header.magic = ARCHIVE_MAGIC;
+  header.version = ARCHIVE_VERSION;
+  header.month = month;
+  sealArchiveHeader(header);
+}
+
+static uint32_t archiveHeaderCrc(const ArchiveHeader &header)
+{
+  uint32_t crc = crc32((const uint8_t *)&header, offsetof(ArchiveHeader, crc));
+  return crc32((const uint8_t *)header.days, sizeof(header.days), crc);
+}
+
+void sealArchiveHeader(ArchiveHeader &header)
+{
+  header.crc = archiveHeaderCrc(header);
+}
+
+bool isArchiveHeaderValid(const ArchiveHeader &header)
+{
+  return header.magic == ARCHIVE_MAGIC && header.version == ARCHIVE_VERSION &&
+         header.dayCount <= ARCHIVE_MAX_DAYS && header.crc == archiveHeaderCrc(header);
+}
+
+const ArchiveDay *findArchiveDay(const ArchiveHeader &header, uint32_t key)
+{
+  for (uint16_t i = 0; i < header.dayCount && i < ARCHIVE_MAX_DAYS; i++)
+  {
+    if (header.days[i].key == key)
+    {
+      return &header.days[i];
+    }
+  }
+  return NULL;
+}
+
+static size_t putVarint(uint8_t *out, uint32_t value)
+{
+  size_t used = 0;
+  while (value >= 0x80)
+  {
+    out[used++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  out[used++] = (uint8_t)value;
+  return used;
+}
+
+// False when data ends inside the varint or it runs past 32 bits
+static bool getVarint(const uint8_t *data, size_t length, size_t &position, uint32_t &value)
+{
+  value = 0;
+  for (int shift = 0; shift < 35; shift += 7)
+  {
+    if (position >= length)
+    {
+      return false;
+    }
+    uint8_t byte = data[position++];
+    value |= (uint32_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Deltas go either way: the clock is set back by an NTP sync, millis() restarts with every boot
+static uint32_t zigzag(uint32_t delta)
+{
+  return (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+}
+
+static uint32_t unzigzag(uint32_t value)
+{
+  return (value >> 1) ^ (0 - (value & 1));
+}
+
+size_t encodeArchiveEvent(const EventRecord &event, ArchiveCodec &codec, uint8_t *out)
+{
+  size_t used = 0;
+  out[used++] = (uint8_t)((event.type & 0x0F) | (event.flags << 4));
+  used += putVarint(out + used, zigzag(event.epoch - codec.epoch));
+  used += putVarint(out + used, zigzag(event.uptimeMs - codec.uptimeMs));
+  used += putVarint(out + used, event.adcSample);
+  codec.epoch = event.epoch;
+  codec.uptimeMs = event.uptimeMs;
+  return used;
+}
+
+size_t decodeArchiveEvent(const uint8_t *data, size_t length, ArchiveCodec &codec, EventRecord &event)
+{
+  if (length == 0)
+  {
+    return 0;
+  }
+  size_t position = 1;
+  uint32_t epochDelta, uptimeDelta, adcSample;
+  if (!getVarint(data, length, position, epochDelta) || !getVarint(data, length, position, uptimeDelta) ||
+      !getVarint(data, length, position, adcSample))
+  {
+    return 0;
+  }
+  memset(&event, 0, sizeof(event));
+  event.type = data[0] & 0x0F;
+  event.flags = data[0] >> 4;
+  if (event.type == EVENT_TYPE_NONE || event.type > EVENT_TYPE_LAST || adcSample > UINT16_MAX)
+  {
+    return 0;
+  }
+  event.epoch = codec.epoch + unzigzag(epochDelta);
+  event.uptimeMs = codec.uptimeMs + unzigzag(uptimeDelta);
+  event.adcSample = (uint16_t)adcSample;
+  sealEventRecord(event);
+  codec.epoch = event.epoch;
+  codec.uptimeMs = event.uptimeMs;
+  return position;
+}
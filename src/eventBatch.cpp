@@ -0,0 +1,122 @@
+#include "eventBatch.h"
+
+#include <stdio.h>
+#include <time.h>
+
+void EventBatch::clear()
+{
+  count = 0;
+  outageCount = 0;
+  powerOnCount = 0;
+  brownoutCount = 0;
+  surgeCount = 0;
+  downtime = 0;
+  longest = 0;
+  powerOffOpen = false;
+}
+
+bool EventBatch::add(const EventRecord &event)
+{
+  if (count == EVENT_BATCH_CAPACITY)
+  {
+    return false;
+  }
+  events[count++] = event;
+  if (event.type == EVENT_TYPE_POFF)
+  {
+    powerOffEpoch = event.epoch;
+    powerOffOpen = true;
+  }
+  else if (event.type == EVENT_TYPE_PRES)
+  {
+    if (powerOffOpen)
+    {
+      uint32_t duration = event.epoch > powerOffEpoch ? event.epoch - powerOffEpoch : 0;
+      outageCount++;
+      downtime += duration;
+      if (duration > longest)
+      {
+        longest = duration;
+      }
+      powerOffOpen = false;
+    }
+    else
+    {
+      // resumed without a logged power off, the device itself was restarted
+      powerOnCount++;
+    }
+  }
+  else if (event.type == EVENT_TYPE_BRWN)
+  {
+    brownoutCount++;
+  }
+  else if (event.type == EVENT_TYPE_SURG)
+  {
+    surgeCount++;
+  }
+  return true;
+}
+
+int EventBatch::formatSummary(char *buf, size_t length) const
+{
+  char first[32];
+  char last[32];
+  char total[16];
+  char longestText[16];
+  formatEventTime(first, sizeof(first), firstEpoch());
+  formatEventTime(last, sizeof(last), lastEpoch());
+  formatDuration(total, sizeof(total), downtime);
+  formatDuration(longestText, sizeof(longestText), longest);
+
+  if (outageCount == 0 && (brownoutCount || surgeCount))
+  {
+    int written = snprintf(buf, length, "[power-quality] %u brownout%s, %u surge%s between %s and %s", brownoutCount,
+                           brownoutCount == 1 ? "" : "s", surgeCount, surgeCount == 1 ? "" : "s", first, last);
+    if (powerOnCount && written >= 0 && (size_t)written < length)
+    {
+      written += snprintf(buf + written, length - written, ", %u restart%s", powerOnCount, powerOnCount == 1 ? "" : "s");
+    }
+    return written;
+  }
+  if (outageCount == 0 && powerOnCount <= 1)
+  {
+    return snprintf(buf, length, "[power-on][Time:%s]", last);
+  }
+  if (outageCount == 0)
+  {
+    return snprintf(buf, length, "[power-on] %u restarts between %s and %s", powerOnCount, first, last);
+  }
+  if (outageCount == 1 && powerOnCount == 0)
+  {
+    return snprintf(buf, length, "[outage] %s, power off at %s, back at %s", total, first, last);
+  }
+  int written = snprintf(buf, length, "[outages] %u outage%s, total %s, longest %s, between %s and %s", outageCount,
+                         outageCount == 1 ? "" : "s", total, longestText, first, last);
+  if (powerOnCount && written >= 0 && (size_t)written < length)
+  {
+    written += snprintf(buf + written, length - written, ", %u restart%s", powerOnCount, powerOnCount == 1 ? "" : "s");
+  }
+  if (brownoutCount && written >= 0 && (size_t)written < length)
+  {
+    written += snprintf(buf + written, length - written, ", %u brownout%s", brownoutCount,
+                        brownoutCount == 1 ? "" : "s");
+  }
+  return written;
+}
+
+int formatEventTime(char *buf, size_t length, uint32_t epoch)
+{
+  time_t seconds = epoch;
+  struct tm fields;
+  localtime_r(&seconds, &fields);
+  return strftime(buf, length, "%a %b %d %H:%M:%S %Y", &fields);
+}
+
+int formatDuration(char *buf, size_t length, uint32_t seconds)
+{
+  if (seconds < 60)
+  {
+    return snprintf(buf, length, "%u s", (unsigned)seconds);
+  }
+  return snprintf(buf, length, "%u min", (unsigned)((seconds + 30) / 60));
+}
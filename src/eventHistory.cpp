@@ -0,0 +1,324 @@
+#include "eventHistory.h"
+
+#include <SD.h>
+
+#include "dayFileIndex.h"
+#include "eventLog.h"
+#include "eventPublisher.h"
+#include "sdStorage.h"
+
+enum EventHistoryState : uint8_t
+{
+  HISTORY_OPEN = 0,
+  HISTORY_EVENTS = 1,
+  HISTORY_DONE = 2,
+};
+
+void EventHistoryStream::beginRange(uint32_t from, uint32_t to)
+{
+  end();
+  this->from = from;
+  this->to = to;
+  lastKey = to == UINT32_MAX ? UINT32_MAX : dayFileKeyForEpoch(to);
+  skip = 0;
+  // events logged past midnight before the clock synced went to the previous day file, start there
+  uint32_t firstKey = dayFileKeyForEpoch(from);
+  uint32_t previousKey = previousDayFileKey(firstKey);
+  fileKey = (previousKey != 0 ? previousKey : firstKey) - 1;
+  if (from > to)
+  {
+    // no day file is opened, the response is still a valid, empty array
+    lastKey = 0;
+  }
+  state = HISTORY_OPEN;
+  streamed = 0;
+  pendingLength = 0;
+  pendingSent = 0;
+  // events are committed to the journal, the day file itself is only written out and flushed before it is read;
+  // this runs from loop() like every other write (httpApi.h)
+  dayFileWriter.flush();
+}
+
+void EventHistoryStream::beginLast(size_t count)
+{
+  beginRange(0, UINT32_MAX);
+  // count back from the newest day file to the one the last count events start in
+  size_t total = 0;
+  uint32_t firstKey = 0;
+  for (uint32_t key = previousDayFileKey(UINT32_MAX); key != 0 && total < count; key = previousDayFileKey(key))
+  {
+    if (archivedDayIndex.contains(key))
+    {
+      // the archive header counts its days' events
+      ArchiveDayReader day;
+      if (day.open(key))
+      {
+        total += day.events();
+        firstKey = key;
+      }
+      continue;
+    }
+    File dayFile = openDayFileByKey(key);
+    if (!dayFile)
+    {
+      continue;
+    }
+    if (readEventFileHeader(dayFile))
+    {
+      // fixed size records, no need to read them
+      total += (dayFile.size() - sizeof(EventFileHeader)) / sizeof(EventRecord);
+    }
+    else
+    {
+      EventRecord event;
+      while (readNextEvent(dayFile, false, event))
+      {
+        total++;
+      }
+    }
+    dayFile.close();
+    firstKey = key;
+  }
+  skip = total > count ? total - count : 0;
+  fileKey = firstKey != 0 ? firstKey - 1 : 0;
+  lastKey = firstKey != 0 ? UINT32_MAX : 0;
+}
+
+void EventHistoryStream::end()
+{
+  if (file)
+  {
+    file.close();
+  }
+  archived.close();
+}
+
+size_t EventHistoryStream::fill(uint8_t *buf, size_t length)
+{
+  // the card was unmounted under the stream by a power loss, the response ends short
+  if (!storageReady)
+  {
+    end();
+    state = HISTORY_DONE;
+    return 0;
+  }
+  size_t written = 0;
+  while (written < length)
+  {
+    if (pendingSent == pendingLength)
+    {
+      pendingLength = formatNext(pending, sizeof(pending));
+      pendingSent = 0;
+      if (pendingLength == 0)
+      {
+        break;
+      }
+    }
+    // an event that does not fit the rest of buf carries over to the next chunk
+    size_t chunk = pendingLength - pendingSent < length - written ? pendingLength - pendingSent : length - written;
+    memcpy(buf + written, pending + pendingSent, chunk);
+    pendingSent += chunk;
+    written += chunk;
+  }
+  return written;
+}
+
+// The next piece of the array: its opening bracket, one event, or its closing bracket
+size_t EventHistoryStream::formatNext(char *buf, size_t length)
+{
+  if (state == HISTORY_OPEN)
+  {
+    state = HISTORY_EVENTS;
+    buf[0] = '[';
+    return 1;
+  }
+  if (state != HISTORY_EVENTS)
+  {
+    return 0;
+  }
+  EventRecord event;
+  if (!nextEvent(event))
+  {
+    end();
+    state = HISTORY_DONE;
+    buf[0] = ']';
+    return 1;
+  }
+  size_t used = 0;
+  if (streamed > 0)
+  {
+    buf[used++] = ',';
+  }
+  used += formatEventJson(event, buf + used, length - used);
+  streamed++;
+  return used;
+}
+
+bool EventHistoryStream::nextEvent(EventRecord &event)
+{
+  while (true)
+  {
+    if (!file && !archived.isOpen())
+    {
+      uint32_t key = nextDayFileKey(fileKey);
+      if (key == 0 || key > lastKey)
+      {
+        return false;
+      }
+      openDayFile(key);
+      continue;
+    }
+    if (archived.isOpen())
+    {
+      // closes itself after the day's last event
+      if (!archived.next(event))
+      {
+        continue;
+      }
+    }
+    else if (!readNextEvent(file, binaryFile, event))
+    {
+      file.close();
+      continue;
+    }
+    if (event.epoch < from || event.epoch > to)
+    {
+      continue;
+    }
+    if (skip > 0)
+    {
+      skip--;
+      continue;
+    }
+    return true;
+  }
+}
+
+bool EventHistoryStream::openDayFile(uint32_t key)
+{
+  fileKey = key;
+  if (archivedDayIndex.contains(key))
+  {
+    // days are short once encoded, events before from are passed over as they are decoded
+    return archived.open(key);
+  }
+  file = openDayFileByKey(key);
+  if (!file)
+  {
+    return false;
+  }
+  binaryFile = readEventFileHeader(file);
+  if (from > 0)
+  {
+    seekEventFrom(file, binaryFile, from);
+  }
+  return true;
+}
+
+static uint32_t nextKeyIn(const DayFileIndex &index, uint32_t after)
+{
+  size_t position = index.lowerBound(after + 1);
+  return position < index.size() ? index.key(position) : 0;
+}
+
+static uint32_t previousKeyIn(const DayFileIndex &index, uint32_t before)
+{
+  size_t position = index.lowerBound(before);
+  return position > 0 ? index.key(position - 1) : 0;
+}
+
+uint32_t nextDayFileKey(uint32_t after)
+{
+  if (after == UINT32_MAX)
+  {
+    return 0;
+  }
+  const DayFileIndex *indexes[] = {&dayFileIndex, &publishedDayFileIndex, &archivedDayIndex};
+  uint32_t next = 0;
+  for (const DayFileIndex *index : indexes)
+  {
+    uint32_t key = nextKeyIn(*index, after);
+    if (key != 0 && (next == 0 || key < next))
+    {
+      next = key;
+    }
+  }
+  return next;
+}
+
+uint32_t previousDayFileKey(uint32_t before)
+{
+  const DayFileIndex *indexes[] = {&dayFileIndex, &publishedDayFileIndex, &archivedDayIndex};
+  uint32_t previous = 0;
+  for (const DayFileIndex *index : indexes)
+  {
+    uint32_t key = previousKeyIn(*index, before);
+    previous = key > previous ? key : previous;
+  }
+  return previous;
+}
+
+File openDayFileByKey(uint32_t key)
+{
+  char path[32];
+  if (dayFileIndex.contains(key))
+  {
+    dayFileIndex.path(key, path, sizeof(path));
+  }
+  else
+  {
+    publishedDayFileIndex.path(key, path, sizeof(path));
+  }
+  return SD.open(path, FILE_READ);
+}
+
+// Events are appended in time order, so the first one at or after from can be found by bisection:
+// on record numbers in a binary file, on byte offsets resynced to the next line start in a CSV file.
+// Out of order events only cost precision, the caller still checks every epoch it reads. Moved events
+// keep the time they were logged with, a probe on one goes left so nothing after it is passed over.
+void seekEventFrom(File &dayFile, bool binaryFile, uint32_t from)
+{
+  uint32_t start = dayFile.position();
+  EventRecord event;
+  if (binaryFile)
+  {
+    uint32_t low = 0;
+    uint32_t high = (dayFile.size() - start) / sizeof(EventRecord);
+    while (low < high)
+    {
+      uint32_t middle = low + (high - low) / 2;
+      dayFile.seek(start + middle * sizeof(EventRecord));
+      if (dayFile.read((uint8_t *)&event, sizeof(event)) == sizeof(event) && isEventRecordValid(event) &&
+          !(event.flags & EVENT_FLAG_MOVED) && event.epoch < from)
+      {
+        low = middle + 1;
+      }
+      else
+      {
+        high = middle;
+      }
+    }
+    dayFile.seek(start + low * sizeof(EventRecord));
+    return;
+  }
+  // low is always a line start before the first event of the range; a short stretch is left to scan
+  char line[EVENT_LINE_LENGTH];
+  uint32_t low = start;
+  uint32_t high = dayFile.size();
+  while (high - low > 2 * EVENT_LINE_LENGTH)
+  {
+    uint32_t middle = low + (high - low) / 2;
+    dayFile.seek(middle);
+    readEventLine(dayFile, line, sizeof(line));
+    if (dayFile.position() < high && readEventLine(dayFile, line, sizeof(line)) > 0 &&
+        parseCsvEventLine(line, event) && event.epoch < from)
+    {
+      low = dayFile.position();
+    }
+    else
+    {
+      high = middle;
+    }
+  }
+  dayFile.seek(low);
+}
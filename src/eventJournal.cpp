@@ -0,0 +1,287 @@
+#include "eventJournal.h"
+
+#include <Arduino.h>
+#include <SD.h>
+
+#include "archiveCompactor.h"
+#include "dayFileIndex.h"
+#include "eventRecord.h"
+#include "logger.h"
+#include "sdStorage.h"
+
+EventJournal eventJournal;
+
+static uint32_t sectorCrc(const EventJournalSector &sector)
+{
+  return crc32((const uint8_t *)&sector, offsetof(EventJournalSector, crc));
+}
+
+bool isEventJournalSectorValid(const EventJournalSector &sector)
+{
+  return sector.magic == EVENT_JOURNAL_MAGIC && sector.kind != EVENT_JOURNAL_EMPTY &&
+         sector.length <= EVENT_JOURNAL_DATA_LENGTH && sector.path[EVENT_JOURNAL_PATH_LENGTH - 1] == '\0' &&
+         sector.crc == sectorCrc(sector);
+}
+
+bool EventJournal::begin(const char *path)
+{
+  end();
+  strlcpy(this->path, path, sizeof(this->path));
+  lastSequence = 0;
+  nextEventSlot = EVENT_JOURNAL_CURSOR_SECTORS;
+  cursorSlot = -1;
+  cursorFile = "";
+  cursorOffset = 0;
+
+  ready = open() && file.size() == (size_t)EVENT_JOURNAL_SECTORS * EVENT_JOURNAL_SECTOR_SIZE;
+  if (!ready)
+  {
+    end();
+    LOG_INFO("event journal: creating journal file");
+    ready = create() && open();
+  }
+  if (!ready)
+  {
+    LOG_ERROR("event journal: cannot open journal file");
+    return false;
+  }
+
+  EventJournalSector sector;
+  uint32_t cursorSequence = 0;
+  uint32_t eventSequence = 0;
+  for (uint32_t slot = 0; slot < EVENT_JOURNAL_SECTORS; slot++)
+  {
+    if (!readSector(slot, sector))
+    {
+      continue;
+    }
+    if (sector.sequence > lastSequence)
+    {
+      lastSequence = sector.sequence;
+    }
+    if (slot < EVENT_JOURNAL_CURSOR_SECTORS && sector.kind == EVENT_JOURNAL_CURSOR && sector.sequence >= cursorSequence)
+    {
+      cursorSequence = sector.sequence;
+      cursorSlot = slot;
+      cursorFile = sector.path;
+      cursorOffset = sector.offset;
+    }
+    else if (slot >= EVENT_JOURNAL_CURSOR_SECTORS &&
+             (sector.kind == EVENT_JOURNAL_EVENT || sector.kind == EVENT_JOURNAL_REWRITE) &&
+             sector.sequence >= eventSequence)
+    {
+      eventSequence = sector.sequence;
+      nextEventSlot = slot + 1 < EVENT_JOURNAL_SECTORS ? slot + 1 : EVENT_JOURNAL_CURSOR_SECTORS;
+    }
+  }
+  LOG_INFO("event journal: sequence %lu", (unsigned long)lastSequence);
+  return true;
+}
+
+void EventJournal::end()
+{
+  if (file)
+  {
+    file.close();
+  }
+}
+
+// Writes every sector empty, so records can later be written in place without growing the file
+bool EventJournal::create()
+{
+  SDFS.remove(path);
+  File created = SDFS.open(path, "w");
+  if (!created)
+  {
+    return false;
+  }
+  uint8_t empty[EVENT_JOURNAL_SECTOR_SIZE];
+  memset(empty, 0, sizeof(empty));
+  for (uint32_t slot = 0; slot < EVENT_JOURNAL_SECTORS; slot++)
+  {
+    if (created.write(empty, sizeof(empty)) != sizeof(empty))
+    {
+      created.close();
+      return false;
+    }
+  }
+  created.close();
+  return true;
+}
+
+bool EventJournal::open()
+{
+  if (!file)
+  {
+    file = SDFS.open(path, "r+");
+  }
+  return (bool)file;
+}
+
+bool EventJournal::readSector(uint32_t slot, EventJournalSector &sector)
+{
+  if (!file.seek(slot * EVENT_JOURNAL_SECTOR_SIZE) ||
+      file.read((uint8_t *)&sector, sizeof(sector)) != sizeof(sector))
+  {
+    return false;
+  }
+  return isEventJournalSectorValid(sector);
+}
+
+bool EventJournal::commit(uint32_t slot, uint8_t kind, const char *path, uint32_t offset, const uint8_t *bytes,
+                          size_t length)
+{
+  if (!ready || length > EVENT_JOURNAL_DATA_LENGTH || strlen(path) >= EVENT_JOURNAL_PATH_LENGTH || !open())
+  {
+    return false;
+  }
+  EventJournalSector sector;
+  memset(&sector, 0, sizeof(sector));
+  sector.magic = EVENT_JOURNAL_MAGIC;
+  sector.sequence = ++lastSequence;
+  sector.kind = kind;
+  sector.length = length;
+  sector.offset = offset;
+  strlcpy(sector.path, path, sizeof(sector.path));
+  if (length > 0)
+  {
+    memcpy(sector.data, bytes, length);
+  }
+  sector.crc = sectorCrc(sector);
+
+  if (!file.seek(slot * EVENT_JOURNAL_SECTOR_SIZE) ||
+      file.write((const uint8_t *)&sector, sizeof(sector)) != sizeof(sector))
+  {
+    LOG_ERROR("event journal: commit failed");
+    end();
+    return false;
+  }
+  file.flush();
+  return true;
+}
+
+bool EventJournal::commitCursor(const char *file, uint32_t offset)
+{
+  // never overwrite the newest cursor, a torn write then still leaves it intact
+  uint32_t slot = cursorSlot == 0 ? 1 : 0;
+  if (!commit(slot, EVENT_JOURNAL_CURSOR, file, offset, NULL, 0))
+  {
+    return false;
+  }
+  cursorSlot = slot;
+  cursorFile = file;
+  cursorOffset = offset;
+  return true;
+}
+
+bool EventJournal::appendEvent(File &dayFile, const uint8_t *bytes, size_t length)
+{
+  uint32_t offset = dayFileWriter.size(dayFile);
+  bool committed = commit(nextEventSlot, EVENT_JOURNAL_EVENT, dayFile.fullName(), offset, bytes, length);
+  if (committed)
+  {
+    nextEventSlot = nextEventSlot + 1 < EVENT_JOURNAL_SECTORS ? nextEventSlot + 1 : EVENT_JOURNAL_CURSOR_SECTORS;
+  }
+  bool written = dayFileWriter.append(dayFile, bytes, length);
+  if (!committed)
+  {
+    written = dayFileWriter.flush() && written;
+  }
+  return written;
+}
+
+bool EventJournal::rewriteEvent(File &dayFile, uint32_t offset, const uint8_t *bytes, size_t length)
+{
+  // recover() replays the newest bytes over the ones this event was first appended with
+  if (commit(nextEventSlot, EVENT_JOURNAL_REWRITE, dayFile.fullName(), offset, bytes, length))
+  {
+    nextEventSlot = nextEventSlot + 1 < EVENT_JOURNAL_SECTORS ? nextEventSlot + 1 : EVENT_JOURNAL_CURSOR_SECTORS;
+  }
+  return dayFile.seek(offset) && dayFile.write(bytes, length) == length;
+}
+
+bool EventJournal::cursor(std::string &file, uint32_t &offset) const
+{
+  if (cursorSlot < 0)
+  {
+    return false;
+  }
+  file = cursorFile;
+  offset = cursorOffset;
+  return true;
+}
+
+size_t EventJournal::recover()
+{
+  if (!ready || !open())
+  {
+    return 0;
+  }
+  // events are written round the ring, so it holds them oldest first starting at the next slot to write
+  size_t recovered = 0;
+  EventJournalSector sector;
+  uint32_t slot = nextEventSlot;
+  for (uint32_t i = 0; i < EVENT_JOURNAL_EVENT_SECTORS; i++)
+  {
+    if (readSector(slot, sector) && (sector.kind == EVENT_JOURNAL_EVENT || sector.kind == EVENT_JOURNAL_REWRITE) &&
+        recoverEvent(sector))
+    {
+      recovered++;
+    }
+    slot = slot + 1 < EVENT_JOURNAL_SECTORS ? slot + 1 : EVENT_JOURNAL_CURSOR_SECTORS;
+  }
+  if (recovered > 0)
+  {
+    LOG_WARN("event journal: recovered events: %u", (unsigned)recovered);
+  }
+  return recovered;
+}
+
+bool EventJournal::recoverEvent(const EventJournalSector &sector)
+{
+  File dayFile;
+  if (SDFS.exists(sector.path))
+  {
+    dayFile = SDFS.open(sector.path, "r+");
+  }
+  else
+  {
+    // published day files are moved to /qop-published and later packed into an archive, those are complete
+    const char *name = strrchr(sector.path, '/');
+    std::string publishedPath = std::string("/qop-published/") + (name ? name + 1 : sector.path);
+    if (SDFS.exists(publishedPath.c_str()) || isDayArchived(dayFileKey(sector.path)))
+    {
+      return false;
+    }
+    dayFile = SDFS.open(sector.path, "w");
+  }
+  if (!dayFile)
+  {
+    return false;
+  }
+
+  uint32_t size = dayFile.size();
+  uint32_t end = sector.offset + sector.length;
+  if (size >= end)
+  {
+    bool matches = dayFile.seek(sector.offset);
+    uint8_t chunk[32];
+    for (uint32_t done = 0; matches && done < sector.length; done += sizeof(chunk))
+    {
+      size_t length = sector.length - done < sizeof(chunk) ? sector.length - done : sizeof(chunk);
+      matches = dayFile.read(chunk, length) == length && memcmp(chunk, sector.data + done, length) == 0;
+    }
+    // intact, or followed by later writes this record does not know about; a rewrite always has events after
+    // it or in its place
+    if (matches || (size > end && sector.kind != EVENT_JOURNAL_REWRITE))
+    {
+      dayFile.close();
+      return false;
+    }
+  }
+  // torn or missing tail: write the event back where it belongs, or at the end when earlier data is gone too
+  dayFile.seek(size < sector.offset ? size : sector.offset);
+  dayFile.write(sector.data, sector.length);
+  dayFile.close();
+  return true;
+}
@@ -0,0 +1,434 @@
+#include "eventLog.h"
+
+#include "clockService.h"
+#include "dayFileIndex.h"
+#include "eventJournal.h"
+#include "liveEvents.h"
+#include "logger.h"
+#include "mainsCalibration.h"
+#include "mainsDetector.h"
+#include "mainsSampler.h"
+#include "outbox.h"
+#include "powerState.h"
+#include "powerStats.h"
+#include "profiler.h"
+#include "sdStorage.h"
+#include "timeCorrection.h"
+#include "traceRecorder.h"
+#include "waveformCapture.h"
+
+bool storageReady = false;
+File dataRoot;
+File currentDayFile;
+std::string currentDateString;
+time_t ntpEpoch;
+bool unpublishedEventsPending = true;
+
+bool beginStorage()
+{
+  if (storageReady)
+  {
+    return true;
+  }
+  if (!sdBegin(SD_CS_PIN))
+  {
+    LOG_ERROR("SD card initialization failed");
+    return false;
+  }
+  dataRoot = SD.open("/qop");
+  if (!dataRoot)
+  {
+    SD.mkdir("qop");
+    dataRoot = SD.open("/qop");
+  }
+  if (!SD.exists("/qop-published"))
+  {
+    SD.mkdir("qop-published");
+  }
+  eventJournal.begin();
+  outbox.begin();
+  storageReady = true;
+  return true;
+}
+
+void endStorage()
+{
+  if (!storageReady)
+  {
+    return;
+  }
+  dayFileWriter.close();
+  currentDayFile.close();
+  dataRoot.close();
+  eventJournal.end();
+  outbox.end();
+  SD.end();
+  storageReady = false;
+  LOG_DEBUG("SD card unmounted");
+}
+
+// A write the card failed, most likely CRC errors at the probed clock: remount one clock slower and replay
+// the journal into the day file. The day file is reopened as it was, this is no power resume.
+static void remountAfterWriteError()
+{
+  if (!sdStepDownClock())
+  {
+    LOG_ERROR("SD card: write failed at the slowest clock");
+    return;
+  }
+  std::string path = currentDayFile ? currentDayFile.fullName() : "";
+  endStorage();
+  if (!beginStorage())
+  {
+    return;
+  }
+  eventJournal.recover();
+  if (!path.empty())
+  {
+    currentDayFile = SD.open(path.c_str(), FILE_WRITE);
+  }
+}
+
+void loopStorage()
+{
+  if (storageReady && !dayFileWriter.loop())
+  {
+    remountAfterWriteError();
+  }
+}
+
+// Opens the day file for the given time, rolling over to a new file when the date changes.
+// The first open after boot or a power loss logs the power resume that brought the device up.
+void openDayFileFor(time_t currentEpochTime) {
+  // unmounted since a power loss, the resume is the first thing logged again
+  if (!beginStorage()) {
+    return;
+  }
+  if (!currentDayFile) {
+    currentDateString = getFilenameFromEpoch(currentEpochTime);
+    currentDayFile = getLatestFileByDate(dataRoot, currentDateString, currentEpochTime);
+    // without NTP time that is the newest day file whatever its date, the first synced pass rolls over from it
+    if (currentDayFile) {
+      currentDateString = currentDayFile.name();
+    }
+    std::string timeOfEventString = getTimeOfEventFromEpoch(currentEpochTime);
+    writePowerResumeEventToFile(currentDayFile, timeOfEventString, currentEpochTime, isEpochNTPSynced(currentEpochTime));
+  } else {
+    if (isEpochNTPSynced(currentEpochTime))
+    {
+      std::string newDateString = getFilenameFromEpoch(currentEpochTime);
+      // Create new file in case, date changes
+      if (currentDateString.compare(newDateString) != 0)
+      {
+        dayFileWriter.close();
+        currentDayFile.close();
+        currentDayFile = getLatestFileByDate(dataRoot, newDateString, currentEpochTime);
+        currentDateString = newDateString;
+        LOG_INFO("picked file for writing new events: %s", currentDayFile.fullName());
+      }
+    }
+  }
+}
+
+// Consumes the blocks queued by mainsSampler since the last call. Cheap while the mains level holds,
+// the time sources and SD are only touched to log a change.
+void updatePowerStatusIfChanged() {
+  // capture windows first, the raw windows of a power loss go to the card before the POFF lets go of it
+  mainsSampler.loop();
+  while (waveformCapture.loop()) {
+  }
+  traceRecorder.loop();
+  MainsSample sample;
+  while (mainsSampler.next(sample)) {
+    traceRecorder.noteSample(sample);
+    mainsCalibration.add(sample.value);
+    if (!mainsDetector.update(sample.takenAt, sample.value)) {
+      continue;
+    }
+    logMainsLevelChange(mainsDetector.previousLevel(), mainsDetector.level(), mainsDetector.changedAt());
+    if (mainsDetector.level() == MAINS_LEVEL_OFF) {
+      powerState.powerLost();
+    } else if (mainsDetector.previousLevel() == MAINS_LEVEL_OFF) {
+      powerState.powerRestored(mainsDetector.changedAt());
+    }
+  }
+}
+
+// Logs the events for a change of the reported mains level, back-dated to the first block at the new level
+void logMainsLevelChange(MainsLevel previous, MainsLevel level, uint32_t changedAt) {
+  LOG_INFO("mains level: %s -> %s", mainsLevelName(previous), mainsLevelName(level));
+  // resync if due, then use the time the change was sampled, not when it was drained
+  getTimeFromMultipleSources();
+  time_t currentEpochTime = clockService.epochAt(changedAt);
+  LOG_DEBUG("current epoch time: %ld", (long)currentEpochTime);
+  // the first open after boot or a power loss logs the resume by itself
+  boolean dayFileWasClosed = !currentDayFile;
+  openDayFileFor(currentEpochTime);
+  std::string timeOfEventString = getTimeOfEventFromEpoch(currentEpochTime);
+  boolean ntpStatus = isEpochNTPSynced(currentEpochTime);
+  if (level == MAINS_LEVEL_OFF) {
+    writePowerOffEventToFile(currentDayFile, timeOfEventString, currentEpochTime, ntpStatus);
+    return;
+  }
+  if (previous == MAINS_LEVEL_OFF && !dayFileWasClosed) {
+    writePowerResumeEventToFile(currentDayFile, timeOfEventString, currentEpochTime, ntpStatus);
+  }
+  if (level == MAINS_LEVEL_BROWNOUT) {
+    writeEventToFile(currentDayFile, EVENT_TYPE_BRWN, timeOfEventString, currentEpochTime, ntpStatus);
+  } else if (level == MAINS_LEVEL_SURGE) {
+    writeEventToFile(currentDayFile, EVENT_TYPE_SURG, timeOfEventString, currentEpochTime, ntpStatus);
+  } else if (previous == MAINS_LEVEL_BROWNOUT || previous == MAINS_LEVEL_SURGE) {
+    writeEventToFile(currentDayFile, EVENT_TYPE_NORM, timeOfEventString, currentEpochTime, ntpStatus);
+  }
+}
+
+// O(1) and bus free between resyncs, clockService only reads NTP and the RTC every
+// CLOCK_RESYNC_INTERVAL_MS, or sooner after it measured drift
+time_t getTimeFromMultipleSources() {
+  time_t now = clockService.now();
+  ntpEpoch = clockService.isNtpSynced() ? now : 0;
+  // the first sync corrects the events logged before it, before anything else is logged
+  timeCorrection.loop();
+  return now;
+}
+
+// Whether epoch, read from the clock now, is NTP time
+boolean isEpochNTPSynced(time_t epoch)
+{
+  return clockService.isNtpSynced() && epoch >= NTP_VALID_EPOCH;
+}
+
+void writePowerResumeEventToFile(File dateFile, std::string timeOfEvent, time_t epoch, boolean ntpStatus)
+{
+  LOG_DEBUG("PRES timeOfEvent: %s", timeOfEvent.c_str());
+  writeEventToFile(dateFile, EVENT_TYPE_PRES, timeOfEvent, epoch, ntpStatus);
+}
+
+void writePowerOffEventToFile(File dateFile, std::string timeOfEvent, time_t epoch, boolean ntpStatus)
+{
+  LOG_DEBUG("POFF timeOfEvent: %s", timeOfEvent.c_str());
+  writeEventToFile(dateFile, EVENT_TYPE_POFF, timeOfEvent, epoch, ntpStatus);
+}
+
+void writePowerOnEventToFile(File dateFile, std::string timeOfEvent, time_t epoch, boolean ntpStatus)
+{
+  LOG_DEBUG("PON timeOfEvent: %s", timeOfEvent.c_str());
+  writeEventToFile(dateFile, EVENT_TYPE_PON, timeOfEvent, epoch, ntpStatus);
+}
+
+void writeEventToFile(File dateFile, uint8_t eventType, std::string timeOfEvent, time_t epoch, boolean ntpStatus)
+{
+  // The whole event, with the file header of a new binary day file, goes out as one journal commit and one write
+  uint8_t bytes[EVENT_JOURNAL_DATA_LENGTH];
+  EventRecord record;
+  record.epoch = epoch;
+  record.uptimeMs = millis();
+  record.adcSample = mainsDetector.filtered();
+  record.type = eventType;
+  record.flags = ntpStatus ? EVENT_FLAG_NTP_SYNCED : 0;
+  sealEventRecord(record);
+  size_t eventOffset;
+  size_t length = encodeEventFor(dateFile, record, timeOfEvent.c_str(), bytes, eventOffset);
+  uint32_t offset = dayFileWriter.size(dateFile) + eventOffset;
+  bool written = eventJournal.appendEvent(dateFile, bytes, length);
+  unpublishedEventsPending = true;
+  // live subscribers hear of it now, the publisher on its next pass
+  liveEvents.publish(record);
+  // an event without NTP time is counted once timeCorrection has corrected it
+  if (ntpStatus || !timeCorrection.note(dateFile, offset, length - eventOffset, record))
+  {
+    powerStats.record(eventType, epoch);
+  }
+  if (!written)
+  {
+    remountAfterWriteError();
+  }
+}
+
+size_t encodeEventFor(File &dayFile, const EventRecord &record, const char *timeOfEvent, uint8_t *bytes,
+                      size_t &eventOffset)
+{
+  size_t length = 0;
+  boolean newFile = dayFileWriter.size(dayFile) == 0;
+  boolean binaryFile = newFile ? QOP_BINARY_EVENT_LOG : isBinaryEventFile(dayFile, record.epoch);
+  if (binaryFile)
+  {
+    if (newFile)
+    {
+      EventFileHeader header;
+      initEventFileHeader(header, record.epoch);
+      memcpy(bytes, &header, sizeof(header));
+      length = sizeof(header);
+    }
+    eventOffset = length;
+    memcpy(bytes + length, &record, sizeof(record));
+    return length + sizeof(record);
+  }
+  eventOffset = 0;
+  return formatCsvEventLine(record, timeOfEvent, (char *)bytes, EVENT_JOURNAL_DATA_LENGTH);
+}
+
+boolean isBinaryEventFile(File dateFile, time_t epoch)
+{
+  if (dateFile.size() == 0)
+  {
+    if (!QOP_BINARY_EVENT_LOG)
+    {
+      return false;
+    }
+    EventFileHeader header;
+    initEventFileHeader(header, epoch);
+    dateFile.write((const uint8_t *)&header, sizeof(header));
+    return true;
+  }
+  uint32_t position = dateFile.position();
+  boolean binaryFile = readEventFileHeader(dateFile);
+  dateFile.seek(position);
+  return binaryFile;
+}
+
+// Leaves a binary file positioned at its first record and a CSV file at its first line
+boolean readEventFileHeader(File &dayFile)
+{
+  EventFileHeader header;
+  dayFile.seek(0);
+  if (dayFile.read((uint8_t *)&header, sizeof(header)) == sizeof(header) && isEventFileHeaderValid(header))
+  {
+    return true;
+  }
+  dayFile.seek(0);
+  return false;
+}
+
+// Reads the next event of a day file in whichever format it was written, skipping corrupt and moved entries.
+// Returns false at end of file.
+boolean readNextEvent(File &dayFile, boolean binaryFile, EventRecord &event)
+{
+  if (binaryFile)
+  {
+    while (dayFile.read((uint8_t *)&event, sizeof(event)) == sizeof(event))
+    {
+      if (!isEventRecordValid(event))
+      {
+        LOG_WARN("skipping event record with bad checksum");
+      }
+      else if (!(event.flags & EVENT_FLAG_MOVED))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+  char line[EVENT_LINE_LENGTH];
+  while (true)
+  {
+    if (readEventLine(dayFile, line, sizeof(line)) == 0)
+    {
+      return false;
+    }
+    if (parseCsvEventLine(line, event))
+    {
+      return true;
+    }
+    if (line[0] != '#')
+    {
+      LOG_WARN("skipping malformed event line: %s", line);
+    }
+  }
+}
+
+// Reads one line into the caller's buffer and leaves the file right after its newline; a longer line is cut
+// to the buffer. Returns the bytes consumed, 0 at end of file.
+size_t readEventLine(File &dayFile, char *line, size_t length)
+{
+  uint32_t start = dayFile.position();
+  size_t read = dayFile.read((uint8_t *)line, length - 1);
+  if (read == 0)
+  {
+    line[0] = '\0';
+    return 0;
+  }
+  char *newline = (char *)memchr(line, '\n', read);
+  size_t consumed = read;
+  if (newline != NULL)
+  {
+    consumed = newline - line + 1;
+    read = newline - line;
+    dayFile.seek(start + consumed);
+  }
+  else if (read == length - 1)
+  {
+    // cut line, skip the rest of it
+    char rest;
+    while (dayFile.read((uint8_t *)&rest, 1) == 1)
+    {
+      consumed++;
+      if (rest == '\n')
+      {
+        break;
+      }
+    }
+  }
+  line[read] = '\0';
+  return consumed;
+}
+
+std::string getFilenameFromEpoch(time_t epochTime)
+{
+  tm *localTime = std::localtime(&epochTime);
+  // "20220701", sized for three full ints so no tm value can overflow it
+  char dateBuf[34];
+  snprintf(dateBuf, sizeof(dateBuf), "%d%02d%02d", 1900 + (localTime->tm_year), (localTime->tm_mon) + 1,
+           localTime->tm_mday);
+  return dateBuf;
+}
+
+std::string getTimeOfEventFromEpoch(time_t epochTime)
+{
+  tm *localTime = std::localtime(&epochTime);
+  char timeOfEvent[9];
+  sprintf(timeOfEvent, "%02d:%02d:%02d", localTime->tm_hour, localTime->tm_min, localTime->tm_sec);
+  return timeOfEvent;
+}
+
+// Get Latest file matching current date if time stamp is valid, otherwise returns latest file
+File getLatestFileByDate(File rootDir, std::string date, time_t epochTime)
+{
+  if (!dayFileIndex.built())
+  {
+    dayFileIndex.build(rootDir);
+  }
+  char path[32];
+  if (!dayFileIndex.empty() && !isEpochNTPSynced(epochTime))
+  {
+    dayFileIndex.path(dayFileIndex.newest(), path, sizeof(path));
+    return SD.open(path, FILE_WRITE);
+  }
+  snprintf(path, sizeof(path), "%s/%s", rootDir.fullName(), date.c_str());
+  File dayFile = SD.open(path, FILE_WRITE);
+  if (dayFile)
+  {
+    dayFileIndex.add(dayFileKey(path));
+  }
+  return dayFile;
+}
+
+std::vector<std::string> listDirSorted(File rootDir)
+{
+  PROFILE_SCOPE(PROFILE_LIST_DIR);
+  std::vector<std::string> filenames;
+  // dataRoot is reused across calls, start the directory walk over every time
+  rootDir.rewindDirectory();
+  while (true)
+  {
+    File pickedFile = rootDir.openNextFile();
+    if (!pickedFile)
+    {
+      break;
+    }
+    filenames.push_back(pickedFile.fullName());
+    pickedFile.close();
+  }
+  std::sort(filenames.begin(), filenames.end());
+  return filenames;
+}
@@ -0,0 +1,55 @@
+#include "eventPublisher.h"
+#include "jsonFormat.h"
+
+size_t formatBatchJson(const EventBatch &batch, const char *device, char *buf, size_t length)
+{
+  size_t used = 0;
+  appendf(buf, length, used, "{\"device\":");
+  appendJsonString(buf, length, used, device);
+  appendf(buf, length, used,
+          ",\"outages\":%u,\"downtime\":%lu,\"longest\":%lu,\"brownouts\":%u,\"surges\":%u,"
+          "\"events\":[",
+          batch.outages(), (unsigned long)batch.totalDowntime(), (unsigned long)batch.longestOutage(),
+          batch.brownouts(), batch.surges());
+  for (size_t i = 0; i < batch.size(); i++)
+  {
+    appendf(buf, length, used, i ? "," : "");
+    if (used < length)
+    {
+      size_t event = formatEventJson(batch.at(i), buf + used, length - used);
+      used = event ? used + event : length;
+    }
+  }
+  appendf(buf, length, used, "]}");
+  return used < length ? used : 0;
+}
+
+size_t formatEventJson(const EventRecord &event, char *buf, size_t length)
+{
+  size_t used = 0;
+  appendf(buf, length, used, "{\"type\":\"%s\",\"epoch\":%lu,\"ntp\":%s,\"adc\":%u}", eventTypeName(event.type),
+          (unsigned long)event.epoch, event.flags & EVENT_FLAG_NTP_SYNCED ? "true" : "false", event.adcSample);
+  return used < length ? used : 0;
+}
+
+size_t formatReportJson(PowerStatsPeriod period, const PowerStatsBucket &bucket, const char *device, char *buf,
+                        size_t length)
+{
+  size_t used = 0;
+  appendf(buf, length, used, "{\"device\":");
+  appendJsonString(buf, length, used, device);
+  appendf(buf, length, used,
+          ",\"report\":\"%s\",\"start\":%lu,\"outages\":%u,\"sustainedOutages\":%u,"
+          "\"downtime\":%lu,\"sustainedDowntime\":%lu,\"longest\":%lu,\"brownouts\":%u,\"brownoutTime\":%lu,"
+          "\"surges\":%u,\"surgeTime\":%lu,\"restarts\":%u,\"histogram\":[",
+          powerStatsPeriodName(period), (unsigned long)bucket.periodStart, bucket.outages,
+          bucket.sustainedOutages, (unsigned long)bucket.downtime, (unsigned long)bucket.sustainedDowntime,
+          (unsigned long)bucket.longestOutage, bucket.brownouts, (unsigned long)bucket.brownoutTime, bucket.surges,
+          (unsigned long)bucket.surgeTime, bucket.restarts);
+  for (int bin = 0; bin < POWER_STATS_HISTOGRAM_BINS; bin++)
+  {
+    appendf(buf, length, used, "%s%u", bin ? "," : "", bucket.outageHistogram[bin]);
+  }
+  appendf(buf, length, used, "]}");
+  return used < length ? used : 0;
+}
@@ -0,0 +1,455 @@
+#include "eventPublishing.h"
+#include "dayFileIndex.h"
+#include "eventJournal.h"
+#include "eventLog.h"
+#include "logger.h"
+#include "outbox.h"
+#include "powerState.h"
+#include "powerStats.h"
+#include "profiler.h"
+#include "sdStorage.h"
+#include "timeCorrection.h"
+
+EventPublisher *eventPublisher = NULL;
+
+std::string publishCursorFile;
+uint32_t publishCursorOffset = 0;
+bool publishCursorLoaded = false;
+bool publishCursorDirty = false;
+
+EventBatch outgoingBatch;
+size_t publishMaxBatchSize = PUBLISH_MAX_BATCH_SIZE;
+uint32_t publishMaxBatchLatency = PUBLISH_MAX_BATCH_LATENCY_S;
+uint32_t heldBatchDeadline = 0;
+
+void publishUnpublishedEvents(File rootDir)
+{
+  // check and update power status change - start
+  updatePowerStatusIfChanged();
+  // check and update power status change - end
+  // the card goes and the radio with it once mains is lost, publishing waits for the resume
+  if (!powerState.running())
+  {
+    return;
+  }
+  // events logged on RTC time are published once NTP corrected them, or once the hold ran out
+  if (timeCorrection.holding())
+  {
+    return;
+  }
+
+  // Nothing was written since the last pass reached the end of the newest file, skip the SD card entirely,
+  // unless a held back batch is due now
+  boolean heldBatchDue = heldBatchDeadline != 0 && (int32_t)(millis() - heldBatchDeadline) >= 0;
+  if (!unpublishedEventsPending && !heldBatchDue)
+  {
+    return;
+  }
+  // nowhere to queue a batch, the day files are not read again until the publisher took some
+  if (outbox.full())
+  {
+    publishOutbox();
+    if (outbox.full())
+    {
+      return;
+    }
+  }
+  // buffered events are read once their durability window writes them out, publishing them waits that long
+  // at most rather than flushing every event on its own
+  if (dayFileWriter.pending() > 0)
+  {
+    return;
+  }
+  heldBatchDeadline = 0;
+  // events are committed to the journal, the day file itself is only flushed before it is read
+  dayFileWriter.flush();
+  if (!publishCursorLoaded)
+  {
+    loadPublishCursor();
+  }
+
+  if (!dayFileIndex.built())
+  {
+    dayFileIndex.build(rootDir);
+  }
+  if (dayFileIndex.empty())
+  {
+    unpublishedEventsPending = false;
+    return;
+  }
+
+  LOG_DEBUG("publish cursor: %s, offset %lu", publishCursorFile.c_str(), (unsigned long)publishCursorOffset);
+
+  // Day files before the cursor are fully published, move them to published dir /qop-published/
+  uint32_t cursorKey = dayFileKey(publishCursorFile.c_str());
+  char pickedPath[32];
+  char publishedPath[32];
+  for (size_t skipped = dayFileIndex.lowerBound(cursorKey); skipped > 0; skipped--)
+  {
+    uint32_t skippedKey = dayFileIndex.key(skipped - 1);
+    dayFileIndex.path(skippedKey, pickedPath, sizeof(pickedPath));
+    snprintf(publishedPath, sizeof(publishedPath), "/qop-published/%08lu", (unsigned long)skippedKey);
+    LOG_INFO("moving file to qop-published directory: %s", publishedPath);
+    if (SD.rename(pickedPath, publishedPath))
+    {
+      dayFileIndex.remove(skippedKey);
+      publishedDayFileIndex.add(skippedKey);
+    }
+  }
+
+  LOG_DEBUG("processing day files from the publish cursor on");
+  outgoingBatch.clear();
+  // Everything before (consumedFile, consumedOffset) is either in outgoingBatch or needs no publishing
+  std::string consumedFile = publishCursorFile;
+  uint32_t consumedOffset = publishCursorOffset;
+  EventRecord pendingPowerOff;
+  boolean powerOffPending = false;
+  for (size_t i = dayFileIndex.lowerBound(cursorKey); i < dayFileIndex.size(); i++)
+  {
+    // check and update power status change - start
+    updatePowerStatusIfChanged();
+    // check and update power status change - end
+    if (!powerState.running())
+    {
+      return;
+    }
+
+    uint32_t pickedKey = dayFileIndex.key(i);
+    dayFileIndex.path(pickedKey, pickedPath, sizeof(pickedPath));
+    std::string pickedFile = pickedPath;
+    LOG_DEBUG("opening file for read: %s", pickedPath);
+    File openedFile = PROFILED(PROFILE_PUBLISH_READ, SD.open(pickedPath, FILE_READ));
+    boolean binaryFile = PROFILED(PROFILE_PUBLISH_READ, readEventFileHeader(openedFile));
+    // resume right after the last consumed event instead of re-reading the file from the start
+    if (pickedKey == cursorKey && publishCursorOffset > openedFile.position() && !openedFile.seek(publishCursorOffset))
+    {
+      // a file cut short under the cursor: re-reading it would publish its events a second time, what is
+      // left counts as published and events appended to it from here on still go out
+      LOG_WARN("publish cursor is past end of %s, taking the file as published", pickedPath);
+      openedFile.seek(openedFile.size());
+      consumedFile = pickedFile;
+      consumedOffset = openedFile.position();
+    }
+    EventRecord event;
+    while (true)
+    {
+      // check and update power status change - start
+      updatePowerStatusIfChanged();
+      // check and update power status change - end
+      if (!powerState.running())
+      {
+        openedFile.close();
+        return;
+      }
+
+      uint32_t eventStart = openedFile.position();
+      if (!PROFILED(PROFILE_PUBLISH_READ, readNextEvent(openedFile, binaryFile, event)))
+      {
+        break;
+      }
+      uint32_t eventEnd = openedFile.position();
+
+      LOG_TRACE("event %s, epoch %lu, ntp synced %d", eventTypeName(event.type), (unsigned long)event.epoch,
+                (event.flags & EVENT_FLAG_NTP_SYNCED) != 0);
+
+      // A POFF only goes out once the event following it has been logged
+      if (powerOffPending)
+      {
+        outgoingBatch.add(pendingPowerOff);
+        powerOffPending = false;
+        consumedFile = pickedFile;
+        consumedOffset = eventStart;
+      }
+      if (event.type == EVENT_TYPE_POFF)
+      {
+        pendingPowerOff = event;
+        powerOffPending = true;
+      }
+      else
+      {
+        // NORM is not batched: the batch counts brownout and surge onsets, how long they lasted goes out
+        // with the power stats reports, and a batch of NORMs alone would read as a power-on
+        if (event.type == EVENT_TYPE_PRES || event.type == EVENT_TYPE_BRWN || event.type == EVENT_TYPE_SURG)
+        {
+          outgoingBatch.add(event);
+        }
+        consumedFile = pickedFile;
+        consumedOffset = eventEnd;
+      }
+
+      // leave room for a POFF/PRES pair, a full batch goes out right away
+      if (outgoingBatch.size() + 2 > publishMaxBatchSize || outgoingBatch.size() + 2 > EVENT_BATCH_CAPACITY)
+      {
+        if (!queueOutgoingBatch(consumedFile, consumedOffset))
+        {
+          openedFile.close();
+          return;
+        }
+      }
+    }
+    openedFile.close();
+  }
+
+  if (outgoingBatch.empty())
+  {
+    advancePublishCursor(consumedFile, consumedOffset);
+    if (publishCursorDirty)
+    {
+      persistPublishCursor();
+    }
+  }
+  else
+  {
+    // A partial batch waits up to publishMaxBatchLatency seconds after its first event for more outages,
+    // backlogged events are older than that and go out at once
+    uint32_t batchAge = getTimeFromMultipleSources() - outgoingBatch.firstEpoch();
+    if (batchAge >= publishMaxBatchLatency)
+    {
+      if (!queueOutgoingBatch(consumedFile, consumedOffset))
+      {
+        return;
+      }
+    }
+    else
+    {
+      heldBatchDeadline = millis() + (publishMaxBatchLatency - batchAge) * 1000;
+      if (heldBatchDeadline == 0)
+      {
+        heldBatchDeadline = 1;
+      }
+      LOG_DEBUG("holding back batch of events: %u", (unsigned)outgoingBatch.size());
+    }
+  }
+  unpublishedEventsPending = false;
+}
+
+// Queues outgoingBatch in the outbox and, only once it is on the card, commits the cursor to the end of the batch
+boolean queueOutgoingBatch(std::string batchEndFile, uint32_t batchEndOffset)
+{
+  if (!outgoingBatch.empty())
+  {
+    if (outbox.full())
+    {
+      publishOutbox();
+    }
+    if (!outbox.enqueueBatch(outgoingBatch, dayFileKey(batchEndFile.c_str()), batchEndOffset))
+    {
+      return false;
+    }
+    LOG_DEBUG("queued batch of events: %u", (unsigned)outgoingBatch.size());
+    outgoingBatch.clear();
+  }
+  advancePublishCursor(batchEndFile, batchEndOffset);
+  persistPublishCursor();
+  return true;
+}
+
+size_t publishBacklog(uint32_t &bytes)
+{
+  bytes = 0;
+  if (!storageReady)
+  {
+    return 0;
+  }
+  if (!publishCursorLoaded)
+  {
+    loadPublishCursor();
+  }
+  if (!dayFileIndex.built())
+  {
+    return 0;
+  }
+  // a size lookup per file from the cursor on, nothing is read
+  uint32_t cursorKey = dayFileKey(publishCursorFile.c_str());
+  size_t files = 0;
+  char path[32];
+  for (size_t i = dayFileIndex.lowerBound(cursorKey); i < dayFileIndex.size(); i++)
+  {
+    uint32_t key = dayFileIndex.key(i);
+    dayFileIndex.path(key, path, sizeof(path));
+    File dayFile = SD.open(path, FILE_READ);
+    if (!dayFile)
+    {
+      continue;
+    }
+    uint32_t size = dayFile.size();
+    dayFile.close();
+    uint32_t start = key == cursorKey ? publishCursorOffset : 0;
+    if (size > start)
+    {
+      bytes += size - start;
+      files++;
+    }
+  }
+  return files;
+}
+
+void advancePublishCursor(std::string file, uint32_t offset)
+{
+  if (publishCursorFile.compare(file) != 0 || publishCursorOffset != offset)
+  {
+    publishCursorFile = file;
+    publishCursorOffset = offset;
+    publishCursorDirty = true;
+  }
+}
+
+void persistPublishCursor()
+{
+  // One sector write and flush in the journal, no remove/create of a cursor file
+  if (!eventJournal.commitCursor(publishCursorFile.c_str(), publishCursorOffset))
+  {
+    LOG_ERROR("unable to persist publish cursor");
+    return;
+  }
+  publishCursorDirty = false;
+  LOG_DEBUG("publish cursor persisted: %s, offset %lu", publishCursorFile.c_str(),
+            (unsigned long)publishCursorOffset);
+}
+
+void loadPublishCursor()
+{
+  publishCursorLoaded = true;
+  if (eventJournal.cursor(publishCursorFile, publishCursorOffset))
+  {
+    // a batch queued right before a crash that kept its cursor commit out of the journal
+    uint32_t queuedKey;
+    uint32_t queuedOffset;
+    uint32_t cursorKey = dayFileKey(publishCursorFile.c_str());
+    if (outbox.newestBatchCursor(queuedKey, queuedOffset) &&
+        (queuedKey > cursorKey || (queuedKey == cursorKey && queuedOffset > publishCursorOffset)))
+    {
+      char path[32];
+      dayFileIndex.path(queuedKey, path, sizeof(path));
+      LOG_WARN("publish cursor behind the outbox, moving it to %s, offset %lu", path, (unsigned long)queuedOffset);
+      advancePublishCursor(path, queuedOffset);
+      persistPublishCursor();
+    }
+    return;
+  }
+
+  // Migrate the cursor file and the line number based status written by older firmware, once
+  File cursorFile = SD.open("qop.cursor", FILE_READ);
+  if (cursorFile)
+  {
+    std::string cursor = cursorFile.readStringUntil('\n').c_str();
+    cursorFile.close();
+    std::string::size_type comma = cursor.rfind(",");
+    if (comma != std::string::npos)
+    {
+      publishCursorFile = cursor.substr(0, comma);
+      publishCursorOffset = std::strtoul(cursor.c_str() + comma + 1, NULL, 10);
+      LOG_INFO("migrating qop.cursor to the event journal");
+      publishCursorDirty = true;
+      persistPublishCursor();
+    }
+    if (!publishCursorDirty)
+    {
+      SD.remove("qop.cursor");
+    }
+    return;
+  }
+
+  std::vector<std::string> pubStatus = getPublishStatusContent();
+  if (doesStatusExist(pubStatus))
+  {
+    publishCursorFile = getDateFromStatus(pubStatus);
+    publishCursorOffset = offsetAfterLines(publishCursorFile, std::stoi(getLineNumFromStatus(pubStatus)));
+    LOG_INFO("migrating qop.status to the event journal, offset: %lu", (unsigned long)publishCursorOffset);
+    publishCursorDirty = true;
+    persistPublishCursor();
+    if (!publishCursorDirty)
+    {
+      SD.remove("qop.status");
+    }
+  }
+}
+
+// Byte offset right after the first lineCount lines of the file
+uint32_t offsetAfterLines(std::string path, int lineCount)
+{
+  File file = SD.open(path.c_str(), FILE_READ);
+  if (!file)
+  {
+    return 0;
+  }
+  char line[EVENT_LINE_LENGTH];
+  for (int i = 0; i < lineCount && readEventLine(file, line, sizeof(line)) > 0; i++)
+  {
+  }
+  uint32_t offset = file.position();
+  file.close();
+  return offset;
+}
+
+std::vector<std::string> getPublishStatusContent()
+{
+  std::vector<std::string> pubStatus;
+  File pubStatusFile = SD.open("qop.status", FILE_READ);
+  if (!pubStatusFile)
+  {
+    return pubStatus;
+  }
+  String status = pubStatusFile.readStringUntil('\n');
+  pubStatusFile.close();
+  if (status == "")
+  {
+    return pubStatus;
+  }
+  char *token = std::strtok((char *)status.c_str(), ",");
+  pubStatus.push_back(token);
+  token = std::strtok(NULL, ",");
+  pubStatus.push_back(token);
+  return pubStatus;
+}
+
+boolean doesStatusExist(std::vector<std::string> statusVec)
+{
+  return statusVec.size() != 0;
+}
+
+std::string getDateFromStatus(std::vector<std::string> statusVec)
+{
+  return statusVec.at(0);
+}
+
+std::string getLineNumFromStatus(std::vector<std::string> statusVec)
+{
+  return statusVec.at(1);
+}
+
+// Queues the daily and monthly reports once their period is over, straight from the summary file
+void publishDueReports(time_t now)
+{
+  if (!powerState.running() || !isEpochNTPSynced(now))
+  {
+    return;
+  }
+  PowerStatsPeriod period;
+  uint32_t periodStart;
+  if (!powerStats.nextDueReport(now, period, periodStart))
+  {
+    return;
+  }
+  // queued before a crash kept it from being marked
+  if (!outbox.hasReport(period, periodStart))
+  {
+    PowerStatsBucket bucket;
+    powerStats.read(period, periodStart, bucket);
+    if (!outbox.enqueueReport(period, bucket))
+    {
+      return;
+    }
+    LOG_DEBUG("queued report: %s", powerStatsPeriodName(period));
+  }
+  powerStats.markReported(period, periodStart);
+}
+
+void publishOutbox()
+{
+  if (!powerState.running() || !storageReady || eventPublisher == NULL)
+  {
+    return;
+  }
+  outbox.sendDue(*eventPublisher);
+}
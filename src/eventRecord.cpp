@@ -0,0 +1,132 @@
+#include "eventRecord.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bitwise CRC-32 (IEEE, reflected). Records are 12 bytes so a table is not worth its RAM.
+uint32_t crc32(const uint8_t *data, size_t length, uint32_t crc)
+{
+  crc = ~crc;
+  while (length--)
+  {
+    crc ^= *data++;
+    for (int bit = 0; bit < 8; bit++)
+    {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+void initEventFileHeader(EventFileHeader &header, uint32_t createdEpoch)
+{
+  memset(&header, 0, sizeof(header));
+  header.magic = EVENT_FILE_MAGIC;
+  header.version = EVENT_FILE_VERSION;
+  header.recordSize = sizeof(EventRecord);
+  header.createdEpoch = createdEpoch;
+}
+
+bool isEventFileHeaderValid(const EventFileHeader &header)
+{
+  return header.magic == EVENT_FILE_MAGIC && header.version == EVENT_FILE_VERSION &&
+         header.recordSize == sizeof(EventRecord);
+}
+
+void sealEventRecord(EventRecord &record)
+{
+  record.crc = crc32((const uint8_t *)&record, offsetof(EventRecord, crc));
+}
+
+bool isEventRecordValid(const EventRecord &record)
+{
+  return record.type != EVENT_TYPE_NONE && record.crc == crc32((const uint8_t *)&record, offsetof(EventRecord, crc));
+}
+
+const char *eventTypeName(uint8_t type)
+{
+  switch (type)
+  {
+  case EVENT_TYPE_PON:
+    return "PON";
+  case EVENT_TYPE_PRES:
+    return "PRES";
+  case EVENT_TYPE_POFF:
+    return "POFF";
+  case EVENT_TYPE_BRWN:
+    return "BRWN";
+  case EVENT_TYPE_SURG:
+    return "SURG";
+  case EVENT_TYPE_NORM:
+    return "NORM";
+  default:
+    return "NONE";
+  }
+}
+
+uint8_t eventTypeFromName(const char *name, size_t length)
+{
+  for (uint8_t type = EVENT_TYPE_PON; type <= EVENT_TYPE_LAST; type++)
+  {
+    const char *candidate = eventTypeName(type);
+    if (strlen(candidate) == length && strncmp(candidate, name, length) == 0)
+    {
+      return type;
+    }
+  }
+  return EVENT_TYPE_NONE;
+}
+
+bool parseCsvEventLine(const char *line, EventRecord &record)
+{
+  memset(&record, 0, sizeof(record));
+  // sync flag: "1" when the epoch came from NTP, "c" when it was corrected to NTP, "-" otherwise
+  if (line[0] == '1')
+  {
+    record.flags |= EVENT_FLAG_NTP_SYNCED;
+  }
+  else if (line[0] == 'c')
+  {
+    record.flags |= EVENT_FLAG_NTP_SYNCED | EVENT_FLAG_CORRECTED;
+  }
+  else if (line[0] == '#')
+  {
+    return false;
+  }
+  const char *eventName = strchr(line, ',');
+  if (eventName == NULL)
+  {
+    return false;
+  }
+  eventName++;
+  const char *timeOfEvent = strchr(eventName, ',');
+  if (timeOfEvent == NULL)
+  {
+    return false;
+  }
+  record.type = eventTypeFromName(eventName, timeOfEvent - eventName);
+  const char *epoch = strchr(timeOfEvent + 1, ',');
+  if (record.type == EVENT_TYPE_NONE || epoch == NULL)
+  {
+    return false;
+  }
+  char *epochEnd;
+  record.epoch = strtoul(epoch + 1, &epochEnd, 10);
+  if (epochEnd == epoch + 1)
+  {
+    return false;
+  }
+  sealEventRecord(record);
+  return true;
+}
+
+size_t formatCsvEventLine(const EventRecord &record, const char *timeOfEvent, char *line, size_t length)
+{
+  const char *syncFlag = !(record.flags & EVENT_FLAG_NTP_SYNCED) ? "-"
+                         : record.flags & EVENT_FLAG_CORRECTED   ? "c"
+                                                                 : "1";
+  int printed = snprintf(line, length, "%s,%s,%s,%ld\r\n", syncFlag, eventTypeName(record.type), timeOfEvent,
+                         (long)record.epoch);
+  return printed > 0 && printed < (int)length ? printed : 0;
+}
@@ -0,0 +1,34 @@
+#include "heapMonitor.h"
+#include "logger.h"
+
+HeapMonitor heapMonitor;
+
+void HeapMonitor::sample()
+{
+  heap.freeHeap = ESP.getFreeHeap();
+  heap.maxFreeBlock = ESP.getMaxFreeBlockSize();
+  heap.fragmentation = ESP.getHeapFragmentation();
+  heap.samples++;
+
+  boolean worse = false;
+  if (heap.freeHeap < heap.minFreeHeap)
+  {
+    heap.minFreeHeap = heap.freeHeap;
+    worse = true;
+  }
+  if (heap.maxFreeBlock < heap.minMaxFreeBlock)
+  {
+    heap.minMaxFreeBlock = heap.maxFreeBlock;
+    worse = true;
+  }
+  if (heap.fragmentation > heap.maxFragmentation)
+  {
+    heap.maxFragmentation = heap.fragmentation;
+    worse = true;
+  }
+  if (worse)
+  {
+    LOG_INFO("heap low: %lu free, largest block %lu, fragmentation %u%%", (unsigned long)heap.minFreeHeap,
+             (unsigned long)heap.minMaxFreeBlock, heap.maxFragmentation);
+  }
+}
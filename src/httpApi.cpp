@@ -0,0 +1,517 @@
+#include "httpApi.h"
+
+#include <functional>
+#include <memory>
+
+#include "archiveCompactor.h"
+#include "bootTimer.h"
+#include "clockService.h"
+#include "configManager.h"
+#include "dayFileIndex.h"
+#include "eventHistory.h"
+#include "eventLog.h"
+#include "eventPublisher.h"
+#include "eventPublishing.h"
+#include "heapMonitor.h"
+#include "jsonFormat.h"
+#include "liveEvents.h"
+#include "logger.h"
+#include "mainsDetector.h"
+#include "mainsSampler.h"
+#include "outbox.h"
+#include "powerState.h"
+#include "powerStats.h"
+#include "profiler.h"
+#include "sdStorage.h"
+#include "waveformCapture.h"
+
+static uint8_t openStreams = 0;
+// publishBacklog() opens every day file past the cursor, loop() refreshes these for the handlers
+static size_t backlogFiles = 0;
+static uint32_t backlogBytes = 0;
+static uint32_t backlogRefreshedAt = 0;
+static bool backlogKnown = false;
+
+size_t httpApiOpenStreams()
+{
+  return openStreams;
+}
+
+// Live events go out as WebSocket text frames; a client whose frames are still queued is not handed more
+class WebSocketSink : public LiveEventSink
+{
+public:
+  explicit WebSocketSink(AsyncWebSocket &socket) : socket(socket) {}
+
+  bool canSend(uint32_t subscriber) override
+  {
+    AsyncWebSocketClient *client = socket.client(subscriber);
+    return client != NULL && client->canSend() && !client->queueIsFull();
+  }
+  void send(uint32_t subscriber, const char *message, size_t length) override
+  {
+    AsyncWebSocketClient *client = socket.client(subscriber);
+    if (client != NULL)
+    {
+      client->text(message, length);
+    }
+  }
+  void drop(uint32_t subscriber) override
+  {
+    AsyncWebSocketClient *client = socket.client(subscriber);
+    if (client != NULL)
+    {
+      client->close();
+    }
+  }
+
+private:
+  AsyncWebSocket &socket;
+};
+
+static AsyncWebSocket liveSocket("/api/live");
+static WebSocketSink liveSink(liveSocket);
+
+// Daily summaries, newest last, one qop.stats bucket at a time
+struct DaySummaryStream
+{
+  uint32_t nextDay = 0;
+  uint32_t lastDay = 0;
+  size_t streamed = 0;
+  bool closed = false;
+  char pending[HTTP_API_DAY_SUMMARY_BUFFER];
+  size_t pendingLength = 0;
+  size_t pendingSent = 0;
+
+  size_t formatNext()
+  {
+    if (closed)
+    {
+      return 0;
+    }
+    size_t used = 0;
+    if (streamed == 0)
+    {
+      pending[used++] = '[';
+    }
+    if (nextDay > lastDay)
+    {
+      pending[used++] = ']';
+      closed = true;
+      return used;
+    }
+    PowerStatsBucket bucket;
+    powerStats.read(POWER_STATS_DAY, nextDay, bucket);
+    // empty days are reported too, with their start filled in
+    bucket.periodStart = nextDay;
+    if (streamed > 0)
+    {
+      pending[used++] = ',';
+    }
+    size_t report = formatReportJson(POWER_STATS_DAY, bucket, configManager.data.projectName, pending + used,
+                                     sizeof(pending) - used);
+    if (report == 0)
+    {
+      // truncated, which the buffer size rules out: end the array where it is instead of after a separator
+      LOG_ERROR("api: day summary does not fit, ending the list");
+      used -= streamed > 0;
+      pending[used++] = ']';
+      closed = true;
+      return used;
+    }
+    used += report;
+    nextDay += 86400;
+    streamed++;
+    return used;
+  }
+
+  size_t fill(uint8_t *buf, size_t length)
+  {
+    if (!storageReady)
+    {
+      return 0;
+    }
+    size_t written = 0;
+    while (written < length)
+    {
+      if (pendingSent == pendingLength)
+      {
+        pendingLength = formatNext();
+        pendingSent = 0;
+        if (pendingLength == 0)
+        {
+          break;
+        }
+      }
+      size_t chunk = pendingLength - pendingSent < length - written ? pendingLength - pendingSent : length - written;
+      memcpy(buf + written, pending + pendingSent, chunk);
+      pendingSent += chunk;
+      written += chunk;
+    }
+    return written;
+  }
+};
+
+// Prometheus text format, a group of metrics at a time; reads no files so it takes no stream slot
+struct MetricsStream
+{
+  uint8_t part = 0;
+  char pending[896];
+  size_t pendingLength = 0;
+  size_t pendingSent = 0;
+
+  size_t formatNext()
+  {
+    size_t used = 0;
+    const HeapStats &heap = heapMonitor.stats();
+    switch (part++)
+    {
+    case 0:
+      appendf(pending, sizeof(pending), used,
+              "# TYPE qop_uptime_seconds gauge\nqop_uptime_seconds %lu\n"
+              "# TYPE qop_heap_free_bytes gauge\nqop_heap_free_bytes %lu\n"
+              "# TYPE qop_heap_min_free_bytes gauge\nqop_heap_min_free_bytes %lu\n"
+              "# TYPE qop_heap_max_free_block_bytes gauge\nqop_heap_max_free_block_bytes %lu\n"
+              "# TYPE qop_heap_fragmentation_percent gauge\nqop_heap_fragmentation_percent %u\n"
+              "# TYPE qop_log_dropped_total counter\nqop_log_dropped_total %lu\n"
+              "# TYPE qop_sampler_dropped_blocks_total counter\nqop_sampler_dropped_blocks_total %lu\n",
+              (unsigned long)(millis() / 1000), (unsigned long)ESP.getFreeHeap(), (unsigned long)heap.minFreeHeap,
+              (unsigned long)ESP.getMaxFreeBlockSize(), (unsigned)ESP.getHeapFragmentation(),
+              (unsigned long)logger.dropped(), (unsigned long)mainsSampler.droppedSamples());
+      return used;
+    case 1:
+      appendf(pending, sizeof(pending), used,
+              "# TYPE qop_sd_buffered_bytes gauge\nqop_sd_buffered_bytes %u\n"
+              "# TYPE qop_publish_backlog_files gauge\nqop_publish_backlog_files %u\n"
+              "# TYPE qop_publish_backlog_bytes gauge\nqop_publish_backlog_bytes %lu\n"
+              "# TYPE qop_publish_batch_events gauge\nqop_publish_batch_events %u\n"
+              "# TYPE qop_outbox_items gauge\nqop_outbox_items %u\n"
+              "# TYPE qop_outbox_events gauge\nqop_outbox_events %u\n",
+              (unsigned)dayFileWriter.pending(), (unsigned)backlogFiles, (unsigned long)backlogBytes,
+              (unsigned)outgoingBatch.size(), (unsigned)outbox.depth(), (unsigned)outbox.queuedEvents());
+      return used;
+    default:
+      break;
+    }
+#if QOP_PROFILE
+    uint8_t section = part - 3;
+    uint32_t mhz = ESP.getCpuFreqMHz();
+    if (part == 3)
+    {
+      appendf(pending, sizeof(pending), used,
+              "# HELP qop_section_seconds Time spent in loop() sections, cycle counter timed\n"
+              "# TYPE qop_section_seconds histogram\n");
+    }
+    if (section < PROFILE_SECTION_COUNT)
+    {
+      const ProfileStats &stats = profileStats(section);
+      const char *name = profileSectionName(section);
+      uint32_t cumulative = 0;
+      for (uint8_t bucket = 0; bucket < PROFILE_BUCKETS; bucket++)
+      {
+        cumulative += stats.buckets[bucket];
+        appendf(pending, sizeof(pending), used, "qop_section_seconds_bucket{section=\"%s\",le=\"%s\"} %lu\n", name,
+                profileBucketBound(bucket), (unsigned long)cumulative);
+      }
+      uint64_t totalUs = stats.totalCycles / mhz;
+      appendf(pending, sizeof(pending), used,
+              "qop_section_seconds_sum{section=\"%s\"} %lu.%06lu\nqop_section_seconds_count{section=\"%s\"} %lu\n",
+              name, (unsigned long)(totalUs / 1000000), (unsigned long)(totalUs % 1000000), name,
+              (unsigned long)stats.count);
+      return used;
+    }
+    if (section == PROFILE_SECTION_COUNT)
+    {
+      appendf(pending, sizeof(pending), used, "# TYPE qop_section_max_seconds gauge\n");
+      for (uint8_t i = 0; i < PROFILE_SECTION_COUNT; i++)
+      {
+        uint32_t maxUs = profileStats(i).maxCycles / mhz;
+        appendf(pending, sizeof(pending), used, "qop_section_max_seconds{section=\"%s\"} %lu.%06lu\n",
+                profileSectionName(i), (unsigned long)(maxUs / 1000000), (unsigned long)(maxUs % 1000000));
+      }
+      return used;
+    }
+#endif
+    return 0;
+  }
+
+  size_t fill(uint8_t *buf, size_t length)
+  {
+    size_t written = 0;
+    while (written < length)
+    {
+      if (pendingSent == pendingLength)
+      {
+        pendingLength = formatNext();
+        pendingSent = 0;
+        if (pendingLength == 0)
+        {
+          break;
+        }
+      }
+      size_t chunk = pendingLength - pendingSent < length - written ? pendingLength - pendingSent : length - written;
+      memcpy(buf + written, pending + pendingSent, chunk);
+      pendingSent += chunk;
+      written += chunk;
+    }
+    return written;
+  }
+};
+
+// Frees a stream slot once the server drops the response holding the stream
+template <typename Stream>
+static std::shared_ptr<Stream> openStream()
+{
+  openStreams++;
+  return std::shared_ptr<Stream>(new Stream(), [](Stream *stream) {
+    delete stream;
+    openStreams--;
+  });
+}
+
+// A stream reading the card, run from loop(): the server's callbacks come from the TCP stack, possibly while
+// loop() is in the middle of an SD write or a publish, and SDFS is not reentrant. loop() fills the buffer
+// once the callbacks took all of it; until then they are asked to call again.
+struct LoopFilledResponse
+{
+  std::function<void()> begin;
+  std::function<size_t(uint8_t *, size_t)> fill;
+  uint8_t buffer[HTTP_API_RESPONSE_BUFFER];
+  volatile size_t length = 0;
+  volatile size_t taken = 0;
+  volatile bool begun = false;
+  volatile bool complete = false;
+
+  // From loop()
+  void pump()
+  {
+    if (complete || taken < length)
+    {
+      return;
+    }
+    // emptied first, so the callbacks see nothing to take while it is refilled
+    length = 0;
+    taken = 0;
+    if (!begun)
+    {
+      begin();
+      begun = true;
+    }
+    size_t filled = fill(buffer, sizeof(buffer));
+    complete = filled == 0;
+    length = filled;
+  }
+
+  // From the server's callbacks
+  size_t take(uint8_t *buf, size_t maxLen)
+  {
+    size_t available = length - taken;
+    if (available == 0)
+    {
+      return complete ? 0 : RESPONSE_TRY_AGAIN;
+    }
+    size_t chunk = available < maxLen ? available : maxLen;
+    memcpy(buf, buffer + taken, chunk);
+    taken += chunk;
+    return chunk;
+  }
+};
+
+static std::weak_ptr<LoopFilledResponse> loopFilled[HTTP_API_MAX_STREAMS];
+
+// Sends stream as a chunked response that loop() begins and fills
+template <typename Stream>
+static void sendFromLoop(AsyncWebServerRequest *request, std::shared_ptr<Stream> stream, std::function<void()> begin)
+{
+  std::shared_ptr<LoopFilledResponse> response = std::make_shared<LoopFilledResponse>();
+  response->begin = begin;
+  response->fill = [stream](uint8_t *buf, size_t length) { return stream->fill(buf, length); };
+  // a slot is free: the stream slot this one holds was checked for
+  for (std::weak_ptr<LoopFilledResponse> &slot : loopFilled)
+  {
+    if (slot.expired())
+    {
+      slot = response;
+      break;
+    }
+  }
+  request->send(request->beginChunkedResponse("application/json",
+                                              [response](uint8_t *buf, size_t maxLen, size_t) {
+                                                return response->take(buf, maxLen);
+                                              }));
+}
+
+static uint32_t paramValue(AsyncWebServerRequest *request, const char *name, uint32_t fallback)
+{
+  if (!request->hasParam(name))
+  {
+    return fallback;
+  }
+  return strtoul(request->getParam(name)->value().c_str(), NULL, 10);
+}
+
+static void handleStatus(AsyncWebServerRequest *request)
+{
+  // never now(): a due resync would ask NTP and the RTC from the TCP stack's context
+  time_t now = clockService.epochAt(millis());
+  const HeapStats &heap = heapMonitor.stats();
+  char json[832];
+  size_t used = 0;
+  // the project name is free text from the settings page
+  appendf(json, sizeof(json), used, "{\"device\":");
+  appendJsonString(json, sizeof(json), used, configManager.data.projectName);
+  appendf(json, sizeof(json), used,
+          ",\"level\":\"%s\",\"adc\":%u,\"since\":%lu,\"epoch\":%lu,\"ntp\":%s,\"uptime\":%lu,"
+          "\"dayFiles\":%u,\"publishedDayFiles\":%u,\"archivedDays\":%u,\"cursor\":{\"file\":\"%s\",\"offset\":%lu},"
+          "\"heap\":{\"free\":%lu,\"minFree\":%lu,\"maxBlock\":%lu},\"logDropped\":%lu,\"liveSubscribers\":%u,"
+          "\"power\":{\"state\":\"%s\",\"resumes\":%lu,\"lastResumeMs\":%lu,\"maxResumeMs\":%lu},"
+          "\"outbox\":{\"items\":%u,\"events\":%u,\"breaker\":\"%s\",\"failures\":%u,\"retryInMs\":%lu},"
+          "\"bootMs\":{\"clock\":%lu,\"storage\":%lu,\"sensing\":%lu,\"network\":%lu,\"wifi\":%lu,\"ntp\":%lu}}",
+          mainsLevelName(mainsDetector.level()), mainsDetector.filtered(),
+          (unsigned long)clockService.epochAt(mainsDetector.changedAt()), (unsigned long)now,
+          clockService.isNtpSynced() ? "true" : "false", (unsigned long)millis(), (unsigned)dayFileIndex.size(),
+          (unsigned)publishedDayFileIndex.size(), (unsigned)archivedDayIndex.size(), publishCursorFile.c_str(), (unsigned long)publishCursorOffset,
+          (unsigned long)heap.freeHeap, (unsigned long)heap.minFreeHeap, (unsigned long)heap.maxFreeBlock,
+          (unsigned long)logger.dropped(), (unsigned)liveEvents.subscribers(), powerStateName(powerState.state()),
+          (unsigned long)powerState.resumes(), (unsigned long)powerState.lastResumeMs(),
+          (unsigned long)powerState.maxResumeMs(), (unsigned)outbox.depth(), (unsigned)outbox.queuedEvents(),
+          outboxBreakerName(outbox.breaker()), (unsigned)outbox.failureStreak(), (unsigned long)outbox.retryInMs(),
+          (unsigned long)bootTimer.at(BOOT_CLOCK), (unsigned long)bootTimer.at(BOOT_STORAGE),
+          (unsigned long)bootTimer.at(BOOT_SENSING), (unsigned long)bootTimer.at(BOOT_NETWORK),
+          (unsigned long)bootTimer.at(BOOT_WIFI), (unsigned long)bootTimer.at(BOOT_NTP));
+  request->send(200, "application/json", json);
+}
+
+static void handleEvents(AsyncWebServerRequest *request)
+{
+  if (openStreams >= HTTP_API_MAX_STREAMS)
+  {
+    request->send(503, "application/json", "{\"error\":\"busy\"}");
+    return;
+  }
+  std::shared_ptr<EventHistoryStream> stream = openStream<EventHistoryStream>();
+  LOG_DEBUG("api: streaming events");
+  if (request->hasParam("from") || request->hasParam("to"))
+  {
+    uint32_t from = paramValue(request, "from", 0);
+    uint32_t to = paramValue(request, "to", UINT32_MAX);
+    sendFromLoop(request, stream, [stream, from, to]() { stream->beginRange(from, to); });
+    return;
+  }
+  uint32_t last = paramValue(request, "last", HTTP_API_DEFAULT_LAST);
+  last = last < EVENT_HISTORY_MAX_LAST ? last : EVENT_HISTORY_MAX_LAST;
+  sendFromLoop(request, stream, [stream, last]() { stream->beginLast(last); });
+}
+
+static void handleDays(AsyncWebServerRequest *request)
+{
+  if (openStreams >= HTTP_API_MAX_STREAMS)
+  {
+    request->send(503, "application/json", "{\"error\":\"busy\"}");
+    return;
+  }
+  uint32_t days = paramValue(request, "last", HTTP_API_DEFAULT_DAYS);
+  // qop.stats holds no older days
+  if (days > POWER_STATS_DAY_SLOTS)
+  {
+    days = POWER_STATS_DAY_SLOTS;
+  }
+  if (days == 0)
+  {
+    days = 1;
+  }
+  std::shared_ptr<DaySummaryStream> stream = openStream<DaySummaryStream>();
+  stream->lastDay = powerStatsPeriodStart(POWER_STATS_DAY, clockService.epochAt(millis()));
+  stream->nextDay = stream->lastDay - (days - 1) * 86400UL;
+  sendFromLoop(request, stream, []() {});
+}
+
+static void handleBacklog(AsyncWebServerRequest *request)
+{
+  char json[224];
+  snprintf(json, sizeof(json),
+           "{\"files\":%u,\"bytes\":%lu,\"asOf\":%lu,\"batch\":%u,\"queued\":%u,\"publisher\":\"%s\"}",
+           (unsigned)backlogFiles, (unsigned long)backlogBytes,
+           (unsigned long)(backlogKnown ? clockService.epochAt(backlogRefreshedAt) : 0), (unsigned)outgoingBatch.size(), (unsigned)outbox.queuedEvents(),
+           eventPublisher ? eventPublisher->name() : "");
+  request->send(200, "application/json", json);
+}
+
+static void handleWaveform(AsyncWebServerRequest *request)
+{
+  const WaveformMetrics &last = waveformCapture.last();
+  char json[384];
+  snprintf(json, sizeof(json),
+           "{\"capture\":%s,\"rateHz\":%u,\"windowSamples\":%u,\"windows\":%lu,\"dropped\":%lu,\"dropouts\":%lu,"
+           "\"saved\":%lu,\"hzMin\":%u.%02u,\"hzMax\":%u.%02u,\"last\":{\"at\":%lu,\"mean\":%u,\"min\":%u,"
+           "\"max\":%u,\"rms\":%u,\"ripple\":%u.%02u,\"hz\":%u.%02u,\"dropout\":%s}}",
+           mainsSampler.capturing() ? "true" : "false", (unsigned)WAVEFORM_SAMPLE_RATE_HZ,
+           (unsigned)WAVEFORM_WINDOW_SAMPLES, (unsigned long)waveformCapture.windows(),
+           (unsigned long)waveformCapture.droppedWindows(), (unsigned long)waveformCapture.dropouts(),
+           (unsigned long)waveformCapture.savedFiles(), waveformCapture.minFrequency() / 100,
+           waveformCapture.minFrequency() % 100, waveformCapture.maxFrequency() / 100,
+           waveformCapture.maxFrequency() % 100, (unsigned long)clockService.epochAt(last.takenAt), last.mean,
+           last.min, last.max, last.rms, last.ripple / 100, last.ripple % 100, last.frequencyCentiHz / 100,
+           last.frequencyCentiHz % 100, last.flags & WAVEFORM_FLAG_DROPOUT ? "true" : "false");
+  request->send(200, "application/json", json);
+}
+
+static void handleMetrics(AsyncWebServerRequest *request)
+{
+  std::shared_ptr<MetricsStream> stream = std::make_shared<MetricsStream>();
+  request->send(request->beginChunkedResponse("text/plain; version=0.0.4",
+                                              [stream](uint8_t *buf, size_t maxLen, size_t) {
+                                                return stream->fill(buf, maxLen);
+                                              }));
+}
+
+static void handleLiveSocket(AsyncWebSocket *, AsyncWebSocketClient *client, AwsEventType type, void *, uint8_t *,
+                             size_t)
+{
+  if (type == WS_EVT_CONNECT)
+  {
+    // applied from loop(), the hub's slots are walked there
+    if (!liveEvents.subscribe(client->id()))
+    {
+      client->close();
+    }
+  }
+  else if (type == WS_EVT_DISCONNECT)
+  {
+    // with the queue full the slot stalls on canSend() until the ring overruns it and it is dropped
+    liveEvents.unsubscribe(client->id());
+  }
+}
+
+void beginHttpApi(AsyncWebServer &server)
+{
+  liveSocket.onEvent(handleLiveSocket);
+  liveEvents.setSink(&liveSink);
+  server.addHandler(&liveSocket);
+  server.on("/api/status", HTTP_GET, handleStatus);
+  server.on("/api/events", HTTP_GET, handleEvents);
+  server.on("/api/days", HTTP_GET, handleDays);
+  server.on("/api/backlog", HTTP_GET, handleBacklog);
+  server.on("/api/waveform", HTTP_GET, handleWaveform);
+  server.on("/metrics", HTTP_GET, handleMetrics);
+}
+
+void loopHttpApi()
+{
+  liveSocket.cleanupClients(LIVE_EVENT_MAX_SUBSCRIBERS);
+  liveEvents.pump();
+  for (std::weak_ptr<LoopFilledResponse> &slot : loopFilled)
+  {
+    std::shared_ptr<LoopFilledResponse> response = slot.lock();
+    if (response)
+    {
+      response->pump();
+    }
+  }
+  if (storageReady && (!backlogKnown || millis() - backlogRefreshedAt >= HTTP_API_BACKLOG_REFRESH_MS))
+  {
+    backlogFiles = publishBacklog(backlogBytes);
+    backlogRefreshedAt = millis();
+    backlogKnown = true;
+  }
+}
@@ -0,0 +1,155 @@
+#include "httpPublisher.h"
+#include "clientIo.h"
+#include "logger.h"
+
+void HttpPublisher::configure(const char *host, uint16_t port, const char *path, const char *device)
+{
+  if (strcmp(this->host, host) != 0 || this->port != port)
+  {
+    stop();
+  }
+  strlcpy(this->host, host, sizeof(this->host));
+  this->port = port;
+  strlcpy(this->path, path, sizeof(this->path));
+  strlcpy(this->device, device, sizeof(this->device));
+}
+
+bool HttpPublisher::publish(const EventBatch &batch)
+{
+  size_t payloadLength = formatBatchJson(batch, device, payload, sizeof(payload));
+  if (payloadLength == 0)
+  {
+    LOG_ERROR("http publisher: batch does not fit payload buffer");
+    return false;
+  }
+  return post(payloadLength);
+}
+
+bool HttpPublisher::publishReport(PowerStatsPeriod period, const PowerStatsBucket &bucket)
+{
+  size_t payloadLength = formatReportJson(period, bucket, device, payload, sizeof(payload));
+  return payloadLength != 0 && post(payloadLength);
+}
+
+bool HttpPublisher::post(size_t payloadLength)
+{
+  int headerLength = snprintf(header, sizeof(header),
+                              "POST %s HTTP/1.1\r\n"
+                              "Host: %s\r\n"
+                              "Content-Type: application/json\r\n"
+                              "Content-Length: %u\r\n"
+                              "Connection: keep-alive\r\n\r\n",
+                              path, host, (unsigned)payloadLength);
+
+  // One retry on a fresh connection, the collector may have timed out the kept-alive one
+  for (int attempt = 0; attempt < 2; attempt++)
+  {
+    if (!client.connected())
+    {
+      client.stop();
+      if (!client.connect(host, port))
+      {
+        LOG_WARN("http publisher: connect failed");
+        return false;
+      }
+      client.setNoDelay(true);
+    }
+    if (client.write((const uint8_t *)header, headerLength) == (size_t)headerLength &&
+        client.write((const uint8_t *)payload, payloadLength) == payloadLength)
+    {
+      return readResponse();
+    }
+    client.stop();
+  }
+  return false;
+}
+
+// Reads and drops length bytes of a response body
+static bool skipBody(Client &client, size_t length)
+{
+  uint8_t body[64];
+  while (length > 0)
+  {
+    size_t part = length < sizeof(body) ? length : sizeof(body);
+    if (!readExact(client, body, part, PUBLISH_REPLY_TIMEOUT_MS))
+    {
+      return false;
+    }
+    length -= part;
+  }
+  return true;
+}
+
+// Reads status line, headers and body, so the connection is ready for the next request
+bool HttpPublisher::readResponse()
+{
+  char line[128];
+  if (readLine(client, line, sizeof(line), PUBLISH_REPLY_TIMEOUT_MS) < 0)
+  {
+    client.stop();
+    return false;
+  }
+  int status = 0;
+  sscanf(line, "HTTP/%*s %d", &status);
+
+  size_t contentLength = 0;
+  bool chunked = false;
+  bool keepAlive = true;
+  int lineLength;
+  while ((lineLength = readLine(client, line, sizeof(line), PUBLISH_REPLY_TIMEOUT_MS)) > 0)
+  {
+    if (strncasecmp(line, "Content-Length:", 15) == 0)
+    {
+      contentLength = strtoul(line + 15, NULL, 10);
+    }
+    else if (strncasecmp(line, "Connection:", 11) == 0)
+    {
+      const char *value = line + 11;
+      while (*value == ' ')
+      {
+        value++;
+      }
+      keepAlive = strncasecmp(value, "close", 5) != 0;
+    }
+    else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0)
+    {
+      const char *value = line + 18;
+      while (*value == ' ')
+      {
+        value++;
+      }
+      chunked = strncasecmp(value, "chunked", 7) == 0;
+    }
+  }
+  bool bodyRead = lineLength == 0;
+  if (bodyRead && chunked)
+  {
+    // hex sized chunks, each followed by CRLF, up to a zero sized one; then trailer lines up to an empty one
+    size_t chunkLength;
+    do
+    {
+      bodyRead = readLine(client, line, sizeof(line), PUBLISH_REPLY_TIMEOUT_MS) >= 0;
+      chunkLength = bodyRead ? strtoul(line, NULL, 16) : 0;
+      bodyRead = bodyRead && (chunkLength == 0 || (skipBody(client, chunkLength) &&
+                                                   readLine(client, line, sizeof(line), PUBLISH_REPLY_TIMEOUT_MS) == 0));
+    } while (bodyRead && chunkLength > 0);
+    while (bodyRead && (lineLength = readLine(client, line, sizeof(line), PUBLISH_REPLY_TIMEOUT_MS)) != 0)
+    {
+      bodyRead = lineLength > 0;
+    }
+  }
+  else if (bodyRead)
+  {
+    bodyRead = skipBody(client, contentLength);
+  }
+  if (!bodyRead || !keepAlive)
+  {
+    client.stop();
+  }
+  return status >= 200 && status < 300;
+}
+
+void HttpPublisher::stop()
+{
+  client.stop();
+}
@@ -0,0 +1,43 @@
+#include "jsonFormat.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+void appendf(char *buf, size_t length, size_t &used, const char *format, ...)
+{
+  if (used >= length)
+  {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  int written = vsnprintf(buf + used, length - used, format, args);
+  va_end(args);
+  used = written < 0 || used + written >= length ? length : used + written;
+}
+
+void appendJsonString(char *buf, size_t length, size_t &used, const char *value)
+{
+  appendf(buf, length, used, "\"");
+  for (const char *c = value; *c != '\0' && used < length; c++)
+  {
+    unsigned char ch = (unsigned char)*c;
+    if (ch == '"' || ch == '\\')
+    {
+      appendf(buf, length, used, "\\%c", ch);
+    }
+    else if (ch < 0x20)
+    {
+      appendf(buf, length, used, "\\u%04x", ch);
+    }
+    else if (used + 1 < length)
+    {
+      buf[used++] = ch;
+    }
+    else
+    {
+      used = length;
+    }
+  }
+  appendf(buf, length, used, "\"");
+}
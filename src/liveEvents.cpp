@@ -0,0 +1,123 @@
+#include "liveEvents.h"
+
+#include <stdio.h>
+
+#include "eventPublisher.h"
+#include "logger.h"
+
+LiveEventHub liveEvents;
+
+static_assert((LIVE_EVENT_QUEUE_SIZE & (LIVE_EVENT_QUEUE_SIZE - 1)) == 0,
+              "sequence numbers wrap, the queue size must be a power of two");
+static_assert((LIVE_EVENT_REQUEST_QUEUE_SIZE & (LIVE_EVENT_REQUEST_QUEUE_SIZE - 1)) == 0 &&
+                  LIVE_EVENT_REQUEST_QUEUE_SIZE < 256,
+              "request indexes are uint8_t that wrap, the queue size must be a power of two");
+
+bool LiveEventHub::subscribe(uint32_t subscriber)
+{
+  return queueRequest(subscriber, true);
+}
+
+bool LiveEventHub::unsubscribe(uint32_t subscriber)
+{
+  return queueRequest(subscriber, false);
+}
+
+// Single producer: the web server's callbacks do not run into each other
+bool LiveEventHub::queueRequest(uint32_t subscriber, bool subscribe)
+{
+  uint8_t at = requestHead;
+  if ((uint8_t)(at - requestTail) >= LIVE_EVENT_REQUEST_QUEUE_SIZE)
+  {
+    return false;
+  }
+  requests[at % LIVE_EVENT_REQUEST_QUEUE_SIZE] = {subscriber, subscribe};
+  // the request is complete before pump() can see it
+  requestHead = at + 1;
+  return true;
+}
+
+void LiveEventHub::applyRequests()
+{
+  while (requestTail != requestHead)
+  {
+    const Request &request = requests[requestTail % LIVE_EVENT_REQUEST_QUEUE_SIZE];
+    Subscriber *slot = nullptr;
+    for (Subscriber &each : slots)
+    {
+      if (request.subscribe ? !each.used : each.used && each.id == request.id)
+      {
+        slot = &each;
+        break;
+      }
+    }
+    if (slot != nullptr)
+    {
+      slot->id = request.id;
+      slot->next = head;
+      slot->used = request.subscribe;
+    }
+    else if (request.subscribe && sink != nullptr)
+    {
+      LOG_WARN("live events: no slot for subscriber %lu", (unsigned long)request.id);
+      sink->drop(request.id);
+    }
+    requestTail = requestTail + 1;
+  }
+}
+
+size_t LiveEventHub::subscribers() const
+{
+  size_t count = 0;
+  for (const Subscriber &slot : slots)
+  {
+    count += slot.used;
+  }
+  return count;
+}
+
+void LiveEventHub::publish(const EventRecord &event)
+{
+  // a subscriber that connected before the event was logged gets it
+  applyRequests();
+  size_t at = head % LIVE_EVENT_QUEUE_SIZE;
+  int length = snprintf(messages[at], LIVE_EVENT_JSON_LENGTH, "{\"seq\":%lu,\"event\":", (unsigned long)head);
+  size_t json = formatEventJson(event, messages[at] + length, LIVE_EVENT_JSON_LENGTH - length - 1);
+  messages[at][length + json] = '}';
+  lengths[at] = length + json + 1;
+  head++;
+  // straight out, the transition should not wait for the next loop() pass
+  pump();
+}
+
+void LiveEventHub::pump()
+{
+  applyRequests();
+  if (sink == nullptr)
+  {
+    return;
+  }
+  for (Subscriber &slot : slots)
+  {
+    while (slot.used && slot.next != head)
+    {
+      if (head - slot.next > LIVE_EVENT_QUEUE_SIZE)
+      {
+        // its oldest unsent message is already overwritten
+        LOG_WARN("live events: dropping subscriber %lu, %lu messages behind", (unsigned long)slot.id,
+                 (unsigned long)(head - slot.next));
+        slot.used = false;
+        dropped++;
+        sink->drop(slot.id);
+        break;
+      }
+      if (!sink->canSend(slot.id))
+      {
+        break;
+      }
+      size_t at = slot.next % LIVE_EVENT_QUEUE_SIZE;
+      sink->send(slot.id, messages[at], lengths[at]);
+      slot.next++;
+    }
+  }
+}
@@ -0,0 +1,201 @@
+#include "logger.h"
+
+#include <SD.h>
+#include <stdarg.h>
+
+Logger logger;
+
+static_assert((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0, "ring positions wrap, the ring size must be a power of two");
+
+static const char *const levelNames[] = {"off", "error", "warn", "info", "debug", "trace"};
+static const char levelLetters[] = "-EWIDT";
+
+void Logger::setSinks(uint8_t sinks)
+{
+  // a sink switched on starts with the lines logged from now on
+  if (!(enabledSinks & LOG_SINK_SERIAL))
+  {
+    serialTail = head;
+  }
+  if (!(enabledSinks & LOG_SINK_SD))
+  {
+    sdTail = head;
+    sdPendingSince = 0;
+  }
+  enabledSinks = sinks;
+}
+
+size_t Logger::pendingFor(size_t tail) const
+{
+  return head - tail;
+}
+
+// Bytes the slowest enabled sink has yet to take
+size_t Logger::pending() const
+{
+  size_t pending = 0;
+  if ((enabledSinks & LOG_SINK_SERIAL) && pendingFor(serialTail) > pending)
+  {
+    pending = pendingFor(serialTail);
+  }
+  if ((enabledSinks & LOG_SINK_SD) && pendingFor(sdTail) > pending)
+  {
+    pending = pendingFor(sdTail);
+  }
+  return pending;
+}
+
+void Logger::write(uint8_t level, const char *format, ...)
+{
+  if (enabledSinks == 0)
+  {
+    return;
+  }
+  char line[LOG_LINE_LENGTH];
+  uint32_t now = millis();
+  size_t length = snprintf(line, sizeof(line), "%lu.%03lu %c ", (unsigned long)(now / 1000),
+                           (unsigned long)(now % 1000), levelLetters[level <= LOG_LEVEL_TRACE ? level : 0]);
+  // leave room for "\r\n", a longer message is cut
+  size_t room = sizeof(line) - length - 2;
+  va_list args;
+  va_start(args, format);
+  int body = vsnprintf(line + length, room, format, args);
+  va_end(args);
+  if (body > 0)
+  {
+    length += (size_t)body < room ? (size_t)body : room - 1;
+  }
+  line[length++] = '\r';
+  line[length++] = '\n';
+
+  if (length > LOG_RING_SIZE - pending())
+  {
+    droppedLines++;
+    return;
+  }
+  size_t at = head % LOG_RING_SIZE;
+  size_t first = length < LOG_RING_SIZE - at ? length : LOG_RING_SIZE - at;
+  memcpy(ring + at, line, first);
+  memcpy(ring, line + first, length - first);
+  head += length;
+  if ((enabledSinks & LOG_SINK_SD) && sdPendingSince == 0)
+  {
+    sdPendingSince = now | 1;
+  }
+}
+
+void Logger::drain()
+{
+  if (enabledSinks & LOG_SINK_SERIAL)
+  {
+    int room = Serial.availableForWrite();
+    drainSerial(room > 0 ? room : 0);
+  }
+  else
+  {
+    serialTail = head;
+  }
+  if (enabledSinks & LOG_SINK_SD)
+  {
+    drainSd(false);
+  }
+  else
+  {
+    sdTail = head;
+  }
+}
+
+void Logger::flush()
+{
+  if (enabledSinks & LOG_SINK_SERIAL)
+  {
+    drainSerial(LOG_RING_SIZE);
+  }
+  if (enabledSinks & LOG_SINK_SD)
+  {
+    drainSd(true);
+  }
+}
+
+// At most room bytes, from drain() as much as the UART FIFO takes right now; the rest waits for the next pass
+size_t Logger::drainSerial(size_t room)
+{
+  size_t count = pendingFor(serialTail);
+  if (count > room)
+  {
+    count = room;
+  }
+  size_t written = 0;
+  while (written < count)
+  {
+    size_t at = serialTail % LOG_RING_SIZE;
+    size_t chunk = count - written < LOG_RING_SIZE - at ? count - written : LOG_RING_SIZE - at;
+    Serial.write((const uint8_t *)ring + at, chunk);
+    serialTail += chunk;
+    written += chunk;
+  }
+  return written;
+}
+
+// Batches lines into sector sized appends, so the card sees few writes
+void Logger::drainSd(bool force)
+{
+  size_t count = pendingFor(sdTail);
+  if (count == 0 ||
+      (!force && count < LOG_SD_WRITE_SIZE && (uint32_t)(millis() - sdPendingSince) < LOG_SD_WRITE_INTERVAL_MS))
+  {
+    return;
+  }
+  sdPendingSince = 0;
+  File logFile = SD.open(LOG_FILE_PATH, FILE_WRITE);
+  if (!logFile)
+  {
+    // card missing or powered down, these lines only go to Serial
+    sdTail = head;
+    return;
+  }
+  while (sdTail != head)
+  {
+    size_t at = sdTail % LOG_RING_SIZE;
+    size_t chunk = head - sdTail < LOG_RING_SIZE - at ? head - sdTail : LOG_RING_SIZE - at;
+    logFile.write((const uint8_t *)ring + at, chunk);
+    sdTail += chunk;
+  }
+  bool rotate = logFile.size() > LOG_FILE_MAX_SIZE;
+  logFile.close();
+  if (rotate)
+  {
+    SD.remove(LOG_FILE_OLD_PATH);
+    SD.rename(LOG_FILE_PATH, LOG_FILE_OLD_PATH);
+  }
+}
+
+uint8_t logLevelFromName(const char *name)
+{
+  for (uint8_t level = LOG_LEVEL_OFF; level <= LOG_LEVEL_TRACE; level++)
+  {
+    if (strcmp(name, levelNames[level]) == 0)
+    {
+      return level;
+    }
+  }
+  return LOG_LEVEL_INFO;
+}
+
+const char *logLevelName(uint8_t level)
+{
+  return level <= LOG_LEVEL_TRACE ? levelNames[level] : "?";
+}
+
+uint8_t logSinksFromName(const char *name)
+{
+  if (strcmp(name, "sd") == 0)
+  {
+    return LOG_SINK_SD;
+  }
+  if (strcmp(name, "both") == 0)
+  {
+    return LOG_SINK_SERIAL | LOG_SINK_SD;
+  }
+  return LOG_SINK_SERIAL;
+}
@@ -14,11 +14,31 @@
 #include <SD.h>
 #include <SdFat.h>
 
+#include "eventLog.h"
+#include "eventJournal.h"
+#include "dayFileIndex.h"
+#include "httpApi.h"
+#include "eventPublishing.h"
+#include "twitterPublisher.h"
+#include "httpPublisher.h"
+#include "mqttPublisher.h"
+#include "mainsSampler.h"
+#include "mainsCalibration.h"
+#include "waveformCapture.h"
+#include "traceRecorder.h"
+#include "clockService.h"
+#include "powerStats.h"
+#include "heapMonitor.h"
+#include "logger.h"
+#include "powerState.h"
+#include "sdStorage.h"
+#include "outbox.h"
+#include "archiveCompactor.h"
+#include "bootTimer.h"
+#include "profiler.h"
+
 File root;
 void printDirectory(File dir, int numTabs);
-#define CS_PIN D8
-
-File dataRoot;
 
 // Setup start: For twitter webclient api
 #include <NTPClient.h>
@@ -36,103 +56,59 @@ WiFiUDP ntpUDP;
 NTPClient timeClient(ntpUDP, ntp_server, (timezone * 3600) + 1800, 60000); // NTP server pool, offset (in seconds), update interval (in milliseconds)
 TwitterClient tcr(timeClient, CONSUMER_KEY, CONSUMER_SECRET, ACCESS_TOKEN, ACCESS_TOKEN_SECRET);
 
-int publishTweet(std::string event, time_t epoch);
-int publishPowerOnEvent(time_t epoch);
-int publishPowerOffEvent(time_t epoch);
+void applyConfig();
+void applyPublisherConfig();
+MainsThresholds configuredMainsThresholds();
+void finishMainsCalibration();
 int publishCounter = 1;
-std::string &reduceDoubleSpaces(std::string &s);
-std::string &removeNewLines(std::string &s);
 
-time_t ntpEpoch;
+// Backend selected by the "publisher" setting, switchable from the web GUI at runtime
+TwitterPublisher twitterPublisher(tcr);
+HttpPublisher httpPublisher;
+MqttPublisher mqttPublisher;
 // Setup End: For twitter webclient api
 
-File getLatestFileByDate(File rootDir, std::string date, time_t epochTime);
-void publishUnpublishedEvents(File rootDir);
-std::vector<std::string> listDirSorted(File rootDir);
-void writePowerResumeEventToFile(File dateFile, std::string timeOfEvent, time_t epoch, boolean ntpStatus);
-void writePowerOnEventToFile(File dateFile, std::string timeOfEvent, time_t epoch, boolean ntpStatus);
-void writePowerOffEventToFile(File dateFile, std::string timeOfEvent, time_t epoch, boolean ntpStatus);
-std::string getFilenameFromEpoch(time_t epochTime);
-std::string getTimeOfEventFromEpoch(time_t epochTime);
-boolean isEpochNTPSynced(time_t epoch);
-std::vector<std::string> getPublishStatusContent();
-boolean doesStatusExist(std::vector<std::string> statusVec);
-std::string getDateFromStatus(std::vector<std::string> statusVec);
-std::string getLineNumFromStatus(std::vector<std::string> statusVec);
-void persistPubStatusToFile(std::string date, std::string lineNum);
 void run();
-time_t getTimeFromMultipleSources();
-boolean requireRtcTimeAdjustment(tm *localTime, DateTime rtcNow);
 
 // RTC setup
 RTC_DS1307 RTC; // Setup an instance of DS1307 naming it RTC
 
 int i;
-#define MAINS_ANALOG_SENSE_PIN A0
-
-File currentDayFile;
-std::string currentDateString;
-bool mainsPoweredOffAtleastOnce = false;
-int lastSensorReading = 0;
-int lastMainPowerStatus = -1;
-
-int mainPowerStatus();
-void updatePowerStatusIfChanged();
-void shutdown();
 
 void setup()
 {
   Serial.begin(115200);
+  // sensing first: clock, card and detector; the web server, WiFi and NTP follow from loop() (bootTimer.h)
   if (!RTC.begin()) {
-    Serial.println("Couldn't find RTC");
+    LOG_ERROR("Couldn't find RTC");
   } else {
-    Serial.println("Connected to RTC");
+    LOG_INFO("Connected to RTC");
   }
 
   if (!RTC.isrunning()) {
-    Serial.println("RTC is NOT running!");
+    LOG_WARN("RTC is NOT running!");
   } else {
-    Serial.println("RTC is running!");
+    LOG_INFO("RTC is running!");
   }
 
-  Serial.print("consumer key: ");
-  Serial.println(CONSUMER_KEY);
-  Serial.print("access token: ");
-  Serial.println(ACCESS_TOKEN);
+  LOG_DEBUG("consumer key: %s", CONSUMER_KEY);
+  LOG_DEBUG("access token: %s", ACCESS_TOKEN);
   // LittleFS.begin();
-  GUI.begin();
   configManager.begin();
-  WiFiManager.begin("quality-of-power-supply-reporter");
-  Serial.println("timeSync.begin()");
-  timeSync.begin();
-  Serial.println("tcr.startNTP()");
-
-  tcr.startNTP();
-  
-  // Get time for NTP/RTC
-  ntpEpoch = getTimeFromMultipleSources();
+  configManager.setConfigSaveCallback(applyConfig);
+  applyConfig();
 
-  Serial.print("Initializing SD card...");
-
-  bool initFailed = false;
-
-  if (!SD.begin(CS_PIN, SD_SCK_MHZ(1)))
-  {
-    initFailed = true;
-    Serial.println("initialization failed!");
-    Serial.println();
-  }
+  // Get time from the RTC, NTP is attached once the network is up
+  clockService.begin(RTC);
+  ntpEpoch = getTimeFromMultipleSources();
+  bootTimer.mark(BOOT_CLOCK);
 
-  delay(500);
+  LOG_INFO("Initializing SD card...");
 
-  Serial.print("Card type:         ");
-  Serial.println(SD.type());
-  Serial.print("fatType:           ");
-  Serial.println(SD.fatType());
-  Serial.print("size:              ");
-  Serial.println(SD.size());
+  bool initFailed = !beginStorage();
 
-  Serial.println();
+  LOG_INFO("Card type: %d, fatType: %d, size: %llu", (int)SD.type(), (int)SD.fatType(), (unsigned long long)SD.size());
+  logger.flush();
   if (initFailed)
   {
     delay(1000);
@@ -140,135 +116,161 @@ void setup()
       ; // Soft reset
   }
 
-  Serial.println("initialization done.");
-  dataRoot = SD.open("/qop");
-  if (!dataRoot)
-  {
-    SD.mkdir("qop");
-    dataRoot = SD.open("/qop");
-  }
+  LOG_INFO("initialization done.");
   File pubDataRoot = SD.open("/qop-published");
-  if (!pubDataRoot)
-  {
-    SD.mkdir("qop-published");
-  }
+
+  // replay events a crash kept out of their day file before anything reads them
+  eventJournal.recover();
+  dayFileIndex.build(dataRoot);
+  publishedDayFileIndex.build(pubDataRoot);
   pubDataRoot.close();
+  archiveCompactor.begin();
+  powerStats.begin();
+  bootTimer.mark(BOOT_STORAGE);
 
-  root = SD.open("/");
-  printDirectory(root, 0);
-  Serial.println("done!");
+  mainsDetector.begin(configuredMainsThresholds());
+  mainsSampler.begin(MAINS_ANALOG_SENSE_PIN);
+  bootTimer.mark(BOOT_SENSING);
+  logger.flush();
 
   // attachInterrupt(digitalPinToInterrupt(MAINS_POWER_SENSE_PIN), senseRisingState, CHANGE);
   // attachInterrupt(digitalPinToInterrupt(MAINS_POWER_SENSE_PIN), senseFallingState, FALLING);
 }
 
-void loop()
+// Set once WiFiManager.begin() ran, its loop() serves the captive portal it starts
+static bool wifiManagerStarted = false;
+
+// What WiFiManager.begin() does before it waits for the connection: the stored static IP settings, if any, then
+// the stored credentials
+static void beginStation()
 {
-  WiFiManager.loop();
-  updater.loop();
-  configManager.loop();
-  // run();
-  if (millis() >= i) {
-    Serial.print("Loop start: ");
-    Serial.println(i);
-    i = i + 1000;
-    publishUnpublishedEvents(dataRoot);
+  WiFi.mode(WIFI_STA);
+  if (configManager.internal.ip || configManager.internal.gw || configManager.internal.sub ||
+      configManager.internal.dns)
+  {
+    WiFi.config(IPAddress(configManager.internal.ip), IPAddress(configManager.internal.gw),
+                IPAddress(configManager.internal.sub), IPAddress(configManager.internal.dns));
   }
+  WiFi.begin();
 }
 
-int mainPowerStatus() {
-  int currentSensorValue = analogRead(MAINS_ANALOG_SENSE_PIN);
-  int diff = currentSensorValue - lastSensorReading;
-  Serial.print("lastSensorReading: ");
-  Serial.println(lastSensorReading);
-  Serial.print("currentSensorValue: ");
-  Serial.println(currentSensorValue);
-  Serial.print("diff: ");
-  Serial.println(diff);
-  lastSensorReading = currentSensorValue;
-  if (mainsPoweredOffAtleastOnce) {
-    if (diff >= 100) {
-      return 1;
-    } else if (diff < -100) {
-      return 0;
-    }
-  } else {
-    if (diff <= -100) {
-      mainsPoweredOffAtleastOnce = true;
-      return 0;
-    }
+// The rest of the boot, off the path to sensing: one step per loop() pass
+static void continueBoot()
+{
+  static bool choresDone = false;
+  if (!bootTimer.reached(BOOT_NETWORK))
+  {
+    GUI.begin();
+    beginHttpApi(GUI.server);
+    // WiFiManager.begin() would wait in here for the connection
+    beginStation();
+    LOG_DEBUG("timeSync.begin()");
+    timeSync.begin();
+    LOG_DEBUG("tcr.startNTP()");
+    tcr.startNTP();
+    clockService.attachNtp(tcr);
+    bootTimer.mark(BOOT_NETWORK);
+    return;
+  }
+  if (!bootTimer.reached(BOOT_WIFI) && WiFi.status() == WL_CONNECTED)
+  {
+    bootTimer.mark(BOOT_WIFI);
+    // the first NTP request goes out now, not at the next resync
+    clockService.resync();
+  }
+  if (!wifiManagerStarted && !bootTimer.reached(BOOT_WIFI) &&
+      millis() - bootTimer.at(BOOT_NETWORK) >= BOOT_WIFI_WAIT_MS)
+  {
+    // no network stored or none in reach: the manager restarts the station with the same settings and, as it
+    // does not connect within its 1 ms wait, opens its captive portal for new credentials
+    wifiManagerStarted = true;
+    LOG_INFO("WiFi not connected after %lu ms, starting the captive portal", (unsigned long)BOOT_WIFI_WAIT_MS);
+    WiFiManager.begin("quality-of-power-supply-reporter", 1);
+  }
+  if (!bootTimer.reached(BOOT_NTP) && clockService.isNtpSynced())
+  {
+    bootTimer.mark(BOOT_NTP);
+  }
+  if (choresDone)
+  {
+    return;
+  }
+  choresDone = true;
+  if (logger.level() >= LOG_LEVEL_DEBUG)
+  {
+    root = SD.open("/");
+    printDirectory(root, 0);
+    root.close();
+  }
+#if QOP_SD_BENCHMARK
+  SdBenchmark bench;
+  if (runSdBenchmark(bench))
+  {
+    LOG_INFO("SD benchmark at %u MHz: write %lu kB/s, read %lu kB/s, flush avg %lu us, max %lu us",
+             (unsigned)bench.clockMhz, (unsigned long)(bench.bytes * 1000ULL / (bench.writeUs ? bench.writeUs : 1)),
+             (unsigned long)(bench.bytes * 1000ULL / (bench.readUs ? bench.readUs : 1)),
+             (unsigned long)(bench.flushes ? bench.totalFlushUs / bench.flushes : 0), (unsigned long)bench.maxFlushUs);
   }
-  return -1;
+  else
+  {
+    LOG_ERROR("SD benchmark failed");
+  }
+  logger.flush();
+#endif
+  LOG_INFO("done!");
 }
 
-void updatePowerStatusIfChanged() {
-  Serial.println("Updating power status if changed");
-  time_t currentEpochTime = getTimeFromMultipleSources();
-  Serial.print("Current epoch time: ");
-  Serial.println(currentEpochTime);
-  if (currentDayFile == NULL) {
-    currentDateString = getFilenameFromEpoch(currentEpochTime);
-    currentDayFile = getLatestFileByDate(dataRoot, currentDateString, currentEpochTime);
-    std::string timeOfEventString = getTimeOfEventFromEpoch(currentEpochTime);
-    writePowerResumeEventToFile(currentDayFile, timeOfEventString, currentEpochTime, isEpochNTPSynced(currentEpochTime));
-  } else {
-    if (isEpochNTPSynced(currentEpochTime))
+void loop()
+{
+  PROFILE_SCOPE(PROFILE_LOOP);
+  // without mains only the detector runs, the card is unmounted and WiFi off
+  powerState.loop();
+  if (!powerState.running())
+  {
+    updatePowerStatusIfChanged();
+    logger.drain();
+    return;
+  }
+  continueBoot();
+  if (bootTimer.reached(BOOT_NETWORK))
+  {
+    if (wifiManagerStarted)
     {
-      std::string newDateString = getFilenameFromEpoch(currentEpochTime);
-      // Create new file in case, date changes
-      if (currentDateString.compare(newDateString) != 0)
-      {
-        currentDayFile.close();
-        currentDayFile = getLatestFileByDate(dataRoot, newDateString, currentEpochTime);
-        currentDateString = newDateString;
-        Serial.print("picked file for writing new events: ");
-        Serial.println(currentDayFile.fullName());
-      }
+      PROFILED(PROFILE_WIFI_MANAGER, WiFiManager.loop());
     }
+    PROFILED(PROFILE_UPDATER, updater.loop());
+    eventPublisher->loop();
   }
-
-  int currentMainPowerStatus = mainPowerStatus();
-  Serial.print("mainPowerStatus: ");
-  Serial.println(currentMainPowerStatus);
-  // Writes event only if main power status changed and it is different from last one
-  if (currentMainPowerStatus != -1 && lastMainPowerStatus != currentMainPowerStatus) {
-    std::string timeOfEventString = getTimeOfEventFromEpoch(currentEpochTime);
-    if (currentMainPowerStatus == 1) {
-      writePowerResumeEventToFile(currentDayFile, timeOfEventString, currentEpochTime, isEpochNTPSynced(currentEpochTime));
-    } else if (currentMainPowerStatus == 0) {
-      writePowerOffEventToFile(currentDayFile, timeOfEventString, currentEpochTime, isEpochNTPSynced(currentEpochTime));
-      shutdown();
-    }
-    lastMainPowerStatus = currentMainPowerStatus;
+  configManager.loop();
+  // run();
+  // drain the sampler on every pass, edge detection no longer waits for the publish tick
+  updatePowerStatusIfChanged();
+  // one outbox item per pass, the sampler is drained again between publishes
+  if (outbox.depth() > 0)
+  {
+    publishOutbox();
   }
-}
-
-void shutdown() {
-    Serial.println("putting in deepsleep");
-    currentDayFile.close();
-    SD.end();
-    // ESP.wdtDisable();
-    int threshold = millis();
-    int startValue = threshold;
-    while (true) {
-      if (millis() > threshold) {
-        delay(100);
-        threshold = threshold + 1000;
-        if (mainPowerStatus() == 1) {
-          break;
-        }
-      } else {
-        yield();
-        delay(100);
-      }
-      if ((millis() - startValue) > 30 * 1000) {
-        yield();
-        break;
-      }
+  if (millis() >= i) {
+    LOG_TRACE("Loop start: %d", i);
+    i = i + 1000;
+    openDayFileFor(getTimeFromMultipleSources());
+    publishUnpublishedEvents(dataRoot);
+    publishDueReports(getTimeFromMultipleSources());
+    // idle: pack one published day file of a finished month, never under a stream reading the day files
+    if (!unpublishedEventsPending && outbox.depth() == 0 && httpApiOpenStreams() == 0)
+    {
+      archiveCompactor.step(getTimeFromMultipleSources());
     }
-    // ESP.restart();
-    // delay(30000);
-    // ESP.deepSleep(0);
+    heapMonitor.sample();
+    if (mainsCalibration.complete())
+    {
+      finishMainsCalibration();
+    }
+  }
+  loopStorage();
+  loopHttpApi();
+  // idle time: hand buffered log lines to Serial and SD without waiting on either
+  logger.drain();
 }
 
 // void run()
@@ -313,418 +315,111 @@ void shutdown() {
 //   dateFile.close();
 // }
 
-time_t getTimeFromMultipleSources() {
-  ntpEpoch = tcr.getEpoch();
-  tm *localTime = std::localtime(&ntpEpoch);
-
-  DateTime rtcNow = RTC.now();
-  String nowTimestamp = rtcNow.timestamp();
-  Serial.print("RTC timestamp before adjustment:");
-  Serial.println(nowTimestamp);
-
-  // Making sure epoch timestamp year is greater than current year itself (dirty check)
-  if (localTime->tm_year + 1900 >= 2022 && requireRtcTimeAdjustment(localTime, rtcNow))  {
-    Serial.println("adjusting RTC clock");
-    RTC.adjust(DateTime(uint16_t(localTime->tm_year+1900), uint8_t(localTime->tm_mon + 1), uint8_t(localTime->tm_mday), uint8_t(localTime->tm_hour), uint8_t(localTime->tm_min), uint8_t(localTime->tm_sec)));  // Time and date is expanded to date and time on your computer at compiletime
-    rtcNow = RTC.now();
-    String nowTimestamp = rtcNow.timestamp();
-    Serial.print("RTC timestamp after adjustment:");
-    Serial.println(nowTimestamp);
-    return ntpEpoch;
-  }
-
-  uint32_t rtcEpoch = rtcNow.unixtime();
-  Serial.print("NTP epoch:");
-  Serial.println(ntpEpoch);
-  Serial.print("RTC epoch:");
-  Serial.println(rtcEpoch);
-  return time_t(rtcEpoch);
-}
-
-boolean requireRtcTimeAdjustment(tm *localTime, DateTime rtcNow) {
-  return localTime->tm_year+1900 != rtcNow.year() || localTime->tm_mon + 1 != rtcNow.month() || localTime->tm_mday != rtcNow.day() ||
-  localTime->tm_hour != rtcNow.hour() || (localTime->tm_min - rtcNow.minute()) > 10;
-}
-
-
-boolean isEpochNTPSynced(time_t epoch)
+void applyConfig()
 {
-  return (ntpEpoch > 1651363200);
-}
-
-void writePowerResumeEventToFile(File dateFile, std::string timeOfEvent, time_t epoch, boolean ntpStatus)
-{
-  Serial.print("PRES timeOfEvent: ");
-  Serial.println(timeOfEvent.c_str());
-  if (ntpStatus)
+  logger.setLevel(logLevelFromName(configManager.data.logLevel));
+  logger.setSinks(logSinksFromName(configManager.data.logSink));
+  applyPublisherConfig();
+  // takes effect at once when the sampler runs, at its begin() otherwise
+  mainsSampler.setCapture(strcmp(configManager.data.waveformCapture, "off") != 0);
+  waveformCapture.setSaveRaw(strcmp(configManager.data.waveformCapture, "raw") == 0);
+  traceRecorder.setEnabled(strcmp(configManager.data.traceRecord, "on") == 0);
+  dayFileWriter.setWindow(configManager.data.sdWriteWindow * 1000UL);
+  // a save of other settings keeps the learning going, selecting "learn" again starts it over
+  bool learn = strcmp(configManager.data.mainsCalibration, "learn") == 0;
+  if (learn && !mainsCalibration.learning())
   {
-    dateFile.print("1,");
+    mainsCalibration.begin();
   }
-  else
+  else if (!learn)
   {
-    dateFile.print("-,");
+    mainsCalibration.stop();
   }
-  dateFile.print("PRES,");
-  dateFile.print(timeOfEvent.c_str());
-  dateFile.print(",");
-  dateFile.println(epoch);
-  dateFile.flush();
+  mainsDetector.setThresholds(configuredMainsThresholds());
 }
 
-void writePowerOffEventToFile(File dateFile, std::string timeOfEvent, time_t epoch, boolean ntpStatus)
+// The stock band edges while learning, the learned or manually set ones after
+MainsThresholds configuredMainsThresholds()
 {
-  Serial.print("POFF timeOfEvent: ");
-  Serial.println(timeOfEvent.c_str());
-  if (ntpStatus)
+  MainsThresholds thresholds;
+  if (strcmp(configManager.data.mainsCalibration, "learn") == 0)
   {
-    dateFile.print("1,");
+    return thresholds;
   }
-  else
+  MainsThresholds configured;
+  configured.offBelow = configManager.data.mainsOffBelow;
+  configured.brownoutBelow = configManager.data.mainsBrownoutBelow;
+  configured.surgeAbove = configManager.data.mainsSurgeAbove;
+  configured.hysteresis = configManager.data.mainsHysteresis;
+  configured.offDebounce = configManager.data.mainsOffDebounce;
+  if (!isMainsThresholdsValid(configured))
   {
-    dateFile.print("-,");
+    LOG_ERROR("calibration: A0 thresholds %u/%u/%u, hysteresis %u, debounce %u are out of order, using the stock ones",
+              configured.offBelow, configured.brownoutBelow, configured.surgeAbove, configured.hysteresis,
+              configured.offDebounce);
+    return thresholds;
   }
-  dateFile.print("POFF,");
-  dateFile.print(timeOfEvent.c_str());
-  dateFile.print(",");
-  dateFile.println(epoch);
-  dateFile.flush();
+  return configured;
 }
 
-void writePowerOnEventToFile(File dateFile, std::string timeOfEvent, time_t epoch, boolean ntpStatus)
+// Persists what three hours of readings show as this unit's thresholds, the web GUI shows and overrides them
+void finishMainsCalibration()
 {
-  Serial.print("PON timeOfEvent: ");
-  Serial.println(timeOfEvent.c_str());
-  if (ntpStatus)
+  MainsCalibrationResult result;
+  if (!mainsCalibration.derive(result))
   {
-    dateFile.print("1,");
-  }
-  else
-  {
-    dateFile.print("-,");
-  }
-  dateFile.print("PON,");
-  dateFile.print(timeOfEvent.c_str());
-  dateFile.print(",");
-  dateFile.println(epoch);
-  dateFile.flush();
-}
-
-std::string getFilenameFromEpoch(time_t epochTime)
-{
-  tm *localTime = std::localtime(&epochTime);
-  char dateBuf[9];
-  sprintf(dateBuf, "%d%02d%02d", 1900 + (localTime->tm_year), (localTime->tm_mon) + 1, localTime->tm_mday);
-  return dateBuf;
-}
-
-std::string getTimeOfEventFromEpoch(time_t epochTime)
-{
-  tm *localTime = std::localtime(&epochTime);
-  char timeOfEvent[9];
-  sprintf(timeOfEvent, "%02d:%02d:%02d", localTime->tm_hour, localTime->tm_min, localTime->tm_sec);
-  return timeOfEvent;
-}
-
-// Get Latest file matching current date if time stamp is valid, otherwise returns latest file
-File getLatestFileByDate(File rootDir, std::string date, time_t epochTime)
-{
-  std::vector<std::string> filenamesSorted = listDirSorted(rootDir);
-  if (!filenamesSorted.empty()) {
-  std::string lastFile = filenamesSorted.at(filenamesSorted.size() - 1);
-    if (!isEpochNTPSynced(epochTime))
-    {
-      return SD.open(lastFile.c_str(), FILE_WRITE);
-    }
+    LOG_WARN("calibration: no clear mains level in %lu blocks, learning again",
+             (unsigned long)mainsCalibration.blocksCounted());
+    mainsCalibration.begin();
+    return;
   }
-  std::string dateFilePath = rootDir.fullName();
-  dateFilePath.append("/" + date);
-  return SD.open(dateFilePath.c_str(), FILE_WRITE);
+  mainsCalibration.stop();
+  const MainsThresholds &thresholds = result.thresholds;
+  LOG_INFO("calibration: mains reads %u (%u..%u), off up to %u: off below %u, brownout below %u, surge above %u, "
+           "hysteresis %u, debounce %u",
+           result.nominal, result.low, result.high, result.offHigh, thresholds.offBelow, thresholds.brownoutBelow,
+           thresholds.surgeAbove, thresholds.hysteresis, thresholds.offDebounce);
+  configManager.data.mainsOffBelow = thresholds.offBelow;
+  configManager.data.mainsBrownoutBelow = thresholds.brownoutBelow;
+  configManager.data.mainsSurgeAbove = thresholds.surgeAbove;
+  configManager.data.mainsHysteresis = thresholds.hysteresis;
+  configManager.data.mainsOffDebounce = thresholds.offDebounce;
+  strlcpy(configManager.data.mainsCalibration, "learned", sizeof(configManager.data.mainsCalibration));
+  configManager.save();
+  mainsDetector.setThresholds(thresholds);
 }
 
-void publishUnpublishedEvents(File rootDir)
+void applyPublisherConfig()
 {
-  // check and update power status change - start
-  updatePowerStatusIfChanged();
-  // check and update power status change - end
-
-  std::vector<std::string> sortedFilenames;
-  Serial.println("started sorting directories");
-  sortedFilenames = listDirSorted(rootDir);
-  if (sortedFilenames.size() < 1)
+  EventPublisher *selected = &twitterPublisher;
+  if (eventPublisher == NULL)
   {
-    return;
+    eventPublisher = selected;
   }
-
-  std::string unPublishedStartDate;
-  std::string unPublishedLineNum;
-  std::vector<std::string> pubStatus = getPublishStatusContent();
-  // check if there is existing file status
-  if (doesStatusExist(pubStatus))
+  if (strcmp(configManager.data.publisher, "http") == 0)
   {
-    unPublishedStartDate = getDateFromStatus(pubStatus);
-    unPublishedLineNum = getLineNumFromStatus(pubStatus);
+    httpPublisher.configure(configManager.data.collectorHost, configManager.data.collectorPort,
+                            configManager.data.collectorPath, configManager.data.projectName);
+    selected = &httpPublisher;
   }
-  Serial.print("unPublishedStartDate: ");
-  Serial.print(unPublishedStartDate.c_str());
-  Serial.print(" , ");
-  Serial.print("unPublishedLineNum: ");
-  Serial.println(unPublishedLineNum.c_str());
-
-  // check and update power status change - start
-  updatePowerStatusIfChanged();
-  // check and update power status change - end
-
-  Serial.println("processing sorted file names one by one");
-  std::string prevEventName;
-  std::string prevTimeOfEvent;
-  std::string prevNtpSynced;
-  std::string prevEpoch;
-  for (int i = 0; i < sortedFilenames.size(); i++)
+  else if (strcmp(configManager.data.publisher, "mqtt") == 0)
   {
-    // check and update power status change - start
-    updatePowerStatusIfChanged();
-    // check and update power status change - end
-
-    std::string pickedFile = sortedFilenames.at(i);
-    // if publish status exist, skip files older than that
-    if (!unPublishedStartDate.empty() && !unPublishedLineNum.empty())
-    {
-      if (pickedFile.compare(unPublishedStartDate) < 0)
-      {
-        // Move this file to published dir /qop-published/
-        Serial.print("skipping file for publishing: ");
-        Serial.println(pickedFile.c_str());
-
-        std::string actualFileName = pickedFile.substr(pickedFile.rfind("/") + 1);
-        std::string newPubFilePath = "/qop-published/" + actualFileName;
-        Serial.print("moving file to qop-published directory: ");
-        Serial.println(newPubFilePath.c_str());
-        SD.rename(pickedFile.c_str(), newPubFilePath.c_str());
-        continue;
-      }
-    }
-    Serial.print("opening file for read: ");
-    Serial.println(pickedFile.c_str());
-    File openedFile = SD.open(pickedFile.c_str(), FILE_READ);
-    String line;
-    int currLineNumber = 0;
-    while (true)
-    {
-      // check and update power status change - start
-      updatePowerStatusIfChanged();
-      // check and update power status change - end
-
-      line = openedFile.readStringUntil('\n');
-      // Serial.print("line read: ");
-      // Serial.println(line);
-      if (line.isEmpty())
-      {
-        break;
-      }
-      currLineNumber++;
-      if (!unPublishedLineNum.empty())
-      {
-        if (pickedFile.compare(unPublishedStartDate) == 0 && currLineNumber < std::stoi(unPublishedLineNum))
-        {
-          continue;
-        }
-      }
-
-      boolean ntpSynced = false;
-      std::string timeOfEvent;
-      std::string eventName;
-      std::string epoch;
-      char *token = std::strtok((char *)line.c_str(), ",");
-      int idx = 0;
-      while (token != NULL && idx <= 3)
-      {
-        switch (idx++)
-        {
-        case 0:
-          if (token == "-")
-          { // NTP synced time
-            ntpSynced = true;
-          }
-          break;
-        case 1:
-          eventName = token;
-          break;
-        case 2:
-          if (token != "")
-          { // Event time stamp
-            timeOfEvent = token;
-          }
-          break;
-        case 3:
-          epoch = token;
-          break;
-        default:
-          break;
-        }
-        token = std::strtok(NULL, ",");
-      }
-      Serial.println("====== event info start ======");
-      Serial.print("timeOfEvent: ");
-      Serial.println(timeOfEvent.c_str());
-      Serial.print("eventName: ");
-      Serial.println(eventName.c_str());
-      Serial.print("ntpSynced: ");
-      Serial.println(ntpSynced);
-      Serial.print("epoch: ");
-      Serial.println(epoch.c_str());
-      Serial.println("====== event info end ======");
-      if (unPublishedLineNum.empty() || pickedFile.compare(unPublishedStartDate) > 0 || (pickedFile.compare(unPublishedStartDate) == 0 && currLineNumber > std::stoi(unPublishedLineNum)))
-      {
-        //    check for unpublished events
-        //    publish event
-        if (prevEventName == "POFF")
-          {
-            // publish power off event first
-            int epochInt = std::stoi(prevEpoch);
-            int pubStatus = publishPowerOffEvent(epochInt);
-            if (pubStatus == 0)
-            {
-              openedFile.close();
-              return;
-            }
-            Serial.println("published power off event successfully");
-            persistPubStatusToFile(pickedFile, std::to_string(currLineNumber - 1));
-        }
-        if (eventName == "PRES")
-        {
-          // publish power resumed event
-          int epochInt = std::stoi(epoch);
-          int pubStatus = publishPowerOnEvent(epochInt);
-          if (pubStatus == 0)
-          {
-            openedFile.close();
-            return;
-          }
-          Serial.println("published power resumed event successfully");
-          persistPubStatusToFile(pickedFile, std::to_string(currLineNumber));
-        }
-      }
-
-      prevEventName = eventName;
-      prevTimeOfEvent = timeOfEvent;
-      prevNtpSynced = ntpSynced;
-      prevEpoch = epoch;
-    }
-    openedFile.close();
+    mqttPublisher.configure(configManager.data.collectorHost, configManager.data.collectorPort,
+                            configManager.data.mqttTopic, configManager.data.projectName);
+    selected = &mqttPublisher;
   }
-}
-
-void persistPubStatusToFile(std::string date, std::string lineNum)
-{
-  // Do recoverable file write
-  Serial.println("persisting publish status");
-  SD.remove("qop.status");
-  File pubStatusFile = SD.open("qop.status", FILE_WRITE);
-  pubStatusFile.print(date.c_str());
-  pubStatusFile.print(",");
-  pubStatusFile.println(lineNum.c_str());
-  pubStatusFile.flush();
-  pubStatusFile.close();
-  Serial.println("publish status persisted successfully");
-}
-
-std::vector<std::string> getPublishStatusContent()
-{
-  std::vector<std::string> pubStatus;
-  File pubStatusFile = SD.open("qop.status", FILE_READ);
-  String status = pubStatusFile.readStringUntil('\n');
-  pubStatusFile.close();
-  if (status == "")
+  if (selected != eventPublisher)
   {
-    return pubStatus;
+    eventPublisher->stop();
+    eventPublisher = selected;
   }
-  char *token = std::strtok((char *)status.c_str(), ",");
-  pubStatus.push_back(token);
-  token = std::strtok(NULL, ",");
-  pubStatus.push_back(token);
-  return pubStatus;
-}
-
-boolean doesStatusExist(std::vector<std::string> statusVec)
-{
-  return statusVec.size() != 0;
-}
-
-std::string getDateFromStatus(std::vector<std::string> statusVec)
-{
-  return statusVec.at(0);
-}
-
-std::string getLineNumFromStatus(std::vector<std::string> statusVec)
-{
-  return statusVec.at(1);
-}
-
-std::vector<std::string> listDirSorted(File rootDir)
-{
-  std::vector<std::string> filenames;
-  while (true)
+  if (configManager.data.publishBatchSize > 0)
   {
-    File pickedFile = rootDir.openNextFile();
-    if (!pickedFile)
-    {
-      break;
-    }
-    filenames.push_back(pickedFile.fullName());
-    pickedFile.close();
+    publishMaxBatchSize = configManager.data.publishBatchSize;
   }
-  std::sort(filenames.begin(), filenames.end());
-  return filenames;
+  publishMaxBatchLatency = configManager.data.publishBatchLatency;
 }
 
-int publishPowerOnEvent(time_t epoch)
-{
-  return publishTweet("[power-on]", epoch);
-}
-int publishPowerOffEvent(time_t epoch)
-{
-  return publishTweet("[power-off]", epoch);
-}
-int publishTweet(std::string event, time_t epoch)
-{
-  std::string epochCovertedTime = std::asctime(std::localtime(&epoch));
-  std::string newTweet = event + "[Time:" + epochCovertedTime + "]";
-  std::string cleanedTweet = removeNewLines(reduceDoubleSpaces(newTweet));
-  Serial.println(cleanedTweet.c_str());
-
-  boolean val = tcr.tweet(cleanedTweet);
-  Serial.print("Tweet published status: ");
-  Serial.println(val);
-  return val;
-}
-
-// Copied from: https://stackoverflow.com/a/48029948
-std::string &reduceDoubleSpaces(std::string &s)
-{
-  std::string::size_type pos = s.find("  ");
-  while (pos != std::string::npos)
-  {
-    // replace BOTH spaces with one space
-    s.replace(pos, 2, " ");
-    // start searching again, where you left off
-    // rather than going back to the beginning
-    pos = s.find("  ", pos);
-  }
-  return s;
-}
-std::string &removeNewLines(std::string &s)
-{
-  std::string::size_type pos = s.find("\n");
-  while (pos != std::string::npos)
-  {
-    // replace BOTH spaces with one space
-    s.replace(pos, 1, "");
-    // start searching again, where you left off
-    // rather than going back to the beginning
-    pos = s.find("\n", pos);
-  }
-  return s;
-}
 void printDirectory(File dir, int numTabs)
 {
   while (true)
@@ -736,22 +431,18 @@ void printDirectory(File dir, int numTabs)
       // no more files
       break;
     }
-    for (uint8_t i = 0; i < numTabs; i++)
-    {
-      Serial.print('\t');
-    }
-    Serial.print(entry.name());
     if (entry.isDirectory())
     {
-      Serial.println("/");
+      LOG_DEBUG("%*s%s/", numTabs * 2, "", entry.name());
       printDirectory(entry, numTabs + 1);
     }
     else
     {
       // files have sizes, directories do not
-      Serial.print("\t\t");
-      Serial.println(entry.size(), DEC);
+      LOG_DEBUG("%*s%s  %lu", numTabs * 2, "", entry.name(), (unsigned long)entry.size());
     }
+    // a card holds more entries than the ring, hand each line to Serial before the next
+    logger.flush();
     entry.close();
   }
 }
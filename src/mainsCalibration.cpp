@@ -0,0 +1,104 @@
+#include "mainsCalibration.h"
+
+#include <string.h>
+
+MainsCalibration mainsCalibration;
+
+void MainsCalibration::begin()
+{
+  memset(bins, 0, sizeof(bins));
+  blocks = 0;
+  active = true;
+}
+
+bool MainsCalibration::add(uint16_t blockMean)
+{
+  if (!active)
+  {
+    return false;
+  }
+  uint16_t &bin = bins[(blockMean > 1023 ? 1023 : blockMean) >> MAINS_CALIBRATION_BIN_SHIFT];
+  if (bin == UINT16_MAX)
+  {
+    for (uint16_t &each : bins)
+    {
+      each >>= 1;
+    }
+  }
+  bin++;
+  blocks++;
+  return complete();
+}
+
+// Middle of the bin the given percent of count blocks in [fromBin, toBin) reach
+uint16_t MainsCalibration::percentile(uint16_t fromBin, uint16_t toBin, uint32_t count, uint8_t percent) const
+{
+  uint32_t wanted = count * percent / 100;
+  uint32_t seen = 0;
+  for (uint16_t i = fromBin; i < toBin; i++)
+  {
+    seen += bins[i];
+    if (seen > wanted)
+    {
+      return (i << MAINS_CALIBRATION_BIN_SHIFT) + (1 << MAINS_CALIBRATION_BIN_SHIFT) / 2;
+    }
+  }
+  return ((toBin - 1) << MAINS_CALIBRATION_BIN_SHIFT) + (1 << MAINS_CALIBRATION_BIN_SHIFT) / 2;
+}
+
+static uint16_t scaled(uint32_t stockEdge, uint16_t nominal)
+{
+  return (uint16_t)((stockEdge * nominal + MAINS_NOMINAL_READING / 2) / MAINS_NOMINAL_READING);
+}
+
+bool MainsCalibration::derive(MainsCalibrationResult &result) const
+{
+  uint16_t modeBin = 0;
+  for (uint16_t i = 1; i < MAINS_CALIBRATION_BINS; i++)
+  {
+    modeBin = bins[i] > bins[modeBin] ? i : modeBin;
+  }
+  if (bins[modeBin] == 0 || (modeBin << MAINS_CALIBRATION_BIN_SHIFT) < MAINS_CALIBRATION_MIN_NOMINAL)
+  {
+    return false;
+  }
+  // brownouts while learning stay in the mains-on distribution, outages and the decay into them do not
+  uint16_t onFrom = modeBin / 2;
+  uint16_t offTo = modeBin / 4;
+  uint32_t onCount = 0;
+  uint32_t offCount = 0;
+  for (uint16_t i = 0; i < MAINS_CALIBRATION_BINS; i++)
+  {
+    onCount += i >= onFrom ? bins[i] : 0;
+    offCount += i < offTo ? bins[i] : 0;
+  }
+  result.nominal = percentile(onFrom, MAINS_CALIBRATION_BINS, onCount, 50);
+  result.low = percentile(onFrom, MAINS_CALIBRATION_BINS, onCount, 2);
+  result.high = percentile(onFrom, MAINS_CALIBRATION_BINS, onCount, 98);
+  result.offHigh = offCount >= MAINS_CALIBRATION_MIN_OFF_BLOCKS ? percentile(0, offTo, offCount, 99) : 0;
+
+  // half the spread, plus a bin for the histogram's resolution
+  uint16_t hysteresis = (result.high - result.low) / 2 + (1 << MAINS_CALIBRATION_BIN_SHIFT);
+  hysteresis = hysteresis < MAINS_CALIBRATION_MIN_HYSTERESIS ? MAINS_CALIBRATION_MIN_HYSTERESIS : hysteresis;
+  hysteresis = hysteresis > MAINS_CALIBRATION_MAX_HYSTERESIS ? MAINS_CALIBRATION_MAX_HYSTERESIS : hysteresis;
+
+  MainsThresholds &thresholds = result.thresholds;
+  thresholds.hysteresis = hysteresis;
+  thresholds.offBelow = scaled(MAINS_OFF_BELOW, result.nominal);
+  if (result.offHigh != 0 && thresholds.offBelow < result.offHigh + 2 * hysteresis)
+  {
+    thresholds.offBelow = result.offHigh + 2 * hysteresis;
+  }
+  thresholds.brownoutBelow = scaled(MAINS_BROWNOUT_BELOW, result.nominal);
+  thresholds.surgeAbove = scaled(MAINS_SURGE_ABOVE, result.nominal);
+  if (thresholds.surgeAbove > 1022 - hysteresis)
+  {
+    thresholds.surgeAbove = 1022 - hysteresis;
+  }
+  thresholds.offDebounce =
+      result.low > thresholds.offBelow + MAINS_CALIBRATION_CONFIDENT_SPREADS * hysteresis ? 1 : MAINS_OFF_DEBOUNCE_BLOCKS;
+
+  // the mains-on readings have to sit in the normal band with the hysteresis to spare
+  return isMainsThresholdsValid(thresholds) && result.low >= thresholds.brownoutBelow + hysteresis &&
+         result.high + hysteresis <= thresholds.surgeAbove;
+}
@@ -0,0 +1,116 @@
+#include "mainsDetector.h"
+
+MainsDetector mainsDetector;
+
+void MainsDetector::begin(const MainsThresholds &thresholds)
+{
+  limits = thresholds;
+  ema = 0;
+  primed = false;
+  current = MAINS_LEVEL_UNKNOWN;
+  previous = MAINS_LEVEL_UNKNOWN;
+  candidate = MAINS_LEVEL_UNKNOWN;
+  candidateBlocks = 0;
+  candidateSince = 0;
+}
+
+bool MainsDetector::update(uint32_t takenAt, uint16_t blockMean)
+{
+  uint32_t sample = (uint32_t)blockMean << 8;
+  // power returns as a step, averaging it in would drag the reading up through the brownout band
+  if (!primed || (current == MAINS_LEVEL_OFF && classify(blockMean) != MAINS_LEVEL_OFF))
+  {
+    ema = sample;
+    primed = true;
+  }
+  else if (sample > ema)
+  {
+    ema += (sample - ema) >> MAINS_EMA_SHIFT;
+  }
+  else
+  {
+    ema -= (ema - sample) >> MAINS_EMA_SHIFT;
+  }
+
+  MainsLevel seen = classify(filtered());
+  if (seen == current)
+  {
+    candidate = current;
+    candidateBlocks = 0;
+    return false;
+  }
+  // while off, any level with power counts as the same candidate, the first block with power dates the resume
+  bool powered = current == MAINS_LEVEL_OFF && seen != MAINS_LEVEL_OFF && candidate != MAINS_LEVEL_OFF &&
+                 candidate != MAINS_LEVEL_UNKNOWN;
+  if (seen != candidate && !powered)
+  {
+    candidateBlocks = 0;
+    candidateSince = takenAt;
+  }
+  candidate = seen;
+  candidateBlocks++;
+  uint8_t needed = seen == MAINS_LEVEL_OFF || current == MAINS_LEVEL_OFF || current == MAINS_LEVEL_UNKNOWN
+                       ? limits.offDebounce
+                       : MAINS_LEVEL_DEBOUNCE_BLOCKS;
+  if (candidateBlocks < needed)
+  {
+    return false;
+  }
+  previous = current;
+  current = seen;
+  candidateBlocks = 0;
+  return true;
+}
+
+// The edge between two bands moves away from the current level by the hysteresis
+uint16_t MainsDetector::edge(uint16_t threshold, MainsLevel below) const
+{
+  if (current == MAINS_LEVEL_UNKNOWN)
+  {
+    return threshold;
+  }
+  return current <= below ? threshold + limits.hysteresis : threshold - limits.hysteresis;
+}
+
+MainsLevel MainsDetector::classify(uint16_t value) const
+{
+  if (value < edge(limits.offBelow, MAINS_LEVEL_OFF))
+  {
+    return MAINS_LEVEL_OFF;
+  }
+  if (value < edge(limits.brownoutBelow, MAINS_LEVEL_BROWNOUT))
+  {
+    return MAINS_LEVEL_BROWNOUT;
+  }
+  if (value > edge(limits.surgeAbove, MAINS_LEVEL_NORMAL))
+  {
+    return MAINS_LEVEL_SURGE;
+  }
+  return MAINS_LEVEL_NORMAL;
+}
+
+bool isMainsThresholdsValid(const MainsThresholds &thresholds)
+{
+  uint32_t hysteresis = thresholds.hysteresis;
+  return thresholds.offDebounce >= 1 && thresholds.offBelow > hysteresis &&
+         thresholds.offBelow + 2 * hysteresis < thresholds.brownoutBelow &&
+         thresholds.brownoutBelow + 2 * hysteresis < thresholds.surgeAbove &&
+         thresholds.surgeAbove + hysteresis < 1023;
+}
+
+const char *mainsLevelName(MainsLevel level)
+{
+  switch (level)
+  {
+  case MAINS_LEVEL_OFF:
+    return "off";
+  case MAINS_LEVEL_BROWNOUT:
+    return "brownout";
+  case MAINS_LEVEL_NORMAL:
+    return "normal";
+  case MAINS_LEVEL_SURGE:
+    return "surge";
+  default:
+    return "unknown";
+  }
+}
@@ -0,0 +1,101 @@
+#include "mainsSampler.h"
+
+MainsSampler mainsSampler;
+
+void MainsSampler::begin(uint8_t pin, uint32_t intervalMs)
+{
+  this->pin = pin;
+  this->intervalMs = intervalMs;
+  blockSum = 0;
+  blockReads = 0;
+  running = true;
+  if (capture)
+  {
+    waveformCapture.restart();
+    burstDueAt = millis();
+  }
+  ticker.attach_ms(intervalMs, takeSample, this);
+}
+
+void MainsSampler::end()
+{
+  ticker.detach();
+  running = false;
+}
+
+void MainsSampler::setCapture(bool enabled)
+{
+  if (enabled == capture)
+  {
+    return;
+  }
+  bool wasRunning = running;
+  if (wasRunning)
+  {
+    end();
+  }
+  capture = enabled;
+  if (wasRunning)
+  {
+    begin(pin, intervalMs);
+  }
+}
+
+// One window at WAVEFORM_SAMPLE_RATE_HZ, busy waiting between reads; the Ticker cannot run meanwhile, so the
+// reads on its interval stand in for its own
+void MainsSampler::loop()
+{
+  if (!running || !capture || (int32_t)(millis() - burstDueAt) < 0 || !waveformCapture.canFill())
+  {
+    return;
+  }
+  // bursts stay on their grid, one late pass does not move the ones after it
+  burstDueAt += WAVEFORM_BURST_INTERVAL_MS;
+  if ((int32_t)(millis() - burstDueAt) >= 0)
+  {
+    burstDueAt = millis() + WAVEFORM_BURST_INTERVAL_MS;
+  }
+  ticker.detach();
+  const uint32_t readsPerTick = WAVEFORM_SAMPLE_RATE_HZ * intervalMs / 1000;
+  const uint32_t readUs = 1000000UL / WAVEFORM_SAMPLE_RATE_HZ;
+  uint32_t startedAt = micros();
+  for (uint32_t i = 0; i < WAVEFORM_WINDOW_SAMPLES; i++)
+  {
+    int32_t wait = (int32_t)(startedAt + i * readUs - micros());
+    if (wait > 0)
+    {
+      delayMicroseconds(wait);
+    }
+    uint16_t value = analogRead(pin);
+    waveformCapture.add(value);
+    if (i % readsPerTick == 0)
+    {
+      add(value);
+    }
+  }
+  ticker.attach_ms(intervalMs, takeSample, this);
+}
+
+void MainsSampler::takeSample(MainsSampler *sampler)
+{
+  sampler->add(analogRead(sampler->pin));
+}
+
+void MainsSampler::add(uint16_t value)
+{
+  if (blockReads == 0)
+  {
+    blockStart = millis();
+  }
+  blockSum += value;
+  if (++blockReads < MAINS_BLOCK_SAMPLES)
+  {
+    return;
+  }
+  MainsSample sample;
+  sample.takenAt = blockStart;
+  sample.value = (blockSum + MAINS_BLOCK_SAMPLES / 2) / MAINS_BLOCK_SAMPLES;
+  ring.push(sample);
+  blockSum = 0;
+  blockReads = 0;
+}
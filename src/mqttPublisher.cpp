@@ -0,0 +1,194 @@
+#include "mqttPublisher.h"
+#include "clientIo.h"
+#include "logger.h"
+
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH_QOS1 0x32
+#define MQTT_PUBACK 0x40
+#define MQTT_PINGREQ 0xC0
+#define MQTT_DISCONNECT 0xE0
+
+void MqttPublisher::configure(const char *host, uint16_t port, const char *topic, const char *clientId)
+{
+  if (strcmp(this->host, host) != 0 || this->port != port || strcmp(this->clientId, clientId) != 0)
+  {
+    stop();
+  }
+  strlcpy(this->host, host, sizeof(this->host));
+  this->port = port;
+  strlcpy(this->topic, topic, sizeof(this->topic));
+  strlcpy(this->clientId, clientId, sizeof(this->clientId));
+}
+
+bool MqttPublisher::publish(const EventBatch &batch)
+{
+  size_t payloadLength = formatBatchJson(batch, clientId, payload, sizeof(payload));
+  if (payloadLength == 0)
+  {
+    LOG_ERROR("mqtt publisher: batch does not fit payload buffer");
+    return false;
+  }
+  return publishPayload(topic, payloadLength);
+}
+
+bool MqttPublisher::publishReport(PowerStatsPeriod period, const PowerStatsBucket &bucket)
+{
+  size_t payloadLength = formatReportJson(period, bucket, clientId, payload, sizeof(payload));
+  if (payloadLength == 0)
+  {
+    return false;
+  }
+  char reportTopic[sizeof(topic) + 8];
+  snprintf(reportTopic, sizeof(reportTopic), "%s/report", topic);
+  return publishPayload(reportTopic, payloadLength);
+}
+
+// QoS 1 PUBLISH of payload, true once the broker acknowledged it
+bool MqttPublisher::publishPayload(const char *topicName, size_t payloadLength)
+{
+  if (!ensureConnected())
+  {
+    return false;
+  }
+  packetId = packetId == 0xFFFF ? 1 : packetId + 1;
+  size_t topicLength = strlen(topicName);
+  uint8_t variableHeader[2 + sizeof(topic) + 8 + 2];
+  variableHeader[0] = topicLength >> 8;
+  variableHeader[1] = topicLength & 0xFF;
+  memcpy(variableHeader + 2, topicName, topicLength);
+  variableHeader[2 + topicLength] = packetId >> 8;
+  variableHeader[3 + topicLength] = packetId & 0xFF;
+  if (!sendPacket(MQTT_PUBLISH_QOS1, variableHeader, topicLength + 4, (const uint8_t *)payload, payloadLength))
+  {
+    return false;
+  }
+  uint8_t ack[2];
+  if (awaitPacket(MQTT_PUBACK, ack, sizeof(ack)) != 2 || ((ack[0] << 8) | ack[1]) != packetId)
+  {
+    LOG_WARN("mqtt publisher: no PUBACK");
+    client.stop();
+    return false;
+  }
+  return true;
+}
+
+void MqttPublisher::loop()
+{
+  if (client.connected() && millis() - lastSentAt > MQTT_KEEP_ALIVE_S * 1000UL / 2)
+  {
+    sendPacket(MQTT_PINGREQ, NULL, 0);
+  }
+  // drain PINGRESPs and anything else the broker sent while idle
+  while (client.available())
+  {
+    client.read();
+  }
+}
+
+void MqttPublisher::stop()
+{
+  if (client.connected())
+  {
+    sendPacket(MQTT_DISCONNECT, NULL, 0);
+  }
+  client.stop();
+}
+
+bool MqttPublisher::ensureConnected()
+{
+  if (client.connected())
+  {
+    return true;
+  }
+  client.stop();
+  if (!client.connect(host, port))
+  {
+    LOG_WARN("mqtt publisher: connect failed");
+    return false;
+  }
+  client.setNoDelay(true);
+  size_t clientIdLength = strlen(clientId);
+  uint8_t connect[12 + sizeof(clientId)] = {0, 4, 'M', 'Q', 'T', 'T', 4, 0x02, MQTT_KEEP_ALIVE_S >> 8,
+                                             MQTT_KEEP_ALIVE_S & 0xFF};
+  connect[10] = clientIdLength >> 8;
+  connect[11] = clientIdLength & 0xFF;
+  memcpy(connect + 12, clientId, clientIdLength);
+  uint8_t connack[2];
+  if (!sendPacket(MQTT_CONNECT, connect, 12 + clientIdLength) ||
+      awaitPacket(MQTT_CONNACK, connack, sizeof(connack)) != 2 || connack[1] != 0)
+  {
+    LOG_WARN("mqtt publisher: broker refused connection");
+    client.stop();
+    return false;
+  }
+  return true;
+}
+
+bool MqttPublisher::sendPacket(uint8_t type, const uint8_t *body, size_t bodyLength, const uint8_t *payload,
+                               size_t payloadLength)
+{
+  uint8_t fixedHeader[5] = {type};
+  size_t headerLength = 1;
+  size_t remaining = bodyLength + payloadLength;
+  do
+  {
+    uint8_t digit = remaining % 128;
+    remaining /= 128;
+    fixedHeader[headerLength++] = remaining ? digit | 0x80 : digit;
+  } while (remaining);
+
+  bool sent = client.write(fixedHeader, headerLength) == headerLength &&
+              (bodyLength == 0 || client.write(body, bodyLength) == bodyLength) &&
+              (payloadLength == 0 || client.write(payload, payloadLength) == payloadLength);
+  if (!sent)
+  {
+    client.stop();
+    return false;
+  }
+  lastSentAt = millis();
+  return true;
+}
+
+int MqttPublisher::awaitPacket(uint8_t type, uint8_t *body, size_t bodyLength)
+{
+  while (true)
+  {
+    uint8_t packetType;
+    if (!readExact(client, &packetType, 1, PUBLISH_REPLY_TIMEOUT_MS))
+    {
+      return -1;
+    }
+    size_t remaining = 0;
+    uint8_t digit;
+    int shift = 0;
+    do
+    {
+      if (!readExact(client, &digit, 1, PUBLISH_REPLY_TIMEOUT_MS) || shift > 21)
+      {
+        return -1;
+      }
+      remaining |= (size_t)(digit & 0x7F) << shift;
+      shift += 7;
+    } while (digit & 0x80);
+
+    // keep what fits, skip the rest
+    size_t kept = remaining < bodyLength ? remaining : bodyLength;
+    if (!readExact(client, body, kept, PUBLISH_REPLY_TIMEOUT_MS))
+    {
+      return -1;
+    }
+    for (size_t skipped = kept; skipped < remaining; skipped++)
+    {
+      uint8_t discard;
+      if (!readExact(client, &discard, 1, PUBLISH_REPLY_TIMEOUT_MS))
+      {
+        return -1;
+      }
+    }
+    if ((packetType & 0xF0) == type)
+    {
+      return kept;
+    }
+  }
+}
@@ -0,0 +1,450 @@
+#include "outbox.h"
+
+#include <ESP8266WiFi.h>
+#include <SD.h>
+
+#include "logger.h"
+#include "traceRecorder.h"
+
+Outbox outbox;
+
+// An item's batch is rebuilt here, outgoingBatch may be half filled while the queue is sent
+static EventBatch sendingBatch;
+
+static uint32_t headerCrc(const OutboxItemHeader &header)
+{
+  return crc32((const uint8_t *)&header.magic, offsetof(OutboxItemHeader, crc) - offsetof(OutboxItemHeader, magic));
+}
+
+bool Outbox::begin(const char *path)
+{
+  end();
+  strlcpy(this->path, path, sizeof(this->path));
+  memset(slots, 0, sizeof(slots));
+  lastSequence = 0;
+  newestSlot = -1;
+  newestCursorKey = 0;
+  newestCursorOffset = 0;
+
+  ready = open() && file.size() == (size_t)OUTBOX_SLOTS * OUTBOX_SLOT_SIZE;
+  if (!ready)
+  {
+    end();
+    LOG_INFO("outbox: creating queue file");
+    ready = create() && open();
+  }
+  if (!ready)
+  {
+    LOG_ERROR("outbox: cannot open queue file");
+    return false;
+  }
+
+  uint32_t newestBatch = 0;
+  OutboxItemHeader header;
+  for (uint32_t slot = 0; slot < OUTBOX_SLOTS; slot++)
+  {
+    if (!file.seek(slot * OUTBOX_SLOT_SIZE) || file.read((uint8_t *)&header, sizeof(header)) != sizeof(header) ||
+        header.magic != OUTBOX_MAGIC || header.crc != headerCrc(header))
+    {
+      continue;
+    }
+    if (header.sequence > lastSequence)
+    {
+      lastSequence = header.sequence;
+      newestSlot = slot;
+    }
+    if (header.kind == OUTBOX_BATCH && header.sequence > newestBatch)
+    {
+      newestBatch = header.sequence;
+      newestCursorKey = header.cursorKey;
+      newestCursorOffset = header.cursorOffset;
+    }
+    if (header.done)
+    {
+      continue;
+    }
+    Slot &entry = slots[slot];
+    entry.sequence = header.sequence;
+    entry.attempts = header.attempts;
+    entry.kind = header.kind;
+    entry.period = header.period;
+    entry.count = header.count;
+    entry.cursorKey = header.cursorKey;
+    entry.cursorOffset = header.cursorOffset;
+    if (header.kind == OUTBOX_REPORT)
+    {
+      // the report's period start is its bucket's first field
+      file.read((uint8_t *)&entry.periodStart, sizeof(entry.periodStart));
+    }
+  }
+  LOG_INFO("outbox: %u items queued", (unsigned)depth());
+  return true;
+}
+
+void Outbox::end()
+{
+  if (file)
+  {
+    file.close();
+  }
+}
+
+// Written empty at its full size once, items are later written in place without growing the file
+bool Outbox::create()
+{
+  SDFS.remove(path);
+  File created = SDFS.open(path, "w");
+  if (!created)
+  {
+    return false;
+  }
+  uint8_t empty[512];
+  memset(empty, 0, sizeof(empty));
+  for (uint32_t written = 0; written < (uint32_t)OUTBOX_SLOTS * OUTBOX_SLOT_SIZE; written += sizeof(empty))
+  {
+    if (created.write(empty, sizeof(empty)) != sizeof(empty))
+    {
+      created.close();
+      return false;
+    }
+  }
+  created.close();
+  return true;
+}
+
+bool Outbox::open()
+{
+  if (!file)
+  {
+    file = SDFS.open(path, "r+");
+  }
+  return (bool)file;
+}
+
+// The payload goes first and the header, which makes the item valid, after it; one flush for both
+bool Outbox::writeItem(uint32_t slot, OutboxItemHeader &header, const uint8_t *payload, size_t length)
+{
+  if (!ready || !open())
+  {
+    return false;
+  }
+  header.done = 0;
+  memset(header.reserved, 0, sizeof(header.reserved));
+  header.attempts = 0;
+  header.magic = OUTBOX_MAGIC;
+  header.sequence = lastSequence + 1;
+  header.crc = headerCrc(header);
+  uint32_t start = slot * OUTBOX_SLOT_SIZE;
+  if (!file.seek(start + sizeof(header)) || file.write(payload, length) != length || !file.seek(start) ||
+      file.write((const uint8_t *)&header, sizeof(header)) != sizeof(header))
+  {
+    LOG_ERROR("outbox: writing item failed");
+    end();
+    return false;
+  }
+  file.flush();
+  lastSequence = header.sequence;
+  newestSlot = slot;
+  Slot &entry = slots[slot];
+  entry.sequence = header.sequence;
+  entry.attempts = 0;
+  entry.kind = header.kind;
+  entry.period = header.period;
+  entry.count = header.count;
+  entry.cursorKey = header.cursorKey;
+  entry.cursorOffset = header.cursorOffset;
+  return true;
+}
+
+bool Outbox::writeState(uint32_t slot, bool done, uint32_t attempts)
+{
+  uint8_t state[8] = {(uint8_t)(done ? 1 : 0)};
+  memcpy(state + 4, &attempts, sizeof(attempts));
+  if (!open() || !file.seek(slot * OUTBOX_SLOT_SIZE) || file.write(state, sizeof(state)) != sizeof(state))
+  {
+    LOG_ERROR("outbox: writing item state failed");
+    end();
+    return false;
+  }
+  file.flush();
+  return true;
+}
+
+int Outbox::freeSlot() const
+{
+  int slot = newestSlot < 0 ? 0 : (newestSlot + 1) % OUTBOX_SLOTS;
+  return slots[slot].kind == OUTBOX_EMPTY ? slot : -1;
+}
+
+int Outbox::oldest() const
+{
+  int found = -1;
+  for (int slot = 0; slot < OUTBOX_SLOTS; slot++)
+  {
+    if (slots[slot].kind != OUTBOX_EMPTY && (found < 0 || slots[slot].sequence < slots[found].sequence))
+    {
+      found = slot;
+    }
+  }
+  return found;
+}
+
+bool Outbox::enqueueBatch(const EventBatch &batch, uint32_t cursorKey, uint32_t cursorOffset)
+{
+  int slot = freeSlot();
+  if (slot < 0 || batch.empty())
+  {
+    return false;
+  }
+  OutboxItemHeader header;
+  header.kind = OUTBOX_BATCH;
+  header.period = 0;
+  header.count = batch.size();
+  header.cursorKey = cursorKey;
+  header.cursorOffset = cursorOffset;
+  if (!writeItem(slot, header, (const uint8_t *)&batch.at(0), batch.size() * sizeof(EventRecord)))
+  {
+    return false;
+  }
+  newestCursorKey = cursorKey;
+  newestCursorOffset = cursorOffset;
+  return true;
+}
+
+bool Outbox::enqueueReport(PowerStatsPeriod period, const PowerStatsBucket &bucket)
+{
+  int slot = freeSlot();
+  if (slot < 0)
+  {
+    return false;
+  }
+  OutboxItemHeader header;
+  header.kind = OUTBOX_REPORT;
+  header.period = period;
+  header.count = 0;
+  header.cursorKey = 0;
+  header.cursorOffset = 0;
+  if (!writeItem(slot, header, (const uint8_t *)&bucket, sizeof(bucket)))
+  {
+    return false;
+  }
+  slots[slot].periodStart = bucket.periodStart;
+  return true;
+}
+
+bool Outbox::hasReport(PowerStatsPeriod period, uint32_t periodStart) const
+{
+  for (const Slot &entry : slots)
+  {
+    if (entry.kind == OUTBOX_REPORT && entry.period == period && entry.periodStart == periodStart)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Outbox::newestBatchCursor(uint32_t &key, uint32_t &offset) const
+{
+  if (newestCursorKey == 0)
+  {
+    return false;
+  }
+  key = newestCursorKey;
+  offset = newestCursorOffset;
+  return true;
+}
+
+size_t Outbox::depth() const
+{
+  size_t count = 0;
+  for (const Slot &entry : slots)
+  {
+    count += entry.kind != OUTBOX_EMPTY;
+  }
+  return count;
+}
+
+size_t Outbox::queuedEvents() const
+{
+  size_t count = 0;
+  for (const Slot &entry : slots)
+  {
+    count += entry.kind == OUTBOX_BATCH ? entry.count : 0;
+  }
+  return count;
+}
+
+uint32_t Outbox::retryInMs() const
+{
+  if (oldest() < 0)
+  {
+    return 0;
+  }
+  int32_t wait = breakerState == OUTBOX_BREAKER_OPEN ? (int32_t)(openedAt + OUTBOX_BREAKER_OPEN_MS - millis())
+                                                     : (int32_t)(nextAttemptAt - millis());
+  return wait > 0 ? wait : 0;
+}
+
+// Half of the doubled wait plus up to as much again at random, so devices that lost the same
+// network do not all retry in step when it comes back
+uint32_t Outbox::backoff(uint32_t attempts) const
+{
+  uint32_t wait = OUTBOX_BACKOFF_MAX_MS;
+  if (attempts <= 16)
+  {
+    uint32_t doubled = (uint32_t)OUTBOX_BACKOFF_BASE_MS << (attempts > 0 ? attempts - 1 : 0);
+    wait = doubled < OUTBOX_BACKOFF_MAX_MS ? doubled : OUTBOX_BACKOFF_MAX_MS;
+  }
+  return wait / 2 + random(wait / 2 + 1);
+}
+
+// Reads the item back and hands it to the publisher; corrupt is set for an item that cannot be read
+bool Outbox::attempt(uint32_t slot, EventPublisher &publisher, bool &corrupt)
+{
+  const Slot &entry = slots[slot];
+  corrupt = true;
+  if (!open() || !file.seek(slot * OUTBOX_SLOT_SIZE + sizeof(OutboxItemHeader)))
+  {
+    corrupt = false;
+    return false;
+  }
+  if (entry.kind == OUTBOX_REPORT)
+  {
+    PowerStatsBucket bucket;
+    if (file.read((uint8_t *)&bucket, sizeof(bucket)) != sizeof(bucket) ||
+        bucket.crc != crc32((const uint8_t *)&bucket, offsetof(PowerStatsBucket, crc)))
+    {
+      return false;
+    }
+    corrupt = false;
+    LOG_INFO("publishing report: %s", powerStatsPeriodName((PowerStatsPeriod)entry.period));
+    bool published = publisher.publishReport((PowerStatsPeriod)entry.period, bucket);
+    traceRecorder.notePublish(true, entry.period, bucket.periodStart, published);
+    return published;
+  }
+  // the batch is rebuilt from its events, its totals with it
+  EventBatch &batch = sendingBatch;
+  batch.clear();
+  EventRecord event;
+  for (uint16_t i = 0; i < entry.count; i++)
+  {
+    if (file.read((uint8_t *)&event, sizeof(event)) != sizeof(event) || !isEventRecordValid(event))
+    {
+      return false;
+    }
+    batch.add(event);
+  }
+  corrupt = false;
+  LOG_DEBUG("publishing batch to: %s", publisher.name());
+  bool published = publisher.publish(batch);
+  traceRecorder.notePublish(false, batch.size(), batch.size() ? batch.at(0).epoch : 0, published);
+  if (!published)
+  {
+    return false;
+  }
+  LOG_INFO("published batch of events successfully: %u", (unsigned)batch.size());
+  return true;
+}
+
+size_t Outbox::sendDue(EventPublisher &publisher)
+{
+  if (!ready)
+  {
+    return 0;
+  }
+  if (WiFi.status() != WL_CONNECTED)
+  {
+    if (breakerState != OUTBOX_BREAKER_OFFLINE)
+    {
+      LOG_INFO("outbox: network down, holding %u items", (unsigned)depth());
+      breakerState = OUTBOX_BREAKER_OFFLINE;
+      publisher.stop();
+    }
+    return 0;
+  }
+  if (breakerState == OUTBOX_BREAKER_OFFLINE)
+  {
+    // a new connection, the failures and backoff of the old one say nothing about it
+    breakerState = OUTBOX_BREAKER_CLOSED;
+    failures = 0;
+    nextAttemptAt = millis();
+  }
+  else if (breakerState == OUTBOX_BREAKER_OPEN)
+  {
+    if ((int32_t)(millis() - (openedAt + OUTBOX_BREAKER_OPEN_MS)) < 0)
+    {
+      return 0;
+    }
+    breakerState = OUTBOX_BREAKER_HALF_OPEN;
+    nextAttemptAt = millis();
+  }
+
+  size_t sentNow = 0;
+  for (int slot = oldest(); slot >= 0; slot = oldest())
+  {
+    if ((int32_t)(millis() - nextAttemptAt) < 0)
+    {
+      break;
+    }
+    Slot &entry = slots[slot];
+    bool corrupt;
+    attemptCount++;
+    if (attempt(slot, publisher, corrupt) || corrupt)
+    {
+      if (corrupt)
+      {
+        LOG_ERROR("outbox: dropping unreadable item %lu", (unsigned long)entry.sequence);
+      }
+      writeState(slot, true, entry.attempts);
+      entry.kind = OUTBOX_EMPTY;
+      failures = 0;
+      breakerState = OUTBOX_BREAKER_CLOSED;
+      if (corrupt)
+      {
+        continue;
+      }
+      // a publish blocks for a TLS/HTTP exchange, loop() gets to drain the sampler before the next one
+      sentNow++;
+      sentCount++;
+      break;
+    }
+    entry.attempts++;
+    writeState(slot, false, entry.attempts);
+    if (failures < UINT8_MAX)
+    {
+      failures++;
+    }
+    if (breakerState == OUTBOX_BREAKER_HALF_OPEN || failures >= OUTBOX_BREAKER_FAILURES)
+    {
+      LOG_WARN("outbox: %u failures in a row, pausing for %lu s", (unsigned)failures,
+               (unsigned long)(OUTBOX_BREAKER_OPEN_MS / 1000));
+      breakerState = OUTBOX_BREAKER_OPEN;
+      openedAt = millis();
+      publisher.stop();
+      break;
+    }
+    uint32_t wait = backoff(entry.attempts);
+    nextAttemptAt = millis() + wait;
+    LOG_WARN("outbox: attempt %lu failed, retrying in %lu ms", (unsigned long)entry.attempts, (unsigned long)wait);
+    break;
+  }
+  return sentNow;
+}
+
+const char *outboxBreakerName(OutboxBreaker breaker)
+{
+  switch (breaker)
+  {
+  case OUTBOX_BREAKER_CLOSED:
+    return "closed";
+  case OUTBOX_BREAKER_OPEN:
+    return "open";
+  case OUTBOX_BREAKER_HALF_OPEN:
+    return "half-open";
+  case OUTBOX_BREAKER_OFFLINE:
+    return "offline";
+  default:
+    return "?";
+  }
+}
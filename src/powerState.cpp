@@ -0,0 +1,164 @@
+#include "powerState.h"
+
+#include <ESP8266WiFi.h>
+
+#include "eventLog.h"
+#include "logger.h"
+#include "mainsDetector.h"
+#include "mainsSampler.h"
+#include "traceRecorder.h"
+
+#ifdef ARDUINO_ARCH_ESP8266
+extern "C"
+{
+#include "user_interface.h"
+}
+#endif
+
+PowerStateMachine powerState;
+
+void PowerStateMachine::powerLost()
+{
+  if (current != POWER_RUNNING)
+  {
+    return;
+  }
+  LOG_INFO("power: holdup");
+  current = POWER_HOLDUP;
+  enteredAt = millis();
+}
+
+void PowerStateMachine::powerRestored(uint32_t changedAt)
+{
+  if (current == POWER_RUNNING)
+  {
+    return;
+  }
+  // from SLEEP the burst that woke us is the earliest sign of mains, the detector only starts after it
+  uint32_t since = current == POWER_RESUME ? restoredAt : changedAt;
+  lastResume = millis() - since;
+  if (lastResume > maxResume)
+  {
+    maxResume = lastResume;
+  }
+  resumeCount++;
+  current = POWER_RUNNING;
+  radioOn();
+  if (lastResume > POWER_RESUME_BUDGET_MS)
+  {
+    LOG_WARN("power: resumed in %lu ms, over budget", (unsigned long)lastResume);
+  }
+  else
+  {
+    LOG_INFO("power: resumed in %lu ms", (unsigned long)lastResume);
+  }
+}
+
+void PowerStateMachine::loop()
+{
+  if (current == POWER_RUNNING)
+  {
+    return;
+  }
+  if (current == POWER_HOLDUP)
+  {
+    // the POFF is committed, nothing needs the card or the network until mains is back
+    endStorage();
+    radioOff();
+    if (millis() - enteredAt >= POWER_HOLDUP_MS)
+    {
+      LOG_INFO("power: sleep");
+      mainsSampler.end();
+      current = POWER_SLEEP;
+      enteredAt = millis();
+      return;
+    }
+    delay(POWER_HOLDUP_POLL_MS);
+    return;
+  }
+  if (current == POWER_SLEEP)
+  {
+    sleepSlice();
+    uint32_t sum = 0;
+    for (int i = 0; i < POWER_SLEEP_BURST_READS; i++)
+    {
+      sum += analogRead(MAINS_ANALOG_SENSE_PIN);
+    }
+    const MainsThresholds &thresholds = mainsDetector.thresholds();
+    bool resumed = sum / POWER_SLEEP_BURST_READS >= thresholds.offBelow + thresholds.hysteresis;
+    traceRecorder.noteBurst(sum / POWER_SLEEP_BURST_READS, resumed);
+    if (resumed)
+    {
+      // the detector confirms it from the sampler's blocks and logs the PRES
+      restoredAt = millis();
+      current = POWER_RESUME;
+      enteredAt = restoredAt;
+      mainsSampler.begin(MAINS_ANALOG_SENSE_PIN);
+    }
+    return;
+  }
+  if (millis() - enteredAt >= POWER_RESUME_TIMEOUT_MS)
+  {
+    LOG_DEBUG("power: resume not confirmed, back to sleep");
+    mainsSampler.end();
+    current = POWER_SLEEP;
+    enteredAt = millis();
+  }
+}
+
+void PowerStateMachine::radioOff()
+{
+  if (radioIsOff)
+  {
+    return;
+  }
+  WiFi.mode(WIFI_OFF);
+  WiFi.forceSleepBegin();
+  radioIsOff = true;
+}
+
+void PowerStateMachine::radioOn()
+{
+  if (!radioIsOff)
+  {
+    return;
+  }
+  WiFi.forceSleepWake();
+  WiFi.mode(WIFI_STA);
+  // reconnects with the credentials the WiFi manager stored
+  WiFi.begin();
+  radioIsOff = false;
+}
+
+// Forced light sleep with a timer wake; timers, and so the sampler's Ticker, stop while in it
+void PowerStateMachine::sleepSlice()
+{
+#ifdef ARDUINO_ARCH_ESP8266
+  wifi_set_opmode_current(NULL_MODE);
+  wifi_fpm_set_sleep_type(LIGHT_SLEEP_T);
+  wifi_fpm_open();
+  wifi_fpm_do_sleep(POWER_SLEEP_SLICE_MS * 1000UL);
+  // the sleep starts once this task yields, and ends with the delay
+  delay(POWER_SLEEP_SLICE_MS + 1);
+  wifi_fpm_close();
+#else
+  delay(POWER_SLEEP_SLICE_MS);
+#endif
+}
+
+const char *powerStateName(PowerState state)
+{
+  switch (state)
+  {
+  case POWER_RUNNING:
+    return "running";
+  case POWER_HOLDUP:
+    return "holdup";
+  case POWER_SLEEP:
+    return "sleep";
+  case POWER_RESUME:
+    return "resume";
+  default:
+    return "?";
+  }
+}
@@ -0,0 +1,430 @@
+#include "powerStats.h"
+
+#include <Arduino.h>
+#include <SD.h>
+#include <time.h>
+
+#include "eventBatch.h"
+#include "eventRecord.h"
+#include "logger.h"
+
+PowerStats powerStats;
+
+static const uint16_t slotCounts[POWER_STATS_PERIODS] = {POWER_STATS_HOUR_SLOTS, POWER_STATS_DAY_SLOTS,
+                                                         POWER_STATS_MONTH_SLOTS};
+// Upper bounds (exclusive, seconds) of all but the last histogram bin
+static const uint32_t histogramEdges[POWER_STATS_HISTOGRAM_BINS - 1] = {60, 300, 900, 3600, 7200, 14400, 28800};
+
+static uint32_t headerCrc(const PowerStatsHeader &header)
+{
+  return crc32((const uint8_t *)&header, offsetof(PowerStatsHeader, crc));
+}
+
+bool PowerStats::begin(const char *path)
+{
+  strlcpy(this->path, path, sizeof(this->path));
+  memset(current, 0, sizeof(current));
+  loaded = false;
+  File file = SDFS.open(this->path, "r");
+  if (file)
+  {
+    size_t read = file.read((uint8_t *)&header, sizeof(header));
+    file.close();
+    loaded = read == sizeof(header) && header.magic == POWER_STATS_MAGIC && header.version == POWER_STATS_VERSION &&
+             header.bucketSize == sizeof(PowerStatsBucket) && header.crc == headerCrc(header);
+    for (int period = 0; loaded && period < POWER_STATS_PERIODS; period++)
+    {
+      loaded = header.slots[period] == slotCounts[period];
+    }
+  }
+  if (!loaded)
+  {
+    LOG_INFO("power stats: creating summary file");
+    loaded = create();
+  }
+  return loaded;
+}
+
+// Writes the header and every slot empty, so slots can later be updated in place
+bool PowerStats::create()
+{
+  memset(&header, 0, sizeof(header));
+  header.magic = POWER_STATS_MAGIC;
+  header.version = POWER_STATS_VERSION;
+  header.bucketSize = sizeof(PowerStatsBucket);
+  for (int period = 0; period < POWER_STATS_PERIODS; period++)
+  {
+    header.slots[period] = slotCounts[period];
+  }
+  header.crc = headerCrc(header);
+
+  SDFS.remove(path);
+  File file = SDFS.open(path, "w");
+  if (!file)
+  {
+    LOG_ERROR("power stats: cannot create summary file");
+    return false;
+  }
+  file.write((const uint8_t *)&header, sizeof(header));
+  uint8_t empty[512];
+  memset(empty, 0, sizeof(empty));
+  size_t remaining = (size_t)sizeof(PowerStatsBucket) *
+                     (POWER_STATS_HOUR_SLOTS + POWER_STATS_DAY_SLOTS + POWER_STATS_MONTH_SLOTS);
+  while (remaining > 0)
+  {
+    size_t chunk = remaining < sizeof(empty) ? remaining : sizeof(empty);
+    if (file.write(empty, chunk) != chunk)
+    {
+      file.close();
+      return false;
+    }
+    remaining -= chunk;
+  }
+  file.close();
+  return true;
+}
+
+void PowerStats::record(uint8_t type, uint32_t epoch)
+{
+  if (!loaded || epoch < POWER_STATS_MIN_EPOCH)
+  {
+    return;
+  }
+  File file = SDFS.open(path, "r+");
+  if (!file)
+  {
+    LOG_ERROR("power stats: cannot open summary file");
+    return;
+  }
+  switch (type)
+  {
+  case EVENT_TYPE_POFF:
+    closeSag(file, epoch, false);
+    closeSag(file, epoch, true);
+    // a repeated power off (restart while still off) keeps the original start
+    if (header.openOutageStart == 0)
+    {
+      header.openOutageStart = epoch;
+    }
+    break;
+  case EVENT_TYPE_PRES:
+    if (header.openOutageStart != 0)
+    {
+      uint32_t start = header.openOutageStart;
+      addOutage(file, start, epoch > start ? epoch - start : 0);
+      header.openOutageStart = 0;
+    }
+    else
+    {
+      addRestart(file, epoch);
+    }
+    break;
+  case EVENT_TYPE_BRWN:
+    closeSag(file, epoch, true);
+    addSagStart(file, epoch, false);
+    break;
+  case EVENT_TYPE_SURG:
+    closeSag(file, epoch, false);
+    addSagStart(file, epoch, true);
+    break;
+  case EVENT_TYPE_NORM:
+    closeSag(file, epoch, false);
+    closeSag(file, epoch, true);
+    break;
+  default:
+    break;
+  }
+  writeHeader(file);
+  file.close();
+}
+
+bool PowerStats::read(PowerStatsPeriod period, uint32_t epoch, PowerStatsBucket &bucket)
+{
+  uint32_t start = powerStatsPeriodStart(period, epoch);
+  if (current[period].periodStart == start)
+  {
+    bucket = current[period];
+    return true;
+  }
+  memset(&bucket, 0, sizeof(bucket));
+  bucket.periodStart = start;
+  File file = SDFS.open(path, "r");
+  if (!file)
+  {
+    return false;
+  }
+  bool found = readSlot(file, period, start, bucket);
+  file.close();
+  return found;
+}
+
+bool PowerStats::nextDueReport(uint32_t now, PowerStatsPeriod &period, uint32_t &periodStart)
+{
+  if (!loaded || now < POWER_STATS_MIN_EPOCH)
+  {
+    return false;
+  }
+  uint32_t lastDay = powerStatsPeriodStart(POWER_STATS_DAY, now) - 86400;
+  uint32_t lastMonth = powerStatsPeriodStart(POWER_STATS_MONTH, powerStatsPeriodStart(POWER_STATS_MONTH, now) - 1);
+  if (header.reportedDay == 0)
+  {
+    // first valid time on a new summary file, nothing was recorded for the periods before
+    markReported(POWER_STATS_DAY, lastDay);
+    markReported(POWER_STATS_MONTH, lastMonth);
+    return false;
+  }
+  // only the latest finished period is reported, days missed while off stay readable in the file
+  if (header.reportedDay < lastDay)
+  {
+    period = POWER_STATS_DAY;
+    periodStart = lastDay;
+    return true;
+  }
+  if (header.reportedMonth < lastMonth)
+  {
+    period = POWER_STATS_MONTH;
+    periodStart = lastMonth;
+    return true;
+  }
+  return false;
+}
+
+void PowerStats::markReported(PowerStatsPeriod period, uint32_t periodStart)
+{
+  if (period == POWER_STATS_DAY)
+  {
+    header.reportedDay = periodStart;
+  }
+  else if (period == POWER_STATS_MONTH)
+  {
+    header.reportedMonth = periodStart;
+  }
+  File file = SDFS.open(path, "r+");
+  if (file)
+  {
+    writeHeader(file);
+    file.close();
+  }
+}
+
+bool PowerStats::readSlot(File &file, PowerStatsPeriod period, uint32_t periodStart, PowerStatsBucket &bucket)
+{
+  bool found = file.seek(powerStatsSlotOffset(period, periodStart)) &&
+               file.read((uint8_t *)&bucket, sizeof(bucket)) == sizeof(bucket) && isPowerStatsBucketValid(bucket) &&
+               bucket.periodStart == periodStart;
+  if (!found)
+  {
+    // never written, or still holding an older period that maps to the same slot
+    memset(&bucket, 0, sizeof(bucket));
+    bucket.periodStart = periodStart;
+  }
+  return found;
+}
+
+bool PowerStats::writeSlot(File &file, PowerStatsPeriod period, PowerStatsBucket &bucket)
+{
+  sealPowerStatsBucket(bucket);
+  return file.seek(powerStatsSlotOffset(period, bucket.periodStart)) &&
+         file.write((const uint8_t *)&bucket, sizeof(bucket)) == sizeof(bucket);
+}
+
+bool PowerStats::writeHeader(File &file)
+{
+  header.crc = headerCrc(header);
+  return file.seek(0) && file.write((const uint8_t *)&header, sizeof(header)) == sizeof(header);
+}
+
+PowerStatsBucket &PowerStats::bucketFor(File &file, PowerStatsPeriod period, uint32_t epoch)
+{
+  uint32_t start = powerStatsPeriodStart(period, epoch);
+  if (current[period].periodStart != start)
+  {
+    readSlot(file, period, start, current[period]);
+  }
+  return current[period];
+}
+
+void PowerStats::addOutage(File &file, uint32_t start, uint32_t duration)
+{
+  int bin = 0;
+  while (bin < POWER_STATS_HISTOGRAM_BINS - 1 && duration >= histogramEdges[bin])
+  {
+    bin++;
+  }
+  for (int period = 0; period < POWER_STATS_PERIODS; period++)
+  {
+    PowerStatsBucket &bucket = bucketFor(file, (PowerStatsPeriod)period, start);
+    bucket.outages++;
+    bucket.downtime += duration;
+    if (duration >= POWER_STATS_SUSTAINED_S)
+    {
+      bucket.sustainedOutages++;
+      bucket.sustainedDowntime += duration;
+    }
+    if (duration > bucket.longestOutage)
+    {
+      bucket.longestOutage = duration;
+    }
+    bucket.outageHistogram[bin]++;
+    writeSlot(file, (PowerStatsPeriod)period, bucket);
+  }
+}
+
+void PowerStats::addRestart(File &file, uint32_t epoch)
+{
+  for (int period = 0; period < POWER_STATS_PERIODS; period++)
+  {
+    PowerStatsBucket &bucket = bucketFor(file, (PowerStatsPeriod)period, epoch);
+    bucket.restarts++;
+    writeSlot(file, (PowerStatsPeriod)period, bucket);
+  }
+}
+
+void PowerStats::addSagStart(File &file, uint32_t epoch, bool surge)
+{
+  uint32_t &openStart = surge ? header.openSurgeStart : header.openBrownoutStart;
+  if (openStart != 0)
+  {
+    return;
+  }
+  openStart = epoch;
+  for (int period = 0; period < POWER_STATS_PERIODS; period++)
+  {
+    PowerStatsBucket &bucket = bucketFor(file, (PowerStatsPeriod)period, epoch);
+    if (surge)
+    {
+      bucket.surges++;
+    }
+    else
+    {
+      bucket.brownouts++;
+    }
+    writeSlot(file, (PowerStatsPeriod)period, bucket);
+  }
+}
+
+void PowerStats::closeSag(File &file, uint32_t epoch, bool surge)
+{
+  uint32_t &openStart = surge ? header.openSurgeStart : header.openBrownoutStart;
+  if (openStart == 0)
+  {
+    return;
+  }
+  uint32_t start = openStart;
+  uint32_t duration = epoch > start ? epoch - start : 0;
+  openStart = 0;
+  for (int period = 0; period < POWER_STATS_PERIODS; period++)
+  {
+    PowerStatsBucket &bucket = bucketFor(file, (PowerStatsPeriod)period, start);
+    if (surge)
+    {
+      bucket.surgeTime += duration;
+    }
+    else
+    {
+      bucket.brownoutTime += duration;
+    }
+    writeSlot(file, (PowerStatsPeriod)period, bucket);
+  }
+}
+
+// Days since 1970-01-01 of a proleptic Gregorian date
+static int32_t daysFromCivil(int32_t year, uint32_t month, uint32_t day)
+{
+  year -= month <= 2;
+  int32_t era = (year >= 0 ? year : year - 399) / 400;
+  uint32_t yearOfEra = (uint32_t)(year - era * 400);
+  uint32_t dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  uint32_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+  return era * 146097 + (int32_t)dayOfEra - 719468;
+}
+
+uint32_t powerStatsPeriodStart(PowerStatsPeriod period, uint32_t epoch)
+{
+  if (period == POWER_STATS_HOUR)
+  {
+    return epoch - epoch % 3600;
+  }
+  if (period == POWER_STATS_DAY)
+  {
+    return epoch - epoch % 86400;
+  }
+  time_t seconds = epoch;
+  struct tm fields;
+  gmtime_r(&seconds, &fields);
+  return (uint32_t)daysFromCivil(fields.tm_year + 1900, fields.tm_mon + 1, 1) * 86400;
+}
+
+uint32_t powerStatsSlotOffset(PowerStatsPeriod period, uint32_t periodStart)
+{
+  uint32_t offset = sizeof(PowerStatsHeader);
+  uint32_t slot;
+  if (period == POWER_STATS_HOUR)
+  {
+    slot = periodStart / 3600 % POWER_STATS_HOUR_SLOTS;
+  }
+  else if (period == POWER_STATS_DAY)
+  {
+    offset += POWER_STATS_HOUR_SLOTS * sizeof(PowerStatsBucket);
+    slot = periodStart / 86400 % POWER_STATS_DAY_SLOTS;
+  }
+  else
+  {
+    offset += (POWER_STATS_HOUR_SLOTS + POWER_STATS_DAY_SLOTS) * sizeof(PowerStatsBucket);
+    time_t seconds = periodStart;
+    struct tm fields;
+    gmtime_r(&seconds, &fields);
+    slot = ((uint32_t)fields.tm_year * 12 + fields.tm_mon) % POWER_STATS_MONTH_SLOTS;
+  }
+  return offset + slot * sizeof(PowerStatsBucket);
+}
+
+const char *powerStatsPeriodName(PowerStatsPeriod period)
+{
+  switch (period)
+  {
+  case POWER_STATS_HOUR:
+    return "hourly";
+  case POWER_STATS_DAY:
+    return "daily";
+  default:
+    return "monthly";
+  }
+}
+
+void sealPowerStatsBucket(PowerStatsBucket &bucket)
+{
+  bucket.crc = crc32((const uint8_t *)&bucket, offsetof(PowerStatsBucket, crc));
+}
+
+bool isPowerStatsBucketValid(const PowerStatsBucket &bucket)
+{
+  return bucket.periodStart != 0 && bucket.crc == crc32((const uint8_t *)&bucket, offsetof(PowerStatsBucket, crc));
+}
+
+int formatPowerReport(const PowerStatsBucket &bucket, PowerStatsPeriod period, char *buf, size_t length)
+{
+  char when[24];
+  time_t seconds = bucket.periodStart;
+  struct tm fields;
+  gmtime_r(&seconds, &fields);
+  const char *format = period == POWER_STATS_MONTH ? "%b %Y" : (period == POWER_STATS_DAY ? "%a %b %d %Y" : "%b %d %H:00");
+  strftime(when, sizeof(when), format, &fields);
+  char downtime[16];
+  char sustained[16];
+  char longest[16];
+  char brownoutTime[16];
+  formatDuration(downtime, sizeof(downtime), bucket.downtime);
+  formatDuration(sustained, sizeof(sustained), bucket.sustainedDowntime);
+  formatDuration(longest, sizeof(longest), bucket.longestOutage);
+  formatDuration(brownoutTime, sizeof(brownoutTime), bucket.brownoutTime);
+  if (bucket.outages == 0 && bucket.brownouts == 0 && bucket.surges == 0)
+  {
+    return snprintf(buf, length, "[%s] %s: no outages", powerStatsPeriodName(period), when);
+  }
+  return snprintf(buf, length,
+                  "[%s] %s: %u outage%s, %s down (%u sustained, %s), longest %s, %u brownout%s (%s), %u surge%s",
+                  powerStatsPeriodName(period), when, bucket.outages, bucket.outages == 1 ? "" : "s", downtime,
+                  bucket.sustainedOutages, sustained, longest, bucket.brownouts, bucket.brownouts == 1 ? "" : "s",
+                  brownoutTime, bucket.surges, bucket.surges == 1 ? "" : "s");
+}
@@ -0,0 +1,69 @@
+#include "profiler.h"
+
+#if QOP_PROFILE
+
+static ProfileStats sections[PROFILE_SECTION_COUNT];
+static const uint32_t boundsUs[PROFILE_BUCKETS - 1] = PROFILE_BUCKET_BOUNDS_US;
+// the bounds in cycles at the CPU clock they were scaled for, no division per run
+static uint32_t boundsCycles[PROFILE_BUCKETS - 1];
+static uint32_t boundsMhz = 0;
+
+void profileRecord(uint8_t section, uint32_t cycles)
+{
+  uint32_t mhz = ESP.getCpuFreqMHz();
+  if (mhz != boundsMhz)
+  {
+    for (uint8_t i = 0; i < PROFILE_BUCKETS - 1; i++)
+    {
+      boundsCycles[i] = boundsUs[i] * mhz;
+    }
+    boundsMhz = mhz;
+  }
+  ProfileStats &stats = sections[section];
+  stats.count++;
+  stats.totalCycles += cycles;
+  stats.maxCycles = cycles > stats.maxCycles ? cycles : stats.maxCycles;
+  uint8_t bucket = 0;
+  while (bucket < PROFILE_BUCKETS - 1 && cycles >= boundsCycles[bucket])
+  {
+    bucket++;
+  }
+  stats.buckets[bucket]++;
+}
+
+const ProfileStats &profileStats(uint8_t section)
+{
+  return sections[section];
+}
+
+const char *profileSectionName(uint8_t section)
+{
+  switch (section)
+  {
+  case PROFILE_LOOP:
+    return "loop";
+  case PROFILE_WIFI_MANAGER:
+    return "wifi_manager";
+  case PROFILE_UPDATER:
+    return "updater";
+  case PROFILE_LIST_DIR:
+    return "list_dir_sorted";
+  case PROFILE_PUBLISH_READ:
+    return "publish_sd_read";
+  case PROFILE_TWEET:
+    return "tweet";
+  case PROFILE_RTC_NOW:
+    return "rtc_now";
+  default:
+    return "unknown";
+  }
+}
+
+const char *profileBucketBound(uint8_t bucket)
+{
+  static const char *const bounds[PROFILE_BUCKETS] = {"0.00001", "0.0001", "0.001", "0.01",
+                                                      "0.1",     "1",      "10",    "+Inf"};
+  return bucket < PROFILE_BUCKETS ? bounds[bucket] : "+Inf";
+}
+
+#endif
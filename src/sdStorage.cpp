@@ -0,0 +1,258 @@
+#include "sdStorage.h"
+
+#include <SD.h>
+
+#include "logger.h"
+
+DayFileWriter dayFileWriter;
+
+static const uint8_t sdClocks[] = {SD_SPI_CLOCKS_MHZ};
+static const int8_t sdClockCount = sizeof(sdClocks) / sizeof(sdClocks[0]);
+// index into sdClocks of the clock in use, -1 until the first mount probed one
+static int8_t clockStep = -1;
+static bool clockVerified = false;
+static uint8_t mountedMhz = 0;
+
+static void fillProbePattern(uint8_t *chunk, size_t length, uint32_t offset, uint8_t mhz)
+{
+  for (size_t i = 0; i < length; i++)
+  {
+    chunk[i] = (uint8_t)((offset + i) * 7 + mhz);
+  }
+}
+
+// One sector written and read back at the new clock; CRC errors at it show up as a failed or wrong transfer
+static bool verifyClock(uint8_t mhz)
+{
+  uint8_t chunk[64];
+  uint8_t expected[sizeof(chunk)];
+  SD.remove(SD_PROBE_PATH);
+  File probe = SD.open(SD_PROBE_PATH, FILE_WRITE);
+  bool ok = (bool)probe;
+  for (uint32_t offset = 0; ok && offset < DAY_FILE_WRITER_BUFFER; offset += sizeof(chunk))
+  {
+    fillProbePattern(chunk, sizeof(chunk), offset, mhz);
+    ok = probe.write(chunk, sizeof(chunk)) == sizeof(chunk);
+  }
+  probe.close();
+  if (ok)
+  {
+    probe = SD.open(SD_PROBE_PATH);
+    ok = (bool)probe;
+    for (uint32_t offset = 0; ok && offset < DAY_FILE_WRITER_BUFFER; offset += sizeof(chunk))
+    {
+      fillProbePattern(expected, sizeof(expected), offset, mhz);
+      ok = probe.read(chunk, sizeof(chunk)) == sizeof(chunk) && memcmp(chunk, expected, sizeof(chunk)) == 0;
+    }
+    probe.close();
+  }
+  SD.remove(SD_PROBE_PATH);
+  return ok;
+}
+
+bool sdBegin(uint8_t csPin)
+{
+  for (int8_t step = clockStep < 0 ? 0 : clockStep; step < sdClockCount; step++)
+  {
+    uint8_t mhz = sdClocks[step];
+    bool known = step == clockStep && clockVerified;
+    if (SD.begin(csPin, SD_SCK_MHZ(mhz)) && (known || verifyClock(mhz)))
+    {
+      if (!known)
+      {
+        LOG_INFO("SD card: SPI clock %u MHz", (unsigned)mhz);
+      }
+      clockStep = step;
+      clockVerified = true;
+      mountedMhz = mhz;
+      return true;
+    }
+    LOG_DEBUG("SD card: no mount at %u MHz", (unsigned)mhz);
+    SD.end();
+  }
+  return false;
+}
+
+uint8_t sdClockMhz()
+{
+  return mountedMhz;
+}
+
+bool sdStepDownClock()
+{
+  if (clockStep < 0 || clockStep + 1 >= sdClockCount)
+  {
+    return false;
+  }
+  clockStep++;
+  clockVerified = false;
+  LOG_WARN("SD card: stepping down to %u MHz", (unsigned)sdClocks[clockStep]);
+  return true;
+}
+
+void sdResetClock()
+{
+  clockStep = -1;
+  clockVerified = false;
+  mountedMhz = 0;
+}
+
+void DayFileWriter::setWindow(uint32_t ms)
+{
+  windowMs = ms < DAY_FILE_WRITER_MAX_WINDOW_MS ? ms : DAY_FILE_WRITER_MAX_WINDOW_MS;
+  if (windowMs == 0)
+  {
+    flush();
+  }
+}
+
+uint32_t DayFileWriter::size(File &dayFile)
+{
+  bool buffering = used > 0 && file && strcmp(file.fullName(), dayFile.fullName()) == 0;
+  return dayFile.size() + (buffering ? used : 0);
+}
+
+bool DayFileWriter::append(File &dayFile, const uint8_t *bytes, size_t length)
+{
+  bool ok = true;
+  if (file && strcmp(file.fullName(), dayFile.fullName()) != 0)
+  {
+    ok = close();
+  }
+  file = dayFile;
+  // a new file's first event goes straight out, readers tell a binary file by the header on the card
+  if (windowMs == 0 || (used == 0 && file.size() == 0) || length > sizeof(buffer))
+  {
+    if (used > 0)
+    {
+      ok = writeOut(used) && ok;
+    }
+    return file.write(bytes, length) == length && ok;
+  }
+  while (used + length > sizeof(buffer))
+  {
+    // out up to the file's next sector boundary, the rest starts the next sector
+    size_t toBoundary = DAY_FILE_WRITER_BUFFER - file.size() % DAY_FILE_WRITER_BUFFER;
+    ok = writeOut(toBoundary < used ? toBoundary : used) && ok;
+  }
+  if (used == 0)
+  {
+    bufferedAt = millis();
+  }
+  memcpy(buffer + used, bytes, length);
+  used += length;
+  events++;
+  if (events >= DAY_FILE_WRITER_MAX_EVENTS)
+  {
+    ok = flush() && ok;
+  }
+  else if ((file.size() + used) % DAY_FILE_WRITER_BUFFER == 0)
+  {
+    ok = writeOut(used) && ok;
+  }
+  return ok;
+}
+
+// Writes the oldest length buffered bytes to the card without flushing. What fails to go out is dropped,
+// its events are in the journal.
+bool DayFileWriter::writeOut(size_t length)
+{
+  size_t written = file.write(buffer, length);
+  used -= length;
+  memmove(buffer, buffer + length, used);
+  if (used == 0)
+  {
+    events = 0;
+  }
+  if (written != length)
+  {
+    LOG_ERROR("day file writer: wrote %u of %u bytes", (unsigned)written, (unsigned)length);
+    return false;
+  }
+  return true;
+}
+
+bool DayFileWriter::flush()
+{
+  if (!file)
+  {
+    return true;
+  }
+  bool ok = used == 0 || writeOut(used);
+  file.flush();
+  return ok;
+}
+
+bool DayFileWriter::close()
+{
+  bool ok = flush();
+  file = File();
+  return ok;
+}
+
+bool DayFileWriter::loop()
+{
+  if (used == 0 || millis() - bufferedAt < windowMs)
+  {
+    return true;
+  }
+  return flush();
+}
+
+bool runSdBenchmark(SdBenchmark &result, uint32_t bytes)
+{
+  memset(&result, 0, sizeof(result));
+  result.clockMhz = mountedMhz;
+  uint8_t sector[DAY_FILE_WRITER_BUFFER];
+  for (size_t i = 0; i < sizeof(sector); i++)
+  {
+    sector[i] = (uint8_t)i;
+  }
+  SD.remove(SD_BENCHMARK_PATH);
+  File bench = SD.open(SD_BENCHMARK_PATH, FILE_WRITE);
+  if (!bench)
+  {
+    return false;
+  }
+  bool ok = true;
+  uint32_t start = micros();
+  for (uint32_t done = 0; ok && done < bytes; done += sizeof(sector))
+  {
+    ok = bench.write(sector, sizeof(sector)) == sizeof(sector);
+    if ((done + sizeof(sector)) % SD_BENCHMARK_FLUSH_BYTES == 0)
+    {
+      uint32_t flushStart = micros();
+      bench.flush();
+      uint32_t took = micros() - flushStart;
+      result.flushes++;
+      result.totalFlushUs += took;
+      if (took > result.maxFlushUs)
+      {
+        result.maxFlushUs = took;
+      }
+    }
+    // a slow card takes seconds for the lot, keep the watchdog fed
+    yield();
+  }
+  bench.close();
+  result.writeUs = micros() - start;
+
+  uint32_t read = 0;
+  bench = SD.open(SD_BENCHMARK_PATH);
+  start = micros();
+  while (ok && bench && read < bytes)
+  {
+    size_t got = bench.read(sector, sizeof(sector));
+    if (got == 0)
+    {
+      break;
+    }
+    read += got;
+    yield();
+  }
+  result.readUs = micros() - start;
+  bench.close();
+  SD.remove(SD_BENCHMARK_PATH);
+  result.bytes = read;
+  return ok && read == bytes;
+}
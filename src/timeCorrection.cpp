@@ -0,0 +1,430 @@
+#include "timeCorrection.h"
+
+#include <SD.h>
+
+#include "archiveCompactor.h"
+#include "clockService.h"
+#include "dayFileIndex.h"
+#include "eventJournal.h"
+#include "eventHistory.h"
+#include "eventLog.h"
+#include "eventPublishing.h"
+#include "logger.h"
+#include "powerStats.h"
+#include "sdStorage.h"
+
+TimeCorrection timeCorrection;
+
+enum CorrectionOutcome : uint8_t
+{
+  CORRECTION_KEPT = 0,     // not recognised or does not fit, left as it was logged
+  CORRECTION_IN_PLACE = 1, // rewritten where it is
+  CORRECTION_MOVE = 2,     // goes to the day file of its corrected date
+};
+
+bool TimeCorrection::note(File &dayFile, uint32_t offset, size_t length, const EventRecord &record)
+{
+  uint32_t key = dayFileKey(dayFile.fullName());
+  if (gaveUp || count >= TIME_CORRECTION_SLOTS || key == 0 || length == 0 || length >= EVENT_LINE_LENGTH)
+  {
+    return false;
+  }
+  Pending &pending = slots[count];
+  pending.key = key;
+  pending.offset = offset;
+  // events are back-dated to the sample that showed the change, a moment before the record was written
+  pending.anchorMs = record.uptimeMs - (uint32_t)(clockService.epochAt(record.uptimeMs) - record.epoch) * 1000;
+  pending.epoch = record.epoch;
+  pending.uptimeMs = record.uptimeMs;
+  pending.adcSample = record.adcSample;
+  pending.type = record.type;
+  pending.length = length;
+  if (count == 0)
+  {
+    firstNotedAt = millis();
+  }
+  count++;
+  return true;
+}
+
+void TimeCorrection::loop()
+{
+  if (applying)
+  {
+    return;
+  }
+  if (clockService.isNtpSynced())
+  {
+    gaveUp = false;
+    if (count > 0 && storageReady)
+    {
+      applying = true;
+      apply();
+      applying = false;
+    }
+    return;
+  }
+  if (count > 0 && millis() - firstNotedAt >= TIME_CORRECTION_HOLD_MS)
+  {
+    LOG_WARN("time correction: no NTP sync, %u events keep their RTC time", (unsigned)count);
+    gaveUp = true;
+    release();
+  }
+}
+
+// The events as they were logged go to the statistics and the publisher
+void TimeCorrection::release()
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    powerStats.record(slots[i].type, slots[i].epoch);
+  }
+  count = 0;
+  unpublishedEventsPending = true;
+}
+
+// Keeps one day file open across consecutive events in it
+static bool openDayFile(uint32_t key, File &dayFile, uint32_t &openKey, boolean &binaryFile)
+{
+  if (key == openKey && dayFile)
+  {
+    return true;
+  }
+  if (dayFile)
+  {
+    dayFile.flush();
+    dayFile.close();
+  }
+  char path[32];
+  dayFileIndex.path(key, path, sizeof(path));
+  dayFile = SDFS.open(path, "r+");
+  openKey = key;
+  binaryFile = dayFile && readEventFileHeader(dayFile);
+  return (bool)dayFile;
+}
+
+static void closeDayFile(File &dayFile)
+{
+  if (dayFile)
+  {
+    dayFile.flush();
+    dayFile.close();
+  }
+}
+
+// Reads back the logged bytes of an event, NUL terminated for a CSV line, and checks they are still the event
+static bool readLogged(File &dayFile, boolean binaryFile, uint32_t offset, size_t length, uint32_t epoch,
+                       uint8_t type, char *bytes)
+{
+  if (!dayFile.seek(offset) || dayFile.read((uint8_t *)bytes, length) != length)
+  {
+    return false;
+  }
+  bytes[length] = '\0';
+  EventRecord logged;
+  if (binaryFile)
+  {
+    memcpy(&logged, bytes, sizeof(logged));
+    if (length != sizeof(logged) || !isEventRecordValid(logged))
+    {
+      return false;
+    }
+  }
+  else if (!parseCsvEventLine(bytes, logged))
+  {
+    return false;
+  }
+  return logged.epoch == epoch && logged.type == type && !(logged.flags & EVENT_FLAG_NTP_SYNCED);
+}
+
+// Rewrites an event read into bytes so readers pass over it: flagged moved in a binary file, a "#" line in a CSV file
+static void markMoved(File &dayFile, boolean binaryFile, uint32_t offset, char *bytes, size_t length)
+{
+  if (binaryFile)
+  {
+    EventRecord logged;
+    memcpy(&logged, bytes, sizeof(logged));
+    logged.flags |= EVENT_FLAG_MOVED;
+    sealEventRecord(logged);
+    memcpy(bytes, &logged, sizeof(logged));
+  }
+  else
+  {
+    bytes[0] = '#';
+  }
+  eventJournal.rewriteEvent(dayFile, offset, (const uint8_t *)bytes, length);
+}
+
+void TimeCorrection::apply()
+{
+  // every noted event is on the card at the offset it was noted with
+  dayFileWriter.flush();
+  offsetS = (int32_t)(clockService.epochAt(slots[0].anchorMs) - slots[0].epoch);
+  EventRecord events[TIME_CORRECTION_SLOTS];
+  uint8_t outcomes[TIME_CORRECTION_SLOTS];
+  size_t moves = 0;
+  File dayFile;
+  uint32_t openKey = 0;
+  boolean binaryFile = false;
+  char bytes[EVENT_LINE_LENGTH];
+
+  // one pass in log order, which is file order: the day file does not roll over before NTP synced
+  for (size_t i = 0; i < count; i++)
+  {
+    const Pending &pending = slots[i];
+    EventRecord &event = events[i];
+    memset(&event, 0, sizeof(event));
+    event.epoch = pending.epoch;
+    event.uptimeMs = pending.uptimeMs;
+    event.adcSample = pending.adcSample;
+    event.type = pending.type;
+    outcomes[i] = CORRECTION_KEPT;
+    if (!openDayFile(pending.key, dayFile, openKey, binaryFile) ||
+        !readLogged(dayFile, binaryFile, pending.offset, pending.length, pending.epoch, pending.type, bytes))
+    {
+      LOG_WARN("time correction: event at %lu in %lu not found", (unsigned long)pending.offset,
+               (unsigned long)pending.key);
+      continue;
+    }
+    EventRecord corrected = event;
+    corrected.epoch = clockService.epochAt(pending.anchorMs);
+    corrected.flags = EVENT_FLAG_NTP_SYNCED | EVENT_FLAG_CORRECTED;
+    sealEventRecord(corrected);
+    uint32_t target = dayFileKeyForEpoch(corrected.epoch);
+    // a day already published or archived is not appended to again, its events are corrected where they are
+    bool closed = target != pending.key && (publishedDayFileIndex.contains(target) || archivedDayIndex.contains(target));
+    size_t length = sizeof(corrected);
+    if (binaryFile)
+    {
+      memcpy(bytes, &corrected, sizeof(corrected));
+    }
+    else
+    {
+      length = formatCsvEventLine(corrected, getTimeOfEventFromEpoch(corrected.epoch).c_str(), bytes, sizeof(bytes));
+    }
+    if ((target == pending.key || closed) && length == pending.length)
+    {
+      if (!eventJournal.rewriteEvent(dayFile, pending.offset, (const uint8_t *)bytes, length))
+      {
+        continue;
+      }
+      outcomes[i] = CORRECTION_IN_PLACE;
+    }
+    else if (!closed)
+    {
+      // another day, or a CSV line that grew with the epoch's digits
+      outcomes[i] = CORRECTION_MOVE;
+      moves++;
+    }
+    else
+    {
+      continue;
+    }
+    event = corrected;
+    correctedCount++;
+  }
+  closeDayFile(dayFile);
+
+  // copies first, a crash in between leaves an event twice rather than not at all; one day file at a time
+  bool grouped[TIME_CORRECTION_SLOTS] = {};
+  for (size_t i = 0; i < count; i++)
+  {
+    if (outcomes[i] != CORRECTION_MOVE || grouped[i])
+    {
+      continue;
+    }
+    uint32_t target = dayFileKeyForEpoch(events[i].epoch);
+    EventRecord group[TIME_CORRECTION_SLOTS];
+    size_t groupSize = 0;
+    for (size_t j = i; j < count; j++)
+    {
+      if (outcomes[j] == CORRECTION_MOVE && !grouped[j] && dayFileKeyForEpoch(events[j].epoch) == target)
+      {
+        // by corrected time; log order already is unless the clock was stepped back in between
+        size_t at = groupSize++;
+        for (; at > 0 && group[at - 1].epoch > events[j].epoch; at--)
+        {
+          group[at] = group[at - 1];
+        }
+        group[at] = events[j];
+        grouped[j] = true;
+      }
+    }
+    moveTo(target, group, groupSize, outcomes);
+  }
+  openKey = 0;
+  for (size_t i = 0; moves > 0 && i < count; i++)
+  {
+    const Pending &pending = slots[i];
+    if (outcomes[i] != CORRECTION_MOVE || !openDayFile(pending.key, dayFile, openKey, binaryFile) ||
+        !readLogged(dayFile, binaryFile, pending.offset, pending.length, pending.epoch, pending.type, bytes))
+    {
+      continue;
+    }
+    markMoved(dayFile, binaryFile, pending.offset, bytes, pending.length);
+  }
+  closeDayFile(dayFile);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    powerStats.record(events[i].type, events[i].epoch);
+  }
+  LOG_INFO("time correction: %u of %u events corrected by %ld s, %u moved to their day file",
+           (unsigned)correctedCount, (unsigned)count, (long)offsetS, (unsigned)moves);
+  count = 0;
+  unpublishedEventsPending = true;
+}
+
+// The events of a day file that have to follow events moved into it: live, not yet published, later than
+// after and not one of the noted events the correction moves away. Returns how many, more than max when they
+// do not all fit.
+size_t TimeCorrection::findLater(File &dayFile, boolean binaryFile, uint32_t key, uint32_t after,
+                                 const uint8_t *outcomes, LaterEvent *later, size_t max) const
+{
+  uint32_t cursorKey = dayFileKey(publishCursorFile.c_str());
+  if (key < cursorKey)
+  {
+    // left behind by the publish cursor, nothing in it goes out again
+    return 0;
+  }
+  if (key == cursorKey && publishCursorOffset > dayFile.position() && !dayFile.seek(publishCursorOffset))
+  {
+    return 0;
+  }
+  seekEventFrom(dayFile, binaryFile, after + 1);
+  size_t found = 0;
+  char line[EVENT_LINE_LENGTH];
+  EventRecord event;
+  while (true)
+  {
+    uint32_t offset = dayFile.position();
+    size_t length = sizeof(event);
+    if (binaryFile)
+    {
+      if (dayFile.read((uint8_t *)&event, sizeof(event)) != sizeof(event))
+      {
+        break;
+      }
+      if (!isEventRecordValid(event) || (event.flags & EVENT_FLAG_MOVED))
+      {
+        continue;
+      }
+    }
+    else
+    {
+      length = readEventLine(dayFile, line, sizeof(line));
+      if (length == 0)
+      {
+        break;
+      }
+      if (length >= EVENT_LINE_LENGTH || !parseCsvEventLine(line, event))
+      {
+        continue;
+      }
+    }
+    bool movedAway = false;
+    for (size_t i = 0; i < count; i++)
+    {
+      movedAway |= outcomes[i] == CORRECTION_MOVE && slots[i].key == key && slots[i].offset == offset;
+    }
+    if (event.epoch <= after || movedAway)
+    {
+      continue;
+    }
+    if (found < max)
+    {
+      later[found] = {offset, event.epoch, (uint8_t)length};
+    }
+    found++;
+  }
+  return found;
+}
+
+// Puts the corrected copies of events into the day file of their date, under /qop, in time order: the copies
+// and the file's later events are appended merged by time, then the later events are marked moved where they
+// were. Events of the file already published stay where they are.
+void TimeCorrection::moveTo(uint32_t target, const EventRecord *moved, size_t copies, const uint8_t *outcomes)
+{
+  // the current day file's buffered events are read back below
+  dayFileWriter.flush();
+  char path[32];
+  dayFileIndex.path(target, path, sizeof(path));
+  LaterEvent later[TIME_CORRECTION_SLOTS];
+  size_t laterCount = 0;
+  File reader = dayFileIndex.contains(target) ? SD.open(path, FILE_READ) : File();
+  boolean binaryFile = reader && readEventFileHeader(reader);
+  if (reader)
+  {
+    laterCount = findLater(reader, binaryFile, target, moved[0].epoch, outcomes, later, TIME_CORRECTION_SLOTS);
+  }
+  if (laterCount > TIME_CORRECTION_SLOTS)
+  {
+    LOG_WARN("time correction: %u later events in %s, appending the moved ones after them", (unsigned)laterCount,
+             path);
+    laterCount = 0;
+  }
+
+  bool current = currentDayFile && dayFileKey(currentDayFile.fullName()) == target;
+  File dayFile = current ? currentDayFile : SD.open(path, FILE_WRITE);
+  if (!dayFile)
+  {
+    LOG_ERROR("time correction: cannot open %s", path);
+    reader.close();
+    return;
+  }
+  dayFileIndex.add(target);
+  uint8_t bytes[EVENT_JOURNAL_DATA_LENGTH];
+  size_t next = 0;
+  size_t nextLater = 0;
+  while (next < copies || nextLater < laterCount)
+  {
+    size_t length;
+    if (nextLater == laterCount || (next < copies && moved[next].epoch <= later[nextLater].epoch))
+    {
+      size_t eventOffset;
+      const EventRecord &event = moved[next++];
+      length = encodeEventFor(dayFile, event, getTimeOfEventFromEpoch(event.epoch).c_str(), bytes, eventOffset);
+      movedCount++;
+    }
+    else
+    {
+      const LaterEvent &event = later[nextLater++];
+      length = reader.seek(event.offset) ? reader.read(bytes, event.length) : 0;
+      if (length != event.length)
+      {
+        continue;
+      }
+    }
+    eventJournal.appendEvent(dayFile, bytes, length);
+  }
+  reader.close();
+  if (current)
+  {
+    dayFileWriter.flush();
+  }
+  else
+  {
+    dayFileWriter.close();
+    dayFile.close();
+  }
+  if (laterCount == 0)
+  {
+    return;
+  }
+
+  // the later events now follow the copies, readers pass over them where they were
+  File laterFile;
+  uint32_t openKey = 0;
+  if (!openDayFile(target, laterFile, openKey, binaryFile))
+  {
+    return;
+  }
+  for (size_t i = 0; i < laterCount; i++)
+  {
+    if (laterFile.seek(later[i].offset) && laterFile.read(bytes, later[i].length) == later[i].length)
+    {
+      markMoved(laterFile, binaryFile, later[i].offset, (char *)bytes, later[i].length);
+    }
+  }
+  closeDayFile(laterFile);
+}
@@ -0,0 +1,93 @@
+#include "traceRecord.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "eventRecord.h"
+
+void initTraceFileHeader(TraceFileHeader &header, uint16_t blockMs, uint32_t startedAtMs, uint32_t epoch,
+                         bool ntpSynced)
+{
+  memset(&header, 0, sizeof(header));
+  header.magic = TRACE_FILE_MAGIC;
+  header.version = TRACE_FILE_VERSION;
+  header.recordSize = sizeof(TraceRecord);
+  header.blockMs = blockMs;
+  header.flags = ntpSynced ? TRACE_HEADER_NTP_SYNCED : 0;
+  header.startedAtMs = startedAtMs;
+  header.epoch = epoch;
+  header.crc = crc32((const uint8_t *)&header, offsetof(TraceFileHeader, crc));
+}
+
+bool isTraceFileHeaderValid(const TraceFileHeader &header)
+{
+  return header.magic == TRACE_FILE_MAGIC && header.version == TRACE_FILE_VERSION &&
+         header.recordSize == sizeof(TraceRecord) && header.blockMs != 0 &&
+         header.crc == crc32((const uint8_t *)&header, offsetof(TraceFileHeader, crc));
+}
+
+bool isTraceRecordValid(const TraceRecord &record)
+{
+  if (record.kind == TRACE_NONE || record.kind > TRACE_KIND_LAST)
+  {
+    return false;
+  }
+  return record.kind != TRACE_SAMPLES || (record.flags >= 1 && record.flags <= TRACE_SAMPLES_PER_RECORD);
+}
+
+void initTraceSamples(TraceRecord &record, uint32_t takenAt, uint16_t mean)
+{
+  memset(&record, 0, sizeof(record));
+  record.at = takenAt;
+  record.kind = TRACE_SAMPLES;
+  record.flags = 1;
+  record.value = mean;
+}
+
+bool addTraceSample(TraceRecord &record, uint32_t takenAt, uint16_t mean, uint16_t blockMs)
+{
+  if (record.flags >= TRACE_SAMPLES_PER_RECORD)
+  {
+    return false;
+  }
+  // Ticker jitter moves a block start by a millisecond or two, a dropped block by a whole block
+  int32_t late = (int32_t)(takenAt - (record.at + (uint32_t)record.flags * blockMs));
+  if (late < -(int32_t)blockMs / 2 || late >= (int32_t)blockMs / 2)
+  {
+    return false;
+  }
+  uint8_t i = record.flags - 1;
+  record.data[i / 2] |= (uint32_t)mean << (16 * (i % 2));
+  record.flags++;
+  return true;
+}
+
+uint16_t traceSampleAt(const TraceRecord &record, uint8_t i)
+{
+  if (i == 0)
+  {
+    return record.value;
+  }
+  return (uint16_t)(record.data[(i - 1) / 2] >> (16 * ((i - 1) % 2)));
+}
+
+const char *traceKindName(uint8_t kind)
+{
+  switch (kind)
+  {
+  case TRACE_SAMPLES:
+    return "samples";
+  case TRACE_BURST:
+    return "burst";
+  case TRACE_CLOCK:
+    return "clock";
+  case TRACE_WIFI:
+    return "wifi";
+  case TRACE_PUBLISH:
+    return "publish";
+  case TRACE_GAP:
+    return "gap";
+  default:
+    return "none";
+  }
+}
@@ -0,0 +1,210 @@
+#include "traceRecorder.h"
+
+#include <ESP8266WiFi.h>
+#include <SD.h>
+
+#include "clockService.h"
+#include "eventLog.h"
+#include "logger.h"
+
+TraceRecorder traceRecorder;
+
+void TraceRecorder::setEnabled(bool enabled)
+{
+  if (enabled == on)
+  {
+    return;
+  }
+  on = enabled;
+  started = false;
+  full = false;
+  packing = false;
+  haveBurst = false;
+  tail = head;
+  lost = 0;
+  LOG_INFO("trace: recording %s", on ? "on" : "off");
+}
+
+void TraceRecorder::noteSample(const MainsSample &sample)
+{
+  if (!started)
+  {
+    return;
+  }
+  // the next light sleep starts over with its first burst
+  haveBurst = false;
+  if (packing && addTraceSample(samples, sample.takenAt, sample.value, header.blockMs))
+  {
+    if (samples.flags == TRACE_SAMPLES_PER_RECORD)
+    {
+      push(samples);
+      packing = false;
+    }
+    return;
+  }
+  if (packing)
+  {
+    push(samples);
+  }
+  initTraceSamples(samples, sample.takenAt, sample.value);
+  packing = true;
+}
+
+void TraceRecorder::noteBurst(uint16_t mean, bool resumeLevel)
+{
+  if (!started)
+  {
+    return;
+  }
+  if (haveBurst && lastBurstResumes == resumeLevel && mean + TRACE_BURST_DELTA >= lastBurst &&
+      mean <= lastBurst + TRACE_BURST_DELTA)
+  {
+    return;
+  }
+  if (packing)
+  {
+    push(samples);
+    packing = false;
+  }
+  haveBurst = true;
+  lastBurst = mean;
+  lastBurstResumes = resumeLevel;
+  TraceRecord record = {};
+  record.at = millis();
+  record.kind = TRACE_BURST;
+  record.value = mean;
+  push(record);
+}
+
+void TraceRecorder::noteClock(uint32_t at, bool ntpAsked, uint32_t ntpEpoch, uint32_t rtcEpoch)
+{
+  if (!started)
+  {
+    return;
+  }
+  TraceRecord record = {};
+  record.at = at;
+  record.kind = TRACE_CLOCK;
+  record.flags = ntpAsked ? TRACE_CLOCK_NTP_ASKED : 0;
+  record.data[0] = ntpEpoch;
+  record.data[1] = rtcEpoch;
+  push(record);
+}
+
+void TraceRecorder::notePublish(bool report, uint16_t count, uint32_t first, bool ok)
+{
+  if (!started)
+  {
+    return;
+  }
+  TraceRecord record = {};
+  record.at = millis();
+  record.kind = TRACE_PUBLISH;
+  record.flags = (ok ? TRACE_PUBLISH_OK : 0) | (report ? TRACE_PUBLISH_REPORT : 0);
+  record.value = count;
+  record.data[0] = first;
+  push(record);
+}
+
+void TraceRecorder::loop()
+{
+  if (!on)
+  {
+    return;
+  }
+  if (!started)
+  {
+    // the clock is anchored by now, at boot the trace starts on the RTC time the clock started on
+    uint32_t now = millis();
+    uint32_t epoch = clockService.epochAt(now);
+    initTraceFileHeader(header, MAINS_SAMPLE_INTERVAL_MS * MAINS_BLOCK_SAMPLES, now, epoch,
+                        clockService.isNtpSynced());
+    snprintf(path, sizeof(path), "%s/%08lX", TRACE_ROOT, (unsigned long)epoch);
+    started = true;
+    lastFlush = now;
+    wifiStatus = 0xFF;
+  }
+  uint8_t status = (uint8_t)WiFi.status();
+  if (status != wifiStatus)
+  {
+    wifiStatus = status;
+    TraceRecord record = {};
+    record.at = millis();
+    record.kind = TRACE_WIFI;
+    record.value = status;
+    push(record);
+  }
+  if (full)
+  {
+    tail = head;
+    return;
+  }
+  // during an outage the card is unmounted, the ring holds on until the resume
+  if (!storageReady || head == tail)
+  {
+    return;
+  }
+  if (head - tail >= TRACE_FLUSH_RECORDS || millis() - lastFlush >= TRACE_FLUSH_INTERVAL_MS)
+  {
+    flush();
+  }
+}
+
+void TraceRecorder::push(const TraceRecord &record)
+{
+  // a full ring keeps the oldest records, the gap shows where the newer ones went
+  uint32_t room = TRACE_RING_RECORDS - (head - tail);
+  if (room < (lost != 0 ? 2u : 1u))
+  {
+    lostAt = lost == 0 ? record.at : lostAt;
+    lost++;
+    lostTotal++;
+    return;
+  }
+  if (lost != 0)
+  {
+    TraceRecord &gap = ring[head++ % TRACE_RING_RECORDS];
+    gap = TraceRecord();
+    gap.at = lostAt;
+    gap.kind = TRACE_GAP;
+    gap.data[0] = lost;
+    lost = 0;
+  }
+  ring[head++ % TRACE_RING_RECORDS] = record;
+}
+
+// Appends the ring in at most two writes, the header first into a new file
+void TraceRecorder::flush()
+{
+  lastFlush = millis();
+  if (!SD.exists(TRACE_ROOT))
+  {
+    SD.mkdir("qop-trace");
+  }
+  File file = SD.open(path, FILE_WRITE);
+  if (!file)
+  {
+    LOG_ERROR("trace: cannot open %s", path);
+    return;
+  }
+  bool ok = file.size() != 0 || file.write((const uint8_t *)&header, sizeof(header)) == sizeof(header);
+  while (ok && tail != head)
+  {
+    uint32_t at = tail % TRACE_RING_RECORDS;
+    uint32_t count = head - tail < TRACE_RING_RECORDS - at ? head - tail : TRACE_RING_RECORDS - at;
+    size_t bytes = count * sizeof(TraceRecord);
+    ok = file.write((const uint8_t *)&ring[at], bytes) == bytes;
+    tail += count;
+    written += bytes;
+  }
+  full = file.size() >= TRACE_MAX_FILE_BYTES;
+  file.close();
+  if (!ok)
+  {
+    LOG_ERROR("trace: writing %s failed", path);
+  }
+  if (full)
+  {
+    LOG_WARN("trace: %s reached %lu bytes, recording stopped", path, (unsigned long)TRACE_MAX_FILE_BYTES);
+  }
+}
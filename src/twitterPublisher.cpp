@@ -0,0 +1,22 @@
+#include "twitterPublisher.h"
+#include "logger.h"
+#include "profiler.h"
+
+bool TwitterPublisher::publish(const EventBatch &batch)
+{
+  char summary[200];
+  batch.formatSummary(summary, sizeof(summary));
+  LOG_DEBUG("tweeting: %s", summary);
+
+  boolean val = PROFILED(PROFILE_TWEET, client.tweet(summary));
+  LOG_INFO("Tweet published status: %d", val);
+  return val;
+}
+
+bool TwitterPublisher::publishReport(PowerStatsPeriod period, const PowerStatsBucket &bucket)
+{
+  char report[200];
+  formatPowerReport(bucket, period, report, sizeof(report));
+  LOG_DEBUG("tweeting: %s", report);
+  return PROFILED(PROFILE_TWEET, client.tweet(report));
+}
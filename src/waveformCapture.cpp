@@ -0,0 +1,100 @@
+#include "waveformCapture.h"
+
+#include <SD.h>
+
+#include "clockService.h"
+#include "eventLog.h"
+#include "logger.h"
+#include "mainsDetector.h"
+
+WaveformCapture waveformCapture;
+
+void WaveformCapture::restart()
+{
+  full[0] = false;
+  full[1] = false;
+  filling = 0;
+  used = 0;
+  haveBefore = false;
+  latest = WaveformMetrics();
+}
+
+bool WaveformCapture::loop()
+{
+  // add() only moves on to the window loop() holds once loop() lets go of it
+  uint8_t ready = filling ^ 1;
+  if (!full[ready])
+  {
+    return false;
+  }
+  const uint16_t *window = buffers[ready];
+  WaveformMetrics metrics;
+  metrics.takenAt = startedAt[ready];
+  computeWaveformMetrics(window, WAVEFORM_WINDOW_SAMPLES, WAVEFORM_SAMPLE_RATE_HZ, mainsDetector.thresholds().offBelow,
+                         metrics);
+  if ((metrics.flags & WAVEFORM_FLAG_DROPOUT) && !(latest.flags & WAVEFORM_FLAG_DROPOUT))
+  {
+    dropoutCount++;
+  }
+  bool transition = isTransition(metrics);
+  // the crossings of a window with a step in it say nothing about the frequency
+  if (metrics.frequencyCentiHz != 0 && haveBefore && !transition && !(metrics.flags & WAVEFORM_FLAG_DROPOUT))
+  {
+    lowestFrequency = lowestFrequency == 0 || metrics.frequencyCentiHz < lowestFrequency ? metrics.frequencyCentiHz
+                                                                                        : lowestFrequency;
+    highestFrequency = metrics.frequencyCentiHz > highestFrequency ? metrics.frequencyCentiHz : highestFrequency;
+  }
+  if (saveRaw && haveBefore && droppedBefore == dropped && transition &&
+      (savedCount == 0 || millis() - lastSavedAt >= WAVEFORM_SAVE_MIN_INTERVAL_MS))
+  {
+    save(window);
+  }
+  memcpy(before, window, sizeof(before));
+  beforeAt = metrics.takenAt;
+  haveBefore = true;
+  droppedBefore = dropped;
+  full[ready] = false;
+  latest = metrics;
+  windowCount++;
+  return true;
+}
+
+bool WaveformCapture::isTransition(const WaveformMetrics &metrics) const
+{
+  int32_t change = (int32_t)metrics.mean - latest.mean;
+  bool dropoutStarted = (metrics.flags & WAVEFORM_FLAG_DROPOUT) && !(latest.flags & WAVEFORM_FLAG_DROPOUT);
+  return change >= WAVEFORM_TRANSITION_COUNTS || change <= -WAVEFORM_TRANSITION_COUNTS || dropoutStarted;
+}
+
+// The burst before and the one the transition shows up in
+void WaveformCapture::save(const uint16_t *window)
+{
+  if (!storageReady)
+  {
+    return;
+  }
+  if (!SD.exists(WAVEFORM_ROOT))
+  {
+    SD.mkdir("qop-wave");
+  }
+  uint32_t epoch = clockService.epochAt(beforeAt);
+  char path[32];
+  snprintf(path, sizeof(path), "%s/%08lX", WAVEFORM_ROOT, (unsigned long)epoch);
+  WaveformFileHeader header;
+  initWaveformFileHeader(header, WAVEFORM_SAMPLE_RATE_HZ, WAVEFORM_WINDOW_SAMPLES, 2, epoch, beforeAt);
+  uint32_t crc = crc32((const uint8_t *)before, sizeof(before), waveformHeaderCrc(header));
+  header.crc = crc32((const uint8_t *)window, sizeof(before), crc);
+  File file = SDFS.open(path, "w");
+  bool ok = file && file.write((const uint8_t *)&header, sizeof(header)) == sizeof(header) &&
+            file.write((const uint8_t *)before, sizeof(before)) == sizeof(before) &&
+            file.write((const uint8_t *)window, sizeof(before)) == sizeof(before);
+  file.close();
+  if (!ok)
+  {
+    LOG_ERROR("waveform: writing %s failed", path);
+    return;
+  }
+  lastSavedAt = millis();
+  savedCount++;
+  LOG_DEBUG("waveform: saved %s", path);
+}
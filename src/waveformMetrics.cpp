@@ -0,0 +1,124 @@
+#include "waveformMetrics.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "eventRecord.h"
+
+uint32_t isqrt32(uint32_t value)
+{
+  uint32_t root = 0;
+  uint32_t bit = 1UL << 30;
+  while (bit > value)
+  {
+    bit >>= 2;
+  }
+  while (bit != 0)
+  {
+    if (value >= root + bit)
+    {
+      value -= root + bit;
+      root = (root >> 1) + bit;
+    }
+    else
+    {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return root;
+}
+
+void computeWaveformMetrics(const uint16_t *reads, size_t samples, uint16_t sampleRateHz, uint16_t offBelow,
+                            WaveformMetrics &metrics)
+{
+  // sums, four reads per iteration
+  uint32_t sum = 0;
+  uint32_t sumSq = 0;
+  uint16_t lo = UINT16_MAX;
+  uint16_t hi = 0;
+  for (size_t i = 0; i < samples; i += 4)
+  {
+    uint32_t a = reads[i];
+    uint32_t b = reads[i + 1];
+    uint32_t c = reads[i + 2];
+    uint32_t d = reads[i + 3];
+    sum += a + b + c + d;
+    sumSq += a * a + b * b + c * c + d * d;
+    uint16_t low = (uint16_t)(a < b ? a : b);
+    uint16_t high = (uint16_t)(a < b ? b : a);
+    uint16_t low2 = (uint16_t)(c < d ? c : d);
+    uint16_t high2 = (uint16_t)(c < d ? d : c);
+    low = low < low2 ? low : low2;
+    high = high > high2 ? high : high2;
+    lo = low < lo ? low : lo;
+    hi = high > hi ? high : hi;
+  }
+  uint16_t mean = (uint16_t)((sum + samples / 2) / samples);
+  uint64_t spread = (uint64_t)samples * sumSq - (uint64_t)sum * sum;
+  metrics.mean = mean;
+  metrics.min = lo;
+  metrics.max = hi;
+  metrics.rms = (uint16_t)isqrt32(sumSq / samples);
+  metrics.ripple = (uint16_t)isqrt32((uint32_t)(spread * 10000 / ((uint64_t)samples * samples)));
+
+  // rising crossings of the mean, each placed between the reads around it in 1/256ths of a read; the mean is
+  // kept in 1/16ths of a count, reads are scaled to match
+  uint32_t level = (sum * 16 + samples / 2) / samples;
+  uint32_t armBelow = level > WAVEFORM_CROSSING_HYSTERESIS * 16 ? level - WAVEFORM_CROSSING_HYSTERESIS * 16 : 0;
+  uint8_t crossings = 0;
+  uint32_t first = 0;
+  uint32_t last = 0;
+  bool armed = (uint32_t)reads[0] * 16 <= armBelow;
+  for (size_t i = 1; i < samples; i++)
+  {
+    uint32_t read = (uint32_t)reads[i] * 16;
+    if (read <= armBelow)
+    {
+      armed = true;
+    }
+    else if (armed && read >= level)
+    {
+      uint32_t before = (uint32_t)reads[i - 1] * 16;
+      uint32_t at = (uint32_t)(i - 1) * 256 + (level - before) * 256 / (read - before);
+      first = crossings == 0 ? at : first;
+      last = at;
+      crossings = crossings < UINT8_MAX ? crossings + 1 : crossings;
+      armed = false;
+    }
+  }
+  uint64_t centiHz = 0;
+  if (crossings >= 2 && last > first)
+  {
+    centiHz = (uint64_t)(crossings - 1) * sampleRateHz * 256 * 100 /
+              ((uint64_t)(last - first) * WAVEFORM_RIPPLE_PER_CYCLE);
+  }
+  metrics.frequencyCentiHz = (uint16_t)(centiHz < UINT16_MAX ? centiHz : UINT16_MAX);
+  metrics.crossings = crossings;
+  metrics.flags = mean >= offBelow && lo < offBelow ? WAVEFORM_FLAG_DROPOUT : 0;
+}
+
+void initWaveformFileHeader(WaveformFileHeader &header, uint16_t sampleRateHz, uint16_t windowSamples,
+                            uint16_t windows, uint32_t epoch, uint32_t takenAtMs)
+{
+  memset(&header, 0, sizeof(header));
+  header.magic = WAVEFORM_FILE_MAGIC;
+  header.version = WAVEFORM_FILE_VERSION;
+  header.sampleRateHz = sampleRateHz;
+  header.windowSamples = windowSamples;
+  header.windows = windows;
+  header.epoch = epoch;
+  header.takenAtMs = takenAtMs;
+}
+
+uint32_t waveformHeaderCrc(const WaveformFileHeader &header)
+{
+  return crc32((const uint8_t *)&header, offsetof(WaveformFileHeader, crc));
+}
+
+bool isWaveformFileValid(const WaveformFileHeader &header, const uint16_t *reads, size_t count)
+{
+  return header.magic == WAVEFORM_FILE_MAGIC && header.version == WAVEFORM_FILE_VERSION &&
+         (size_t)header.windowSamples * header.windows == count &&
+         header.crc == crc32((const uint8_t *)reads, count * sizeof(uint16_t), waveformHeaderCrc(header));
+}
@@ -0,0 +1,139 @@
+// EventBatch's running totals and the one line summaries text sinks publish.
+//
+//   pio test -e native -f test_eventBatch
+
+#include "eventBatch.h"
+
+#include <unity.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TEST_EPOCH 1656633600 // 2022-07-01 00:00:00
+
+static EventBatch batch;
+static char summary[160];
+
+void setUp()
+{
+  batch.clear();
+  summary[0] = '\0';
+}
+void tearDown() {}
+
+static void add(uint8_t type, uint32_t offset)
+{
+  EventRecord event = {};
+  event.epoch = TEST_EPOCH + offset;
+  event.type = type;
+  TEST_ASSERT_TRUE(batch.add(event));
+}
+
+static void formatSummary()
+{
+  int written = batch.formatSummary(summary, sizeof(summary));
+  TEST_ASSERT_TRUE(written > 0 && (size_t)written < sizeof(summary));
+}
+
+static void assertEndsWith(const char *suffix)
+{
+  size_t length = strlen(summary);
+  size_t suffixLength = strlen(suffix);
+  TEST_ASSERT_TRUE_MESSAGE(length >= suffixLength, summary);
+  TEST_ASSERT_EQUAL_STRING(suffix, summary + length - suffixLength);
+}
+
+static void test_outage()
+{
+  add(EVENT_TYPE_POFF, 0);
+  add(EVENT_TYPE_PRES, 600);
+  TEST_ASSERT_EQUAL_UINT16(1, batch.outages());
+  TEST_ASSERT_EQUAL_UINT16(0, batch.powerOns());
+  TEST_ASSERT_EQUAL_UINT32(600, batch.totalDowntime());
+  TEST_ASSERT_EQUAL_UINT32(600, batch.longestOutage());
+  formatSummary();
+  TEST_ASSERT_EQUAL_STRING("[outage] 10 min, power off at Fri Jul 01 00:00:00 2022, back at Fri Jul 01 00:10:00 2022",
+                           summary);
+}
+
+static void test_restart()
+{
+  add(EVENT_TYPE_PRES, 0);
+  TEST_ASSERT_EQUAL_UINT16(0, batch.outages());
+  TEST_ASSERT_EQUAL_UINT16(1, batch.powerOns());
+  formatSummary();
+  TEST_ASSERT_EQUAL_STRING("[power-on][Time:Fri Jul 01 00:00:00 2022]", summary);
+}
+
+static void test_outages_with_restart_and_brownout()
+{
+  add(EVENT_TYPE_POFF, 0);
+  add(EVENT_TYPE_PRES, 120);
+  add(EVENT_TYPE_PRES, 600);
+  add(EVENT_TYPE_BRWN, 900);
+  add(EVENT_TYPE_POFF, 1800);
+  add(EVENT_TYPE_PRES, 2100);
+  TEST_ASSERT_EQUAL_UINT16(2, batch.outages());
+  TEST_ASSERT_EQUAL_UINT16(1, batch.powerOns());
+  TEST_ASSERT_EQUAL_UINT16(1, batch.brownouts());
+  TEST_ASSERT_EQUAL_UINT32(420, batch.totalDowntime());
+  TEST_ASSERT_EQUAL_UINT32(300, batch.longestOutage());
+  formatSummary();
+  TEST_ASSERT_EQUAL_STRING_LEN("[outages] 2 outages, total 7 min, longest 5 min,", summary, 48);
+  assertEndsWith(", 1 restart, 1 brownout");
+}
+
+static void test_power_quality()
+{
+  add(EVENT_TYPE_BRWN, 0);
+  add(EVENT_TYPE_NORM, 20);
+  add(EVENT_TYPE_SURG, 60);
+  add(EVENT_TYPE_SURG, 90);
+  TEST_ASSERT_EQUAL_UINT16(0, batch.outages());
+  TEST_ASSERT_EQUAL_UINT16(1, batch.brownouts());
+  TEST_ASSERT_EQUAL_UINT16(2, batch.surges());
+  formatSummary();
+  TEST_ASSERT_EQUAL_STRING("[power-quality] 1 brownout, 2 surges between Fri Jul 01 00:00:00 2022 and Fri Jul 01 "
+                           "00:01:30 2022",
+                           summary);
+}
+
+// a brownout-only batch still reports a restart in it
+static void test_power_quality_with_restart()
+{
+  add(EVENT_TYPE_PRES, 0);
+  add(EVENT_TYPE_BRWN, 30);
+  formatSummary();
+  TEST_ASSERT_EQUAL_STRING("[power-quality] 1 brownout, 0 surges between Fri Jul 01 00:00:00 2022 and Fri Jul 01 "
+                           "00:00:30 2022, 1 restart",
+                           summary);
+}
+
+static void test_capacity()
+{
+  for (uint32_t i = 0; i < EVENT_BATCH_CAPACITY; i++)
+  {
+    add(EVENT_TYPE_BRWN, i);
+  }
+  EventRecord event = {};
+  event.type = EVENT_TYPE_BRWN;
+  TEST_ASSERT_FALSE(batch.add(event));
+  TEST_ASSERT_EQUAL(EVENT_BATCH_CAPACITY, batch.size());
+  TEST_ASSERT_EQUAL_UINT16(EVENT_BATCH_CAPACITY, batch.brownouts());
+}
+
+int main(int, char **)
+{
+  // summaries are formatted in local time
+  setenv("TZ", "UTC", 1);
+  tzset();
+  UNITY_BEGIN();
+  RUN_TEST(test_outage);
+  RUN_TEST(test_restart);
+  RUN_TEST(test_outages_with_restart_and_brownout);
+  RUN_TEST(test_power_quality);
+  RUN_TEST(test_power_quality_with_restart);
+  RUN_TEST(test_capacity);
+  return UNITY_END();
+}
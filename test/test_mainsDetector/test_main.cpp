@@ -0,0 +1,53 @@
+// MainsDetector against the built-in waveforms of mainsWaveforms.h: each must
+// report exactly its expected levels with the stock band edges, and again
+// scaled to a unit reading 60 % of the stock divider, with the edges
+// mainsCalibration learns from three hours of that unit.
+//
+//   pio test -e native -f test_mainsDetector
+
+#include "mainsCalibration.h"
+#include "mainsDetector.h"
+
+#include <mainsWaveforms.h>
+#include <unity.h>
+
+#include <vector>
+
+#define CALIBRATION_PERCENT 60
+
+static std::vector<MainsWaveform> waveforms;
+
+void setUp() {}
+void tearDown() {}
+
+static void test_stock_edges()
+{
+  for (const MainsWaveform &waveform : waveforms)
+  {
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(mainsLevelList(waveform.expected).c_str(),
+                                     mainsLevelList(replayMainsWaveform(waveform.reads)).c_str(), waveform.name);
+  }
+}
+
+static void test_learned_edges()
+{
+  MainsCalibrationResult learned;
+  TEST_ASSERT_TRUE_MESSAGE(learnMainsThresholds(CALIBRATION_PERCENT, learned), "no thresholds learned");
+  for (const MainsWaveform &waveform : waveforms)
+  {
+    std::vector<uint16_t> reads = scaledMainsWaveform(waveform.reads, CALIBRATION_PERCENT);
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(mainsLevelList(waveform.expected).c_str(),
+                                     mainsLevelList(replayMainsWaveform(reads, false, learned.thresholds)).c_str(),
+                                     waveform.name);
+  }
+}
+
+int main(int, char **)
+{
+  // the calibration's noise follows the waveforms', build them first as detector-replay does
+  waveforms = builtinMainsWaveforms();
+  UNITY_BEGIN();
+  RUN_TEST(test_stock_edges);
+  RUN_TEST(test_learned_edges);
+  return UNITY_END();
+}
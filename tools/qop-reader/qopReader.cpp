@@ -0,0 +1,432 @@
+// Host side reader for day files and monthly archives pulled off the SD card.
+//
+//   qop-reader [--events] <file or directory>...   outage summary, optionally every event
+//   qop-reader --convert <csv day file> <binary day file>
+//   qop-reader --stats <qop.stats>                 daily and monthly buckets of the summary file
+//   qop-reader --wave <capture file>...            metrics of each window of raw A0 captures from /qop-wave
+//
+// Files are memory mapped; binary day files are walked in place as an array
+// of EventRecords, CSV day files are parsed straight out of the mapping and
+// archives (eventArchive.h) decoded day by day out of it.
+// Build with: pio run -e qop-reader
+
+#include "eventArchive.h"
+#include "eventRecord.h"
+#include "powerStats.h"
+#include "waveformMetrics.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct MappedFile
+{
+  const uint8_t *data = nullptr;
+  size_t size = 0;
+
+  bool open(const std::string &path)
+  {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+      void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapping != MAP_FAILED)
+      {
+        data = (const uint8_t *)mapping;
+        size = st.st_size;
+      }
+    }
+    ::close(fd);
+    return data != nullptr || st.st_size == 0;
+  }
+
+  ~MappedFile()
+  {
+    if (data)
+    {
+      munmap((void *)data, size);
+    }
+  }
+};
+
+struct ReadStats
+{
+  size_t files = 0;
+  size_t binaryFiles = 0;
+  size_t archives = 0;
+  size_t waveforms = 0;
+  size_t badEntries = 0;
+};
+
+// Appends the events of every day in an archive, in day order; a day whose block fails its CRC counts as bad
+static void readArchive(const MappedFile &file, std::vector<EventRecord> &events, ReadStats &stats)
+{
+  const ArchiveHeader *header = (const ArchiveHeader *)file.data;
+  std::vector<ArchiveDay> days(header->days, header->days + header->dayCount);
+  std::sort(days.begin(), days.end(), [](const ArchiveDay &a, const ArchiveDay &b) { return a.key < b.key; });
+  for (const ArchiveDay &day : days)
+  {
+    uint32_t stored;
+    if ((uint64_t)day.offset + day.length + sizeof(stored) > file.size)
+    {
+      stats.badEntries += day.events;
+      continue;
+    }
+    const uint8_t *block = file.data + day.offset;
+    memcpy(&stored, block + day.length, sizeof(stored));
+    if (stored != crc32(block, day.length))
+    {
+      stats.badEntries += day.events;
+      continue;
+    }
+    ArchiveCodec codec;
+    size_t position = 0;
+    size_t decoded = 0;
+    EventRecord record;
+    while (size_t used = decodeArchiveEvent(block + position, day.length - position, codec, record))
+    {
+      events.push_back(record);
+      position += used;
+      decoded++;
+    }
+    stats.badEntries += decoded < day.events ? day.events - decoded : 0;
+  }
+}
+
+// Appends every valid event of one day file, binary or CSV, or of one archive to events
+static bool readDayFile(const std::string &path, std::vector<EventRecord> &events, ReadStats &stats)
+{
+  MappedFile file;
+  if (!file.open(path))
+  {
+    fprintf(stderr, "cannot read %s\n", path.c_str());
+    return false;
+  }
+  stats.files++;
+  const EventFileHeader *header = (const EventFileHeader *)file.data;
+  if (file.size >= sizeof(EventFileHeader) && isEventFileHeaderValid(*header))
+  {
+    stats.binaryFiles++;
+    const EventRecord *records = (const EventRecord *)(file.data + sizeof(EventFileHeader));
+    size_t count = (file.size - sizeof(EventFileHeader)) / sizeof(EventRecord);
+    for (size_t i = 0; i < count; i++)
+    {
+      if (isEventRecordValid(records[i]))
+      {
+        // left behind where a corrected copy went to another day file
+        if (!(records[i].flags & EVENT_FLAG_MOVED))
+        {
+          events.push_back(records[i]);
+        }
+      }
+      else
+      {
+        stats.badEntries++;
+      }
+    }
+    return true;
+  }
+  if (file.size >= sizeof(ArchiveHeader) && isArchiveHeaderValid(*(const ArchiveHeader *)file.data))
+  {
+    stats.archives++;
+    readArchive(file, events, stats);
+    return true;
+  }
+  // raw captures in a pulled /qop-wave hold no events
+  if (file.size >= sizeof(WaveformFileHeader) && ((const WaveformFileHeader *)file.data)->magic == WAVEFORM_FILE_MAGIC)
+  {
+    stats.waveforms++;
+    return true;
+  }
+
+  // CSV: lines are short, copy each into a terminated buffer for the shared parser
+  char line[64];
+  const uint8_t *cursor = file.data;
+  const uint8_t *end = file.data + file.size;
+  while (cursor < end)
+  {
+    const uint8_t *newline = (const uint8_t *)memchr(cursor, '\n', end - cursor);
+    const uint8_t *lineEnd = newline ? newline : end;
+    size_t length = std::min((size_t)(lineEnd - cursor), sizeof(line) - 1);
+    memcpy(line, cursor, length);
+    line[length] = '\0';
+    EventRecord record;
+    if (parseCsvEventLine(line, record))
+    {
+      events.push_back(record);
+    }
+    else if (length > 1 && line[0] != '#')
+    {
+      stats.badEntries++;
+    }
+    cursor = lineEnd + 1;
+  }
+  return true;
+}
+
+static void collectPaths(const std::string &path, std::vector<std::string> &paths)
+{
+  namespace fs = std::filesystem;
+  if (fs::is_directory(path))
+  {
+    for (const auto &entry : fs::recursive_directory_iterator(path))
+    {
+      if (entry.is_regular_file())
+      {
+        paths.push_back(entry.path().string());
+      }
+    }
+  }
+  else
+  {
+    paths.push_back(path);
+  }
+}
+
+static std::string formatEpoch(uint32_t epoch)
+{
+  time_t seconds = epoch;
+  std::tm fields;
+  gmtime_r(&seconds, &fields);
+  char buf[24];
+  strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &fields);
+  return buf;
+}
+
+static int convert(const char *csvPath, const char *binaryPath)
+{
+  std::vector<EventRecord> events;
+  ReadStats stats;
+  if (!readDayFile(csvPath, events, stats))
+  {
+    return 1;
+  }
+  FILE *out = fopen(binaryPath, "wb");
+  if (!out)
+  {
+    fprintf(stderr, "cannot create %s\n", binaryPath);
+    return 1;
+  }
+  EventFileHeader header;
+  initEventFileHeader(header, events.empty() ? 0 : events.front().epoch);
+  fwrite(&header, sizeof(header), 1, out);
+  fwrite(events.data(), sizeof(EventRecord), events.size(), out);
+  fclose(out);
+  printf("converted %zu events (%zu malformed lines skipped)\n", events.size(), stats.badEntries);
+  return 0;
+}
+
+static int printStats(const char *path)
+{
+  MappedFile file;
+  if (!file.open(path) || file.size < sizeof(PowerStatsHeader))
+  {
+    fprintf(stderr, "cannot read %s\n", path);
+    return 1;
+  }
+  const PowerStatsHeader *header = (const PowerStatsHeader *)file.data;
+  if (header->magic != POWER_STATS_MAGIC || header->version != POWER_STATS_VERSION ||
+      header->bucketSize != sizeof(PowerStatsBucket))
+  {
+    fprintf(stderr, "%s is not a summary file\n", path);
+    return 1;
+  }
+  const PowerStatsBucket *slots = (const PowerStatsBucket *)(file.data + sizeof(PowerStatsHeader));
+  size_t slotCount = (file.size - sizeof(PowerStatsHeader)) / sizeof(PowerStatsBucket);
+  const char *names[POWER_STATS_PERIODS] = {"hour", "day", "month"};
+  size_t first = 0;
+  printf("%-6s %-19s %7s %9s %10s %9s %9s %9s %7s %8s\n", "period", "start", "outages", "sustained", "downtime",
+         "SAIDI", "longest", "brownouts", "surges", "restarts");
+  for (int period = 0; period < POWER_STATS_PERIODS; period++)
+  {
+    std::vector<PowerStatsBucket> buckets;
+    for (size_t slot = first; slot < first + header->slots[period] && slot < slotCount; slot++)
+    {
+      const PowerStatsBucket &bucket = slots[slot];
+      if (bucket.periodStart != 0 && bucket.crc == crc32((const uint8_t *)&bucket, offsetof(PowerStatsBucket, crc)))
+      {
+        buckets.push_back(bucket);
+      }
+    }
+    first += header->slots[period];
+    std::sort(buckets.begin(), buckets.end(),
+              [](const PowerStatsBucket &a, const PowerStatsBucket &b) { return a.periodStart < b.periodStart; });
+    for (const PowerStatsBucket &bucket : buckets)
+    {
+      printf("%-6s %-19s %7u %9u %8u m %7u m %7u s %9u %7u %8u\n", names[period],
+             formatEpoch(bucket.periodStart).c_str(), bucket.outages, bucket.sustainedOutages, bucket.downtime / 60,
+             bucket.sustainedDowntime / 60, bucket.longestOutage, bucket.brownouts, bucket.surges, bucket.restarts);
+    }
+  }
+  if (header->openOutageStart)
+  {
+    printf("outage in progress since %s\n", formatEpoch(header->openOutageStart).c_str());
+  }
+  return 0;
+}
+
+static int printWaveforms(int count, char **paths)
+{
+  int failed = 0;
+  printf("%-19s %8s %5s %5s %5s %5s %7s %7s\n", "window", "millis", "mean", "min", "max", "rms", "ripple", "Hz");
+  for (int i = 0; i < count; i++)
+  {
+    MappedFile file;
+    const WaveformFileHeader *header = nullptr;
+    size_t reads = 0;
+    if (file.open(paths[i]) && file.size >= sizeof(WaveformFileHeader))
+    {
+      header = (const WaveformFileHeader *)file.data;
+      reads = (file.size - sizeof(WaveformFileHeader)) / sizeof(uint16_t);
+    }
+    const uint16_t *samples = (const uint16_t *)(file.data + sizeof(WaveformFileHeader));
+    if (header == nullptr || !isWaveformFileValid(*header, samples, reads) || header->windowSamples % 4 != 0 ||
+        header->windowSamples > WAVEFORM_WINDOW_SAMPLES || header->sampleRateHz == 0)
+    {
+      fprintf(stderr, "%s is not a valid capture file\n", paths[i]);
+      failed = 1;
+      continue;
+    }
+    for (uint16_t window = 0; window < header->windows; window++)
+    {
+      WaveformMetrics metrics;
+      computeWaveformMetrics(samples + (size_t)window * header->windowSamples, header->windowSamples,
+                             header->sampleRateHz, 0, metrics);
+      uint32_t offsetMs = (uint32_t)window * header->windowSamples * 1000 / header->sampleRateHz;
+      printf("%-19s %8lu %5u %5u %5u %5u %4u.%02u %4u.%02u\n",
+             formatEpoch(header->epoch + offsetMs / 1000).c_str(), (unsigned long)(header->takenAtMs + offsetMs),
+             metrics.mean, metrics.min, metrics.max, metrics.rms, metrics.ripple / 100, metrics.ripple % 100,
+             metrics.frequencyCentiHz / 100, metrics.frequencyCentiHz % 100);
+    }
+  }
+  return failed;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc == 4 && strcmp(argv[1], "--convert") == 0)
+  {
+    return convert(argv[2], argv[3]);
+  }
+  if (argc == 3 && strcmp(argv[1], "--stats") == 0)
+  {
+    return printStats(argv[2]);
+  }
+  if (argc >= 3 && strcmp(argv[1], "--wave") == 0)
+  {
+    return printWaveforms(argc - 2, argv + 2);
+  }
+
+  bool printEvents = false;
+  std::vector<std::string> paths;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--events") == 0)
+    {
+      printEvents = true;
+    }
+    else
+    {
+      collectPaths(argv[i], paths);
+    }
+  }
+  if (paths.empty())
+  {
+    fprintf(stderr, "usage: %s [--events] <file or directory>...\n"
+                    "       %s --convert <csv day file> <binary day file>\n"
+                    "       %s --stats <qop.stats>\n"
+                    "       %s --wave <capture file>...\n",
+            argv[0], argv[0], argv[0], argv[0]);
+    return 2;
+  }
+  // day files are named YYYYMMDD and archives YYYYMM, so name order is time order
+  std::sort(paths.begin(), paths.end(), [](const std::string &a, const std::string &b) {
+    return std::filesystem::path(a).filename() < std::filesystem::path(b).filename();
+  });
+
+  std::vector<EventRecord> events;
+  ReadStats stats;
+  for (const std::string &path : paths)
+  {
+    readDayFile(path, events, stats);
+  }
+
+  size_t outages = 0;
+  size_t brownouts = 0;
+  size_t surges = 0;
+  size_t unsynced = 0;
+  uint64_t totalDowntime = 0;
+  uint32_t longestOutage = 0;
+  uint32_t longestOutageStart = 0;
+  const EventRecord *pendingPowerOff = nullptr;
+  for (const EventRecord &event : events)
+  {
+    if (printEvents)
+    {
+      printf("%s %-4s %s adc=%u\n", formatEpoch(event.epoch).c_str(), eventTypeName(event.type),
+             event.flags & EVENT_FLAG_CORRECTED ? "fix" : event.flags & EVENT_FLAG_NTP_SYNCED ? "ntp" : "-",
+             event.adcSample);
+    }
+    if (!(event.flags & EVENT_FLAG_NTP_SYNCED))
+    {
+      unsynced++;
+    }
+    if (event.type == EVENT_TYPE_BRWN)
+    {
+      brownouts++;
+    }
+    else if (event.type == EVENT_TYPE_SURG)
+    {
+      surges++;
+    }
+    else if (event.type == EVENT_TYPE_POFF)
+    {
+      pendingPowerOff = &event;
+    }
+    else if (event.type == EVENT_TYPE_PRES && pendingPowerOff)
+    {
+      uint32_t duration = event.epoch > pendingPowerOff->epoch ? event.epoch - pendingPowerOff->epoch : 0;
+      outages++;
+      totalDowntime += duration;
+      if (duration > longestOutage)
+      {
+        longestOutage = duration;
+        longestOutageStart = pendingPowerOff->epoch;
+      }
+      pendingPowerOff = nullptr;
+    }
+  }
+
+  printf("files:            %zu (%zu binary, %zu archives, %zu waveform captures)\n", stats.files, stats.binaryFiles,
+         stats.archives, stats.waveforms);
+  printf("events:           %zu (%zu without NTP time, %zu corrupt skipped)\n", events.size(), unsynced,
+         stats.badEntries);
+  if (!events.empty())
+  {
+    printf("range:            %s .. %s\n", formatEpoch(events.front().epoch).c_str(),
+           formatEpoch(events.back().epoch).c_str());
+  }
+  printf("outages:          %zu\n", outages);
+  printf("brownouts:        %zu, surges: %zu\n", brownouts, surges);
+  printf("total downtime:   %llu min\n", (unsigned long long)(totalDowntime / 60));
+  if (outages)
+  {
+    printf("mean outage:      %llu s\n", (unsigned long long)(totalDowntime / outages));
+    printf("longest outage:   %u min, from %s\n", longestOutage / 60, formatEpoch(longestOutageStart).c_str());
+  }
+  return 0;
+}